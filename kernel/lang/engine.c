@@ -30,6 +30,8 @@
 #include <pfq/global.h>
 #include <pfq/printk.h>
 
+#include <linux/jhash.h>
+
 
 const char *
 pfq_lang_signature_by_user_symbol(const char __user *symb)
@@ -156,7 +158,7 @@ pfq_lang_run(struct qbuff * buff, struct pfq_lang_computation_tree *prg)
 struct pfq_lang_computation_tree *
 pfq_lang_computation_alloc (struct pfq_lang_computation_descr const *descr)
 {
-        struct pfq_lang_computation_tree * c = kzalloc(sizeof(size_t) + descr->size * sizeof(struct pfq_lang_functional_node),
+        struct pfq_lang_computation_tree * c = kzalloc(sizeof(struct pfq_lang_computation_tree) + descr->size * sizeof(struct pfq_lang_functional_node),
 						  GFP_KERNEL);
 	if (c)
 		c->size = descr->size;
@@ -396,7 +398,7 @@ pfq_lang_check_computation_descr(struct pfq_lang_computation_descr const *descr)
 
 static void *
 resolve_user_symbol(struct symtable *table, const char __user *symb, const char **signature,
-		    init_ptr_t *init, fini_ptr_t *fini)
+		    init_ptr_t *init, fini_ptr_t *fini, bool *pure)
 {
 	struct symtable_entry *entry;
         char *symbol;
@@ -416,6 +418,7 @@ resolve_user_symbol(struct symtable *table, const char __user *symb, const char
         *signature = entry->signature;
 	*init = entry->init;
 	*fini = entry->fini;
+	*pure = entry->pure;
 
         kfree(symbol);
         return entry->function;
@@ -474,6 +477,27 @@ get_functional_node_by_index(struct pfq_lang_computation_descr const *descr, str
 }
 
 
+/*
+ * 64-bit fingerprint of a linked computation: functions, composition and
+ * the content of their arguments (not their addresses in the context).
+ */
+
+static inline uint64_t
+fingerprint_update(uint64_t fp, const void *data, size_t len)
+{
+	uint32_t lo = jhash(data, (u32)len, (uint32_t)fp);
+	uint32_t hi = jhash(data, (u32)len, (uint32_t)(fp >> 32) ^ JHASH_INITVAL);
+	return ((uint64_t)hi << 32) | lo;
+}
+
+
+static inline uint64_t
+fingerprint_value(uint64_t fp, ptrdiff_t value)
+{
+	return fingerprint_update(fp, &value, sizeof(value));
+}
+
+
 /*
  * Prerequisite: valid computation (check by means of pfq_lang_validate_computation_descr)
  */
@@ -481,12 +505,17 @@ get_functional_node_by_index(struct pfq_lang_computation_descr const *descr, str
 int
 pfq_lang_computation_rtlink(struct pfq_lang_computation_descr const *descr, struct pfq_lang_computation_tree *comp, void *context)
 {
+	uint64_t fp = 0;
+	bool pure = true;
 	size_t n;
 
         /* size */
 
         comp->size = descr->size;
 
+	fp = fingerprint_value(fp, (ptrdiff_t)descr->size);
+	fp = fingerprint_value(fp, (ptrdiff_t)descr->entry_point);
+
         /* entry point */
 
         comp->entry_point = &comp->node[descr->entry_point];
@@ -499,17 +528,23 @@ pfq_lang_computation_rtlink(struct pfq_lang_computation_descr const *descr, stru
 		struct pfq_lang_functional_node *next;
 		const char *signature;
 		init_ptr_t init, fini;
+		bool fun_pure;
 		void *addr;
                 size_t i;
 
                 fun = &descr->fun[n];
 
-		addr = resolve_user_symbol(&global->functions, fun->symbol, &signature, &init, &fini);
+		addr = resolve_user_symbol(&global->functions, fun->symbol, &signature, &init, &fini, &fun_pure);
 		if (addr == NULL) {
 			printk(KERN_INFO "[PFQ] %zu: rtlink: bad descriptor!\n", n);
 			return -EPERM;
 		}
 
+		pure = pure && fun_pure;
+
+		fp = fingerprint_value(fp, (ptrdiff_t)addr);
+		fp = fingerprint_value(fp, (ptrdiff_t)descr->fun[n].next);
+
 		next = get_functional_node_by_index(descr, comp, (int)descr->fun[n].next);
 
 		comp->node[n].init = init;
@@ -536,6 +571,9 @@ pfq_lang_computation_rtlink(struct pfq_lang_computation_descr const *descr, stru
 
 				comp->node[n].fun.arg[i].value = (ptrdiff_t)str;
 				comp->node[n].fun.arg[i].nelem = -1ULL;
+
+				fp = fingerprint_value(fp, 's');
+				fp = fingerprint_update(fp, str, strlen_user(fun->arg[i].addr));
 			}
 			else if (is_arg_vector_str(&fun->arg[i])) {
 
@@ -558,6 +596,9 @@ pfq_lang_computation_rtlink(struct pfq_lang_computation_descr const *descr, stru
 						printk(KERN_INFO "[PFQ] %zu: pod_user(2): internal error!\n", n);
 						return -EPERM;
 					}
+
+					fp = fingerprint_value(fp, 'S');
+					fp = fingerprint_update(fp, base_ptr[j], strlen_user(user_ptr[j]));
 				}
 
 				comp->node[n].fun.arg[i].value = (ptrdiff_t)base_ptr;
@@ -575,6 +616,9 @@ pfq_lang_computation_rtlink(struct pfq_lang_computation_descr const *descr, stru
 
 					comp->node[n].fun.arg[i].value = (ptrdiff_t)ptr;
 					comp->node[n].fun.arg[i].nelem = -1ULL;
+
+					fp = fingerprint_value(fp, 'p');
+					fp = fingerprint_update(fp, ptr, fun->arg[i].size);
 				}
 				else {
 					ptrdiff_t arg = 0;
@@ -586,6 +630,9 @@ pfq_lang_computation_rtlink(struct pfq_lang_computation_descr const *descr, stru
 
 					comp->node[n].fun.arg[i].value = arg;
 					comp->node[n].fun.arg[i].nelem = -1ULL;
+
+					fp = fingerprint_value(fp, 'd');
+					fp = fingerprint_value(fp, arg);
 				}
 
 			}
@@ -602,17 +649,25 @@ pfq_lang_computation_rtlink(struct pfq_lang_computation_descr const *descr, stru
 
 					comp->node[n].fun.arg[i].value = (ptrdiff_t)ptr;
 					comp->node[n].fun.arg[i].nelem = (size_t)fun->arg[i].nelem;
+
+					fp = fingerprint_value(fp, 'v');
+					fp = fingerprint_update(fp, ptr, (size_t)fun->arg[i].size * (size_t)fun->arg[i].nelem);
 				}
 				else {  /* empty vector */
 
 					comp->node[n].fun.arg[i].value = 0xdeadbeef;
 					comp->node[n].fun.arg[i].nelem = 0;
+
+					fp = fingerprint_value(fp, 'v');
 				}
 			}
 			else if (is_arg_function(&fun->arg[i])) {
 
 				comp->node[n].fun.arg[i].value = (ptrdiff_t)get_functional_node_by_index(descr, comp, (int)fun->arg[i].size);
 				comp->node[n].fun.arg[i].nelem = -1ULL;
+
+				fp = fingerprint_value(fp, 'f');
+				fp = fingerprint_value(fp, (ptrdiff_t)fun->arg[i].size);
 			}
 			else if (!is_arg_null(&fun->arg[i])) {
 
@@ -623,6 +678,9 @@ pfq_lang_computation_rtlink(struct pfq_lang_computation_descr const *descr, stru
 		}
 	}
 
+	/* only computations made of pure functions can share their results */
+
+	comp->fingerprint = pure ? (fp ? fp : 1) : 0;
 	return 0;
 }
 
@@ -27,6 +27,7 @@
 #include <pfq/percpu.h>
 #include <pfq/netdev.h>
 #include <pfq/io.h>
+#include <pfq/memory.h>
 
 static int
 forward_init(arguments_t args)
@@ -96,11 +97,18 @@ link_fini(arguments_t args)
 }
 
 
+/*
+ * immediate forward: the packet is copied into an skb of the per-cpu Tx pool
+ * and sent in order, before the computation goes on.
+ */
+
 static ActionQbuff
 forwardIO(arguments_t args, struct qbuff * buff)
 {
 	struct net_device *dev = GET_ARG(struct net_device *, args);
-	struct qbuff *nbuff;
+	struct pfq_skb_pool *pool;
+	struct qbuff copy, *nbuff;
+	int rc;
 
 	pfq_group_stats_t *stats = get_group_stats(buff);
 
@@ -113,8 +121,15 @@ forwardIO(arguments_t args, struct qbuff * buff)
                 return Pass(buff);
 	}
 
-	nbuff = qbuff_clone(buff);
+	/* the pool of this cpu is owned while the bottom half is disabled */
+
+	local_bh_disable();
+
+	pool = &this_cpu_ptr(global->percpu_pool)->tx;
+
+	nbuff = qbuff_clone(buff, &copy, pool);
 	if (!nbuff) {
+		local_bh_enable();
                 if (printk_ratelimit())
 			printk(KERN_INFO "[pfq-lang] forward pfq_xmit %s: no memory!\n", pfq_dev_name(dev));
 		sparse_inc(global->percpu_stats, disc);
@@ -122,7 +137,17 @@ forwardIO(arguments_t args, struct qbuff * buff)
 		return Pass(buff);
 	}
 
-	if (pfq_xmit(nbuff, dev, qbuff_get_queue_mapping(nbuff), 0) != 1) {
+	/* a reference for the driver, the pool keeps its own until qbuff_free */
+
+	QBUFF_SKB(nbuff)->dev = dev;
+	skb_get(QBUFF_SKB(nbuff));
+
+	rc = pfq_xmit(nbuff, dev, qbuff_get_queue_mapping(nbuff), 0);
+
+	qbuff_free(nbuff, pool);
+	local_bh_enable();
+
+	if (rc != NETDEV_TX_OK) {
                 if (printk_ratelimit())
                         printk(KERN_INFO "[pfq-lang] forward pfq_xmit: error on device %s!\n", pfq_dev_name(dev));
 
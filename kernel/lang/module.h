@@ -163,6 +163,7 @@ struct pfq_lang_computation_tree
 {
 	size_t size;
 	struct pfq_lang_functional_node *entry_point;
+	uint64_t fingerprint;			/* identical pure computations share it (0: not shareable) */
 	struct pfq_lang_functional_node node[];
 };
 
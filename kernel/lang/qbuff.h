@@ -159,4 +159,77 @@ qbuff_ip_protocol(struct qbuff * buff)
 }
 
 
+/* fragment-consistent hash: for IPv4/IPv6 fragments returns true and
+ * a hash of the addresses and the datagram id, so that every fragment of
+ * a datagram (the first one included) is steered alike. */
+
+static inline bool
+qbuff_ip_frag_hash(struct qbuff * buff, uint32_t *hash)
+{
+	switch(qbuff_ip_version(buff))
+	{
+	case 4: {
+		struct iphdr _iph;
+		const struct iphdr *ip;
+
+		ip = qbuff_ip_header_pointer(buff, 0, sizeof(_iph), &_iph);
+		if (ip == NULL ||
+		    !(ip->frag_off & __constant_htons(IP_MF|IP_OFFSET)))
+			return false;
+
+		*hash = (__force uint32_t)(ip->saddr ^ ip->daddr) ^ (__force uint32_t)ip->id;
+		return true;
+
+	} break;
+	case 6: {
+		struct ipv6hdr _ip6h;
+		const struct ipv6hdr *ip6;
+		struct ipv6_opt_hdr _oh;
+		const struct ipv6_opt_hdr *oh;
+		struct frag_hdr _fh;
+		const struct frag_hdr *fh;
+		int offset = sizeof(struct ipv6hdr), n;
+		uint8_t nexthdr;
+
+		ip6 = qbuff_generic_ip_header_pointer(buff, IPPROTO_IPV6, 0, sizeof(_ip6h), &_ip6h);
+		if (ip6 == NULL)
+			return false;
+
+		nexthdr = ip6->nexthdr;
+
+		for(n = 0; n < 8; n++)
+		{
+			switch(nexthdr)
+			{
+			case NEXTHDR_FRAGMENT: {
+				fh = qbuff_generic_ip_header_pointer(buff, IPPROTO_IPV6, offset, sizeof(_fh), &_fh);
+				if (fh == NULL)
+					return false;
+
+				*hash = ipv6_addr_hash(&ip6->saddr) ^ ipv6_addr_hash(&ip6->daddr) ^
+					(__force uint32_t)fh->identification;
+				return true;
+			}
+			case NEXTHDR_HOP:
+			case NEXTHDR_ROUTING:
+			case NEXTHDR_DEST:
+			case NEXTHDR_AUTH: {
+				oh = qbuff_generic_ip_header_pointer(buff, IPPROTO_IPV6, offset, sizeof(_oh), &_oh);
+				if (oh == NULL)
+					return false;
+
+				offset += nexthdr == NEXTHDR_AUTH ? (oh->hdrlen + 2) << 2 : ipv6_optlen(oh);
+				nexthdr = oh->nexthdr;
+			} break;
+			default:
+				return false;
+			}
+		}
+	} break;
+	}
+
+	return false;
+}
+
+
 #endif /* PFQ_LANG_QBUFF_H */
@@ -47,6 +47,12 @@ steering_key(arguments_t args, struct qbuff * buff)
 	struct udphdr  _udp;   struct udphdr const *udp;
 	struct icmphdr _icmp;  struct icmphdr const *icmp;
 
+	/* non-first fragments carry no ports */
+
+	if ((key & (Q_KEY_SRC_PORT|Q_KEY_DST_PORT)) &&
+	    qbuff_ip_frag_hash(buff, &hash))
+		return Steering(buff, hash);
+
 	switch(key)
 	{
 	case Q_KEY_IP_SRC|Q_KEY_IP_DST|Q_KEY_IP_PROTO: {
@@ -154,7 +160,10 @@ steering_key(arguments_t args, struct qbuff * buff)
 
                 case Q_KEY_SRC_PORT:
                 {
-                        udp = qbuff_ip_header_pointer(buff, 0, sizeof(_udp), &_udp);
+                        ip = qbuff_ip_header_pointer(buff, 0, sizeof(_ip), &_ip);
+                        if (ip == NULL)
+                                return Drop(buff);
+                        udp = qbuff_ip_header_pointer(buff, (ip->ihl<<2), sizeof(_udp), &_udp);
                         if (udp == NULL)
                                 return Drop(buff);
 
@@ -164,7 +173,10 @@ steering_key(arguments_t args, struct qbuff * buff)
 
                 case Q_KEY_DST_PORT:
                 {
-                        udp = qbuff_ip_header_pointer(buff, 0, sizeof(_udp), &_udp);
+                        ip = qbuff_ip_header_pointer(buff, 0, sizeof(_ip), &_ip);
+                        if (ip == NULL)
+                                return Drop(buff);
+                        udp = qbuff_ip_header_pointer(buff, (ip->ihl<<2), sizeof(_udp), &_udp);
                         if (udp == NULL)
                                 return Drop(buff);
 
@@ -215,7 +227,13 @@ steering_rrobin(arguments_t args, struct qbuff * buff)
 static ActionQbuff
 steering_rss(arguments_t args, struct qbuff * buff)
 {
-	uint32_t hash = qbuff_get_rss_hash(buff);
+	uint32_t hash;
+
+	/* the NIC may hash the first fragment on L4 and the others on L3 */
+
+	if (!qbuff_ip_frag_hash(buff, &hash))
+		hash = qbuff_get_rss_hash(buff);
+
 	return Steering(buff, hash);
 }
 
@@ -380,6 +398,17 @@ steering_p2p(arguments_t args, struct qbuff * buff)
 	struct iphdr _iph;
 	const struct iphdr *ip;
 
+	if (qbuff_ip_version(buff) == 6) {
+		struct ipv6hdr _ip6h;
+		const struct ipv6hdr *ip6;
+
+		ip6 = qbuff_generic_ip_header_pointer(buff, IPPROTO_IPV6, 0, sizeof(_ip6h), &_ip6h);
+		if (ip6 == NULL)
+			return Drop(buff);
+
+		return Steering(buff, ipv6_addr_hash(&ip6->saddr) ^ ipv6_addr_hash(&ip6->daddr));
+	}
+
 	ip = qbuff_ip_header_pointer(buff, 0, sizeof(_iph), &_iph);
 	if (ip == NULL)
 		return Drop(buff);
@@ -510,8 +539,14 @@ steering_flow(arguments_t args, struct qbuff * buff)
 
 	struct udphdr _udp;
 	const struct udphdr *udp;
+	uint32_t frag_hash;
 	__be32 hash;
 
+	/* IPv4 and IPv6 fragments (the latter carry no IPv4 header) */
+
+	if (qbuff_ip_frag_hash(buff, &frag_hash))
+		return Steering(buff, frag_hash);
+
 	ip = qbuff_ip_header_pointer(buff, 0, sizeof(_iph), &_iph);
 	if (ip == NULL)
 		return Drop(buff);
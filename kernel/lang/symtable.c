@@ -123,6 +123,7 @@ __pfq_lang_symtable_register_function(struct symtable *table, const char *symbol
 	elem->function = fun;
         elem->init     = init;
         elem->fini     = fini;
+        elem->pure     = false;
 	return 0;
 }
 
@@ -138,6 +139,7 @@ __pfq_lang_symtable_unregister_function(struct symtable *table, const char *symb
 			table->entry[n].function = NULL;
 			table->entry[n].init = NULL;
 			table->entry[n].fini = NULL;
+			table->entry[n].pure = false;
 			return 0;
 		}
 	}
@@ -212,6 +214,56 @@ pfq_lang_symtable_pr_devel(const char *hdr, struct symtable *table)
 }
 
 
+/*
+ * Mark as pure the functions that neither forward the packet nor touch
+ * the group they run on: identical computations built out of them can be
+ * evaluated once per packet and shared among groups. The stateful ones
+ * listed below are excluded.
+ */
+
+static const char *impure_functions[] =
+{
+	"steer_rrobin",		/* depends on the packet counter */
+	NULL
+};
+
+
+static bool
+pfq_lang_symtable_is_impure(const char *symbol)
+{
+	int i = 0;
+	for(; impure_functions[i] != NULL; i++)
+	{
+		if (strcmp(impure_functions[i], symbol) == 0)
+			return true;
+	}
+	return false;
+}
+
+
+static void
+pfq_lang_symtable_set_pure(struct symtable *table, struct pfq_lang_function_descr *fun)
+{
+	int i = 0;
+
+	down_write(&global->symtable_sem);
+
+	for(; fun[i].symbol != NULL; i++)
+	{
+		struct symtable_entry *elem;
+
+		if (pfq_lang_symtable_is_impure(fun[i].symbol))
+			continue;
+
+		elem = __pfq_lang_symtable_search(table, fun[i].symbol);
+		if (elem)
+			elem->pure = true;
+	}
+
+	up_write(&global->symtable_sem);
+}
+
+
 void
 pfq_lang_symtable_init(void)
 {
@@ -229,6 +281,15 @@ pfq_lang_symtable_init(void)
         pfq_lang_symtable_register_functions(NULL, &global->functions, combinator_functions);
         pfq_lang_symtable_register_functions(NULL, &global->functions, property_functions);
 
+        pfq_lang_symtable_set_pure(&global->functions, filter_functions);
+        pfq_lang_symtable_set_pure(&global->functions, steering_functions);
+        pfq_lang_symtable_set_pure(&global->functions, bloom_functions);
+        pfq_lang_symtable_set_pure(&global->functions, control_functions);
+        pfq_lang_symtable_set_pure(&global->functions, vlan_functions);
+        pfq_lang_symtable_set_pure(&global->functions, predicate_functions);
+        pfq_lang_symtable_set_pure(&global->functions, combinator_functions);
+        pfq_lang_symtable_set_pure(&global->functions, property_functions);
+
 	numfun = pfq_lang_symtable_pr_devel("pfq-lang functions",   &global->functions);
 
 	printk(KERN_INFO "[PFQ] symtable initialized (%zu pfq-lang functions loaded).\n",
@@ -35,6 +35,7 @@ struct symtable_entry
 	void *                  function;
 	void *			init;
 	void *			fini;
+	bool			pure;		/* no side effects: results can be shared */
 };
 
 
@@ -30,6 +30,9 @@
 extern  int pfq_netif_rx(struct sk_buff *);
 extern  int pfq_netif_receive_skb(struct sk_buff *);
 extern  gro_result_t pfq_gro_receive(struct napi_struct *, struct sk_buff *);
+extern  int pfq_receive_frag(struct napi_struct *, struct net_device *, struct page *,
+			     unsigned int offset, unsigned int len, unsigned int truesize,
+			     u32 hash, u8 hash_type, u16 vlan_tci, u16 queue);
 
 extern struct sk_buff * __pfq_alloc_skb(unsigned int len, gfp_t priority, int fclone, int node);
 extern struct sk_buff * pfq_dev_alloc_skb(unsigned int length);
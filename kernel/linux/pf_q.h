@@ -104,6 +104,7 @@ typedef uint8_t  pfq_qver_t;
 #define Q_SO_SET_TX_LEN			6
 #define Q_SO_SET_TX_SLOTS		7
 #define Q_SO_SET_WEIGHT			8
+#define Q_SO_SET_RX_CLASS_RESERVE	9       /* per-class reserved Rx slots */
 
 #define Q_SO_GROUP_BIND			10
 #define Q_SO_GROUP_UNBIND		11
@@ -131,11 +132,38 @@ typedef uint8_t  pfq_qver_t;
 #define Q_SO_GET_GROUP_STATS		31
 #define Q_SO_GET_GROUP_COUNTERS		32
 #define Q_SO_GET_WEIGHT			33
+#define Q_SO_GET_RX_CLASS_STATS		34      /* per-class Rx drop counters */
+#define Q_SO_GET_NUMA_NODE		35      /* NUMA node of the shared memory */
+#define Q_SO_GET_GROUP_STEER_STATS	36      /* load-aware steering statistics */
+#define Q_SO_GROUP_GET_RETA		37      /* steering indirection table */
+#define Q_SO_GET_TX_ASYNC		38      /* number of Tx queues bound to threads */
+#define Q_SO_GET_TX_PACING_STATS	39      /* departure-time pacing error histogram */
+#define Q_SO_GET_TX_REPLAY_STATS	43      /* progress of the trace replayed by a Tx thread */
 
 #define Q_SO_TX_BIND			40
 #define Q_SO_TX_UNBIND			41
 #define Q_SO_TX_QUEUE_XMIT	        42
 
+#define Q_SO_SET_NUMA_NODE		50      /* NUMA node of the consumer */
+#define Q_SO_GROUP_STEER_DYNAMIC	51      /* load-aware steering */
+#define Q_SO_GROUP_SET_RETA		52      /* steering indirection table */
+#define Q_SO_GROUP_FLOW_EXPORT		53      /* in-kernel flow-record export */
+#define Q_SO_TX_BIND_PIPE		54      /* deliver Tx slots to the Rx queue of another socket */
+#define Q_SO_SET_DETACH			55      /* keep the socket alive after close */
+#define Q_SO_ATTACH			56      /* take over a detached socket (getsockopt: new fd) */
+#define Q_SO_ARENA_REGISTER		57      /* HugePages arena shared by the sockets of a process */
+#define Q_SO_RESIZE			58      /* resize the queues of an enabled socket */
+#define Q_SO_RESIZE_RELEASE		59      /* release the queues drained after a resize */
+#define Q_SO_TX_ZEROCOPY		60      /* transmit Tx slots without copying them */
+#define Q_SO_TX_DOORBELL		61      /* wake up the Tx thread of an async queue */
+#define Q_SO_TX_THREAD_START		62      /* start a Tx thread at runtime */
+#define Q_SO_TX_THREAD_STOP		63      /* stop a Tx thread, migrating its queues */
+#define Q_SO_TX_THREAD_PIN		64      /* move a Tx thread to another cpu */
+#define Q_SO_TX_LOSSLESS		65      /* keep the Tx slots while the device queue is stopped */
+#define Q_SO_TX_REPLAY			66      /* replay a trace from a Tx thread */
+#define Q_SO_TX_REPLAY_STOP		67      /* stop the replay and release the trace */
+#define Q_SO_TX_SHAPER			68      /* token bucket of the socket or of a Tx queue */
+
 /* general placeholders */
 
 #define Q_ANY_DEVICE			-1
@@ -143,6 +171,10 @@ typedef uint8_t  pfq_qver_t;
 #define Q_ANY_GROUP			-1
 #define Q_ANY_KTHREAD			0xbadbee
 #define Q_NO_KTHREAD			-1
+#define Q_ANY_NODE			-1
+#define Q_AUTO_NODE			-2	/* node of the CPU enabling the socket */
+#define Q_PKTHDR_FLOW_RECORD		-1	/* pfq_pkthdr.info.ifindex of a slot carrying a pfq_flow_record */
+#define Q_PKTHDR_PIPE			-2	/* pfq_pkthdr.info.ifindex of a slot delivered by a pipe (info.queue = source id) */
 
 /* timestamp */
 
@@ -183,6 +215,7 @@ typedef uint8_t  pfq_qver_t;
 #define Q_MAX_COUNTERS			64
 #define Q_MAX_TX_QUEUES			4
 #define Q_MAX_RX_NAPI			4
+#define Q_MAX_RETA_SIZE			4096	/* hash buckets of a steering indirection table */
 
 
 /* default flow key constants */
@@ -220,6 +253,7 @@ struct pfq_shared_rx_queue
 struct pfq_shared_tx_queue
 {
         size_t				size;	    /* queue size in bytes */
+        unsigned int			slot_size;  /* sizeof(pfq_pkthdr) + xmitlen */
 
 	struct
 	{
@@ -233,6 +267,8 @@ struct pfq_shared_tx_queue
 	{
 		unsigned int		index;
 		ptrdiff_t		off;
+		int			inflight[2];	/* zero-copy slots still owned by the kernel, per buffer (copy of the kernel count) */
+		int			sleeping;	/* the Tx thread waits for a doorbell */
 
 	} cons ____pfq_cacheline_aligned;
 
@@ -265,7 +301,8 @@ struct pfq_pkthdr_info
 		struct
 		{
 			unsigned int copies;	/* for packet Tx */
-			uint32_t reserved;	/* reserved */
+			uint16_t gso_size;	/* Tx segment size (0 = no GSO) */
+			uint16_t gso_type;	/* Q_TX_GSO_TCPV4, Q_TX_GSO_TCPV6 */
 		};
 	} data;
 
@@ -286,6 +323,14 @@ struct pfq_pkthdr_info
 };
 
 
+/* Tx GSO: a slot up to Q_TX_GSO_MAX_LEN bytes is segmented by the device (TSO) or by software GSO */
+
+#define Q_TX_GSO_TCPV4			1
+#define Q_TX_GSO_TCPV6			2
+
+#define Q_TX_GSO_MAX_LEN		65535	/* frame length, headers included (the slot caplen is 16 bits) */
+
+
 struct pfq_pkthdr
 {
         union
@@ -397,6 +442,73 @@ struct pfq_so_binding
         int qindex;
 };
 
+struct pfq_so_tx_pipe
+{
+        int tid;			/* Tx thread index, -1 = synchronous queue */
+        int id;				/* id of the socket at the other end */
+};
+
+struct pfq_so_resize
+{
+        size_t rx_slots;
+        size_t caplen;
+        size_t tx_slots;
+        size_t xmitlen;
+};
+
+struct pfq_so_tx_replay
+{
+        unsigned long user_addr;		/* trace: pfq_replay_pkthdr records */
+        size_t        user_size;		/* size of the (HugePages) mapping */
+        size_t        hugepage_size;
+        size_t        size;			/* bytes of records */
+        int           tid;			/* Tx thread */
+        int           ifindex;
+        int           queue;
+        unsigned int  loops;			/* 0 = until stopped */
+        unsigned int  rate;			/* speed x1000 of the original timing, 0 = no pacing */
+        unsigned int  rewrite;			/* Q_REPLAY_REWRITE_* */
+        unsigned char mac_src[6];
+        unsigned char mac_dst[6];
+        uint32_t      ip_src_step;		/* added to the addresses at every loop */
+        uint32_t      ip_dst_step;
+};
+
+/* token bucket shaping (Q_SO_TX_SHAPER) */
+
+#define Q_TX_SHAPER_SOCKET		(-2)	/* bucket shared by the Tx queues of the socket */
+#define Q_TX_SHAPER_SYNC		(-1)	/* queue of the sync transmissions, 0.. async queues */
+
+#define Q_TX_SHAPER_PACKETS		0
+#define Q_TX_SHAPER_BYTES		1
+
+struct pfq_so_tx_shaper
+{
+        int           queue;			/* Q_TX_SHAPER_SOCKET, Q_TX_SHAPER_SYNC or async queue */
+        int           mode;			/* Q_TX_SHAPER_PACKETS or Q_TX_SHAPER_BYTES */
+        int           drop;			/* drop the exceeding packets instead of holding the queue */
+        uint64_t      rate;			/* tokens per second, 0 = disabled */
+        uint64_t      burst;			/* size of the bucket (tokens) */
+};
+
+struct pfq_so_tx_thread
+{
+        int tid;
+        int cpu;
+};
+
+struct pfq_so_detach
+{
+        unsigned int handle;		/* 0 = the socket is released on close */
+        unsigned int timeout;		/* msec */
+};
+
+struct pfq_so_attach
+{
+        unsigned int handle;		/* handle of the detached socket */
+        int          fd;		/* returned: a new descriptor for it */
+};
+
 struct pfq_so_group_join
 {
         int gid;
@@ -410,6 +522,33 @@ struct pfq_so_group_computation
         struct pfq_lang_computation_descr const __user *prog;
 };
 
+struct pfq_so_group_reta
+{
+        int gid;
+        unsigned int size;		/* number of hash buckets (power of 2), 0 = no table */
+        int __user *table;		/* socket id for each bucket */
+};
+
+struct pfq_so_group_flow_export
+{
+        int gid;
+        unsigned int idle_timeout;	/* msec, 0 = disabled */
+        unsigned int active_timeout;	/* msec, 0 = none */
+};
+
+struct pfq_so_group_steer
+{
+        int gid;
+        unsigned int threshold;		/* Rx queue occupancy (%) above which new flows are moved, 0 = disabled */
+};
+
+
+struct pfq_so_class_reserve
+{
+        unsigned long class_mask;
+        size_t slots;           /* Rx slots reserved to each class in mask */
+};
+
 
 struct pfq_so_group_context
 {
@@ -446,6 +585,94 @@ struct pfq_stats
 };
 
 
+/* pfq per-class statistics for sockets */
+
+struct pfq_class_stats
+{
+        unsigned long int drop[Q_CLASS_MAX];	/* dropped above the class watermark */
+};
+
+
+/* pfq Tx pacing statistics for sockets: lateness of the packets sent
+ * with a departure time, in decades: <100ns, <1us, <10us, <100us, <1ms, >=1ms */
+
+#define Q_TX_PACING_BUCKETS		6
+
+struct pfq_tx_pacing_stats
+{
+        unsigned long int deferred;			/* packets sent with a departure time */
+        unsigned long int late[Q_TX_PACING_BUCKETS];	/* pacing error histogram */
+        unsigned long int held;				/* queues held by a token bucket */
+        unsigned long int shaped;			/* packets dropped by a token bucket */
+        unsigned long int zerocopy;			/* packets sent from the slot pages (Q_SO_TX_ZEROCOPY) */
+};
+
+
+/* trace replayed by a Tx thread (Q_SO_TX_REPLAY): a sequence of records,
+ * each one made of a pfq_replay_pkthdr followed by caplen bytes and aligned
+ * to 8 bytes */
+
+struct pfq_replay_pkthdr
+{
+        uint64_t tstamp;			/* nsec */
+        uint32_t caplen;
+        uint32_t len;
+};
+
+#define Q_REPLAY_RECORD_LEN(caplen)	((sizeof(struct pfq_replay_pkthdr) + (caplen) + 7) & ~(size_t)7)
+
+#define Q_REPLAY_REWRITE_MAC_SRC	1
+#define Q_REPLAY_REWRITE_MAC_DST	2
+#define Q_REPLAY_REWRITE_IP_SRC		4
+#define Q_REPLAY_REWRITE_IP_DST		8
+
+struct pfq_tx_replay_stats
+{
+        unsigned long int loop;			/* current loop */
+        unsigned long int sent;
+        unsigned long int fail;
+        int		  done;
+};
+
+
+/* pfq flow record (flow-record export mode) */
+
+#define Q_FLOW_END_IDLE			1
+#define Q_FLOW_END_ACTIVE		2
+#define Q_FLOW_END_EVICTED		3
+#define Q_FLOW_END_FLUSH		4
+
+struct pfq_flow_record
+{
+        uint64_t first;			/* timestamp of the first packet (nsec) */
+        uint64_t last;			/* timestamp of the last packet (nsec) */
+        uint64_t packets;
+        uint64_t bytes;
+        uint32_t saddr;			/* network byte order */
+        uint32_t daddr;			/* network byte order */
+        uint16_t sport;			/* network byte order */
+        uint16_t dport;			/* network byte order */
+        uint16_t vid;			/* 8021q vlan id */
+        uint8_t  proto;
+        uint8_t  tcp_flags;		/* OR-ed TCP flags */
+        int32_t  ifindex;
+        uint8_t  end;			/* Q_FLOW_END_* */
+        uint8_t  reserved[3];
+};
+
+
+/* pfq load-aware steering statistics for groups */
+
+struct pfq_steer_stats
+{
+        int gid;
+        unsigned long int flows;	/* new flows seen */
+        unsigned long int moves;	/* new flows moved to a less loaded socket */
+        unsigned long int stuck;	/* new flows left on an overloaded socket (no better one) */
+        unsigned long int untracked;	/* packets steered by hash, their flow table entry taken by a live flow */
+};
+
+
 /* pfq counters for groups */
 
 struct pfq_counters
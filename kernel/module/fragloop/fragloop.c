@@ -0,0 +1,162 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+/*
+ * fragloop: a loopback ethernet device (fragloop0) for the skb-less ingestion
+ * of PFQ. Every frame transmitted is copied into a page and received back on
+ * the same device through pfq_receive_frag, the way a patched driver hands
+ * over its rx pages, along with the hash a NIC would compute (L4 if the flow
+ * dissector finds the ports, L3 otherwise).
+ *
+ * If no PFQ socket captures from the device, the frame is passed to the
+ * kernel as a plain loopback would do.
+ *
+ * e.g. test-steer-frag -b steer_rss fragloop0 fragloop0
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/version.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/skbuff.h>
+
+#include <linux/pf_q-kcompat.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("loopback device for the PFQ page-fragment ingestion");
+
+
+static struct net_device *fragloop_dev;
+
+
+static netdev_tx_t
+fragloop_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	unsigned int len = skb->len;
+	struct page *page;
+	u8 hash_type;
+	u32 hash;
+
+	if (unlikely(len > PAGE_SIZE))
+		goto drop;
+
+	page = alloc_page(GFP_ATOMIC);
+	if (unlikely(!page))
+		goto drop;
+
+	if (skb_copy_bits(skb, 0, page_address(page), (int)len) < 0) {
+		put_page(page);
+		goto drop;
+	}
+
+	hash = skb_get_hash(skb);
+	hash_type = skb->l4_hash ? PKT_HASH_TYPE_L4 : PKT_HASH_TYPE_L3;
+
+	dev->stats.tx_packets++;
+	dev->stats.tx_bytes += len;
+
+	if (pfq_receive_frag(NULL, dev, page, 0, len, PAGE_SIZE, hash, hash_type, 0,
+			     skb_get_queue_mapping(skb)) == -EAGAIN) {
+
+		/* capture not enabled: the page is still ours */
+
+		put_page(page);
+
+		if (dev_forward_skb(dev, skb) == NET_RX_SUCCESS) {
+			dev->stats.rx_packets++;
+			dev->stats.rx_bytes += len;
+		}
+		else
+			dev->stats.rx_dropped++;
+
+		return NETDEV_TX_OK;
+	}
+
+	dev->stats.rx_packets++;
+	dev->stats.rx_bytes += len;
+
+	consume_skb(skb);
+	return NETDEV_TX_OK;
+drop:
+	dev->stats.tx_dropped++;
+	kfree_skb(skb);
+	return NETDEV_TX_OK;
+}
+
+
+static const struct net_device_ops fragloop_ops =
+{
+	.ndo_start_xmit		= fragloop_xmit,
+	.ndo_set_mac_address	= eth_mac_addr,
+};
+
+
+static void
+fragloop_setup(struct net_device *dev)
+{
+	ether_setup(dev);
+
+	dev->netdev_ops = &fragloop_ops;
+	dev->flags |= IFF_NOARP;
+	dev->tx_queue_len = 0;
+}
+
+
+static int __init
+fragloop_init(void)
+{
+	int err;
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,17,0))
+	fragloop_dev = alloc_netdev(0, "fragloop%d", NET_NAME_UNKNOWN, fragloop_setup);
+#else
+	fragloop_dev = alloc_netdev(0, "fragloop%d", fragloop_setup);
+#endif
+	if (fragloop_dev == NULL)
+		return -ENOMEM;
+
+	eth_hw_addr_random(fragloop_dev);
+
+	err = register_netdev(fragloop_dev);
+	if (err) {
+		free_netdev(fragloop_dev);
+		return err;
+	}
+
+	printk(KERN_INFO "[PFQ] fragloop: %s registered\n", fragloop_dev->name);
+	return 0;
+}
+
+
+static void __exit
+fragloop_exit(void)
+{
+	unregister_netdev(fragloop_dev);
+	free_netdev(fragloop_dev);
+}
+
+
+module_init(fragloop_init);
+module_exit(fragloop_exit);
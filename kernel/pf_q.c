@@ -61,6 +61,7 @@
 #include <pfq/stats.h>
 #include <pfq/queue.h>
 #include <pfq/endpoint.h>
+#include <pfq/fastpath.h>
 #include <pfq/define.h>
 
 #include <pfq/percpu.h>
@@ -111,16 +112,14 @@ pfq_release(struct socket *sock)
 
         mutex_lock(&global->socket_lock);
 
-	/* disable socket... */
+	/* a socket with a handle outlives the close, waiting for a new consumer */
 
-	pr_devel("[PFQ|%d] disabling socket...\n", so->id);
-	pfq_sock_disable(so);
+	if (!pfq_sock_detach(so)) {
 
-	/* release the socket id */
+		/* disable socket and release the id... */
 
-	pr_devel("[PFQ|%d] releasing id...\n", so->id);
-	msleep(Q_GRACE_PERIOD);
-	pfq_sock_release_id(so->id);
+		pfq_sock_destroy(so);
+	}
 
 #if 0
 	/* reset the GC at the last socket closed */
@@ -161,6 +160,9 @@ pfq_poll(struct file *file, struct socket *sock, poll_table * wait)
         if (pfq_mpsc_queue_len(so) > 0)
                 mask |= POLLIN | POLLRDNORM;
 
+        if (pfq_sk_queue_tx_space(so))
+                mask |= POLLOUT | POLLWRNORM;
+
         return mask;
 }
 
@@ -176,7 +178,8 @@ static int pfq_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 		}
 
 		if (likely(arg == 0)) { /* transmit Tx queue */
-			tx_response_t tx = pfq_sk_queue_xmit(so, -1, Q_NO_KTHREAD);
+			uint64_t departure;
+			tx_response_t tx = pfq_sk_queue_xmit(so, -1, Q_NO_KTHREAD, NULL, &departure);
 
 			sparse_add(so->stats, sent, tx.ok);
 			sparse_add(so->stats, fail, tx.fail);
@@ -485,12 +488,9 @@ static int __init pfq_init_module(void)
 	if ((err = pfq_check_threads_affinity()) < 0)
 		goto err6;
 
-	/* start Tx threads */
-	if (global->tx_cpu_nr)
-	{
-		if ((err = pfq_start_tx_threads()) < 0)
-			goto err7;
-	}
+	/* start Tx threads (and the rebalancing of their queues) */
+	if ((err = pfq_start_tx_threads()) < 0)
+		goto err7;
 
 	/* proc init */
 
@@ -502,6 +502,10 @@ static int __init pfq_init_module(void)
 
 	pfq_timer_init();
 
+	/* enable the optional stages of the receive path */
+
+	pfq_fastpath_vlan_untag_init();
+
 
         printk(KERN_INFO "[PFQ] version %d.%d.%d...\n",
                PFQ_MAJOR(PFQ_VERSION_CODE),
@@ -512,6 +516,7 @@ static int __init pfq_init_module(void)
         printk(KERN_INFO "[PFQ] capt_batch_len  : %d\n", global->capt_batch_len);
         printk(KERN_INFO "[PFQ] xmit_batch_len  : %d\n", global->xmit_batch_len);
         printk(KERN_INFO "[PFQ] vlan_untag      : %d\n", global->vlan_untag);
+        printk(KERN_INFO "[PFQ] tx_idle_spin    : %d\n", global->tx_idle_spin);
         printk(KERN_INFO "[PFQ] skb_tx_pool_size: %d\n", global->skb_tx_pool_size);
         printk(KERN_INFO "[PFQ] skb_rx_pool_size: %d\n", global->skb_rx_pool_size);
         printk(KERN_INFO "[PFQ] skb_size        : %zu\n", sizeof(struct sk_buff));
@@ -526,6 +531,7 @@ err6:
 	unregister_netdevice_notifier(&pfq_netdev_notifier_block);
 
 #ifdef PFQ_USE_SKB_POOL
+	pfq_tx_thread_pool_free_all();
 	pfq_skb_pool_free_all();
 err5:
 #endif
@@ -545,9 +551,14 @@ static void __exit pfq_exit_module(void)
 {
         int total = 0;
 
+	/* release the sockets still waiting for a consumer */
+	pfq_sock_detach_flush();
+
 	/* stop the timer */
 	pfq_timer_fini();
 
+	pfq_fastpath_vlan_untag_fini();
+
 	/* unregister proc */
 	pfq_proc_destruct();
 
@@ -577,6 +588,7 @@ static void __exit pfq_exit_module(void)
         total += pfq_percpu_destruct();
 
 #ifdef PFQ_USE_SKB_POOL
+        pfq_tx_thread_pool_free_all();
         pfq_skb_pool_free_all();
 #endif
         if (total)
@@ -599,7 +611,8 @@ static void __exit pfq_exit_module(void)
 static inline
 bool pfq_capture_enabled(const struct sk_buff *skb)
 {
-        return pfq_devmap_toggle_get(skb->dev->ifindex);
+        return static_key_false(&pfq_key_capture) &&
+		pfq_devmap_toggle_get(skb->dev->ifindex);
 }
 
 
@@ -701,6 +714,75 @@ pfq_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 }
 
 
+/*
+ * skb-less ingestion for patched drivers: the packet lives in a page fragment
+ * owned by the driver (one page reference is handed over to PFQ). The headers
+ * are pulled into a recycled skb of the per-cpu rx pool and the rest of the
+ * payload is attached as a fragment, so that no sk_buff is allocated per
+ * packet while the pool is enabled. The fragment is released when the skb is
+ * recycled; a private copy is only made if the packet is passed to the kernel.
+ *
+ * The rx hash is recorded with the given hash_type (PKT_HASH_TYPE_L3 or _L4,
+ * as computed by the NIC); a hash of 0 is not recorded.
+ *
+ * Returns 0 if the packet has been consumed, -EAGAIN if capture is not enabled
+ * on dev (the page is still owned by the driver, which should build its own skb).
+ *
+ * See kernel/module/fragloop for a driver using it.
+ */
+
+static int
+pfq_receive_frag(struct napi_struct *napi, struct net_device *dev,
+		 struct page *page, unsigned int offset, unsigned int len,
+		 unsigned int truesize, u32 hash, u8 hash_type, u16 vlan_tci, u16 queue)
+{
+	struct sk_buff *skb;
+	unsigned int pull;
+
+	if (!static_key_false(&pfq_key_capture) ||
+	    !pfq_devmap_toggle_get(dev->ifindex))
+		return -EAGAIN;
+
+	if (unlikely(len < ETH_HLEN)) {
+		put_page(page);
+		sparse_inc(global->percpu_stats, lost);
+		return 0;
+	}
+
+	pull = min_t(unsigned int, len, Q_RX_FRAG_PULL_LEN);
+
+	skb = pfq_alloc_skb(pull + NET_IP_ALIGN, GFP_ATOMIC);
+	if (unlikely(!skb)) {
+		put_page(page);
+		sparse_inc(global->percpu_stats, lost);
+		return 0;
+	}
+
+	skb_reserve(skb, NET_IP_ALIGN);
+	memcpy(skb_put(skb, pull), page_address(page) + offset, pull);
+
+	if (len > pull)
+		skb_add_rx_frag(skb, 0, page, offset + pull, len - pull, truesize);
+	else
+		put_page(page);
+
+	skb_record_rx_queue(skb, queue);
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,14,0))
+	if (hash)
+		skb_set_hash(skb, hash, (enum pkt_hash_types)hash_type);
+#endif
+	if (vlan_tci)
+		__vlan_hwaccel_put_tag(skb, vlan_tci);
+
+	skb->protocol = eth_type_trans(skb, dev);
+
+	pfq_normalize_skb(skb);
+
+	pfq_receive(napi, skb);
+	return 0;
+}
+
+
 int
 pfq_lang_register_functions(const char *module, struct pfq_lang_function_descr *fun)
 {
@@ -718,6 +800,7 @@ pfq_lang_unregister_functions(const char *module, struct pfq_lang_function_descr
 EXPORT_SYMBOL_GPL(pfq_netif_rx);
 EXPORT_SYMBOL_GPL(pfq_netif_receive_skb);
 EXPORT_SYMBOL_GPL(pfq_gro_receive);
+EXPORT_SYMBOL_GPL(pfq_receive_frag);
 
 EXPORT_SYMBOL(pfq_lang_register_functions);
 EXPORT_SYMBOL(pfq_lang_unregister_functions);
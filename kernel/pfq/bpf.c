@@ -26,6 +26,7 @@
 #include <linux/version.h>
 #include <linux/module.h>
 #include <linux/filter.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <net/sock.h>
@@ -82,3 +83,29 @@ pfq_free_sk_filter(struct sk_filter *filter)
 }
 
 
+/* 64-bit fingerprint of an attached BPF program: the instructions actually
+ * run by the filter (the kernel copy, not the user one) are hashed */
+
+uint64_t
+pfq_sk_filter_fingerprint(struct sk_filter *filter)
+{
+	const void *insns;
+	size_t size;
+	uint32_t lo, hi;
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,15,0))
+	insns = filter->insns;
+	size  = filter->len * sizeof(struct sock_filter);
+#elif (LINUX_VERSION_CODE < KERNEL_VERSION(3,18,0))
+	insns = filter->insnsi;
+	size  = filter->len * sizeof(struct sock_filter_int);
+#else
+	insns = filter->prog->insnsi;
+	size  = filter->prog->len * sizeof(struct bpf_insn);
+#endif
+
+	lo = jhash(insns, (u32)size, 0);
+	hi = jhash(insns, (u32)size, JHASH_INITVAL);
+
+	return (((uint64_t)hi << 32) | lo) ?: 1;
+}
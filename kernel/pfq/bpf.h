@@ -29,5 +29,6 @@
 
 extern struct sk_filter * pfq_alloc_sk_filter(struct sock_fprog *fprog);
 extern void pfq_free_sk_filter(struct sk_filter *filter);
+extern uint64_t pfq_sk_filter_fingerprint(struct sk_filter *filter);
 
 #endif /* PFQ_BPF_H */
@@ -35,6 +35,13 @@
 
 #define Q_MAX_STEERING_MASK	        512
 
+#define Q_STEER_FLOW_BITS		8	/* per-cpu flow table (load-aware steering) */
+#define Q_STEER_FLOW_TIMEOUT		HZ	/* idle time after which a flow is new */
+
+#define Q_FLOW_CACHE_SIZE		4096	/* per-cpu flow cache entries (flow-record export) */
+
+#define Q_SHARED_RESULTS		4	/* per-packet results of identical filters/computations */
+
 #define Q_MAX_DEVICE			4096
 #define Q_MAX_DEVICE_MASK		(Q_MAX_DEVICE-1)
 #define Q_MAX_QUEUE			256
@@ -42,8 +49,30 @@
 
 #define Q_MAX_TX_SKB_COPY		256
 
+#define Q_RX_FRAG_PULL_LEN		128	/* bytes copied to the linear area by pfq_receive_frag */
+#define Q_TX_ZEROCOPY_LINEAR		128	/* bytes of a zero-copy Tx slot copied to the linear area */
+#define Q_TX_GSO_LINEAR			256	/* bytes of a GSO Tx slot copied to the linear area (headers) */
+#define Q_TX_ZEROCOPY_TIMEOUT		5000	/* msec, wait for the driver to release zero-copy slots */
+#define Q_TX_PACING_SPIN		50000	/* nsec, departure gaps busy-waited in the Tx path */
+#define Q_TX_PACING_SPIN_BATCH		200000	/* nsec, total busy-wait of a batch (under the device lock) */
+#define Q_TX_PACING_MAX_SLEEP		1000000	/* nsec, longest sleep of a Tx thread waiting for a departure */
+#define Q_TX_THREAD_SLEEP		HZ	/* longest sleep of an idle Tx thread (without doorbell) */
+#define Q_TX_LOSSLESS_RETRY		100000	/* nsec, a lossless queue blocked on a stopped device is retried */
+#define Q_TX_PIPE_CLOSED		(-2)	/* pipe of a released socket: the slots are discarded */
+#define Q_TX_QUEUE_REPLAY		Q_MAX_TX_QUEUES	/* socket queue of a Tx thread replaying a trace */
+#define Q_TX_REPLAY_BUDGET		256	/* records replayed per pass of the Tx thread */
+#define Q_REPLAY_MAX_CAPLEN		65535
+
+#define Q_MAX_TX_THREADS		64
+#define Q_TX_THREAD_QUEUES		32	/* socket queues served by a Tx thread */
+#define Q_TX_REBALANCE_INTERVAL		1000	/* msec */
+#define Q_TX_REBALANCE_HIGH		80	/* % utilization, a thread gives a queue away */
+#define Q_TX_REBALANCE_LOW		50	/* % utilization, a thread takes a queue */
+
 #define Q_GRACE_PERIOD			200 /* msec */
 
+#define Q_MAX_DETACH_TIMEOUT		600000	/* msec, a detached socket waits for a new consumer */
+
 #define Q_FUN_SYMB_LEN			256
 #define Q_FUN_SIGN_LEN			1024
 #define Q_FUN_MAX_ENTRIES		1024
@@ -23,14 +23,19 @@
  ****************************************************************/
 
 #include <pfq/devmap.h>
+#include <pfq/fastpath.h>
 #include <pfq/group.h>
 #include <pfq/kcompat.h>
 #include <pfq/printk.h>
 #include <pfq/thread.h>
 
 
+static bool pfq_devmap_capture = false;
+
+
 void pfq_devmap_toggle_update(void)
 {
+    bool any = false;
     int i,j;
     for(i=0; i < Q_MAX_DEVICE; ++i)
     {
@@ -41,7 +46,26 @@ void pfq_devmap_toggle_update(void)
         }
 
         atomic_set(&global->devmap_toggle[i], val ? 1 : 0);
+        any |= val != 0;
     }
+
+    /* enable the capture fast path only if at least a device is bound */
+
+    pfq_fastpath_update(&pfq_key_capture, pfq_devmap_capture, any);
+    pfq_devmap_capture = any;
+}
+
+
+void pfq_devmap_toggle_reset(void)
+{
+    int n;
+    for(n = 0; n < Q_MAX_DEVICE; n++)
+    {
+        atomic_set(&global->devmap_toggle[n],0);
+    }
+
+    pfq_fastpath_update(&pfq_key_capture, pfq_devmap_capture, false);
+    pfq_devmap_capture = false;
 }
 
 
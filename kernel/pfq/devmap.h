@@ -63,6 +63,7 @@ unsigned long pfq_devmap_get_groups(int dev, int queue)
 
 
 extern void pfq_devmap_toggle_update(void);
+extern void pfq_devmap_toggle_reset(void);
 
 static inline
 int pfq_devmap_toggle_get(int index)
@@ -71,14 +72,4 @@ int pfq_devmap_toggle_get(int index)
 }
 
 
-static inline
-void pfq_devmap_toggle_reset(void)
-{
-        int n;
-        for(n = 0; n < Q_MAX_DEVICE; n++)
-        {
-                atomic_set(&global->devmap_toggle[n],0);
-        }
-}
-
 #endif /* PFQ_DEVMAP_H */
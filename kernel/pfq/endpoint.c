@@ -42,9 +42,11 @@ pfq_get_lazy_endpoints( struct pfq_qbuff_queue *qb
 
 	for(n = 0; n < qb->len; ++n)
 	{
+		int queue = qbuff_get_queue_mapping(&qb->queue[n]);
+
 		for(i = 0; i < qb->queue[n].fwd_dev_num; i++)
 		{
-			pfq_add_dev_to_endpoints(qb->queue[n].fwd_dev[i], ts);
+			pfq_add_dev_to_endpoints(qb->queue[n].fwd_dev[i], queue, n, ts);
 		}
 	}
 }
@@ -52,13 +54,16 @@ pfq_get_lazy_endpoints( struct pfq_qbuff_queue *qb
 
 void
 pfq_add_dev_to_endpoints( struct net_device *dev
+			, int queue
+			, size_t index
 			, struct pfq_endpoint_info *ts)
 {
 	size_t n = 0;
 
 	for(; n < ts->num; ++n)
 	{
-		if (dev == ts->dev[n]) {
+		if (dev == ts->dev[n] && queue == ts->queue[n]) {
+			ts->mask[n] |= (unsigned __int128)1 << index;
 			ts->cnt[n]++;
 			ts->cnt_total++;
 			return;
@@ -67,6 +72,8 @@ pfq_add_dev_to_endpoints( struct net_device *dev
 
 	if (n < Q_BUFF_LOG_LEN) {
 		ts->dev[n] = dev;
+		ts->queue[n] = queue;
+		ts->mask[n] = (unsigned __int128)1 << index;
 		ts->cnt[n] = 1;
 		ts->cnt_total++;
 		ts->num++;
@@ -76,20 +83,64 @@ pfq_add_dev_to_endpoints( struct net_device *dev
 }
 
 
+/*
+ * drop the packets whose classes exceed their watermark, given the
+ * current occupancy of the Rx queue: low-priority traffic is dropped
+ * first, leaving the reserved slots to the other classes.
+ */
+
+static
+unsigned __int128 rx_class_admit( struct pfq_sock *so
+				, struct pfq_queue_layout const *ql
+				, struct pfq_qbuff_queue *buffs
+				, unsigned __int128 mask
+				, int cpu)
+{
+	unsigned __int128 admit = mask;
+	struct qbuff *buff;
+	size_t n, slot;
+
+	slot = PFQ_SHARED_QUEUE_LEN(__atomic_load_n(&ql->addr->rx.shinfo, __ATOMIC_RELAXED));
+
+	for_each_qbuff_with_mask(mask, buffs, buff, n)
+	{
+		if (slot < pfq_sock_rx_class_watermark(so, ql->rx_len, buff->class_mask)) {
+			slot++;
+			continue;
+		}
+
+		admit ^= (unsigned __int128)1 << n;
+
+		__sparse_inc(so->class_stats, drop[buff->class_mask ? pfq_ctz(buff->class_mask) : 0], cpu);
+		__sparse_inc(so->stats, drop, cpu);
+	}
+
+	return admit;
+}
+
+
 static inline
 size_t copy_to_user_qbuffs( struct pfq_sock *so
 			  , struct pfq_qbuff_queue *buffs
 			  , unsigned __int128 mask
 			  , int cpu)
 {
+	struct pfq_queue_layout *ql = pfq_sock_queue_layout(so);
         size_t cpy, len = pfq_popcount(mask);
 
 	__sparse_add(so->stats, recv, len, cpu);
 
-        if (likely(pfq_sock_rx_shared_queue(so) != NULL)) {
+        if (likely(ql != NULL)) {
 
 		smp_rmb();
 
+		if (so->rx_reserved) {
+			mask = rx_class_admit(so, ql, buffs, mask, cpu);
+			len = pfq_popcount(mask);
+			if (!len)
+				return 0;
+		}
+
                 cpy = pfq_sk_queue_recv(so, buffs, mask, (int)len);
 		if (len > cpy)
 			__sparse_add(so->stats, lost, len - cpy, cpu);
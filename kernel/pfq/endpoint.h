@@ -43,16 +43,21 @@ enum pfq_endpoint_type
 };
 
 
+/* devices (and hw queues) the batch is forwarded to: each one has the list
+ * of its buffs, as a mask over the batch, to be transmitted under one lock */
+
 struct pfq_endpoint_info
 {
 	struct net_device * dev[Q_BUFF_LOG_LEN];
+	int queue [Q_BUFF_LOG_LEN];
+	unsigned __int128 mask [Q_BUFF_LOG_LEN];
 	size_t cnt [Q_BUFF_LOG_LEN];
 	size_t cnt_total;
 	size_t num;
 };
 
 
-extern void pfq_add_dev_to_endpoints(struct net_device *dev, struct pfq_endpoint_info *ts);
+extern void pfq_add_dev_to_endpoints(struct net_device *dev, int queue, size_t index, struct pfq_endpoint_info *ts);
 
 extern size_t pfq_copy_to_endpoint_qbuffs( struct pfq_sock *so
 					 , struct pfq_qbuff_queue *buffs
@@ -0,0 +1,74 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#include <pfq/fastpath.h>
+#include <pfq/global.h>
+
+#include <linux/mutex.h>
+
+
+struct static_key pfq_key_capture	= STATIC_KEY_INIT_FALSE;
+struct static_key pfq_key_vlan_untag	= STATIC_KEY_INIT_FALSE;
+struct static_key pfq_key_bp_filter	= STATIC_KEY_INIT_FALSE;
+struct static_key pfq_key_vlan_filter	= STATIC_KEY_INIT_FALSE;
+struct static_key pfq_key_computation	= STATIC_KEY_INIT_FALSE;
+struct static_key pfq_key_flow_export	= STATIC_KEY_INIT_FALSE;
+struct static_key pfq_key_tstamp	= STATIC_KEY_INIT_FALSE;
+
+
+static DEFINE_MUTEX(vlan_untag_lock);
+
+static bool vlan_untag_live;	/* the module is initialized */
+static bool vlan_untag_key;	/* pfq_key_vlan_untag is held */
+
+
+void pfq_fastpath_vlan_untag(int value)
+{
+	mutex_lock(&vlan_untag_lock);
+	if (vlan_untag_live) {
+		pfq_fastpath_update(&pfq_key_vlan_untag, vlan_untag_key, value != 0);
+		vlan_untag_key = value != 0;
+	}
+	mutex_unlock(&vlan_untag_lock);
+}
+
+
+void pfq_fastpath_vlan_untag_init(void)
+{
+	mutex_lock(&vlan_untag_lock);
+	vlan_untag_live = true;
+	vlan_untag_key = READ_ONCE(global->vlan_untag) != 0;
+	pfq_fastpath_update(&pfq_key_vlan_untag, false, vlan_untag_key);
+	mutex_unlock(&vlan_untag_lock);
+}
+
+
+void pfq_fastpath_vlan_untag_fini(void)
+{
+	mutex_lock(&vlan_untag_lock);
+	pfq_fastpath_update(&pfq_key_vlan_untag, vlan_untag_key, false);
+	vlan_untag_key = false;
+	vlan_untag_live = false;
+	mutex_unlock(&vlan_untag_lock);
+}
+
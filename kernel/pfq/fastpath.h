@@ -0,0 +1,65 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#ifndef PFQ_FASTPATH_H
+#define PFQ_FASTPATH_H
+
+#include <linux/jump_label.h>
+#include <linux/types.h>
+
+/*
+ * Static keys of the receive path: each key counts the users of an optional
+ * stage (one per group/socket/device that needs it), so that configurations
+ * that do not use a stage run a straight-line pfq_receive().
+ *
+ * Keys are updated from user-context only (sockopt/group/devmap control path).
+ */
+
+extern struct static_key pfq_key_capture;	/* at least one device bound */
+extern struct static_key pfq_key_vlan_untag;	/* vlan_untag module parameter */
+extern struct static_key pfq_key_bp_filter;	/* groups with a BPF filter */
+extern struct static_key pfq_key_vlan_filter;	/* groups with vlan filters enabled */
+extern struct static_key pfq_key_computation;	/* groups with a pfq-lang computation */
+extern struct static_key pfq_key_flow_export;	/* groups in flow-record export mode */
+extern struct static_key pfq_key_tstamp;	/* sockets/groups that need timestamps */
+
+
+static inline
+void pfq_fastpath_update(struct static_key *key, bool old, bool value)
+{
+	if (!old && value)
+		static_key_slow_inc(key);
+	else if (old && !value)
+		static_key_slow_dec(key);
+}
+
+
+/* vlan_untag can be changed at runtime: the key follows the module parameter
+ * while the module is live (between the _init and _fini calls) */
+
+extern void pfq_fastpath_vlan_untag(int value);
+extern void pfq_fastpath_vlan_untag_init(void);
+extern void pfq_fastpath_vlan_untag_fini(void);
+
+
+#endif /* PFQ_FASTPATH_H */
@@ -0,0 +1,257 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#include <linux/jhash.h>
+#include <linux/vmalloc.h>
+
+#include <pfq/bitops.h>
+#include <pfq/flow.h>
+#include <pfq/global.h>
+#include <pfq/group.h>
+#include <pfq/io.h>
+#include <pfq/nethdr.h>
+#include <pfq/qbuff.h>
+#include <pfq/sock.h>
+#include <pfq/stats.h>
+
+
+struct pfq_flow_export *
+pfq_flow_export_alloc(unsigned int idle_msec, unsigned int active_msec)
+{
+	struct pfq_flow_export *fe;
+	int cpu;
+
+	fe = kzalloc(sizeof(struct pfq_flow_export), GFP_KERNEL);
+	if (fe == NULL)
+		return NULL;
+
+	fe->idle_timeout   = msecs_to_jiffies(idle_msec);
+	fe->active_timeout = active_msec ? msecs_to_jiffies(active_msec) : 0;
+
+	for_each_possible_cpu(cpu)
+	{
+		if (cpu >= Q_MAX_CPU)
+			break;
+
+		fe->cache[cpu] = vzalloc_node(sizeof(struct pfq_flow_cache), cpu_to_node(cpu));
+		if (fe->cache[cpu] == NULL) {
+			printk(KERN_WARNING "[PFQ] flow export: could not allocate flow cache for cpu %d!\n", cpu);
+			goto err;
+		}
+	}
+
+	return fe;
+err:
+	for(cpu = 0; cpu < Q_MAX_CPU; cpu++)
+		vfree(fe->cache[cpu]);
+	kfree(fe);
+	return NULL;
+}
+
+
+/*
+ * export a record into the Rx queue of one of the sockets of the group,
+ * chosen by the flow key so that a flow always lands on the same consumer.
+ */
+
+static void
+flow_export_record(struct pfq_group *group, struct pfq_flow_entry *e, uint8_t end, int cpu)
+{
+	unsigned long sock_mask = (unsigned long)atomic_long_read(&group->sock_id[pfq_ctz(Q_CLASS_DEFAULT)]);
+	struct pfq_sock *so;
+	uint32_t idx;
+
+	if (!sock_mask)
+		return;
+
+	e->rec.end = end;
+
+	idx = jhash_3words(e->rec.saddr, e->rec.daddr,
+			   ((uint32_t)e->rec.sport << 16) | e->rec.dport, e->rec.proto) % pfq_popcount(sock_mask);
+	while (idx--)
+		sock_mask &= sock_mask - 1;
+
+	so = pfq_sock_get_by_id((__force pfq_id_t)pfq_ctz(sock_mask));
+	if (so == NULL)
+		return;
+
+	__sparse_inc(so->stats, recv, cpu);
+
+	if (!pfq_sk_queue_recv_record(so, &e->rec, sizeof(e->rec)))
+		__sparse_inc(so->stats, lost, cpu);
+}
+
+
+void
+pfq_flow_account(struct pfq_group *group, struct pfq_flow_export *fe, struct qbuff *buff, int cpu)
+{
+	struct pfq_flow_cache *cache = fe->cache[cpu & Q_MAX_CPU_MASK];
+	struct pfq_flow_record key = { 0 };
+	struct pfq_flow_entry *e;
+	struct iphdr _iph; const struct iphdr *ip;
+	int ipoff = (int)qbuff_maclen(buff);
+	uint64_t now;
+
+	if (unlikely(cache == NULL) ||
+	    qbuff_eth_hdr(buff)->h_proto != __constant_htons(ETH_P_IP))
+		return;
+
+	ip = qbuff_header_pointer(buff, ipoff, sizeof(_iph), &_iph);
+	if (ip == NULL)
+		return;
+
+	key.saddr = (__force uint32_t)ip->saddr;
+	key.daddr = (__force uint32_t)ip->daddr;
+	key.proto = ip->protocol;
+	key.vid   = qbuff_vlan_tci(buff) & Q_VLAN_VID_MASK;
+
+	/* ports and flags are only in non-fragmented packets or first fragments */
+
+	if (!(ip->frag_off & __constant_htons(IP_OFFSET)) &&
+	    (ip->protocol == IPPROTO_TCP || ip->protocol == IPPROTO_UDP)) {
+
+		struct tcphdr _tcp; const struct tcphdr *tcp;
+
+		tcp = qbuff_header_pointer(buff, ipoff + (ip->ihl<<2),
+					   ip->protocol == IPPROTO_TCP ? sizeof(_tcp) : sizeof(struct udphdr), &_tcp);
+		if (tcp) {
+			key.sport = (__force uint16_t)tcp->source;
+			key.dport = (__force uint16_t)tcp->dest;
+			if (ip->protocol == IPPROTO_TCP)
+				key.tcp_flags = tcp_flag_byte(tcp);
+		}
+	}
+
+	e = &cache->entry[jhash_3words(key.saddr, key.daddr,
+				       ((uint32_t)key.sport << 16) | key.dport,
+				       ((uint32_t)key.vid << 8) | key.proto) & (Q_FLOW_CACHE_SIZE-1)];
+
+	now = (uint64_t)ktime_to_ns(qbuff_get_ktime(buff));
+
+	if (e->rec.packets) {
+		if (e->rec.saddr == key.saddr && e->rec.daddr == key.daddr &&
+		    e->rec.sport == key.sport && e->rec.dport == key.dport &&
+		    e->rec.proto == key.proto && e->rec.vid   == key.vid) {
+
+			e->rec.last = now;
+			e->rec.packets++;
+			e->rec.bytes += qbuff_len(buff);
+			e->rec.tcp_flags |= key.tcp_flags;
+			e->last = jiffies;
+			return;
+		}
+
+		/* collision: export the old flow */
+
+		flow_export_record(group, e, Q_FLOW_END_EVICTED, cpu);
+	}
+
+	e->rec = key;
+	e->rec.first   = now;
+	e->rec.last    = now;
+	e->rec.packets = 1;
+	e->rec.bytes   = qbuff_len(buff);
+	e->rec.ifindex = qbuff_get_ifindex(buff);
+	e->first = e->last = jiffies;
+}
+
+
+static void
+flow_expire_cache(struct pfq_group *group, struct pfq_flow_export *fe, struct pfq_flow_cache *cache, bool flush, int cpu)
+{
+	unsigned long now = jiffies;
+	size_t n;
+
+	for(n = 0; n < Q_FLOW_CACHE_SIZE; n++)
+	{
+		struct pfq_flow_entry *e = &cache->entry[n];
+		uint8_t end;
+
+		if (!e->rec.packets)
+			continue;
+
+		if (flush)
+			end = Q_FLOW_END_FLUSH;
+		else if (time_after_eq(now, e->last + fe->idle_timeout))
+			end = Q_FLOW_END_IDLE;
+		else if (fe->active_timeout && time_after_eq(now, e->first + fe->active_timeout))
+			end = Q_FLOW_END_ACTIVE;
+		else
+			continue;
+
+		flow_export_record(group, e, end, cpu);
+		e->rec.packets = 0;
+	}
+}
+
+
+/*
+ * called by the per-cpu heartbeat: export the expired flows of every group
+ * in flow-record export mode.
+ */
+
+void
+pfq_flow_expire(int cpu)
+{
+	int n;
+	for(n = 0; n < Q_MAX_GID; n++)
+	{
+		struct pfq_group *group = pfq_group_get((__force pfq_gid_t)n);
+		struct pfq_flow_export *fe;
+
+		fe = (struct pfq_flow_export *)atomic_long_read(&group->flow_export);
+		if (fe && fe->cache[cpu & Q_MAX_CPU_MASK])
+			flow_expire_cache(group, fe, fe->cache[cpu & Q_MAX_CPU_MASK], false, cpu);
+	}
+}
+
+
+/*
+ * release a flow cache no longer reachable from the group (i.e. after the
+ * grace period), optionally exporting the pending flows.
+ */
+
+void
+pfq_flow_export_free(struct pfq_group *group, struct pfq_flow_export *fe, bool flush)
+{
+	int cpu;
+
+	if (fe == NULL)
+		return;
+
+	for(cpu = 0; cpu < Q_MAX_CPU; cpu++)
+	{
+		if (fe->cache[cpu] == NULL)
+			continue;
+
+		if (flush) {
+			local_bh_disable();
+			flow_expire_cache(group, fe, fe->cache[cpu], true, smp_processor_id());
+			local_bh_enable();
+		}
+
+		vfree(fe->cache[cpu]);
+	}
+
+	kfree(fe);
+}
@@ -0,0 +1,66 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#ifndef PFQ_FLOW_H
+#define PFQ_FLOW_H
+
+#include <pfq/define.h>
+#include <pfq/types.h>
+
+#include <linux/pf_q.h>
+
+
+struct pfq_group;
+struct qbuff;
+
+
+struct pfq_flow_entry
+{
+	struct pfq_flow_record	rec;		/* exported as is */
+	unsigned long		first;		/* jiffies of the first packet */
+	unsigned long		last;		/* jiffies of the last packet */
+};
+
+
+struct pfq_flow_cache
+{
+	struct pfq_flow_entry	entry[Q_FLOW_CACHE_SIZE];
+};
+
+
+struct pfq_flow_export
+{
+	unsigned long		idle_timeout;	/* jiffies */
+	unsigned long		active_timeout;	/* jiffies, 0 = none */
+	struct pfq_flow_cache  *cache[Q_MAX_CPU];
+};
+
+
+extern struct pfq_flow_export *pfq_flow_export_alloc(unsigned int idle_msec, unsigned int active_msec);
+extern void pfq_flow_export_free(struct pfq_group *group, struct pfq_flow_export *fe, bool flush);
+
+extern void pfq_flow_account(struct pfq_group *group, struct pfq_flow_export *fe, struct qbuff *buff, int cpu);
+extern void pfq_flow_expire(int cpu);
+
+
+#endif /* PFQ_FLOW_H */
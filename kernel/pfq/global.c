@@ -41,6 +41,7 @@ struct pfq_global_data default_global =
 	.tx_cpu			= {0},
 	.tx_cpu_nr		= 0,
 	.tx_retry		= 1,
+	.tx_idle_spin		= 100,
 
 	.socket_ptr		= {{0}},
 	.socket_count		= {0},
@@ -53,6 +53,7 @@ struct pfq_global_data
 	int tx_cpu[Q_MAX_CPU];
 	int tx_cpu_nr;
 	int tx_retry;
+	int tx_idle_spin;
 
 	atomic_long_t   socket_ptr[Q_MAX_ID];
 	atomic_t        socket_count;
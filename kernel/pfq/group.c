@@ -28,6 +28,8 @@
 #include <pfq/bitops.h>
 #include <pfq/bpf.h>
 #include <pfq/devmap.h>
+#include <pfq/fastpath.h>
+#include <pfq/flow.h>
 #include <pfq/global.h>
 #include <pfq/group.h>
 #include <pfq/kcompat.h>
@@ -72,8 +74,16 @@ pfq_groups_init(void)
 			goto err;
 		}
 
+		group->steer_stats = alloc_percpu(struct pfq_steer_counters);
+		if (group->steer_stats == NULL) {
+			goto err;
+		}
+
+		group->steer_threshold = 0;
+
 		pfq_group_stats_reset(group->stats);
 		pfq_group_counters_reset(group->counters);
+		pfq_steer_counters_reset(group->steer_stats);
 	}
 
 	return 0;
@@ -94,8 +104,10 @@ pfq_groups_destruct(void)
 
 		free_percpu(group->stats);
 		free_percpu(group->counters);
+		free_percpu(group->steer_stats);
 		group->stats = NULL;
 		group->counters = NULL;
+		group->steer_stats = NULL;
 	}
 }
 
@@ -176,12 +188,17 @@ __pfq_group_init(struct pfq_group *group, pfq_gid_t gid)
         }
 
         atomic_long_set(&group->bp_filter,0L);
+        atomic_long_set(&group->bp_fingerprint, 0L);
         atomic_long_set(&group->comp,     0L);
         atomic_long_set(&group->comp_ctx, 0L);
+        atomic_long_set(&group->reta,     0L);
+        atomic_long_set(&group->flow_export, 0L);
 
 	pfq_group_stats_reset(group->stats);
 	pfq_group_counters_reset(group->counters);
+	pfq_steer_counters_reset(group->steer_stats);
 
+	group->steer_threshold = 0;
 	group->vlan_filt = false;
 
 	for(i = 0; i < 4096; i++) {
@@ -198,6 +215,8 @@ __pfq_group_free(struct pfq_group *group, pfq_gid_t gid)
 {
         struct sk_filter *filter;
         struct pfq_lang_computation_tree *old_comp;
+        struct pfq_group_reta *old_reta;
+        struct pfq_flow_export *old_fe;
         void *old_ctx;
         size_t i;
 
@@ -211,9 +230,21 @@ __pfq_group_free(struct pfq_group *group, pfq_gid_t gid)
         group->owner  = Q_INVALID_ID;
         group->policy = Q_POLICY_GROUP_UNDEFINED;
 
+        atomic_long_set(&group->bp_fingerprint, 0L);
+        smp_wmb();
+
         filter   = (struct sk_filter *)atomic_long_xchg(&group->bp_filter, 0L);
         old_comp = (struct pfq_lang_computation_tree *)atomic_long_xchg(&group->comp, 0L);
         old_ctx  = (void *)atomic_long_xchg(&group->comp_ctx, 0L);
+        old_reta = (struct pfq_group_reta *)atomic_long_xchg(&group->reta, 0L);
+        old_fe   = (struct pfq_flow_export *)atomic_long_xchg(&group->flow_export, 0L);
+
+        group->steer_threshold = 0;
+
+	pfq_fastpath_update(&pfq_key_bp_filter, filter != NULL, false);
+	pfq_fastpath_update(&pfq_key_computation, old_comp != NULL, false);
+	pfq_fastpath_update(&pfq_key_flow_export, old_fe != NULL, false);
+	pfq_fastpath_update(&pfq_key_tstamp, old_fe != NULL, false);
 
         msleep(Q_GRACE_PERIOD);   /* sleeping is possible here: user-context */
 
@@ -225,10 +256,14 @@ __pfq_group_free(struct pfq_group *group, pfq_gid_t gid)
 
 	kfree(old_comp);
 	kfree(old_ctx);
+	kfree(old_reta);
+
+	pfq_flow_export_free(group, old_fe, false);
 
 	if (filter)
 		pfq_free_sk_filter(filter);
 
+	pfq_fastpath_update(&pfq_key_vlan_filter, group->vlan_filt, false);
         group->vlan_filt = false;
 	for(i = 0; i < 4096; i++) {
 		group->vid_filters[i] = 0;
@@ -335,7 +370,7 @@ pfq_group_get_all_sock_mask(pfq_gid_t gid)
 
 
 void
-pfq_group_set_filter(pfq_gid_t gid, struct sk_filter *filter)
+pfq_group_set_filter(pfq_gid_t gid, struct sk_filter *filter, uint64_t fingerprint)
 {
         struct pfq_group * group;
         struct sk_filter * old_filter;
@@ -346,10 +381,22 @@ pfq_group_set_filter(pfq_gid_t gid, struct sk_filter *filter)
                 return;
         }
 
+	pfq_fastpath_update(&pfq_key_bp_filter, false, filter != NULL);
+
+	/* stop sharing the results of the old filter before replacing it */
+
+        atomic_long_set(&group->bp_fingerprint, 0L);
+        smp_wmb();
+
         old_filter = (void *)atomic_long_xchg(&group->bp_filter, (long)filter);
 
+	pfq_fastpath_update(&pfq_key_bp_filter, old_filter != NULL, false);
+
         msleep(Q_GRACE_PERIOD);
 
+        if (filter)
+		atomic_long_set(&group->bp_fingerprint, (long)fingerprint);
+
 	if (old_filter)
 		pfq_free_sk_filter(old_filter);
 }
@@ -368,9 +415,13 @@ pfq_group_set_prog(pfq_gid_t gid, struct pfq_lang_computation_tree *comp, void *
 
         mutex_lock(&global->groups_lock);
 
+	pfq_fastpath_update(&pfq_key_computation, false, comp != NULL);
+
         old_comp = (struct pfq_lang_computation_tree *)atomic_long_xchg(&group->comp, (long)comp);
         old_ctx  = (void *)atomic_long_xchg(&group->comp_ctx, (long)ctx);
 
+	pfq_fastpath_update(&pfq_key_computation, old_comp != NULL, false);
+
         msleep(Q_GRACE_PERIOD);   /* sleeping is possible here: user-context */
 
 	/* call fini on old computation */
@@ -388,6 +439,103 @@ pfq_group_set_prog(pfq_gid_t gid, struct pfq_lang_computation_tree *comp, void *
 }
 
 
+int
+pfq_group_set_reta(pfq_gid_t gid, struct pfq_group_reta *reta)
+{
+        struct pfq_group * group;
+        struct pfq_group_reta *old_reta;
+
+	group = pfq_group_get(gid);
+        if (group == NULL)
+                return -EINVAL;
+
+        mutex_lock(&global->groups_lock);
+
+        old_reta = (struct pfq_group_reta *)atomic_long_xchg(&group->reta, (long)reta);
+        if (old_reta) {
+                msleep(Q_GRACE_PERIOD);   /* sleeping is possible here: user-context */
+                kfree(old_reta);
+        }
+
+        mutex_unlock(&global->groups_lock);
+        return 0;
+}
+
+
+int
+pfq_group_set_flow_export(pfq_gid_t gid, unsigned int idle_msec, unsigned int active_msec)
+{
+        struct pfq_group * group;
+        struct pfq_flow_export *fe = NULL, *old_fe;
+
+	group = pfq_group_get(gid);
+        if (group == NULL)
+                return -EINVAL;
+
+        if (idle_msec) {
+                fe = pfq_flow_export_alloc(idle_msec, active_msec);
+                if (fe == NULL)
+                        return -ENOMEM;
+        }
+
+        mutex_lock(&global->groups_lock);
+
+	pfq_fastpath_update(&pfq_key_flow_export, false, fe != NULL);
+	pfq_fastpath_update(&pfq_key_tstamp, false, fe != NULL);
+
+        old_fe = (struct pfq_flow_export *)atomic_long_xchg(&group->flow_export, (long)fe);
+
+	pfq_fastpath_update(&pfq_key_flow_export, old_fe != NULL, false);
+	pfq_fastpath_update(&pfq_key_tstamp, old_fe != NULL, false);
+
+        if (old_fe) {
+                msleep(Q_GRACE_PERIOD);   /* sleeping is possible here: user-context */
+                pfq_flow_export_free(group, old_fe, true);
+        }
+
+        mutex_unlock(&global->groups_lock);
+        return 0;
+}
+
+
+int
+pfq_group_get_reta(pfq_gid_t gid, struct pfq_so_group_reta *ureta)
+{
+        struct pfq_group * group;
+        struct pfq_group_reta *reta;
+        unsigned int n;
+        int ret = 0;
+
+	group = pfq_group_get(gid);
+        if (group == NULL)
+                return -EINVAL;
+
+        mutex_lock(&global->groups_lock);
+
+        reta = (struct pfq_group_reta *)atomic_long_read(&group->reta);
+        if (reta) {
+                if (ureta->size < reta->size) {
+                        ret = -ENOSPC;
+                        goto out;
+                }
+
+                for(n = 0; n < reta->size; n++)
+                {
+                        int id = reta->id[n];
+                        if (copy_to_user(&ureta->table[n], &id, sizeof(id))) {
+                                ret = -EFAULT;
+                                goto out;
+                        }
+                }
+        }
+
+        ureta->size = reta ? reta->size : 0;
+out:
+        mutex_unlock(&global->groups_lock);
+        return ret;
+}
+
+
 int
 pfq_group_join(pfq_gid_t gid, pfq_id_t id, unsigned long class_mask, int policy)
 {
@@ -530,6 +678,9 @@ pfq_group_toggle_vlan_filters(pfq_gid_t gid, bool value)
 
         smp_wmb();
 
+	pfq_fastpath_update(&pfq_key_vlan_filter, false, value);
+	pfq_fastpath_update(&pfq_key_vlan_filter, group->vlan_filt, false);
+
         group->vlan_filt = value;
         return true;
 }
@@ -547,3 +698,21 @@ pfq_group_set_vlan_filter(pfq_gid_t gid, bool value, int vid)
         group->vid_filters[vid & 4095] = value;
 }
 
+
+bool
+pfq_group_set_steer_threshold(pfq_gid_t gid, unsigned int threshold)
+{
+        struct pfq_group *group;
+
+        group = pfq_group_get(gid);
+        if (group == NULL)
+                return false;
+
+        if (threshold)
+                pfq_steer_counters_reset(group->steer_stats);
+
+        smp_wmb();
+
+        group->steer_threshold = threshold;
+        return true;
+}
@@ -35,6 +35,14 @@
 
 typedef struct pfq_kernel_stats pfq_group_stats_t;
 struct pfq_group_counters;
+struct pfq_steer_counters;
+
+struct pfq_group_reta
+{
+	unsigned int size;
+	int8_t id[];					/* socket id for each hash bucket */
+};
+
 
 struct pfq_group
 {
@@ -47,13 +55,20 @@ struct pfq_group
         						   Q_CLASS_DEFAULT, Q_CLASS_USER_PLANE, Q_CLASS_CONTROL_PLANE etc... */
 
         atomic_long_t bp_filter;			/* struct sk_filter pointer */
+        atomic_long_t bp_fingerprint;			/* identical filters share it (0: not shareable) */
 
         atomic_long_t comp;                             /* struct pfq_lang_computation_tree *  (new functional program) */
         atomic_long_t comp_ctx;                         /* void *: storage context (new functional program) */
 
+        atomic_long_t reta;                             /* struct pfq_group_reta * (steering indirection table) */
+        atomic_long_t flow_export;                      /* struct pfq_flow_export * (flow-record export mode) */
+
 	pfq_group_stats_t __percpu *stats;
 	struct pfq_group_counters __percpu *counters;
 
+	unsigned int steer_threshold;			/* load-aware steering: Rx queue occupancy (%), 0 = disabled */
+	struct pfq_steer_counters __percpu *steer_stats;
+
         bool   enabled;
         bool   vlan_filt;                               /* enable/disable vlan filtering */
         char   vid_filters[4096];                       /* vlan filters */
@@ -67,13 +82,16 @@ extern int  pfq_group_join_free(pfq_id_t id, unsigned long class_mask, int polic
 extern int  pfq_group_join(pfq_gid_t gid, pfq_id_t id, unsigned long class_mask, int policy);
 extern int  pfq_group_leave(pfq_gid_t gid, pfq_id_t id);
 extern int  pfq_group_set_prog(pfq_gid_t gid, struct pfq_lang_computation_tree *prog, void *ctx);
+extern int  pfq_group_set_reta(pfq_gid_t gid, struct pfq_group_reta *reta);
+extern int  pfq_group_get_reta(pfq_gid_t gid, struct pfq_so_group_reta *ureta);
+extern int  pfq_group_set_flow_export(pfq_gid_t gid, unsigned int idle_msec, unsigned int active_msec);
 extern void pfq_group_leave_all(pfq_id_t id);
 
 extern unsigned long pfq_group_get_groups(pfq_id_t id);
 extern unsigned long pfq_group_get_all_sock_mask(pfq_gid_t gid);
 
 extern int  pfq_group_get_context(pfq_gid_t gid, int level, int size, void __user *context);
-extern void pfq_group_set_filter(pfq_gid_t gid, struct sk_filter *filter);
+extern void pfq_group_set_filter(pfq_gid_t gid, struct sk_filter *filter, uint64_t fingerprint);
 
 extern struct pfq_group * pfq_group_get(pfq_gid_t gid);
 
@@ -82,6 +100,8 @@ extern bool pfq_group_check_vlan_filter(pfq_gid_t gid, int vid);
 extern bool pfq_group_toggle_vlan_filters(pfq_gid_t gid, bool value);
 extern void pfq_group_set_vlan_filter(pfq_gid_t gid, bool value, int vid);
 
+extern bool pfq_group_set_steer_threshold(pfq_gid_t gid, unsigned int threshold);
+
 extern bool pfq_group_policy_access(pfq_gid_t gid, pfq_id_t id, int policy);
 extern bool pfq_group_access(pfq_gid_t gid, pfq_id_t id);
 
@@ -24,15 +24,32 @@
  ****************************************************************/
 
 #include <net/sock.h>
+#include <net/checksum.h>
+#include <net/ip6_checksum.h>
 #ifdef CONFIG_INET
 #include <net/inet_common.h>
 #endif
 
+#include <linux/hash.h>
+#include <linux/if_vlan.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0))
+#include <linux/sched/clock.h>
+#else
+#include <linux/sched.h>
+#endif
+
 #include <lang/engine.h>
 #include <lang/symtable.h>
 
 #include <pfq/bitops.h>
 #include <pfq/devmap.h>
+#include <pfq/fastpath.h>
+#include <pfq/flow.h>
 #include <pfq/global.h>
 #include <pfq/io.h>
 #include <pfq/memory.h>
@@ -41,6 +58,7 @@
 #include <pfq/prefetch.h>
 #include <pfq/qbuff.h>
 #include <pfq/queue.h>
+#include <pfq/replay.h>
 #include <pfq/sock.h>
 #include <pfq/skbuff.h>
 #include <pfq/thread.h>
@@ -82,85 +100,35 @@ pfq_netdev_pick_tx(struct net_device *dev, struct sk_buff *skb, int *queue)
 }
 
 
-#if 0
-
 /*
- * wait function for active timestamping
- *
+ * departure-time pacing: gaps up to Q_TX_PACING_SPIN are busy-waited on
+ * local_clock() (TSC based, cheaper than the real-time clock), longer ones
+ * stop the batch and are left to the hrtimer sleep of the Tx thread.
+ * The spin is done holding the device queue lock with bottom halves
+ * disabled: a batch also stops once it has spun Q_TX_PACING_SPIN_BATCH.
  */
 
-
 static inline
-bool giveup_tx_process(atomic_t const *stop)
+void pfq_tx_spin(s64 gap)
 {
-	return atomic_read(stop) == -1 || signal_pending(current) || is_kthread_should_stop();
-}
-
-static inline
-ktime_t wait_until_busy(uint64_t ts, atomic_t const *stop, bool *intr)
-{
-	ktime_t now;
-	do
-	{
-		now = ktime_get_real();
-		if (giveup_tx_process(stop)) {
-			*intr= true;
-			return now;
-		}
-	}
-	while (ktime_to_ns(now) < ts);
-	return now;
+	u64 deadline = local_clock() + (u64)gap;
+	while (local_clock() < deadline)
+		cpu_relax();
 }
 
 
 static inline
-ktime_t wait_until_relaxed(uint64_t ts, atomic_t const *stop, bool *intr)
-{
-	ktime_t now;
-	do
-	{
-		now = ktime_get_real();
-		if (giveup_tx_process(stop)) {
-			*intr= true;
-			return now;
-		}
-	}
-	while (ktime_to_ns(now) < ts
-	       && (pfq_relax(), true));
-
-	return now;
-}
-
-
-static
-ktime_t wait_until(uint64_t tv64, ktime_t now, struct pfq_dev_queue *dev_queue, atomic_t const *stop, bool *intr)
+int pfq_tx_pacing_bucket(s64 late)
 {
-	ktime_t now_;
-
-	if (tv64 > ktime_to_ns(now)) {
-
-		if ((tv64 - ktime_to_ns(now)) < 100000) { /* < 100us, just like pktgen */
-
-			now_ = wait_until_busy(tv64, stop, intr);
-		}
-		else {
-			pfq_hard_tx_unlock(dev_queue);
-			local_bh_enable();
+	s64 bound = 100;
+	int n = 0;
 
-			now_ = wait_until_relaxed(tv64, stop, intr);
-
-			local_bh_disable();
-			pfq_hard_tx_lock(dev_queue);
-		}
+	while (n < Q_TX_PACING_BUCKETS - 1 && late >= bound) {
+		bound *= 10;
+		n++;
 	}
-	else {
-		if (!global->tx_rate_control_eager)
-			return now;
-	}
-
-	return now_;
+	return n;
 }
-#endif
 
 
 static inline
@@ -194,6 +162,74 @@ ptrdiff_t maybe_swap_sk_tx_queue(struct pfq_shared_tx_queue *tx_queue, unsigned
 }
 
 
+/* the offsets of a Tx buffer are in the shared memory (writable by the
+ * user space): bound them to the slots of the buffer, as per the layout */
+
+static inline
+ptrdiff_t pfq_tx_buffer_off(struct pfq_queue_layout const *ql, ptrdiff_t off, bool slot)
+{
+	if (unlikely(off < 0))
+		return 0;
+	if (unlikely(off > (ptrdiff_t)ql->tx_size))
+		off = (ptrdiff_t)ql->tx_size;
+	return slot ? off - off % (ptrdiff_t)ql->tx_slot_size : off;
+}
+
+
+/* slots produced and not yet transmitted */
+
+bool
+pfq_sk_queue_pending(struct pfq_sock *so, int sock_queue)
+{
+	struct pfq_shared_tx_queue *tx_queue;
+	unsigned int cons_idx;
+
+	if (sock_queue == Q_TX_QUEUE_REPLAY)
+		return so->replay && !so->replay->done;
+
+	tx_queue = pfq_sock_tx_shared_queue(so, sock_queue);
+	if (unlikely(tx_queue == NULL))
+		return false;
+
+	cons_idx = __atomic_load_n(&tx_queue->cons.index, __ATOMIC_RELAXED);
+
+	return __atomic_load_n(&tx_queue->prod.index, __ATOMIC_ACQUIRE) != cons_idx ||
+	       acquire_sk_tx_prod_off_by(cons_idx, tx_queue) != tx_queue->cons.off;
+}
+
+
+/* a Tx queue of the socket can take a slot: either the buffer of the
+ * producer has room, or the consumer has caught up and the producer can
+ * swap the buffers (poll POLLOUT) */
+
+bool
+pfq_sk_queue_tx_space(struct pfq_sock *so)
+{
+	struct pfq_queue_layout *ql = pfq_sock_queue_layout(so);
+	int n;
+
+	if (ql == NULL)
+		return false;
+
+	for(n = -1; n < (int)so->txq_num_async; n++)
+	{
+		struct pfq_shared_tx_queue *tx_queue = pfq_shared_tx_queue(ql->addr, n);
+		unsigned int prod_idx;
+
+		prod_idx = __atomic_load_n(&tx_queue->prod.index, __ATOMIC_ACQUIRE);
+
+		if ((size_t)pfq_tx_buffer_off(ql, acquire_sk_tx_prod_off_by(prod_idx, tx_queue), false) + ql->tx_slot_size < ql->tx_size)
+			return true;
+
+		if (__atomic_load_n(&tx_queue->cons.index, __ATOMIC_RELAXED) == prod_idx &&
+		    !pfq_tx_inflight_read(ql->tx_inflight, n, (int)prod_idx+1))
+			return true;
+	}
+
+	return false;
+}
+
+
 static inline
 unsigned int dev_tx_max_skb_copies(struct net_device *dev, unsigned int req_copies)
 {
@@ -272,33 +308,61 @@ pfq_xmit(struct qbuff *buff, struct net_device *dev, int queue, int more)
 
 
 /*
- * transmit a buff with copies
+ * transmit an skb with copies (the reference of the caller is not released)
  */
 
 static tx_response_t
-__pfq_slot_xmit(const void *buf,
-		size_t len,
-		struct pfq_dev_queue *dev_queue,
-		struct pfq_xmit_context *ctx)
+__pfq_skb_xmit_copies(struct sk_buff *skb,
+		      struct pfq_dev_queue *dev_queue,
+		      struct pfq_xmit_context *ctx)
 {
-	struct sk_buff *skb;
         tx_response_t rc = { 0 };
 
-	if (unlikely(!dev_queue->dev))
-		return (tx_response_t){.ok = 0, .fail = ctx->copies};
+	atomic_set(&skb->users, ctx->copies + 1);
+
+	do { /* copies > 1 when the device support TX_SKB_SHARING */
+
+		const bool xmit_more_ = ctx->xmit_more || ctx->copies != 1;
+
+		if (__pfq_xmit(skb, dev_queue->dev, xmit_more_, global->tx_retry) == NETDEV_TX_OK)
+			rc.ok++;
+		else
+			rc.fail++;
 
-	/* allocate a new socket buffer */
+		ctx->copies--;
+	}
+	while (ctx->copies > 0);
 
-	skb = pfq_alloc_skb_pool( len + LL_RESERVED_SPACE(dev_queue->dev)
-				, GFP_KERNEL
-				, ctx->node
-				, 1
-				, ctx->tx);
+	if (rc.ok)
+	     dev_queue->queue->trans_start = ctx->jiffies;
+
+	return rc;
+}
+
+
+/*
+ * copy a buff into a socket buffer of the Tx pool
+ */
+
+static struct sk_buff *
+__pfq_slot_skb(const void *buf,
+	       size_t len,
+	       struct pfq_dev_queue *dev_queue,
+	       struct pfq_xmit_context *ctx)
+{
+	size_t size = len + LL_RESERVED_SPACE(dev_queue->dev);
+	struct sk_buff *skb;
+
+	/* allocate a new socket buffer (from the OS if larger than the pool ones) */
+
+	skb = likely(size <= SKB_WITH_OVERHEAD(global->max_slot_size)) ?
+		pfq_alloc_skb_pool(size, GFP_KERNEL, ctx->node, 1, ctx->tx) :
+		alloc_skb(size, GFP_ATOMIC);
 
 	if (unlikely(skb == NULL)) {
 		if (printk_ratelimit())
 			printk(KERN_INFO "[PFQ] Tx could not allocate an skb!\n");
-		return (tx_response_t){.ok = 0, .fail = ctx->copies};
+		return NULL;
 	}
 
 	/* fill the socket buffer */
@@ -315,31 +379,444 @@ __pfq_slot_xmit(const void *buf,
 
 	skb_set_queue_mapping(skb, dev_queue->mapping);
 	skb_store_bits(skb, 0, buf, len);
+	return skb;
+}
 
-	/* transmit the packet + copies */
 
-	atomic_set(&skb->users, ctx->copies + 1);
+/*
+ * transmit a buff with copies
+ */
 
-	do { /* copies > 1 when the device support TX_SKB_SHARING */
+static tx_response_t
+__pfq_slot_xmit(const void *buf,
+		size_t len,
+		struct pfq_dev_queue *dev_queue,
+		struct pfq_xmit_context *ctx)
+{
+	struct sk_buff *skb;
+        tx_response_t rc;
 
-		const bool xmit_more_ = ctx->xmit_more || ctx->copies != 1;
+	if (unlikely(!dev_queue->dev))
+		return (tx_response_t){.ok = 0, .fail = ctx->copies};
 
-		if (__pfq_xmit(skb, dev_queue->dev, xmit_more_, global->tx_retry) == NETDEV_TX_OK)
-			rc.ok++;
-		else
-			rc.fail++;
+	skb = __pfq_slot_skb(buf, len, dev_queue, ctx);
+	if (unlikely(skb == NULL))
+		return (tx_response_t){.ok = 0, .fail = ctx->copies};
 
-		ctx->copies--;
-	}
-	while (ctx->copies > 0);
+	/* transmit the packet + copies */
+
+	rc = __pfq_skb_xmit_copies(skb, dev_queue, ctx);
 
 	/* release the packet */
 
 	pfq_free_skb_pool(skb, ctx->tx);
+	return rc;
+}
+
+
+/*
+ * GSO transmission: a slot holding a TCP frame up to Q_TX_GSO_MAX_LEN bytes
+ * becomes a single skb with the gso metadata, segmented by the device (TSO)
+ * or by software GSO. The TCP checksum is set by PFQ.
+ */
+
+static int
+__pfq_skb_set_gso(struct sk_buff *skb, unsigned int gso_size, int gso_type)
+{
+	const unsigned int hlen = skb_headlen(skb);
+	unsigned int nhoff = ETH_HLEN, thoff;
+	__be16 proto, inner;
+	struct tcphdr *th;
+
+	if (unlikely(gso_size == 0 || hlen < ETH_HLEN))
+		return -EINVAL;
+
+	proto = inner = ((struct ethhdr *)skb->data)->h_proto;
+
+	if (inner == htons(ETH_P_8021Q)) {
+		if (unlikely(hlen < VLAN_ETH_HLEN))
+			return -EINVAL;
+		inner = ((struct vlan_ethhdr *)skb->data)->h_vlan_encapsulated_proto;
+		nhoff = VLAN_ETH_HLEN;
+	}
+
+	switch(gso_type)
+	{
+	case Q_TX_GSO_TCPV4: {
+		struct iphdr *iph = (struct iphdr *)(skb->data + nhoff);
+
+		if (inner != htons(ETH_P_IP) || hlen < nhoff + sizeof(struct iphdr) ||
+		    iph->ihl < 5 || iph->protocol != IPPROTO_TCP)
+			return -EINVAL;
+
+		thoff = nhoff + iph->ihl * 4;
+		if (hlen < thoff + sizeof(struct tcphdr))
+			return -EINVAL;
+
+		th = (struct tcphdr *)(skb->data + thoff);
+		th->check = ~csum_tcpudp_magic(iph->saddr, iph->daddr, skb->len - thoff, IPPROTO_TCP, 0);
+		skb_shinfo(skb)->gso_type = SKB_GSO_TCPV4;
+	} break;
+	case Q_TX_GSO_TCPV6: {
+		struct ipv6hdr *ip6h = (struct ipv6hdr *)(skb->data + nhoff);
+
+		if (inner != htons(ETH_P_IPV6) || hlen < nhoff + sizeof(struct ipv6hdr) ||
+		    ip6h->nexthdr != IPPROTO_TCP)
+			return -EINVAL;
+
+		thoff = nhoff + sizeof(struct ipv6hdr);
+		if (hlen < thoff + sizeof(struct tcphdr))
+			return -EINVAL;
+
+		th = (struct tcphdr *)(skb->data + thoff);
+		th->check = ~csum_ipv6_magic(&ip6h->saddr, &ip6h->daddr, skb->len - thoff, IPPROTO_TCP, 0);
+		skb_shinfo(skb)->gso_type = SKB_GSO_TCPV6;
+	} break;
+	default:
+		return -EINVAL;
+	}
+
+	if (th->doff < 5 || hlen < thoff + th->doff * 4)
+		return -EINVAL;
+
+	skb->protocol = proto;
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, nhoff);
+	skb_set_transport_header(skb, thoff);
 
+	if (!skb_partial_csum_set(skb, thoff, offsetof(struct tcphdr, check)))
+		return -EINVAL;
+
+	/* the frame comes from user space: gso_segs is verified by the stack */
+
+	skb_shinfo(skb)->gso_type |= SKB_GSO_DODGY;
+	skb_shinfo(skb)->gso_size = gso_size;
+	skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(skb->len - thoff - th->doff * 4, gso_size);
+	return 0;
+}
+
+
+static tx_response_t
+__pfq_slot_xmit_gso(const void *buf,
+		    size_t len,
+		    unsigned int gso_size,
+		    int gso_type,
+		    struct pfq_dev_queue *dev_queue,
+		    struct pfq_xmit_context *ctx)
+{
+	size_t linear = min_t(size_t, len, Q_TX_GSO_LINEAR);
+	const int copies = ctx->copies;
+	const bool xmit_more = ctx->xmit_more;
+	netdev_features_t features;
+	struct sk_buff *skb, *segs;
+        tx_response_t rc = {0};
+	int err;
+
+	if (unlikely(!dev_queue->dev))
+		return (tx_response_t){.ok = 0, .fail = copies};
+
+	/* the headers in the linear area, the payload in page fragments */
+
+	skb = alloc_skb_with_frags(linear + LL_RESERVED_SPACE(dev_queue->dev), len - linear, 0, &err, GFP_ATOMIC);
+	if (unlikely(skb == NULL)) {
+		if (printk_ratelimit())
+			printk(KERN_INFO "[PFQ] Tx could not allocate a GSO skb (%d)!\n", err);
+		return (tx_response_t){.ok = 0, .fail = copies};
+	}
+
+	skb_reserve(skb, LL_RESERVED_SPACE(dev_queue->dev));
+	skb_put(skb, linear);
+	skb->data_len = len - linear;
+	skb->len += len - linear;
+
+	skb_store_bits(skb, 0, buf, len);
+
+	skb->dev = dev_queue->dev;
+	skb_set_queue_mapping(skb, dev_queue->mapping);
+
+	if (unlikely(__pfq_skb_set_gso(skb, gso_size, gso_type) < 0)) {
+		if (printk_ratelimit())
+			printk(KERN_INFO "[PFQ] Tx invalid GSO frame (len=%zu gso_size=%u gso_type=%d)!\n", len, gso_size, gso_type);
+		kfree_skb(skb);
+		return (tx_response_t){.ok = 0, .fail = copies};
+	}
+
+	/* TSO: the device segments the frame (as validate_xmit_skb does, the stack
+	 * only verifies the headers of a dodgy frame if the device takes it) */
+
+	features = netif_skb_features(skb);
+
+	segs = skb_gso_ok(skb, features) ? NULL : skb_gso_segment(skb, features);
+	if (unlikely(IS_ERR(segs))) {
+		kfree_skb(skb);
+		return (tx_response_t){.ok = 0, .fail = copies};
+	}
+
+	if (segs == NULL) {
+		rc = __pfq_skb_xmit_copies(skb, dev_queue, ctx);
+		consume_skb(skb);
+		return rc;
+	}
+
+	/* software GSO: transmit the segments */
+
+	consume_skb(skb);
+
+	while (segs)
+	{
+		struct sk_buff *next = segs->next;
+		tx_response_t tmp;
+
+		segs->next = NULL;
+
+		ctx->copies = copies;
+		ctx->xmit_more = next ? true : xmit_more;
+
+		tmp = __pfq_skb_xmit_copies(segs, dev_queue, ctx);
+		rc.value += tmp.value;
+
+		consume_skb(segs);
+		segs = next;
+	}
+
+	ctx->xmit_more = xmit_more;
+	return rc;
+}
+
+
+/*
+ * zero-copy transmission: the payload of the slot is attached to the skb
+ * as page fragments; the slot stays owned by the kernel (inflight counter
+ * of its buffer, pinned by the skb) until the driver frees the skb.
+ */
+
+struct pfq_zc_ubuf
+{
+	struct ubuf_info	info;
+	struct pfq_tx_inflight	*inflight;
+	int			queue;
+	int			buffer;
+};
+
+
+static void
+pfq_zc_callback(struct ubuf_info *ubuf, bool zerocopy_success)
+{
+	struct pfq_zc_ubuf *zc = container_of(ubuf, struct pfq_zc_ubuf, info);
+
+	pfq_tx_inflight_add(zc->inflight, zc->queue, zc->buffer, -1);
+	pfq_tx_inflight_put(zc->inflight);
+	kfree(zc);
+}
+
+
+static tx_response_t
+__pfq_slot_xmit_zerocopy(struct pfq_sock *so,
+			 const void *buf,
+			 size_t len,
+			 struct pfq_tx_inflight *inflight,
+			 int sock_queue,
+			 int buffer,
+			 struct pfq_dev_queue *dev_queue,
+			 struct pfq_xmit_context *ctx)
+{
+	size_t linear = min_t(size_t, len, Q_TX_ZEROCOPY_LINEAR), off;
+	struct pfq_zc_ubuf *zc;
+	struct sk_buff *skb;
+        tx_response_t rc;
+	int nr_frags = 0;
+
+	if (unlikely(!dev_queue->dev))
+		return (tx_response_t){.ok = 0, .fail = ctx->copies};
+
+	/* the frames that do not fit MAX_SKB_FRAGS pages are copied */
+
+	if (unlikely(DIV_ROUND_UP(offset_in_page(buf + linear) + len - linear, PAGE_SIZE) > MAX_SKB_FRAGS))
+		return __pfq_slot_xmit(buf, len, dev_queue, ctx);
+
+	skb = alloc_skb(linear + LL_RESERVED_SPACE(dev_queue->dev), GFP_ATOMIC);
+	zc = kmalloc(sizeof(*zc), GFP_ATOMIC);
+
+	if (unlikely(skb == NULL || zc == NULL)) {
+		if (printk_ratelimit())
+			printk(KERN_INFO "[PFQ] Tx could not allocate a zero-copy skb!\n");
+		kfree_skb(skb);
+		kfree(zc);
+		return (tx_response_t){.ok = 0, .fail = ctx->copies};
+	}
+
+	/* the headers in the linear area, the payload in the slot pages */
+
+	skb_reserve(skb, LL_RESERVED_SPACE(dev_queue->dev));
+	skb->dev = dev_queue->dev;
+
+	skb_put(skb, linear);
+	skb_copy_to_linear_data(skb, buf, linear);
+
+	for(off = linear; off < len; nr_frags++)
+	{
+		const void *addr = buf + off;
+		size_t chunk = min_t(size_t, len - off, PAGE_SIZE - offset_in_page(addr));
+		struct page *page = is_vmalloc_addr(addr) ? vmalloc_to_page(addr) : virt_to_page(addr); /* 1G HugePages: direct map */
+
+		get_page(page);
+		skb_fill_page_desc(skb, nr_frags, page, offset_in_page(addr), chunk);
+		off += chunk;
+	}
+
+	skb->len      += len - linear;
+	skb->data_len += len - linear;
+	skb->truesize += len - linear;
+
+	/* completion: the driver frees the skb */
+
+	zc->info.callback = pfq_zc_callback;
+	zc->info.ctx = NULL;
+	zc->info.desc = 0;
+	zc->inflight = inflight;
+	zc->queue = sock_queue;
+	zc->buffer = buffer;
+
+	skb_shinfo(skb)->destructor_arg = &zc->info;
+	skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY;
+
+	pfq_tx_inflight_get(inflight);
+	pfq_tx_inflight_add(inflight, sock_queue, buffer, 1);
+
+	/* transmit the packet + copies */
+
+	skb_set_queue_mapping(skb, dev_queue->mapping);
+
+	rc = __pfq_skb_xmit_copies(skb, dev_queue, ctx);
 	if (rc.ok)
-	     dev_queue->queue->trans_start = ctx->jiffies;
+		sparse_add(so->pacing_stats, zerocopy, rc.ok);
 
+	consume_skb(skb);
+	return rc;
+}
+
+
+/*
+ * replay the records of a trace (Tx thread), up to Q_TX_REPLAY_BUDGET per
+ * pass: with a rate the original gaps are scaled and paced as departure
+ * times; each loop is started from the time it is reached.
+ */
+
+static tx_response_t
+pfq_sk_replay_xmit(struct pfq_sock *so, int cpu, struct pfq_skb_pool *tx_pool, uint64_t *departure)
+{
+	struct pfq_replay *replay = so->replay;
+	struct pfq_dev_queue dev_queue = {.dev = NULL, .queue = NULL, .mapping = 0};
+	struct pfq_xmit_context ctx;
+	tx_response_t rc = {0};
+	s64 spun = 0;
+	int n;
+
+	if (unlikely(replay == NULL || replay->done))
+		return rc;
+
+	local_bh_disable();
+
+	ctx.tx	    = tx_pool ? tx_pool : &this_cpu_ptr(global->percpu_pool)->tx;
+	ctx.net	    = sock_net(&so->sk);
+	ctx.now	    = ktime_get_real();
+	ctx.jiffies = jiffies;
+	ctx.node    = cpu_to_node(cpu);
+
+	if (pfq_dev_queue_get(ctx.net, replay->opt.ifindex, replay->opt.queue, &dev_queue) < 0) {
+		local_bh_enable();
+
+		if (printk_ratelimit())
+			printk(KERN_INFO "[PFQ|%d] Tx replay: could not lock the dev_queue!\n", so->id);
+		return rc;
+	}
+
+	HARD_TX_LOCK(dev_queue.dev, dev_queue.queue, cpu);
+
+	for(n = 0; n < Q_TX_REPLAY_BUDGET; n++)
+	{
+		struct pfq_replay_pkthdr *hdr;
+		tx_response_t tmp = { .ok = 0, .fail = 1 };
+		size_t next, caplen;
+
+		if (replay->off >= replay->opt.size) {
+			replay->off = 0;
+			replay->loop_start = 0;
+			if (replay->opt.loops && replay->loop + 1 >= replay->opt.loops) {
+				replay->done = true;
+				break;
+			}
+			replay->loop++;
+		}
+
+		/* the records stay in the user pages: the caplen checked by
+		 * pfq_replay_check can be changed since, read it once and check it again */
+
+		hdr    = (struct pfq_replay_pkthdr *)(replay->pages.addr + replay->off);
+		caplen = READ_ONCE(hdr->caplen);
+
+		if (unlikely(replay->opt.size - replay->off < sizeof(*hdr) ||
+			     caplen == 0 || caplen > Q_REPLAY_MAX_CAPLEN ||
+			     Q_REPLAY_RECORD_LEN(caplen) > replay->opt.size - replay->off)) {
+			if (printk_ratelimit())
+				printk(KERN_INFO "[PFQ|%d] Tx replay: bad record (offset %zu), stopped!\n", so->id, replay->off);
+			replay->done = true;
+			break;
+		}
+
+		next = replay->off + Q_REPLAY_RECORD_LEN(caplen);
+
+		if (replay->opt.rate) {
+
+			uint64_t now = (uint64_t)ktime_to_ns(ktime_get_real()), due;
+			s64 gap;
+
+			if (!replay->loop_start) {
+				replay->loop_start = now;
+				replay->first_tstamp = hdr->tstamp;
+			}
+
+			due = replay->loop_start + div_u64((hdr->tstamp - replay->first_tstamp) * 1000, replay->opt.rate);
+			gap = (s64)(due - now);
+
+			if (gap > Q_TX_PACING_SPIN || (gap > 0 && spun + gap > Q_TX_PACING_SPIN_BATCH)) {
+				*departure = due;
+				break;
+			}
+
+			if (gap > 0) {
+				pfq_tx_spin(gap);
+				spun += gap;
+			}
+		}
+
+		/* xmit_more only within a burst of this pass */
+
+		ctx.copies = 1;
+		ctx.xmit_more = !replay->opt.rate && next < replay->opt.size &&
+				n + 1 < Q_TX_REPLAY_BUDGET && (n + 1) % global->xmit_batch_len;
+
+		if (likely(netif_running(dev_queue.dev) && netif_carrier_ok(dev_queue.dev))) {
+
+			struct sk_buff *skb = __pfq_slot_skb(hdr+1, caplen, &dev_queue, &ctx);
+			if (likely(skb)) {
+				pfq_replay_rewrite(replay, skb);
+				tmp = __pfq_skb_xmit_copies(skb, &dev_queue, &ctx);
+				pfq_free_skb_pool(skb, ctx.tx);
+			}
+		}
+
+		rc.value += tmp.value;
+		replay->off = next;
+	}
+
+	HARD_TX_UNLOCK(dev_queue.dev, dev_queue.queue);
+	local_bh_enable();
+
+	pfq_dev_queue_put(&dev_queue);
+
+	replay->sent += rc.ok;
+	replay->fail += rc.fail;
 	return rc;
 }
 
@@ -351,49 +828,74 @@ __pfq_slot_xmit(const void *buf,
 tx_response_t
 pfq_sk_queue_xmit( struct pfq_sock *so
 		 , int sock_queue
-		 , int cpu)
+		 , int cpu
+		 , struct pfq_skb_pool *tx_pool
+		 , uint64_t *departure)
 {
-	struct pfq_queue_info const * txinfo = pfq_sock_get_tx_queue_info(so, sock_queue);
+	struct pfq_queue_info const * txinfo;
 	struct pfq_dev_queue dev_queue = {.dev = NULL, .queue = NULL, .mapping = 0};
 	struct pfq_xmit_context ctx;
-	struct pfq_percpu_pool *pool;
+	struct pfq_tx_shaper *shaper;
 	int batch_cntr = 0, cons_idx;
+	bool blocked = false, shaped;
+	s64 spun = 0;
 	struct pfq_shared_tx_queue *tx_queue;
+	struct pfq_queue_layout *ql;
 	struct pfq_pkthdr *hdr;
 	ptrdiff_t prod_off;
+	size_t slot_size;
         char *begin, *end;
         void *tx_queue_mem;
         tx_response_t rc = {0};
 
-	/* get the Tx queue descriptor */
+	*departure = 0;
 
-	tx_queue = pfq_sock_tx_shared_queue(so, sock_queue);
-	if (unlikely(tx_queue == NULL))
-		return rc; /* socket not enabled... */
+	/* a trace replayed by the Tx thread */
+
+	if (sock_queue == Q_TX_QUEUE_REPLAY)
+		return pfq_sk_replay_xmit(so, cpu, tx_pool, departure);
 
-	tx_queue_mem = pfq_sock_tx_queue_mem(so,sock_queue);
-	BUG_ON(tx_queue_mem == NULL);
+	/* the other end of this queue is a socket: no skb, no device */
 
+	txinfo = pfq_sock_get_tx_queue_info(so, sock_queue);
 
-	/* enable skb_pool for Tx threads */
+	{
+		int pipe = READ_ONCE(txinfo->pipe);
+		if (pipe != -1)
+			return pfq_sk_queue_pipe(so, sock_queue, pipe);
+	}
+
+	/* get the Tx queue descriptor (and the layout kept by the kernel) */
+
+	ql = pfq_sock_queue_layout(so);
+	if (unlikely(ql == NULL))
+		return rc; /* socket not enabled... */
 
-	pool = this_cpu_ptr(global->percpu_pool);
-	ctx.tx = &pool->tx;
+	tx_queue = pfq_shared_tx_queue(ql->addr, sock_queue);
+	tx_queue_mem = pfq_shared_tx_queue_mem(ql, sock_queue);
+	slot_size = ql->tx_slot_size;
 
-	/* lock the Tx pool */
+	/* token buckets (xmit_more is not used on shaped queues, the batch can stop at any packet) */
+
+	shaper = pfq_sock_tx_shaper(so, sock_queue);
+	shaped = shaper->rate || so->tx_shaper_sock.rate;
+
+	/* skb pool: the one of the Tx thread, or the per-cpu one for sync
+	 * transmissions (owned by this cpu while the bottom half is disabled) */
 
-	spin_lock(&pool->tx_lock);
 	local_bh_disable();
 
+	ctx.tx = tx_pool ? tx_pool : &this_cpu_ptr(global->percpu_pool)->tx;
+
 	if (cpu == Q_NO_KTHREAD) {
 		cpu = smp_processor_id();
 	}
 
 	/* initialize the boundaries of this queue */
 
-	prod_off = maybe_swap_sk_tx_queue(tx_queue, &cons_idx);
-	begin    = tx_queue_mem + (cons_idx & 1) * tx_queue->size + tx_queue->cons.off;
-	end      = tx_queue_mem + (cons_idx & 1) * tx_queue->size + prod_off;
+	prod_off = pfq_tx_buffer_off(ql, maybe_swap_sk_tx_queue(tx_queue, &cons_idx), false);
+	begin    = tx_queue_mem + (cons_idx & 1) * ql->tx_size + pfq_tx_buffer_off(ql, tx_queue->cons.off, true);
+	end      = tx_queue_mem + (cons_idx & 1) * ql->tx_size + prod_off;
 
         /* setup the context */
 
@@ -406,7 +908,6 @@ pfq_sk_queue_xmit( struct pfq_sock *so
 
 	if (pfq_dev_queue_get(ctx.net, txinfo->ifindex, txinfo->queue, &dev_queue) < 0) {
 		local_bh_enable();
-		spin_unlock(&pool->tx_lock);
 
 		if (printk_ratelimit())
 			printk(KERN_INFO "[PFQ] sk_queue_xmit: could not lock the dev_queue!\n");
@@ -423,26 +924,55 @@ pfq_sk_queue_xmit( struct pfq_sock *so
 
 	HARD_TX_LOCK(dev_queue.dev, dev_queue.queue, cpu);
 
-	for_each_sk_slot(hdr, end, so->tx_slot_size)
+	for_each_sk_slot(hdr, end, slot_size)
 	{
 		struct pfq_pkthdr *next;
                 tx_response_t tmp = {0};
 
-		next = PFQ_SHARED_QUEUE_NEXT_PKTHDR(hdr, so->tx_slot_size);
+		next = PFQ_SHARED_QUEUE_NEXT_PKTHDR(hdr, slot_size);
 		prefetch_r3(next);
 		prefetch_r3((char *)next+64);
 
 		/* because of dynamic slot size, ensure the caplen is not set to 0 */
 
-		if (unlikely(!hdr->caplen)) {
-			if (printk_ratelimit()) {
-				printk(KERN_INFO "[PFQ] sk_queue_xmit: zero caplen! len:%u queue:%u commit:%u copies:%u\n"
-						      , hdr->len
-						      , hdr->info.queue
-						      , hdr->info.commit
-						      , hdr->info.data.copies);
+		if (unlikely(!hdr->caplen)) {
+			if (printk_ratelimit()) {
+				printk(KERN_INFO "[PFQ] sk_queue_xmit: zero caplen! len:%u queue:%u commit:%u copies:%u\n"
+						      , hdr->len
+						      , hdr->info.queue
+						      , hdr->info.commit
+						      , hdr->info.data.copies);
+			}
+
+			break;
+		}
+
+		/* departure time: wait for short gaps, stop the batch for long ones */
+
+		if (hdr->tstamp.tv64) {
+
+			s64 gap = (s64)(hdr->tstamp.tv64 - (uint64_t)ktime_to_ns(ktime_get_real()));
+
+			if (gap > Q_TX_PACING_SPIN || (gap > 0 && spun + gap > Q_TX_PACING_SPIN_BATCH)) {
+				*departure = hdr->tstamp.tv64;
+				break;
+			}
+
+			if (gap > 0) {
+				pfq_tx_spin(gap);
+				spun += gap;
 			}
 
+			sparse_inc(so->pacing_stats, deferred);
+			sparse_inc(so->pacing_stats, late[pfq_tx_pacing_bucket((s64)((uint64_t)ktime_to_ns(ktime_get_real()) - hdr->tstamp.tv64))]);
+		}
+
+		/* lossless: stop at the first slot the device cannot take */
+
+		if (so->tx_lossless &&
+		    (!netif_running(dev_queue.dev) || !netif_carrier_ok(dev_queue.dev) ||
+		     netif_xmit_frozen_or_drv_stopped(dev_queue.queue))) {
+			blocked = true;
 			break;
 		}
 
@@ -451,10 +981,56 @@ pfq_sk_queue_xmit( struct pfq_sock *so
                 ctx.copies = dev_tx_max_skb_copies(dev_queue.dev, hdr->info.data.copies);
 		batch_cntr += ctx.copies;
 
-                /* set the xmit_more bit */
+		/* shaping: hold the queue until the buckets have the tokens, or drop the packet */
+
+		if (shaped) {
+
+			uint64_t now = (uint64_t)ktime_to_ns(ktime_get_real());
+			uint64_t wait_q = 0, wait_s = 0, cost_q = 0, cost_s = 0;
+			bool drop;
+
+			spin_lock(&so->tx_shaper_lock);
+
+			if (shaper->rate) {
+				cost_q = pfq_tx_shaper_cost(shaper, hdr->caplen, ctx.copies);
+				wait_q = pfq_tx_shaper_wait(shaper, cost_q, now);
+			}
+
+			if (so->tx_shaper_sock.rate) {
+				cost_s = pfq_tx_shaper_cost(&so->tx_shaper_sock, hdr->caplen, ctx.copies);
+				wait_s = pfq_tx_shaper_wait(&so->tx_shaper_sock, cost_s, now);
+			}
+
+			if (!wait_q && !wait_s) {
+				pfq_tx_shaper_take(shaper, cost_q);
+				pfq_tx_shaper_take(&so->tx_shaper_sock, cost_s);
+			}
+
+			drop = (wait_q && shaper->drop) || (wait_s && so->tx_shaper_sock.drop);
+
+			spin_unlock(&so->tx_shaper_lock);
+
+			if (drop) {
+				sparse_inc(so->pacing_stats, shaped);
+				sparse_inc(so->stats, disc);
+				sparse_inc(global->percpu_stats, disc);
+				continue;
+			}
+
+			if (wait_q || wait_s) {
+				sparse_inc(so->pacing_stats, held);
+				*departure = now + max(wait_q, wait_s);
+				break;
+			}
+		}
+
+                /* set the xmit_more bit (not before a packet to be sent later) */
 
 		ctx.xmit_more = batch_cntr < global->xmit_batch_len ?
-				PFQ_SHARED_QUEUE_NEXT_PKTHDR(hdr, so->tx_slot_size) < (struct pfq_pkthdr *)end : (batch_cntr = 0, false);
+				PFQ_SHARED_QUEUE_NEXT_PKTHDR(hdr, slot_size) < (struct pfq_pkthdr *)end : (batch_cntr = 0, false);
+
+		if (ctx.xmit_more && (shaped || next->tstamp.tv64 > (uint64_t)ktime_to_ns(ctx.now)))
+			ctx.xmit_more = false;
 
 		/* transmit this packet */
 
@@ -462,9 +1038,27 @@ pfq_sk_queue_xmit( struct pfq_sock *so
 
 			size_t len = min_t( size_t
 					  , hdr->caplen
-					  , so->tx_slot_size - sizeof(struct pfq_pkthdr) - LL_RESERVED_SPACE(dev_queue.dev));
+					  , slot_size - sizeof(struct pfq_pkthdr) - LL_RESERVED_SPACE(dev_queue.dev));
+
+			/* GSO: the frame is not cut to the link-layer reserved space */
+
+			if (hdr->info.data.gso_size)
+				tmp = __pfq_slot_xmit_gso( hdr+1
+							 , min_t(size_t, hdr->caplen, slot_size - sizeof(struct pfq_pkthdr))
+							 , hdr->info.data.gso_size
+							 , hdr->info.data.gso_type
+							 , &dev_queue, &ctx);
+			else if (so->tx_zerocopy && len > Q_TX_ZEROCOPY_LINEAR)
+				tmp = __pfq_slot_xmit_zerocopy(so, hdr+1, len, ql->tx_inflight, sock_queue, cons_idx, &dev_queue, &ctx);
+			else
+				tmp = __pfq_slot_xmit(hdr+1, len, &dev_queue, &ctx);
 
-			tmp = __pfq_slot_xmit(hdr+1, len, &dev_queue, &ctx);
+			/* lossless: a slot not taken by the driver is kept in the queue */
+
+			if (so->tx_lossless && tmp.ok == 0) {
+				blocked = true;
+				break;
+			}
 
 			rc.value += tmp.value;
 		}
@@ -476,15 +1070,32 @@ pfq_sk_queue_xmit( struct pfq_sock *so
 	local_bh_enable();
 
 	pfq_dev_queue_put(&dev_queue);
-	spin_unlock(&pool->tx_lock);
 
-	/* update the local consumer offset */
+	/* update the local consumer offset: the packets to be sent later stay in the queue
+	 * (lossless: until the device queue is woken up, retried by the Tx thread) */
+
+	if (blocked)
+		*departure = (uint64_t)ktime_to_ns(ktime_get_real()) + Q_TX_LOSSLESS_RETRY;
+
+	if (*departure) {
+		tx_queue->cons.off = (char *)hdr - (char *)(tx_queue_mem + (cons_idx & 1) * ql->tx_size);
+		return rc;
+	}
 
 	tx_queue->cons.off = prod_off;
 
+	/* release the drained buffer to a producer waiting in poll (POLLOUT) */
+
+	{
+		int idx = cons_idx;
+		maybe_swap_sk_tx_queue(tx_queue, &idx);
+		if (idx != cons_idx && waitqueue_active(&so->waitqueue))
+			wake_up_interruptible(&so->waitqueue);
+	}
+
 	/* count the packets left in the shared queue */
 
-	for_each_sk_slot(hdr, end, so->tx_slot_size) {
+	for_each_sk_slot(hdr, end, slot_size) {
 		/* dynamic slot size: ensure the caplen is not zero! */
 		if (unlikely(!hdr->caplen))
 			break;
@@ -575,73 +1186,76 @@ pfq_qbuff_lazy_xmit(struct qbuff * buff, struct net_device *dev, int queue)
 }
 
 
+/*
+ * transmit the lazy forwarded buffs: one list (mask of the batch) per
+ * device/queue, sent with xmit_more under a single HARD_TX_LOCK. Devices
+ * that support TX_SKB_SHARING take the skb itself, with the references of
+ * all its copies taken at once; the others get a clone per copy.
+ */
+
 int
 pfq_qbuff_lazy_xmit_run(struct pfq_qbuff_queue *buffs, struct pfq_endpoint_info const *endpoints)
 {
-	struct netdev_queue *txq;
-	struct net_device *dev;
         size_t sent = 0;
 	size_t n, i;
-	int queue = -1;
 
-	/* for each net_device... */
+	/* for each net_device/queue... */
 
 	for(n = 0; n < endpoints->num; n++)
 	{
-		size_t sent_dev = 0;
-		dev = endpoints->dev[n];
+		struct net_device *dev = endpoints->dev[n];
+		unsigned __int128 mask = endpoints->mask[n];
+		const bool shared = dev->priv_flags & IFF_TX_SKB_SHARING;
+		struct netdev_queue *txq;
+		size_t left = endpoints->cnt[n];
+		int queue = endpoints->queue[n];
+		struct qbuff *buff;
 
-		txq = NULL;
-                queue = -1;
+		/* the queue of the list (the driver selects it for any-queue) */
 
-		/* scan the list of buffs, and forward them in batch fashion */
+		txq = pfq_netdev_pick_tx(dev, QBUFF_SKB(&buffs->queue[pfq_ctz(mask)]), &queue);
 
-		for(i = 0; i < buffs->len; i++)
-		{
-                        size_t j, num;
+		local_bh_disable();
+		HARD_TX_LOCK(dev, txq, smp_processor_id());
 
-			struct qbuff * buff = &buffs->queue[i];
+		for_each_qbuff_with_mask(mask, buffs, buff, i)
+		{
 			struct sk_buff *skb = QBUFF_SKB(buff);
+			size_t j, num;
 
 			num = pfq_count_fwd_devs(dev, buff->fwd_dev, buff->fwd_dev_num);
-			if (num == 0)
-				continue;
-
-			if (queue != skb->queue_mapping) {
-
-				queue = skb->queue_mapping;
 
-				if (txq) {
-					HARD_TX_UNLOCK(dev, txq);
-					local_bh_enable();
-                                }
+			skb_set_queue_mapping(skb, queue);
 
-				txq = pfq_netdev_pick_tx(dev, skb, &queue);
-
-				local_bh_disable();
-				HARD_TX_LOCK(dev, txq, smp_processor_id());
-			}
+			if (shared)
+				atomic_add(num, &skb->users);
 
 			/* forward this skb `num` times (to this device) */
 
 			for (j = 0; j < num; j++)
 			{
-				const int xmit_more = ++sent_dev != endpoints->cnt[n];
-				struct sk_buff *nskb = skb_clone_for_tx(skb, dev, GFP_ATOMIC);
+				struct sk_buff *nskb;
+				const int xmit_more = --left != 0;
+
+				/* the rest of the list is discarded */
+
+				if (unlikely(netif_xmit_frozen_or_drv_stopped(txq))) {
+					if (shared)
+						atomic_sub(num - j, &skb->users);
+					goto next_dev;
+				}
+
+				nskb = shared ? skb : skb_clone(skb, GFP_ATOMIC);
 				if (likely(nskb))
 				{
 					if (__pfq_xmit(nskb, dev, xmit_more, global->tx_retry) == NETDEV_TX_OK)
 						sent++;
-					else
-						sparse_inc(global->percpu_stats, disc);
 				}
 			}
 		}
-
-		if (txq) {
-			HARD_TX_UNLOCK(dev, txq);
-			local_bh_enable();
-		}
+	next_dev:
+		HARD_TX_UNLOCK(dev, txq);
+		local_bh_enable();
 	}
 
 	return sent;
@@ -702,6 +1316,198 @@ unsigned int pfq_fold(unsigned int a, unsigned int b)
 }
 
 
+/*
+ * Results of BPF filters and pure pfq-lang computations evaluated for the
+ * current packet, looked up by fingerprint: groups running an identical
+ * program reuse them instead of evaluating it again.
+ */
+
+struct pfq_shared_results
+{
+	size_t bpf_len;
+	size_t comp_len;
+
+	struct {
+		uint64_t fingerprint;
+		bool	 pass;
+	} bpf[Q_SHARED_RESULTS];
+
+	struct {
+		uint64_t fingerprint;
+		bool	 pass;
+		struct pfq_lang_monad monad;
+	} comp[Q_SHARED_RESULTS];
+};
+
+
+static inline
+bool pfq_run_bp_filter_shared(struct qbuff *buff, struct pfq_group *group, struct pfq_shared_results *sr)
+{
+	uint64_t fp = (uint64_t)atomic_long_read(&group->bp_fingerprint);
+	bool pass;
+	size_t n;
+
+	if (fp) {
+		for(n = 0; n < sr->bpf_len; n++)
+		{
+			if (sr->bpf[n].fingerprint == fp)
+				return sr->bpf[n].pass;
+		}
+	}
+
+	smp_rmb();
+
+	pass = qbuff_run_bp_filter(buff, group);
+
+	/* share the result only if the filter was not replaced meanwhile */
+
+	smp_rmb();
+
+	if (fp && sr->bpf_len < Q_SHARED_RESULTS &&
+	    fp == (uint64_t)atomic_long_read(&group->bp_fingerprint)) {
+		sr->bpf[sr->bpf_len].fingerprint = fp;
+		sr->bpf[sr->bpf_len].pass = pass;
+		sr->bpf_len++;
+	}
+
+	return pass;
+}
+
+
+static inline
+bool pfq_lang_run_shared(struct qbuff *buff, struct pfq_lang_computation_tree *prg, struct pfq_shared_results *sr)
+{
+	struct pfq_lang_monad *monad = buff->monad;
+	uint64_t fp = prg->fingerprint;
+	bool pass;
+	size_t n;
+
+	if (fp) {
+		for(n = 0; n < sr->comp_len; n++)
+		{
+			if (sr->comp[n].fingerprint == fp) {
+				struct pfq_group *group = monad->group;
+				*monad = sr->comp[n].monad;
+				monad->group = group;
+				return sr->comp[n].pass;
+			}
+		}
+	}
+
+	pass = pfq_lang_run(buff, prg).qbuff != NULL;
+
+	if (!fp) {
+		/* side effects (e.g. mark) may have changed the packet: forget shared results */
+		sr->bpf_len = 0;
+		sr->comp_len = 0;
+	}
+	else if (sr->comp_len < Q_SHARED_RESULTS) {
+		sr->comp[sr->comp_len].fingerprint = fp;
+		sr->comp[sr->comp_len].pass = pass;
+		sr->comp[sr->comp_len].monad = *monad;
+		sr->comp_len++;
+	}
+
+	return pass;
+}
+
+
+/*
+ * Steering indirection table: the bucket of the hash selects the socket,
+ * as long as it is still eligible for the packet.
+ */
+
+static inline
+unsigned long pfq_steer_reta(struct pfq_group_reta const *reta, uint32_t hash, unsigned long elig_mask, unsigned long sbit)
+{
+	unsigned long bit = 1UL << reta->id[prefold(hash) & (reta->size - 1)];
+	return (elig_mask & bit) ? bit : sbit;
+}
+
+/*
+ * Load-aware steering: Rx queue occupancy of a socket (%)
+ */
+
+static inline
+unsigned int pfq_steer_load(unsigned long sbit)
+{
+	struct pfq_sock * so = pfq_sock_get_by_id((__force pfq_id_t)pfq_ctz(sbit));
+	if (unlikely(!so || !so->rx_queue_len))
+		return 0;
+	return (unsigned int)(pfq_mpsc_queue_len(so) * 100 / so->rx_queue_len);
+}
+
+/*
+ * Load-aware steering: flows already in the per-cpu flow table stick to
+ * their socket; a new flow whose hashed socket is above the group threshold
+ * is moved to the least loaded eligible socket.
+ *
+ * An entry of the table is taken by a flow until it is idle for
+ * Q_STEER_FLOW_TIMEOUT: a new flow colliding with a live one does not evict
+ * it (the evicted flow would be handled as new, and moved) but is steered by
+ * the hash alone, untracked.
+ */
+
+static inline
+unsigned long pfq_steer_dynamic( struct pfq_percpu_data *data
+			       , struct pfq_group *group
+			       , pfq_gid_t gid
+			       , uint32_t hash
+			       , unsigned long elig_mask
+			       , unsigned long sbit
+			       , int cpu)
+{
+	struct pfq_steer_flow *flow = &data->flow_table[hash_32(hash ^ (__force uint32_t)gid, Q_STEER_FLOW_BITS)];
+	unsigned long now = jiffies, bit, best;
+	unsigned int load, min;
+
+	if (flow->stamp && time_before(now, flow->stamp + Q_STEER_FLOW_TIMEOUT)) {
+
+		if (flow->hash != hash || flow->gid != (__force int)gid) {
+			__sparse_inc(group->steer_stats, untracked, cpu);
+			return sbit;
+		}
+
+		if (elig_mask & (1UL << flow->id)) {
+			flow->stamp = now;
+			return 1UL << flow->id;
+		}
+	}
+
+	__sparse_inc(group->steer_stats, flows, cpu);
+
+	load = pfq_steer_load(sbit);
+	if (load > group->steer_threshold) {
+
+		best = sbit;
+		min  = load;
+
+		pfq_bitwise_foreach(elig_mask, bit,
+		{
+			unsigned int l = pfq_steer_load(bit);
+			if (l < min) {
+				min  = l;
+				best = bit;
+			}
+		});
+
+		if (best != sbit) {
+			__sparse_inc(group->steer_stats, moves, cpu);
+			sbit = best;
+		}
+		else {
+			__sparse_inc(group->steer_stats, stuck, cpu);
+		}
+	}
+
+	flow->stamp = now;
+	flow->hash  = hash;
+	flow->gid   = (int16_t)(__force int)gid;
+	flow->id    = (int16_t)pfq_ctz(sbit);
+	return sbit;
+}
+
+
 int
 pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 {
@@ -728,17 +1534,19 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 
 	if (likely(skb)) /* ensure this is not the timer heartbeat */
 	{
+		struct pfq_shared_results shared;
 		struct pfq_lang_monad monad;
 		unsigned long group_mask;
 		struct qbuff *buff;
 		ktime_t current_rx;
 
 		/* if required, timestamp the packet now */
-		if (ktime_to_ns(skb->tstamp) == 0)
+		if (static_key_false(&pfq_key_tstamp) && ktime_to_ns(skb->tstamp) == 0)
 			__net_timestamp(skb);
 
 		/* if vlan header is present, remove it */
-		if (global->vlan_untag && skb->protocol == cpu_to_be16(ETH_P_8021Q)) {
+		if (static_key_false(&pfq_key_vlan_untag) &&
+		    skb->protocol == cpu_to_be16(ETH_P_8021Q)) {
 			skb = pfq_vlan_untag(skb);
 			if (unlikely(!skb)) {
 				__sparse_inc(global->percpu_stats, lost, cpu);
@@ -761,6 +1569,9 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 			  , &monad
 			  , data->counter++);
 
+		shared.bpf_len = 0;
+		shared.comp_len = 0;
+
 		/* get the eligible groups */
 
 		group_mask = pfq_devmap_get_groups( qbuff_get_ifindex(buff)
@@ -774,6 +1585,7 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 			pfq_gid_t gid = (__force pfq_gid_t)pfq_ctz(bit);
 			struct pfq_group * this_group = pfq_group_get(gid);
 			struct pfq_lang_computation_tree *prg;
+			struct pfq_flow_export *fe;
 
 			if (unlikely(!this_group))
 				continue;
@@ -784,8 +1596,9 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 
 			/* check if bp filter is enabled */
 
-			if (atomic_long_read(&this_group->bp_filter)) {
-				if (!qbuff_run_bp_filter(buff, this_group)) {
+			if (static_key_false(&pfq_key_bp_filter) &&
+			    atomic_long_read(&this_group->bp_filter)) {
+				if (!pfq_run_bp_filter_shared(buff, this_group, &shared)) {
 					__sparse_inc(this_group->stats, drop, cpu);
 					continue;
 				}
@@ -793,7 +1606,8 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 
 			/* check vlan filter */
 
-			if (pfq_group_vlan_filters_enabled(gid)) {
+			if (static_key_false(&pfq_key_vlan_filter) &&
+			    pfq_group_vlan_filters_enabled(gid)) {
 				if (!qbuff_run_vlan_filter(buff, (pfq_gid_t)gid)) {
 					__sparse_inc(this_group->stats, drop, cpu);
 					continue;
@@ -802,7 +1616,8 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 
 			/* process pfq-lang */
 
-			prg = (struct pfq_lang_computation_tree *)atomic_long_read(&this_group->comp);
+			prg = static_key_false(&pfq_key_computation) ?
+				(struct pfq_lang_computation_tree *)atomic_long_read(&this_group->comp) : NULL;
 			if (prg) {
 				unsigned long cbit, elig_mask = 0;
 				size_t to_kernel = buff->to_kernel;
@@ -819,9 +1634,9 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 			 	monad.ipproto = IPPROTO_NONE;
 			 	monad.ep_ctx = EPOINT_SRC | EPOINT_DST;
 
-			 	/* run the functional program */
+			 	/* run the functional program (or reuse the result of an identical one) */
 
-			 	if (!pfq_lang_run(buff, prg).qbuff) {
+			 	if (!pfq_lang_run_shared(buff, prg, &shared)) {
 			 		__sparse_inc(this_group->stats, drop, cpu);
 			 		continue;
 			 	}
@@ -838,6 +1653,15 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 			 		continue;
 			 	}
 
+				/* flow-record export mode: account the packet, do not deliver it */
+
+				fe = static_key_false(&pfq_key_flow_export) ?
+					(struct pfq_flow_export *)atomic_long_read(&this_group->flow_export) : NULL;
+				if (fe) {
+					pfq_flow_account(this_group, fe, buff, cpu);
+					continue;
+				}
+
 			 	/* compute the eligible mask of sockets enabled to receive this packet... */
 
 			 	pfq_bitwise_foreach(monad.fanout.class_mask, cbit,
@@ -846,10 +1670,14 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 			 		elig_mask |= (unsigned long)atomic_long_read(&this_group->sock_id[class]);
 			 	});
 
+				buff->class_mask |= monad.fanout.class_mask;
+
 
 			 	if (is_steering(monad.fanout)) { /* single or double */
 
 			 		unsigned long steer_mask[Q_MAX_STEERING_MASK];
+			 		struct pfq_group_reta *reta;
+			 		unsigned long target;
 			 		unsigned int sbit, steer_mask_numb = 0;
 
 					/* compute the load balancing mask list */
@@ -864,10 +1692,23 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 							steer_mask[steer_mask_numb++] = sbit;
 			 		});
 
-					buff->fwd_mask |= steer_mask[pfq_fold(prefold(monad.fanout.hash), (unsigned int)steer_mask_numb)];
+					reta = (struct pfq_group_reta *)atomic_long_read(&this_group->reta);
+
+					target = steer_mask[pfq_fold(prefold(monad.fanout.hash), (unsigned int)steer_mask_numb)];
 
-					if (is_double_steering(monad.fanout))
-						buff->fwd_mask |= steer_mask[pfq_fold(prefold(monad.fanout.hash2), (unsigned int)steer_mask_numb)];
+					if (reta)
+						target = pfq_steer_reta(reta, monad.fanout.hash, elig_mask, target);
+					else if (this_group->steer_threshold && steer_mask_numb)
+						target = pfq_steer_dynamic(data, this_group, gid, monad.fanout.hash, elig_mask, target, cpu);
+
+					buff->fwd_mask |= target;
+
+					if (is_double_steering(monad.fanout)) {
+						target = steer_mask[pfq_fold(prefold(monad.fanout.hash2), (unsigned int)steer_mask_numb)];
+						if (reta)
+							target = pfq_steer_reta(reta, monad.fanout.hash2, elig_mask, target);
+						buff->fwd_mask |= target;
+					}
 
 			 	}
 			 	else {  /* broadcast */
@@ -876,14 +1717,22 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 			 	}
 
 			} else {
+				fe = static_key_false(&pfq_key_flow_export) ?
+					(struct pfq_flow_export *)atomic_long_read(&this_group->flow_export) : NULL;
+				if (fe) {
+					pfq_flow_account(this_group, fe, buff, cpu);
+					continue;
+				}
+
 				buff->fwd_mask |= (unsigned long)atomic_long_read(&this_group->sock_id[0]);
+				buff->class_mask |= Q_CLASS_DEFAULT;
 			}
 		}
 		);
 
-		/* get the current timestamp */
+		/* get the current time (packets are not timestamped unless required) */
 
-		current_rx = qbuff_get_ktime(buff);
+		current_rx = ns_to_ktime(local_clock());
 
 		/* this packet is ready to be enqueued for transmission or possibly dropped */
 
@@ -905,6 +1754,10 @@ pfq_receive(struct napi_struct *napi, struct sk_buff * skb)
 		data->last_rx = current_rx;
 	}
 	else {
+		/* heartbeat: export expired flow records */
+
+		pfq_flow_expire(cpu);
+
 		if (data->qbuff_queue->len == 0)
 			return 0;
 	}
@@ -1024,24 +1877,28 @@ size_t pfq_sk_queue_recv(struct pfq_sock *so,
 			 unsigned __int128 mask,
 			 int burst_len)
 {
-	struct pfq_shared_rx_queue *rx_queue = pfq_sock_rx_shared_queue(so);
+	struct pfq_queue_layout *ql = pfq_sock_queue_layout(so);
+	struct pfq_shared_rx_queue *rx_queue;
 	struct pfq_pkthdr *hdr;
 	struct qbuff *buff;
 	unsigned long data;
-	size_t n, copied = 0;
+	size_t n, copied = 0, caplen;
 	pfq_qver_t qver;
 	int qlen;
 
-	if (unlikely(rx_queue == NULL))
+	if (unlikely(ql == NULL))
 		return 0;
 
+	/* the whole batch goes to the queues loaded here (see pfq_shared_queue_resize) */
+
+	rx_queue = &ql->addr->rx;
+	caplen = min_t(size_t, so->rx_len, ql->rx_slot_size - sizeof(struct pfq_pkthdr));
+
 	data = __atomic_fetch_add(&rx_queue->shinfo, burst_len, __ATOMIC_RELAXED);
 	qlen = PFQ_SHARED_QUEUE_LEN(data);
 	qver = PFQ_SHARED_QUEUE_VER(data);
 
-	hdr  = (struct pfq_pkthdr *) pfq_mpsc_slot_ptr(so, qver, qlen);
-	if (unlikely(hdr == NULL))
-		return 0;
+	hdr  = (struct pfq_pkthdr *) pfq_mpsc_slot_ptr(ql, qver, qlen);
 
 	for_each_qbuff_with_mask(mask, buffs, buff, n)
 	{
@@ -1051,14 +1908,14 @@ size_t pfq_sk_queue_recv(struct pfq_sock *so,
 
 		/* compute the boundaries */
 
-		bytes = min_t(size_t, skb->len, so->tx_len);
+		bytes = min_t(size_t, skb->len, caplen);
 		pkt = (char *)(hdr+1);
 		slot_index = qlen + copied;
 
 		prefetch_w0(hdr);
 		prefetch_w0((char *)hdr + 64);
 
-		if (unlikely(slot_index >= so->rx_queue_len)) {
+		if (unlikely(slot_index >= ql->rx_len)) {
 #ifdef PFQ_USE_POLL
 			if (waitqueue_active(&so->waitqueue)) {
 				wake_up_interruptible(&so->waitqueue);
@@ -1116,9 +1973,191 @@ size_t pfq_sk_queue_recv(struct pfq_sock *so,
 
 		copied++;
 
-		hdr = PFQ_SHARED_QUEUE_NEXT_PKTHDR(hdr, so->rx_slot_size);
+		hdr = PFQ_SHARED_QUEUE_NEXT_PKTHDR(hdr, ql->rx_slot_size);
 	}
 
 	return copied;
 }
 
+
+/*
+ * enqueue a single buffer in the Rx queue of the socket: the ifindex
+ * field tells the consumer where it comes from (e.g. Q_PKTHDR_FLOW_RECORD).
+ */
+
+static size_t
+__pfq_sk_queue_recv_raw(struct pfq_sock *so,
+			void const *rec,
+			size_t len,
+			int ifindex,
+			uint16_t queue)
+{
+	struct pfq_queue_layout *ql = pfq_sock_queue_layout(so);
+	struct pfq_shared_rx_queue *rx_queue;
+	struct pfq_pkthdr *hdr;
+	unsigned long data;
+	pfq_qver_t qver;
+	size_t bytes;
+	int qlen;
+
+	if (unlikely(ql == NULL))
+		return 0;
+
+	rx_queue = &ql->addr->rx;
+
+	data = __atomic_fetch_add(&rx_queue->shinfo, 1, __ATOMIC_RELAXED);
+	qlen = PFQ_SHARED_QUEUE_LEN(data);
+	qver = PFQ_SHARED_QUEUE_VER(data);
+
+	if (unlikely((size_t)qlen >= ql->rx_len))
+		return 0;
+
+	hdr = (struct pfq_pkthdr *) pfq_mpsc_slot_ptr(ql, qver, qlen);
+
+	bytes = min_t(size_t, len, min_t(size_t, so->rx_len, ql->rx_slot_size - sizeof(struct pfq_pkthdr)));
+
+	memcpy(hdr+1, rec, bytes);
+
+	if (likely(so->tstamp != 0)) {
+		struct timespec ts;
+		getnstimeofday(&ts);
+		hdr->tstamp.tv.sec  = (uint32_t)ts.tv_sec;
+		hdr->tstamp.tv.nsec = (uint32_t)ts.tv_nsec;
+	}
+
+	hdr->caplen = (uint16_t)bytes;
+	hdr->len = (uint16_t)len;
+	hdr->info.data.mark = 0;
+	hdr->info.ifindex = ifindex;
+	hdr->info.vlan.tci = 0;
+	hdr->info.queue = queue;
+
+	/* commit the slot (release semantic) */
+
+	__atomic_store_n(&hdr->info.commit, qver, __ATOMIC_RELEASE);
+
+#ifdef PFQ_USE_POLL
+	if (waitqueue_active(&so->waitqueue))
+		wake_up_interruptible(&so->waitqueue);
+#endif
+	return 1;
+}
+
+
+/*
+ * enqueue a single record (e.g. a flow record) in the Rx queue of the socket,
+ * marked by Q_PKTHDR_FLOW_RECORD in place of the ifindex.
+ */
+
+size_t pfq_sk_queue_recv_record(struct pfq_sock *so,
+				void const *rec,
+				size_t len)
+{
+	return __pfq_sk_queue_recv_raw(so, rec, len, Q_PKTHDR_FLOW_RECORD, 0);
+}
+
+
+/*
+ * the records of a pipe belong to the default class: they are not admitted
+ * in the slots the peer socket reserved to the other classes.
+ */
+
+static inline bool
+pfq_sk_pipe_admit(struct pfq_sock *dst)
+{
+	struct pfq_queue_layout *ql;
+	size_t slot;
+
+	if (likely(!dst->rx_reserved))
+		return true;
+
+	ql = pfq_sock_queue_layout(dst);
+	if (unlikely(ql == NULL))
+		return true; /* dropped by the Rx queue itself */
+
+	slot = PFQ_SHARED_QUEUE_LEN(__atomic_load_n(&ql->addr->rx.shinfo, __ATOMIC_RELAXED));
+	if (slot < pfq_sock_rx_class_watermark(dst, ql->rx_len, Q_CLASS_DEFAULT))
+		return true;
+
+	sparse_inc(dst->class_stats, drop[0]);
+	sparse_inc(dst->stats, drop);
+	return false;
+}
+
+
+/*
+ * pipe: deliver the slots of a socket Tx queue to the Rx queue of another
+ * socket, marked by Q_PKTHDR_PIPE in place of the ifindex and with the id
+ * of the source socket in place of the hw queue.
+ */
+
+tx_response_t
+pfq_sk_queue_pipe(struct pfq_sock *so, int sock_queue, int id)
+{
+	struct pfq_shared_tx_queue *tx_queue;
+	struct pfq_queue_layout *ql;
+	struct pfq_pkthdr *hdr;
+	struct pfq_sock *dst;
+	unsigned int cons_idx;
+	ptrdiff_t prod_off;
+	size_t slot_size;
+	char *begin, *end;
+	void *tx_queue_mem;
+	tx_response_t rc = {0};
+
+	ql = pfq_sock_queue_layout(so);
+	if (unlikely(ql == NULL))
+		return rc; /* socket not enabled... */
+
+	tx_queue = pfq_shared_tx_queue(ql->addr, sock_queue);
+	tx_queue_mem = pfq_shared_tx_queue_mem(ql, sock_queue);
+	slot_size = ql->tx_slot_size;
+
+	prod_off = pfq_tx_buffer_off(ql, maybe_swap_sk_tx_queue(tx_queue, &cons_idx), false);
+	begin    = tx_queue_mem + (cons_idx & 1) * ql->tx_size + pfq_tx_buffer_off(ql, tx_queue->cons.off, true);
+	end      = tx_queue_mem + (cons_idx & 1) * ql->tx_size + prod_off;
+
+	/* same context as the Rx path: the socket is not released under our feet
+	 * (and its id is not reused before the pipes to it are closed) */
+
+	local_bh_disable();
+
+	dst = id != Q_TX_PIPE_CLOSED ? pfq_sock_get_by_id((__force pfq_id_t)id) : NULL;
+
+	hdr = (struct pfq_pkthdr *)begin;
+
+	for_each_sk_slot(hdr, end, slot_size)
+	{
+		size_t len;
+
+		/* because of dynamic slot size, ensure the caplen is not set to 0 */
+
+		if (unlikely(!hdr->caplen))
+			break;
+
+		len = min_t(size_t, hdr->caplen, slot_size - sizeof(struct pfq_pkthdr));
+
+		if (likely(dst != NULL) && !pfq_sk_pipe_admit(dst)) {
+			rc.fail++;
+			continue;
+		}
+
+		if (likely(dst != NULL) &&
+		    __pfq_sk_queue_recv_raw(dst, hdr+1, len, Q_PKTHDR_PIPE, (uint16_t)(__force int)so->id)) {
+			sparse_inc(dst->stats, recv);
+			rc.ok++;
+		}
+		else {
+			if (dst)
+				sparse_inc(dst->stats, lost);
+			rc.fail++;
+		}
+	}
+
+	local_bh_enable();
+
+	/* update the local consumer offset */
+
+	tx_queue->cons.off = prod_off;
+	return rc;
+}
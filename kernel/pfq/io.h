@@ -72,6 +72,11 @@ extern size_t pfq_sk_queue_recv( struct pfq_sock *so
 			       , int burst_len
 			       );
 
+extern size_t pfq_sk_queue_recv_record( struct pfq_sock *so
+				      , void const *rec
+				      , size_t len
+				      );
+
 
 struct pfq_xmit_context
 {
@@ -99,10 +104,21 @@ pfq_count_fwd_devs(struct net_device *dev, struct net_device **devs, size_t num_
 }
 
 
-/* socket queues */
+/* socket queues (departure: time of the first packet left in the queue, 0 if none) */
+
+struct pfq_skb_pool;
+
+extern tx_response_t
+pfq_sk_queue_xmit(struct pfq_sock *so, int qindex, int cpu, struct pfq_skb_pool *tx_pool, uint64_t *departure);
 
 extern tx_response_t
-pfq_sk_queue_xmit(struct pfq_sock *so, int qindex, int cpu);
+pfq_sk_queue_pipe(struct pfq_sock *so, int qindex, int id);
+
+extern bool
+pfq_sk_queue_pending(struct pfq_sock *so, int qindex);
+
+extern bool
+pfq_sk_queue_tx_space(struct pfq_sock *so);
 
 
 /* skb queues */
@@ -25,6 +25,7 @@
 #define PFQ_NET_HEADERS_H
 
 #include <net/ip.h>
+#include <net/ipv6.h>
 
 #include <linux/ip.h>
 #include <linux/ipv6.h>
@@ -23,6 +23,7 @@
 
 #include <pfq/global.h>
 #include <pfq/define.h>
+#include <pfq/fastpath.h>
 
 #include <linux/module.h>
 
@@ -30,6 +31,24 @@
 extern struct pfq_global_data default_global;
 
 
+/* vlan_untag: the static key of the receive stage follows the parameter */
+
+static int
+pfq_param_set_vlan_untag(const char *val, const struct kernel_param *kp)
+{
+	int ret = param_set_int(val, kp);
+	if (ret == 0)
+		pfq_fastpath_vlan_untag(*(int *)kp->arg);
+	return ret;
+}
+
+static const struct kernel_param_ops pfq_param_vlan_untag_ops =
+{
+	.set = pfq_param_set_vlan_untag,
+	.get = param_get_int,
+};
+
+
 module_param_named(max_slot_size,	 default_global.max_slot_size,		int, 0644);
 module_param_named(max_pool_size,	 default_global.max_pool_size,		int, 0644);
 
@@ -37,8 +56,9 @@ module_param_named(capt_batch_len,	 default_global.capt_batch_len,		int, 0644);
 module_param_named(xmit_batch_len,	 default_global.xmit_batch_len,		int, 0644);
 module_param_named(skb_tx_pool_size,	 default_global.skb_tx_pool_size,	int, 0644);
 module_param_named(skb_rx_pool_size,	 default_global.skb_rx_pool_size,	int, 0644);
-module_param_named(vlan_untag,		 default_global.vlan_untag,		int, 0644);
+module_param_cb(vlan_untag,		 &pfq_param_vlan_untag_ops, &default_global.vlan_untag, 0644);
 module_param_named(tx_retry,		 default_global.tx_retry,		int, 0644);
+module_param_named(tx_idle_spin,	 default_global.tx_idle_spin,		int, 0644);
 
 module_param_array_named(tx_cpu,	 default_global.tx_cpu,	  int, &default_global.tx_cpu_nr, 0644);
 
@@ -55,4 +75,5 @@ MODULE_PARM_DESC(skb_rx_pool_size,	" Socket buffer Rx pool size (default=1024)")
 
 MODULE_PARM_DESC(tx_cpu,		" Tx k-threads cpu");
 MODULE_PARM_DESC(tx_retry,		" Tx retry attempts (default 1)");
+MODULE_PARM_DESC(tx_idle_spin,		" Tx k-threads polling time before sleeping (default 100 usec, -1 never sleep)");
 
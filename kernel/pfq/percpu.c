@@ -99,6 +99,8 @@ int pfq_percpu_init(void)
 
 		data->counter = 0;
 
+		memset(data->flow_table, 0, sizeof(data->flow_table));
+
 		data->qbuff_queue = pfq_malloc_pages(sizeof(struct pfq_qbuff_long_queue), GFP_KERNEL);
 		if (!data->qbuff_queue)
 			return -ENOMEM;
@@ -41,10 +41,11 @@ extern int  pfq_percpu_qbuff_queue_reset(void);
 extern int  pfq_percpu_destruct(void);
 
 
+/* the tx pool serves the sync transmissions of this cpu (bottom half
+ * disabled); each Tx thread owns a pool of its own */
+
 struct pfq_percpu_pool
 {
-        struct spinlock		tx_lock;
-
 	struct pfq_skb_pool	tx;
 	struct pfq_skb_pool	rx;
 
@@ -55,6 +56,15 @@ int  pfq_percpu_alloc(void);
 void pfq_percpu_free(void);
 
 
+struct pfq_steer_flow
+{
+	unsigned long		stamp;		/* jiffies of the last packet, 0 = free */
+	uint32_t		hash;
+	int16_t			gid;
+	int16_t			id;		/* socket the flow is steered to */
+};
+
+
 struct pfq_percpu_data
 {
 	struct pfq_qbuff_long_queue  *qbuff_queue;
@@ -63,6 +73,8 @@ struct pfq_percpu_data
 	struct timer_list	timer;
 	uint32_t		counter;
 
+	struct pfq_steer_flow	flow_table[1 << Q_STEER_FLOW_BITS];
+
 } ____pfq_cacheline_aligned;
 
 
@@ -210,8 +210,6 @@ int pfq_skb_pool_init_all(void)
 		struct pfq_percpu_pool *pool = per_cpu_ptr(global->percpu_pool, cpu);
 		if (pool)
 		{
-			spin_lock_init(&pool->tx_lock);
-
 			if (pfq_skb_pool_init(&pool->rx, global->skb_rx_pool_size, global->max_slot_size, 0, cpu) < 0)
 				goto err;
 			if (pfq_skb_pool_init(&pool->tx, global->skb_tx_pool_size, global->max_slot_size, 1, cpu) < 0)
@@ -234,10 +232,8 @@ int pfq_skb_pool_free_all(void)
 	{
 		struct pfq_percpu_pool *pool = per_cpu_ptr(global->percpu_pool, cpu);
 		if (pool) {
-			spin_lock(&pool->tx_lock);
 			pfq_skb_pool_free(&pool->rx, global->skb_rx_pool_size);
 			pfq_skb_pool_free(&pool->tx, global->skb_tx_pool_size);
-			spin_unlock(&pool->tx_lock);
 		}
 	}
 
@@ -245,4 +241,21 @@ int pfq_skb_pool_free_all(void)
 }
 
 
+/* pool of a Tx thread: allocated the first time the thread is started */
+
+int pfq_skb_pool_init_tx(struct pfq_skb_pool *pool, int cpu)
+{
+	if (pfq_skb_pool_init(pool, global->skb_tx_pool_size, global->max_slot_size, 1, cpu) < 0)
+		return -ENOMEM;
+	return 0;
+}
+
+
+void pfq_skb_pool_free_tx(struct pfq_skb_pool *pool)
+{
+	if (pool->fifo)
+		pfq_skb_pool_free(pool, global->skb_tx_pool_size);
+}
+
+
 
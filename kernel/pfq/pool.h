@@ -43,6 +43,8 @@ struct pfq_skb_pool
 
 extern int pfq_skb_pool_init_all(void);
 extern int pfq_skb_pool_free_all(void);
+extern int pfq_skb_pool_init_tx(struct pfq_skb_pool *pool, int cpu);
+extern void pfq_skb_pool_free_tx(struct pfq_skb_pool *pool);
 extern struct pfq_pool_stats pfq_get_skb_pool_stats(void);
 
 
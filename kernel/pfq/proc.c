@@ -33,6 +33,7 @@
 #include <pfq/proc.h>
 #include <pfq/sparse.h>
 #include <pfq/sock.h>
+#include <pfq/thread.h>
 
 #include <linux/kernel.h>
 #include <linux/module.h>
@@ -52,6 +53,7 @@ static const char proc_groups[]  = "groups";
 static const char proc_sockets[] = "sockets";
 static const char proc_global[]  = "global";
 static const char proc_memory[]  = "memory";
+static const char proc_tx[]	 = "tx";
 
 
 static void
@@ -111,7 +113,7 @@ static int pfq_proc_sockets(struct seq_file *m, void *v)
 {
 	size_t n;
 
-	seq_printf(m, "socket: recv      lost      drop      sent      disc.     failed    forward   kernel\n");
+	seq_printf(m, "socket: recv      lost      drop      sent      disc.     failed    forward   kernel    node\n");
 
 	mutex_lock(&global->socket_lock);
 
@@ -125,7 +127,7 @@ static int pfq_proc_sockets(struct seq_file *m, void *v)
 
 		pfq_kernel_stats_read(so->stats, &stats);
 
-		seq_printf(m, "%6zu: %-9lu %-9lu %-9lu %-9lu %-9lu %-9lu %-9lu %-9lu\n", n,
+		seq_printf(m, "%6zu: %-9lu %-9lu %-9lu %-9lu %-9lu %-9lu %-9lu %-9lu %d\n", n,
 			   stats.recv,
 			   stats.lost,
 			   stats.drop,
@@ -133,7 +135,8 @@ static int pfq_proc_sockets(struct seq_file *m, void *v)
 			   stats.disc,
 			   stats.fail,
 			   stats.frwd,
-			   stats.kern);
+			   stats.kern,
+			   so->shmem.node);
         }
 
 	mutex_unlock(&global->socket_lock);
@@ -202,10 +205,10 @@ static int pfq_proc_stats(struct seq_file *m, void *v)
 
 static int pfq_proc_memory(struct seq_file *m, void *v)
 {
-#ifdef PFQ_USE_SKB_POOL
-
 	int i;
 
+#ifdef PFQ_USE_SKB_POOL
+
 	long int push_0 = sparse_read(global->percpu_memory, pool_push[0]);
 	long int push_1 = sparse_read(global->percpu_memory, pool_push[1]);
 
@@ -262,9 +265,58 @@ static int pfq_proc_memory(struct seq_file *m, void *v)
 	seq_printf(m, "  skb_alloc      : %10ld\n", sparse_read(global->percpu_memory, os_alloc));
 	seq_printf(m, "  skb_free       : %10ld\n", sparse_read(global->percpu_memory, os_free));
 
+	seq_printf(m, "\nHugePages arenas\n");
+
+	for(i = 0; i < Q_MAX_ID; i++)
+	{
+		struct pfq_arena_stat stat;
+		if (!pfq_arena_get_stat(i, &stat))
+			continue;
+
+		seq_printf(m, "  arena-%-2d       : owner %3d, %zu/%zu bytes used (%zu%%), %d sockets, %zuk pages\n",
+			   i, stat.owner, stat.used, stat.size, stat.size ? stat.used * 100 / stat.size : 0,
+			   stat.sockets, stat.hugepage_size >> 10);
+	}
+
 	return 0;
 }
 
+static int pfq_proc_tx(struct seq_file *m, void *v)
+{
+	struct pfq_tx_thread_stat stat;
+	int n;
+
+	seq_printf(m, "Tx-thread: cpu queues util%% migrations sleeps     wakeups    doorbells  wake-avg(ns) wake-max(ns)\n");
+
+	for(n = 0; n < Q_MAX_TX_THREADS; n++)
+	{
+		if (!pfq_tx_thread_get_stat(n, &stat))
+			continue;
+
+		seq_printf(m, "%9d: %3d %6d %5d %-10lu %-10lu %-10lu %-10lu %-12llu %-12llu\n", n,
+			   stat.cpu, stat.queues, stat.util, stat.migrations,
+			   stat.sleeps, stat.wakeups, stat.doorbells,
+			   stat.wakeups ? (unsigned long long)div64_u64(stat.wake_latency, stat.wakeups) : 0ULL,
+			   (unsigned long long)stat.wake_latency_max);
+	}
+
+	return 0;
+}
+
+static int pfq_proc_tx_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pfq_proc_tx, PDE_DATA(inode));
+}
+
+static const struct file_operations pfq_proc_tx_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pfq_proc_tx_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+
 static int pfq_proc_memory_open(struct inode *inode, struct file *file)
 {
 	return single_open(file, pfq_proc_memory, PDE_DATA(inode));
@@ -363,6 +415,7 @@ int pfq_proc_init(void)
 	proc_create(proc_sockets, 0644, pfq_proc_dir, &pfq_proc_sockets_fops);
 	proc_create(proc_global,  0644, pfq_proc_dir, &pfq_proc_global_fops);
 	proc_create(proc_memory,  0644, pfq_proc_dir, &pfq_proc_memory_fops);
+	proc_create(proc_tx,	  0644, pfq_proc_dir, &pfq_proc_tx_fops);
 
 	return 0;
 }
@@ -375,6 +428,7 @@ int pfq_proc_destruct(void)
 	remove_proc_entry(proc_sockets, pfq_proc_dir);
 	remove_proc_entry(proc_global,	pfq_proc_dir);
 	remove_proc_entry(proc_memory,	pfq_proc_dir);
+	remove_proc_entry(proc_tx,	pfq_proc_dir);
 	remove_proc_entry("pfq", init_net.proc_net);
 
 	return 0;
@@ -22,6 +22,7 @@
  ****************************************************************/
 
 #include <lang/monad.h>
+#include <pfq/memory.h>
 #include <pfq/qbuff.h>
 
 bool
@@ -48,3 +49,43 @@ qbuff_ingress(struct qbuff const *buff, struct iphdr const *ip)
 }
 
 
+/*
+ * The packet (from the mac header) is copied into an skb of the pool, so that
+ * no slab allocation takes place while the pool has recycleable skbs; the
+ * copy must be released with qbuff_free() to the same pool.
+ */
+
+struct qbuff *
+qbuff_clone(struct qbuff const *buff, struct qbuff *nbuff, struct pfq_skb_pool *pool)
+{
+	struct sk_buff const *skb = QBUFF_SKB(buff);
+	struct sk_buff *nskb;
+
+	if (unlikely(skb->len + NET_SKB_PAD > global->max_slot_size))
+		return NULL;
+
+	nskb = pfq_alloc_skb_pool(skb->len + NET_SKB_PAD, GFP_ATOMIC, NUMA_NO_NODE, 1, pool);
+	if (unlikely(nskb == NULL))
+		return NULL;
+
+	skb_reserve(nskb, NET_SKB_PAD);
+	skb_reset_tail_pointer(nskb);
+	nskb->len = 0;
+
+	__skb_put(nskb, skb->len);
+
+	if (unlikely(skb_copy_bits(skb, 0, nskb->data, skb->len) < 0)) {
+		pfq_free_skb_pool(nskb, pool);
+		return NULL;
+	}
+
+	nskb->dev	= skb->dev;
+	nskb->protocol	= skb->protocol;
+	nskb->priority	= skb->priority;
+	nskb->mark	= skb->mark;
+	skb_set_queue_mapping(nskb, skb_get_queue_mapping(skb));
+	skb_reset_mac_header(nskb);
+
+	qbuff_init(nbuff, nskb, buff->monad, buff->counter);
+	return nbuff;
+}
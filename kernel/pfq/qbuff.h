@@ -34,15 +34,17 @@
 #include <linux/ip.h>
 
 struct pfq_lang_monad;
+struct pfq_skb_pool;
 
 
 struct qbuff
 {
 	void		       *addr;				/* struct sk_buff * */
 	struct pfq_lang_monad  *monad;
-	struct net_device      *fwd_dev[Q_BUFF_QUEUE_LEN];	/* fwd to devs */
+	struct net_device      *fwd_dev[Q_BUFF_LOG_LEN];	/* fwd to devs */
 	size_t			fwd_dev_num;
         unsigned long		fwd_mask;			/* fwd to sockets */
+        unsigned long		class_mask;			/* classes of delivery */
         uint32_t		counter;			/* unique id */
         bool			to_kernel;			/* fwd to kernel */
 };
@@ -60,6 +62,7 @@ qbuff_init( struct qbuff *buff
 	buff->fwd_dev_num = 0;
 	buff->counter = id;
 	buff->fwd_mask = 0;
+	buff->class_mask = 0;
 	buff->to_kernel = false;
 }
 
@@ -172,13 +175,10 @@ void qbuff_set_queue_mapping(struct qbuff *buff, uint16_t map)
 }
 
 
-static inline
-struct qbuff *
-qbuff_clone(struct qbuff *buff)
-{
-	/* FIXME: GFP_ATMOIC */
-	return NULL;
-}
+/* copy of the packet into an skb of the given pool, described by nbuff */
+
+extern struct qbuff *
+qbuff_clone(struct qbuff const *buff, struct qbuff *nbuff, struct pfq_skb_pool *pool);
 
 static inline uint32_t
 qbuff_get_rss_hash(struct qbuff *buff)
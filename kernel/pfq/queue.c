@@ -30,105 +30,332 @@
 #include <pfq/queue.h>
 
 
+/* zero-copy Tx in-flight counters of a generation of queues */
+
+static struct pfq_tx_inflight *
+pfq_tx_inflight_alloc(struct pfq_shared_queue *addr)
+{
+	struct pfq_tx_inflight *inf = kzalloc(sizeof(*inf), GFP_KERNEL);
+	if (inf == NULL)
+		return NULL;
+
+	kref_init(&inf->ref);
+	spin_lock_init(&inf->lock);
+	inf->addr = addr;
+	return inf;
+}
+
+
+static void
+pfq_tx_inflight_release(struct kref *ref)
+{
+	kfree(container_of(ref, struct pfq_tx_inflight, ref));
+}
+
+
+void
+pfq_tx_inflight_put(struct pfq_tx_inflight *inf)
+{
+	kref_put(&inf->ref, pfq_tx_inflight_release);
+}
+
+
+/* update the count of a Tx queue buffer (any context) and its copy in the
+ * shared memory, if still mapped */
+
+void
+pfq_tx_inflight_add(struct pfq_tx_inflight *inf, int index, int buffer, int value)
+{
+	unsigned long flags;
+	int count;
+
+	spin_lock_irqsave(&inf->lock, flags);
+
+	count = inf->count[1 + index][buffer & 1] += value;
+	if (inf->addr)
+		__atomic_store_n(&pfq_shared_tx_queue(inf->addr, index)->cons.inflight[buffer & 1], count, __ATOMIC_RELEASE);
+
+	spin_unlock_irqrestore(&inf->lock, flags);
+}
+
+
+static int
+pfq_tx_inflight_total(struct pfq_tx_inflight *inf)
+{
+	unsigned long flags;
+	int n, ret = 0;
+
+	spin_lock_irqsave(&inf->lock, flags);
+	for(n = 0; n < 1 + Q_MAX_TX_QUEUES; n++)
+		ret += inf->count[n][0] + inf->count[n][1];
+	spin_unlock_irqrestore(&inf->lock, flags);
+
+	return ret;
+}
+
+
+/* the layout of a new generation of queues, kept by the kernel */
+
+static struct pfq_queue_layout *
+pfq_shared_queue_layout(struct pfq_sock *so, void *addr)
+{
+	struct pfq_tx_inflight *inf = pfq_tx_inflight_alloc(addr);
+	struct pfq_queue_layout *ql;
+
+	if (inf == NULL)
+		return NULL;
+
+	ql = &so->layout[++so->layout_gen & 1];
+
+	ql->tx_inflight	 = inf;
+	ql->addr	 = (struct pfq_shared_queue *)addr;
+	ql->rx_len	 = so->rx_queue_len;
+	ql->rx_slot_size = so->rx_slot_size;
+	ql->rx_size	 = pfq_mpsc_queue_mem(so)/2;
+	ql->tx_size	 = pfq_spsc_queue_mem(so)/2;
+	ql->tx_slot_size = so->tx_slot_size;
+	return ql;
+}
+
+
+/* initialize the headers (for the user space) and the slots of the queues */
+
+static void
+pfq_shared_queue_init(struct pfq_queue_layout const *ql)
+{
+	struct pfq_shared_queue * mapped_queue = ql->addr;
+	unsigned int i; size_t n;
+
+	/* initialize Rx queue */
+
+	mapped_queue->rx.shinfo    = 0;
+	mapped_queue->rx.len       = (unsigned int)ql->rx_len;
+	mapped_queue->rx.size      = (unsigned int)ql->rx_size;
+	mapped_queue->rx.slot_size = (unsigned int)ql->rx_slot_size;
+
+	/* reset Rx slots */
+
+	for(i = 0; i < 2; i++)
+	{
+		char * raw = pfq_shared_rx_queue_mem(ql) + i * ql->rx_size;
+		char * end = raw + ql->rx_size;
+		const int rst = !i;
+		for(;raw < end; raw += ql->rx_slot_size)
+			((struct pfq_pkthdr *)raw)->info.commit = (uint16_t)rst;
+	}
+
+	/* initialize TX queues */
+
+	mapped_queue->tx.size  = ql->tx_size;
+	mapped_queue->tx.slot_size = (unsigned int)ql->tx_slot_size;
+
+	mapped_queue->tx.prod.index = 0;
+	mapped_queue->tx.prod.off0  = 0;
+	mapped_queue->tx.prod.off1  = 0;
+	mapped_queue->tx.cons.index = 0;
+	mapped_queue->tx.cons.off   = 0;
+	mapped_queue->tx.cons.inflight[0] = 0;
+	mapped_queue->tx.cons.inflight[1] = 0;
+
+	/* initialize TX async queues */
+
+	for(n = 0; n < Q_MAX_TX_QUEUES; n++)
+	{
+		mapped_queue->tx_async[n].size  = ql->tx_size;
+		mapped_queue->tx_async[n].slot_size = (unsigned int)ql->tx_slot_size;
+
+		mapped_queue->tx_async[n].prod.index = 0;
+		mapped_queue->tx_async[n].prod.off0  = 0;
+		mapped_queue->tx_async[n].prod.off1  = 0;
+		mapped_queue->tx_async[n].cons.index = 0;
+		mapped_queue->tx_async[n].cons.off   = 0;
+		mapped_queue->tx_async[n].cons.inflight[0] = 0;
+		mapped_queue->tx_async[n].cons.inflight[1] = 0;
+	}
+}
+
+
+static void
+pfq_shared_queue_dump(struct pfq_sock *so)
+{
+	pr_devel("[PFQ|%d] shared memory on node %d\n", so->id, so->shmem.node);
+
+	pr_devel("[PFQ|%d] Rx queue: len=%zu slot_size=%zu caplen=%zu, mem=%zu bytes\n",
+		 so->id,
+		 so->rx_queue_len,
+		 so->rx_slot_size,
+		 so->rx_len,
+		 pfq_mpsc_queue_mem(so));
+
+	pr_devel("[PFQ|%d] Tx queue: len=%zu slot_size=%zu xmitlen=%zu, mem=%zu bytes\n",
+		 so->id,
+		 so->tx_queue_len,
+		 so->tx_slot_size,
+		 so->tx_len,
+		 pfq_spsc_queue_mem(so));
+
+	pr_devel("[PFQ|%d] Tx async queues: len=%zu slot_size=%zu xmitlen=%zu, mem=%zu bytes (%d queues)\n",
+		 so->id,
+		 so->tx_queue_len,
+		 so->tx_slot_size,
+		 so->tx_len,
+		 pfq_spsc_queue_mem(so) * Q_MAX_TX_QUEUES, Q_MAX_TX_QUEUES);
+}
+
+
 int
 pfq_shared_queue_enable(struct pfq_sock *so, unsigned long user_addr, size_t user_size, size_t hugepage_size)
 {
 	if (!atomic_long_read(&so->shmem_addr)) {
 
-		struct pfq_shared_queue * mapped_queue;
-                unsigned int i; size_t n;
+		struct pfq_queue_layout *ql;
+		int node = so->numa_node;
+
+		/* auto-detect the node of the consumer: the one enabling the socket */
+
+		if (node == Q_AUTO_NODE)
+			node = numa_node_id();
 
 		/* alloc queue memory */
 
-		if (pfq_shared_memory_alloc(so->id, &so->shmem, user_addr, user_size, hugepage_size, pfq_total_queue_mem_aligned(so)) < 0)
+		if (pfq_shared_memory_alloc(so->id, &so->shmem, user_addr, user_size, hugepage_size, pfq_total_queue_mem_aligned(so), node) < 0)
 		{
 			return -ENOMEM;
 		}
 
 		/* initialize queues headers */
 
-		mapped_queue = (struct pfq_shared_queue *)so->shmem.addr;
+		ql = pfq_shared_queue_layout(so, so->shmem.addr);
+		if (ql == NULL) {
+			pfq_shared_memory_free(&so->shmem);
+			return -ENOMEM;
+		}
 
-		/* initialize Rx queue */
+		pfq_shared_queue_init(ql);
 
-		mapped_queue->rx.shinfo    = 0;
-		mapped_queue->rx.len       = (unsigned int)so->rx_queue_len;
-		mapped_queue->rx.size      = (unsigned int)pfq_mpsc_queue_mem(so)/2;
-		mapped_queue->rx.slot_size = (unsigned int)so->rx_slot_size;
+		/* commit queues */
 
-		/* reset Rx slots */
+		smp_wmb();
 
-		for(i = 0; i < 2; i++)
-		{
-			char * raw = so->shmem.addr + sizeof(struct pfq_shared_queue) + i * mapped_queue->rx.size;
-			char * end = raw + mapped_queue->rx.size;
-			const int rst = !i;
-			for(;raw < end; raw += mapped_queue->rx.slot_size)
-				((struct pfq_pkthdr *)raw)->info.commit = (uint16_t)rst;
-		}
+		atomic_long_set(&so->shmem_layout, (unsigned long)ql);
+		atomic_long_set(&so->shmem_addr, (unsigned long)so->shmem.addr);
 
-		/* initialize TX queues */
+		pfq_shared_queue_dump(so);
+	}
 
-		mapped_queue->tx.size  = pfq_spsc_queue_mem(so)/2;
+	return 0;
+}
 
-		mapped_queue->tx.prod.index = 0;
-		mapped_queue->tx.prod.off0  = 0;
-		mapped_queue->tx.prod.off1  = 0;
-		mapped_queue->tx.cons.index = 0;
-		mapped_queue->tx.cons.off   = 0;
 
-		/* initialize TX async queues */
+/*
+ * move the producers to new queues, allocated with the current geometry of
+ * the socket. The old queues stay mapped until the consumer has drained
+ * them (see pfq_sock_resize_release).
+ */
 
-		for(n = 0; n < Q_MAX_TX_QUEUES; n++)
-		{
-			mapped_queue->tx_async[n].size  = pfq_spsc_queue_mem(so)/2;
+int
+pfq_shared_queue_resize(struct pfq_sock *so)
+{
+	struct pfq_queue_layout *ql;
+	struct pfq_shmem_descr shmem;
+
+	if (pfq_shared_memory_alloc(so->id, &shmem, 0, 0, 0, pfq_total_queue_mem_aligned(so), so->shmem.node) < 0)
+		return -ENOMEM;
+
+	/* the previous generation of the layout is no longer in use (grace period of the last resize) */
+
+	ql = pfq_shared_queue_layout(so, shmem.addr);
+	if (ql == NULL) {
+		pfq_shared_memory_free(&shmem);
+		return -ENOMEM;
+	}
+
+	pfq_shared_queue_init(ql);
 
-			mapped_queue->tx_async[n].prod.index = 0;
-			mapped_queue->tx_async[n].prod.off0  = 0;
-			mapped_queue->tx_async[n].prod.off1  = 0;
-			mapped_queue->tx_async[n].cons.index = 0;
-			mapped_queue->tx_async[n].cons.off   = 0;
+	so->shmem_old = so->shmem;
+	so->shmem = shmem;
+
+	/* commit queues: producers switch at the next batch */
+
+	smp_wmb();
+
+	atomic_long_set(&so->shmem_layout, (unsigned long)ql);
+	atomic_long_set(&so->shmem_addr, (unsigned long)so->shmem.addr);
+
+	/* wait for the producers still on the old queues */
+
+	msleep(Q_GRACE_PERIOD);
+
+	pfq_shared_queue_dump(so);
+	return 0;
+}
+
+
+/* the layout of the generation of queues in the given memory */
+
+static struct pfq_queue_layout *
+pfq_shared_queue_layout_of(struct pfq_sock *so, void *addr)
+{
+	int n;
+	for(n = 0; n < 2; n++)
+		if (so->layout[n].addr == addr)
+			return &so->layout[n];
+	return NULL;
+}
+
+
+/* free the memory of the queues, once the driver has released the zero-copy
+ * slots (as counted by the kernel, the copy in the shared memory is ignored) */
+
+void
+pfq_shared_queue_free(struct pfq_sock *so, struct pfq_shmem_descr *shmem)
+{
+	struct pfq_queue_layout *ql;
+	struct pfq_tx_inflight *inf;
+	int wait = 0, inflight = 0;
+	unsigned long flags;
+
+	if (!shmem->addr)
+		return;
+
+	ql = pfq_shared_queue_layout_of(so, shmem->addr);
+	inf = ql ? ql->tx_inflight : NULL;
+
+	if (inf) {
+		while ((inflight = pfq_tx_inflight_total(inf)) > 0 &&
+			wait < Q_TX_ZEROCOPY_TIMEOUT) {
+			msleep(Q_GRACE_PERIOD);
+			wait += Q_GRACE_PERIOD;
 		}
 
-		/* commit queues */
+		/* the skbs still in flight no longer update the shared memory */
 
-		smp_wmb();
+		spin_lock_irqsave(&inf->lock, flags);
+		inf->addr = NULL;
+		spin_unlock_irqrestore(&inf->lock, flags);
 
-		atomic_long_set(&so->shmem_addr, (unsigned long)so->shmem.addr);
+		ql->tx_inflight = NULL;
+		ql->addr = NULL;
+		pfq_tx_inflight_put(inf);
+	}
 
-		pr_devel("[PFQ|%d] Rx queue: len=%zu slot_size=%zu caplen=%zu, mem=%zu bytes\n",
-			 so->id,
-			 so->rx_queue_len,
-			 so->rx_slot_size,
-			 so->rx_len,
-			 pfq_mpsc_queue_mem(so));
-
-		pr_devel("[PFQ|%d] Tx queue: len=%zu slot_size=%zu xmitlen=%zu, mem=%zu bytes\n",
-			 so->id,
-			 so->tx_queue_len,
-			 so->tx_slot_size,
-			 so->tx_len,
-			 pfq_spsc_queue_mem(so));
-
-		pr_devel("[PFQ|%d] Tx async queues: len=%zu slot_size=%zu xmitlen=%zu, mem=%zu bytes (%d queues)\n",
-			 so->id,
-			 so->tx_queue_len,
-			 so->tx_slot_size,
-			 so->tx_len,
-			 pfq_spsc_queue_mem(so) * Q_MAX_TX_QUEUES, Q_MAX_TX_QUEUES);
+	if (inflight > 0) {
+		/* the skbs still point to the queues: leak them */
+		printk(KERN_WARNING "[PFQ|%d] %d zero-copy Tx slots not released by the driver: %zu bytes leaked!\n",
+		       so->id, inflight, shmem->size);
+		shmem->addr = NULL;
+		return;
 	}
 
-	return 0;
+	pfq_shared_memory_free(shmem);
 }
 
 
 int
 pfq_shared_queue_unmap(struct pfq_sock *so)
 {
-	if (so->shmem.addr) {
-		pfq_shared_memory_free(&so->shmem);
-		so->shmem.addr = NULL;
-	}
+	pfq_shared_queue_free(so, &so->shmem);
+	pfq_shared_queue_free(so, &so->shmem_old);
 
 	pr_devel("[PFQ|%d] Rx/Tx shared queues unmapped.\n", so->id);
 	return 0;
@@ -33,7 +33,26 @@
 
 
 extern int pfq_shared_queue_enable(struct pfq_sock *so, unsigned long user_addr, size_t user_size, size_t hugepage_size);
+extern int pfq_shared_queue_resize(struct pfq_sock *so);
 extern int pfq_shared_queue_unmap(struct pfq_sock *so);
+extern void pfq_shared_queue_free(struct pfq_sock *so, struct pfq_shmem_descr *shmem);
+
+extern void pfq_tx_inflight_add(struct pfq_tx_inflight *inf, int index, int buffer, int value);
+extern void pfq_tx_inflight_put(struct pfq_tx_inflight *inf);
+
+
+static inline
+void pfq_tx_inflight_get(struct pfq_tx_inflight *inf)
+{
+	kref_get(&inf->ref);
+}
+
+
+static inline
+int pfq_tx_inflight_read(struct pfq_tx_inflight *inf, int index, int buffer)
+{
+	return READ_ONCE(inf->count[1 + index][buffer & 1]);
+}
 
 
 static inline size_t pfq_mpsc_queue_mem(struct pfq_sock *so)
@@ -72,38 +91,29 @@ int pfq_mpsc_queue_index(struct pfq_sock *p)
 
 
 
+/* the layout of the queues comes from the kernel copy published with them:
+ * producers that loaded the queues before a resize keep a consistent view */
+
 static inline
-void * pfq_sock_rx_queue_mem(struct pfq_sock *so)
+void * pfq_shared_rx_queue_mem(struct pfq_queue_layout const *ql)
 {
-	struct pfq_shared_queue *sq = pfq_sock_shared_queue(so);
-	if (unlikely(sq == NULL))
-		return NULL;
-
-	return (void *)sq + sizeof(struct pfq_shared_queue);
+	return (void *)ql->addr + sizeof(struct pfq_shared_queue);
 }
 
 
 static inline
-void *pfq_sock_tx_queue_mem(struct pfq_sock *so, int index)
+void * pfq_shared_tx_queue_mem(struct pfq_queue_layout const *ql, int index)
 {
-	struct pfq_shared_queue *sq = pfq_sock_shared_queue(so);
-	if (unlikely(sq == NULL))
-		return NULL;
-
-	return (void *)sq + sizeof(struct pfq_shared_queue)
-			  + pfq_mpsc_queue_mem(so)
-			  + pfq_spsc_queue_mem(so) * (1 + index);
+	return (void *)ql->addr + sizeof(struct pfq_shared_queue)
+				+ ql->rx_size * 2
+				+ ql->tx_size * 2 * (1 + index);
 }
 
 
 static inline
-char *pfq_mpsc_slot_ptr(struct pfq_sock *so, size_t qindex, size_t slot)
+char *pfq_mpsc_slot_ptr(struct pfq_queue_layout const *ql, size_t qindex, size_t slot)
 {
-	void *rx_mem = pfq_sock_rx_queue_mem(so);
-	if (!rx_mem)
-		return NULL;
-
-	return (char *)rx_mem + (so->rx_queue_len * (qindex & 1) + slot) * so->rx_slot_size;
+	return (char *)pfq_shared_rx_queue_mem(ql) + (ql->rx_len * (qindex & 1) + slot) * ql->rx_slot_size;
 }
 
 
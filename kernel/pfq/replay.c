@@ -0,0 +1,260 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#include <linux/etherdevice.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <net/checksum.h>
+
+#include <pfq/replay.h>
+#include <pfq/sock.h>
+#include <pfq/thread.h>
+
+
+/* start, stop and stats of the replay of a socket */
+
+static DEFINE_MUTEX(pfq_replay_lock);
+
+
+/* walk the records once: a malformed trace is refused before the Tx
+ * thread is involved */
+
+static int
+pfq_replay_check(struct pfq_sock *so, struct pfq_replay *replay)
+{
+	size_t off = 0, count = 0;
+
+	while (off < replay->opt.size)
+	{
+		struct pfq_replay_pkthdr *hdr = (struct pfq_replay_pkthdr *)(replay->pages.addr + off);
+		size_t caplen;
+
+		if (replay->opt.size - off < sizeof(*hdr) ||
+		    (caplen = READ_ONCE(hdr->caplen)) == 0 || caplen > Q_REPLAY_MAX_CAPLEN ||
+		    Q_REPLAY_RECORD_LEN(caplen) > replay->opt.size - off) {
+			printk(KERN_INFO "[PFQ|%d] Tx replay: bad record #%zu (offset %zu)!\n", so->id, count, off);
+			return -EINVAL;
+		}
+
+		off += Q_REPLAY_RECORD_LEN(caplen);
+		count++;
+	}
+
+	printk(KERN_INFO "[PFQ|%d] Tx replay: %zu records, %zu bytes.\n", so->id, count, off);
+	return 0;
+}
+
+
+static int
+__pfq_replay_start(struct pfq_sock *so, struct pfq_so_tx_replay *opt)
+{
+	struct pfq_replay *replay;
+	int err;
+
+	if (so->replay) {
+		printk(KERN_INFO "[PFQ|%d] Tx replay: already running!\n", so->id);
+		return -EBUSY;
+	}
+
+	if (!opt->user_addr || (opt->user_addr & (PAGE_SIZE-1)) ||
+	    opt->size == 0 || opt->size > opt->user_size) {
+		printk(KERN_INFO "[PFQ|%d] Tx replay: bad trace (addr=%p size=%zu user_size=%zu)!\n",
+		       so->id, (void *)opt->user_addr, opt->size, opt->user_size);
+		return -EINVAL;
+	}
+
+	/* a 1G HugePage is mapped through its page address */
+
+	if (opt->hugepage_size == 1024*1024*1024 && opt->user_size > opt->hugepage_size) {
+		printk(KERN_INFO "[PFQ|%d] Tx replay: trace larger than a 1G HugePage!\n", so->id);
+		return -EINVAL;
+	}
+
+	replay = kzalloc(sizeof(struct pfq_replay), GFP_KERNEL);
+	if (replay == NULL)
+		return -ENOMEM;
+
+	replay->opt = *opt;
+
+	err = pin_HugePages(&replay->pages, so->id, opt->user_addr, opt->user_size, opt->hugepage_size, NUMA_NO_NODE);
+	if (err < 0) {
+		kfree(replay);
+		return err;
+	}
+
+	err = pfq_replay_check(so, replay);
+	if (err < 0)
+		goto err;
+
+	so->replay = replay;
+	smp_wmb();
+
+	err = pfq_bind_tx_thread(opt->tid, so, Q_TX_QUEUE_REPLAY);
+	if (err < 0) {
+		so->replay = NULL;
+		goto err;
+	}
+
+	return 0;
+err:
+	release_HugePages(&replay->pages);
+	kfree(replay);
+	return err;
+}
+
+
+int
+pfq_replay_start(struct pfq_sock *so, struct pfq_so_tx_replay *opt)
+{
+	int err;
+
+	mutex_lock(&pfq_replay_lock);
+	err = __pfq_replay_start(so, opt);
+	mutex_unlock(&pfq_replay_lock);
+	return err;
+}
+
+
+void
+pfq_replay_stop(struct pfq_sock *so)
+{
+	struct pfq_replay *replay;
+
+	mutex_lock(&pfq_replay_lock);
+
+	replay = so->replay;
+	if (replay == NULL) {
+		mutex_unlock(&pfq_replay_lock);
+		return;
+	}
+
+	/* the thread is done with the trace after the grace period of the unbind */
+
+	pfq_unbind_tx_thread_queue(so, Q_TX_QUEUE_REPLAY);
+
+	so->replay = NULL;
+
+	mutex_unlock(&pfq_replay_lock);
+
+	printk(KERN_INFO "[PFQ|%d] Tx replay: stopped at loop %lu (sent=%lu fail=%lu).\n",
+	       so->id, replay->loop, replay->sent, replay->fail);
+
+	release_HugePages(&replay->pages);
+	kfree(replay);
+}
+
+
+void
+pfq_replay_get_stats(struct pfq_sock *so, struct pfq_tx_replay_stats *stats)
+{
+	struct pfq_replay *replay;
+
+	memset(stats, 0, sizeof(*stats));
+
+	mutex_lock(&pfq_replay_lock);
+
+	replay = so->replay;
+	if (replay) {
+		stats->loop = replay->loop;
+		stats->sent = replay->sent;
+		stats->fail = replay->fail;
+		stats->done = replay->done;
+	}
+
+	mutex_unlock(&pfq_replay_lock);
+}
+
+
+/* incremental update of the IP checksum and of the TCP/UDP one (pseudo header) */
+
+static void
+pfq_replay_rewrite_addr(struct iphdr *ip, size_t room, __be32 *addr, __be32 to)
+{
+	size_t ihl = ip->ihl * 4;
+
+	if (!(ip->frag_off & htons(IP_OFFSET))) {
+
+		void *l4 = (char *)ip + ihl;
+
+		if (ip->protocol == IPPROTO_TCP && room >= ihl + sizeof(struct tcphdr)) {
+			csum_replace4(&((struct tcphdr *)l4)->check, *addr, to);
+		}
+		else if (ip->protocol == IPPROTO_UDP && room >= ihl + sizeof(struct udphdr)) {
+			struct udphdr *udp = l4;
+			if (udp->check) {
+				csum_replace4(&udp->check, *addr, to);
+				if (!udp->check)
+					udp->check = CSUM_MANGLED_0;
+			}
+		}
+	}
+
+	csum_replace4(&ip->check, *addr, to);
+	*addr = to;
+}
+
+
+void
+pfq_replay_rewrite(struct pfq_replay *replay, struct sk_buff *skb)
+{
+	unsigned int rewrite = replay->opt.rewrite;
+	struct ethhdr *eth;
+	struct iphdr *ip;
+	size_t room;
+
+	if (!rewrite || skb_headlen(skb) < ETH_HLEN)
+		return;
+
+	eth = (struct ethhdr *)skb->data;
+
+	if (rewrite & Q_REPLAY_REWRITE_MAC_SRC)
+		ether_addr_copy(eth->h_source, replay->opt.mac_src);
+	if (rewrite & Q_REPLAY_REWRITE_MAC_DST)
+		ether_addr_copy(eth->h_dest, replay->opt.mac_dst);
+
+	/* the first loop replays the addresses of the trace */
+
+	if (!(rewrite & (Q_REPLAY_REWRITE_IP_SRC|Q_REPLAY_REWRITE_IP_DST)) || replay->loop == 0)
+		return;
+
+	room = skb_headlen(skb) - ETH_HLEN;
+
+	if (eth->h_proto != htons(ETH_P_IP) || room < sizeof(struct iphdr))
+		return;
+
+	ip = (struct iphdr *)(eth + 1);
+
+	if (ip->ihl < 5 || room < ip->ihl * 4)
+		return;
+
+	if (rewrite & Q_REPLAY_REWRITE_IP_SRC)
+		pfq_replay_rewrite_addr(ip, room, &ip->saddr,
+					htonl(ntohl(ip->saddr) + (uint32_t)replay->loop * replay->opt.ip_src_step));
+	if (rewrite & Q_REPLAY_REWRITE_IP_DST)
+		pfq_replay_rewrite_addr(ip, room, &ip->daddr,
+					htonl(ntohl(ip->daddr) + (uint32_t)replay->loop * replay->opt.ip_dst_step));
+}
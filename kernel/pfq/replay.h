@@ -0,0 +1,62 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#ifndef PFQ_REPLAY_H
+#define PFQ_REPLAY_H
+
+#include <pfq/define.h>
+#include <pfq/shmem.h>
+
+#include <linux/pf_q.h>
+
+
+struct pfq_sock;
+struct sk_buff;
+
+
+/* trace replayed by a Tx thread: the records live in the pinned pages of
+ * the user mapping, the progress is owned by the thread */
+
+struct pfq_replay
+{
+	struct pfq_pages_descr	pages;
+	struct pfq_so_tx_replay	opt;
+
+	size_t			off;		/* next record */
+	unsigned long		loop;
+	uint64_t		loop_start;	/* nsec, departure of the first record of the loop */
+	uint64_t		first_tstamp;	/* tstamp of the first record */
+
+	unsigned long		sent;
+	unsigned long		fail;
+	bool			done;
+};
+
+
+extern int  pfq_replay_start(struct pfq_sock *so, struct pfq_so_tx_replay *opt);
+extern void pfq_replay_stop(struct pfq_sock *so);
+extern void pfq_replay_get_stats(struct pfq_sock *so, struct pfq_tx_replay_stats *stats);
+extern void pfq_replay_rewrite(struct pfq_replay *replay, struct sk_buff *skb);
+
+
+#endif /* PFQ_REPLAY_H */
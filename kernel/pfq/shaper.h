@@ -0,0 +1,96 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ *
+ ****************************************************************/
+
+#ifndef PFQ_SHAPER_H
+#define PFQ_SHAPER_H
+
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/time.h>
+
+#include <linux/pf_q.h>
+
+
+/* token bucket: the credit is kept in tokens x nsec, so that the refill
+ * takes no division (rate and burst up to Q_TX_SHAPER_MAX) */
+
+#define Q_TX_SHAPER_MAX		(U64_MAX / 2 / NSEC_PER_SEC)
+
+struct pfq_tx_shaper
+{
+	uint64_t	rate;		/* tokens per second, 0 = disabled */
+	uint64_t	burst;		/* tokens */
+	int		mode;		/* Q_TX_SHAPER_PACKETS or Q_TX_SHAPER_BYTES */
+	int		drop;
+
+	uint64_t	credit;		/* tokens x NSEC_PER_SEC */
+	uint64_t	last;		/* nsec */
+};
+
+
+static inline
+void pfq_tx_shaper_init(struct pfq_tx_shaper *s, struct pfq_so_tx_shaper const *opt, uint64_t now)
+{
+	s->rate   = opt->rate;
+	s->burst  = opt->burst;
+	s->mode   = opt->mode;
+	s->drop   = opt->drop;
+	s->credit = opt->burst * NSEC_PER_SEC;
+	s->last   = now;
+}
+
+
+static inline
+uint64_t pfq_tx_shaper_cost(struct pfq_tx_shaper const *s, size_t len, int copies)
+{
+	return (s->mode == Q_TX_SHAPER_BYTES ? (uint64_t)len * copies : (uint64_t)copies) * NSEC_PER_SEC;
+}
+
+
+/* refill the bucket and return the nsec to wait for the cost (0 if it can be taken now);
+ * a packet larger than the bucket is taken with the bucket full */
+
+static inline
+uint64_t pfq_tx_shaper_wait(struct pfq_tx_shaper *s, uint64_t cost, uint64_t now)
+{
+	uint64_t max = s->burst * NSEC_PER_SEC;
+	uint64_t elapsed = now > s->last ? now - s->last : 0;
+
+	s->last = now;
+	s->credit = min(s->credit + min_t(uint64_t, elapsed, NSEC_PER_SEC) * s->rate, max);
+
+	if (s->credit >= min(cost, max))
+		return 0;
+
+	return div64_u64(min(cost, max) - s->credit + s->rate - 1, s->rate);
+}
+
+
+static inline
+void pfq_tx_shaper_take(struct pfq_tx_shaper *s, uint64_t cost)
+{
+	s->credit = s->credit > cost ? s->credit - cost : 0;
+}
+
+
+#endif /* PFQ_SHAPER_H */
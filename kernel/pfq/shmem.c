@@ -53,29 +53,13 @@ static const char *__size_HugePage(size_t size)
 }
 
 
-static struct pfq_pages_descr *
-get_HugePages(int id, unsigned long user_addr, size_t user_size, size_t hugepage_size, size_t size)
+int
+pin_HugePages(struct pfq_pages_descr *descr, int id, unsigned long user_addr, size_t user_size, size_t hugepage_size, int node)
 {
-	struct pfq_pages_descr *ret = NULL, *descr;
 	struct page ** hugepages;
 	int nid, pinned, npages;
         void *base_addr;
 
-	mutex_lock(&pfq_pages_mutex);
-
-        descr = &__pfq_hugepages[id];
-        if (descr->addr) {
-		printk(KERN_WARNING "[PFQ] error: get_HugePages[%d]: already in use!\n", id);
-		ret = NULL;
-		goto done;
-	}
-
-	if (size > user_size) {
-		printk(KERN_WARNING "[PFQ] error: could not allocate %zu bytes in HugePages (%zu bytes)!\n", size, hugepage_size);
-		ret = NULL;
-		goto done;
-	}
-
 	npages = (hugepage_size == 1024*1024*1024) ?
 			1 : PAGE_ALIGN(user_size) / PAGE_SIZE;
 
@@ -85,58 +69,52 @@ get_HugePages(int id, unsigned long user_addr, size_t user_size, size_t hugepage
 	hugepages = vmalloc(npages * sizeof(struct page *));
 	if (hugepages == NULL) {
 		printk(KERN_WARNING "[PFQ] error: could not allocate the pages for %s HugePages (%d pages)!\n", __size_HugePage(hugepage_size), npages);
-		ret = NULL;
-		goto done;
+		return -ENOMEM;
 	}
 
 	pinned = get_user_pages_fast(user_addr, npages, 1, hugepages);
 	if (pinned != npages) {
-		vfree(hugepages);
 		printk(KERN_WARNING "[PFQ] error: could not get user HugePages (pinned pages = %d)!\n", pinned);
-		ret = NULL;
-		goto done;
+		while (pinned > 0)
+			put_page(hugepages[--pinned]);
+		vfree(hugepages);
+		return -EFAULT;
 	}
 
+	/* HugePages are placed by the user process (mbind), just check the node */
+
+	nid = page_to_nid(hugepages[0]);
+	if (node != NUMA_NO_NODE && nid != node)
+		printk(KERN_WARNING "[PFQ|%d] HugePages on node %d, consumer on node %d!\n", id, nid, node);
+
 	if (hugepage_size == 1024*1024*1024) {
 		base_addr = page_address(hugepages[0]);
 	}
 	else {
-		nid = page_to_nid(hugepages[0]);
 		base_addr = vm_map_ram(hugepages, npages, nid, PAGE_KERNEL);
 	}
 
 	if (!base_addr) {
+		while (npages > 0)
+			put_page(hugepages[--npages]);
 		vfree(hugepages);
 		printk(KERN_WARNING "[PFQ] error: vm_map_ram: mapping memory failure!\n");
-		ret = NULL;
-		goto done;
+		return -ENOMEM;
 	}
 
-        /* commit the slot */
-
-	ret = descr;
-
-	ret->hugepages = hugepages;
-	ret->npages    = npages;
-	ret->addr      = base_addr;
-	ret->size      = user_size;
-
-done:
-	mutex_unlock(&pfq_pages_mutex);
-	return ret;
+	descr->hugepages = hugepages;
+	descr->npages    = npages;
+	descr->addr      = base_addr;
+	descr->size      = user_size;
+	return 0;
 }
 
 
-static
-int put_HugePages(int id)
+static void
+unpin_HugePages(struct pfq_pages_descr *descr, int id)
 {
-	struct pfq_pages_descr *descr;
 	int i;
 
-	mutex_lock(&pfq_pages_mutex);
-
-	descr = &__pfq_hugepages[id];
-
 	if (current->mm)
 		up_read(&current->mm->mmap_sem);
 
@@ -160,12 +138,297 @@ int put_HugePages(int id)
 	descr->npages = 0;
 	descr->addr = NULL;
 	descr->size = 0;
+}
 
+
+/* release pinned pages outside the mmap path (no mmap_sem held) */
+
+void
+release_HugePages(struct pfq_pages_descr *descr)
+{
+	int i;
+
+	if (!descr->hugepages)
+		return;
+
+	if (is_vmalloc_addr(descr->addr))
+		vm_unmap_ram(descr->addr, descr->npages);
+
+	for(i = 0; i < descr->npages; i++)
+		put_page(descr->hugepages[i]);
+
+	vfree(descr->hugepages);
+
+	descr->hugepages = NULL;
+	descr->npages = 0;
+	descr->addr = NULL;
+	descr->size = 0;
+}
+
+
+static struct pfq_pages_descr *
+get_HugePages(int id, unsigned long user_addr, size_t user_size, size_t hugepage_size, size_t size, int node)
+{
+	struct pfq_pages_descr *ret = NULL, *descr;
+
+	mutex_lock(&pfq_pages_mutex);
+
+        descr = &__pfq_hugepages[id];
+        if (descr->addr) {
+		printk(KERN_WARNING "[PFQ] error: get_HugePages[%d]: already in use!\n", id);
+		ret = NULL;
+		goto done;
+	}
+
+	if (size > user_size) {
+		printk(KERN_WARNING "[PFQ] error: could not allocate %zu bytes in HugePages (%zu bytes)!\n", size, hugepage_size);
+		ret = NULL;
+		goto done;
+	}
+
+        /* commit the slot */
+
+	if (pin_HugePages(descr, id, user_addr, user_size, hugepage_size, node) == 0)
+		ret = descr;
+
+done:
+	mutex_unlock(&pfq_pages_mutex);
+	return ret;
+}
+
+
+static
+int put_HugePages(int id)
+{
+	mutex_lock(&pfq_pages_mutex);
+	unpin_HugePages(&__pfq_hugepages[id], id);
 	mutex_unlock(&pfq_pages_mutex);
 	return 0;
 }
 
 
+/*
+ * HugePages arena: a region registered once by a socket, in which the
+ * sockets of the same process carve their queues (one region each).
+ */
+
+static struct pfq_arena __pfq_arenas[Q_MAX_ID];
+
+
+static void
+__pfq_arena_put(struct pfq_arena *arena)
+{
+	if (--arena->refcnt == 0) {
+		pr_devel("[PFQ] arena: releasing %zu bytes...\n", arena->pages.size);
+		unpin_HugePages(&arena->pages, arena->owner);
+		arena->mm = NULL;
+		arena->user_addr = 0;
+		arena->owner = -1;
+	}
+}
+
+
+int
+pfq_arena_register(pfq_id_t id, unsigned long user_addr, size_t user_size, size_t hugepage_size)
+{
+	struct pfq_arena *arena = NULL;
+	int n, err = 0;
+
+	if (!user_addr || !user_size || (user_addr & (PAGE_SIZE-1))) {
+		printk(KERN_INFO "[PFQ|%d] arena: invalid memory region!\n", id);
+		return -EINVAL;
+	}
+
+	/* a 1G page is mapped by its linear address: only a single page is contiguous */
+
+	if (hugepage_size == 1024*1024*1024 && user_size > hugepage_size) {
+		printk(KERN_INFO "[PFQ|%d] arena: 1G HugePages arena larger than a page!\n", id);
+		return -EINVAL;
+	}
+
+	mutex_lock(&pfq_pages_mutex);
+
+	for(n = 0; n < Q_MAX_ID; n++)
+	{
+		struct pfq_arena *that = &__pfq_arenas[n];
+
+		if (!that->refcnt) {
+			if (!arena)
+				arena = that;
+			continue;
+		}
+
+		if (that->owner == (int)id) {
+			printk(KERN_INFO "[PFQ|%d] arena: socket already registered an arena!\n", id);
+			err = -EBUSY;
+			goto done;
+		}
+
+		if (that->mm == current->mm &&
+		    user_addr < that->user_addr + that->pages.size &&
+		    that->user_addr < user_addr + user_size) {
+			printk(KERN_INFO "[PFQ|%d] arena: region overlaps arena %d!\n", id, n);
+			err = -EBUSY;
+			goto done;
+		}
+	}
+
+	if (!arena) {
+		err = -ENOMEM;
+		goto done;
+	}
+
+	err = pin_HugePages(&arena->pages, (int)id, user_addr, user_size, hugepage_size, NUMA_NO_NODE);
+	if (err < 0)
+		goto done;
+
+	arena->mm = current->mm;
+	arena->user_addr = user_addr;
+	arena->hugepage_size = hugepage_size;
+	arena->owner = (int)id;
+	arena->refcnt = 1;
+	memset(arena->region, 0, sizeof(arena->region));
+
+	printk(KERN_INFO "[PFQ|%d] arena: %zu bytes registered (%s HugePages).\n", id, user_size, __size_HugePage(hugepage_size));
+done:
+	mutex_unlock(&pfq_pages_mutex);
+	return err;
+}
+
+
+void
+pfq_arena_unregister(pfq_id_t id)
+{
+	int n;
+
+	mutex_lock(&pfq_pages_mutex);
+
+	for(n = 0; n < Q_MAX_ID; n++)
+	{
+		struct pfq_arena *arena = &__pfq_arenas[n];
+		if (arena->refcnt && arena->owner == (int)id) {
+			__pfq_arena_put(arena);
+			break;
+		}
+	}
+
+	mutex_unlock(&pfq_pages_mutex);
+}
+
+
+/* map the queues of a socket at user_addr, if it falls within an arena of the process */
+
+static int
+pfq_arena_map(pfq_id_t id, struct pfq_shmem_descr *shmem, unsigned long user_addr, size_t user_size, size_t req_size)
+{
+	struct pfq_arena *arena = NULL;
+	size_t off;
+	int n, err = 0;
+
+	mutex_lock(&pfq_pages_mutex);
+
+	for(n = 0; n < Q_MAX_ID; n++)
+	{
+		struct pfq_arena *that = &__pfq_arenas[n];
+		if (that->refcnt && that->mm == current->mm &&
+		    user_addr >= that->user_addr &&
+		    user_addr + user_size <= that->user_addr + that->pages.size) {
+			arena = that;
+			break;
+		}
+	}
+
+	if (!arena) {
+		err = -ENOENT;
+		goto done;
+	}
+
+	off = user_addr - arena->user_addr;
+
+	if ((off & (PAGE_SIZE-1)) || req_size > user_size) {
+		printk(KERN_WARNING "[PFQ|%d] arena: could not map %zu bytes at offset %zu (%zu bytes)!\n", id, req_size, off, user_size);
+		err = -EINVAL;
+		goto done;
+	}
+
+	for(n = 0; n < Q_MAX_ID; n++)
+	{
+		if (arena->region[n].size &&
+		    off < arena->region[n].off + arena->region[n].size &&
+		    arena->region[n].off < off + req_size) {
+			printk(KERN_WARNING "[PFQ|%d] arena: region at offset %zu overlaps socket %d!\n", id, off, n);
+			err = -EBUSY;
+			goto done;
+		}
+	}
+
+	arena->region[(int)id].off  = off;
+	arena->region[(int)id].size = req_size;
+	arena->refcnt++;
+
+	shmem->addr  = arena->pages.addr + off;
+	shmem->id    = (int)id;
+	shmem->node  = page_to_nid(arena->pages.hugepages[0]);
+        shmem->size  = req_size;
+	shmem->kind  = pfq_shmem_arena;
+	shmem->arena = (int)(arena - __pfq_arenas);
+        shmem->hugepages_descr = &arena->pages;
+
+	printk(KERN_INFO "[PFQ|%d] mapped memory: %zu bytes at offset %zu of arena %d.\n", (int)id, req_size, off, shmem->arena);
+done:
+	mutex_unlock(&pfq_pages_mutex);
+	return err;
+}
+
+
+static void
+pfq_arena_unmap(struct pfq_shmem_descr *shmem)
+{
+	struct pfq_arena *arena = &__pfq_arenas[shmem->arena];
+
+	mutex_lock(&pfq_pages_mutex);
+
+	arena->region[shmem->id].off  = 0;
+	arena->region[shmem->id].size = 0;
+	__pfq_arena_put(arena);
+
+	mutex_unlock(&pfq_pages_mutex);
+
+	shmem->arena = -1;
+}
+
+
+bool
+pfq_arena_get_stat(int n, struct pfq_arena_stat *stat)
+{
+	struct pfq_arena *arena = &__pfq_arenas[n];
+	bool ret = false;
+	int i;
+
+	mutex_lock(&pfq_pages_mutex);
+
+	if (arena->refcnt) {
+		stat->owner = arena->owner;
+		stat->size = arena->pages.size;
+		stat->hugepage_size = arena->hugepage_size;
+		stat->used = 0;
+		stat->sockets = 0;
+
+		for(i = 0; i < Q_MAX_ID; i++)
+		{
+			if (arena->region[i].size) {
+				stat->used += arena->region[i].size;
+				stat->sockets++;
+			}
+		}
+		ret = true;
+	}
+
+	mutex_unlock(&pfq_pages_mutex);
+	return ret;
+}
+
+
 static int
 pfq_memory_map(struct vm_area_struct *vma, unsigned long size, char *ptr, unsigned int flags, enum pfq_shmem_kind kind)
 {
@@ -181,6 +444,7 @@ pfq_memory_map(struct vm_area_struct *vma, unsigned long size, char *ptr, unsign
 	} break;
 
 	case pfq_shmem_user:
+	case pfq_shmem_arena:
 		break;
 	}
         return 0;
@@ -211,9 +475,9 @@ pfq_mmap(struct file *file, struct socket *sock, struct vm_area_struct *vma)
 
 
 int
-pfq_hugepages_map(pfq_id_t id, struct pfq_shmem_descr *shmem, unsigned long user_addr, size_t user_size, size_t hugepage_size, size_t req_size)
+pfq_hugepages_map(pfq_id_t id, struct pfq_shmem_descr *shmem, unsigned long user_addr, size_t user_size, size_t hugepage_size, size_t req_size, int node)
 {
-        struct pfq_pages_descr * hpages = get_HugePages((int)id, user_addr, user_size, hugepage_size, req_size);
+        struct pfq_pages_descr * hpages = get_HugePages((int)id, user_addr, user_size, hugepage_size, req_size, node);
 
 	if (!hpages) {
 		printk(KERN_WARNING "[PFQ] mapping memory failure.\n");
@@ -222,6 +486,7 @@ pfq_hugepages_map(pfq_id_t id, struct pfq_shmem_descr *shmem, unsigned long user
 
 	shmem->addr = hpages->addr;
 	shmem->id   = (int)id;
+	shmem->node = page_to_nid(hpages->hugepages[0]);
         shmem->size = req_size;
 	shmem->kind = pfq_shmem_user;
         shmem->hugepages_descr = hpages;
@@ -247,15 +512,36 @@ pfq_hugepages_unmap(struct pfq_shmem_descr *shmem)
 }
 
 
+/*
+ * vmalloc_user on a given node: zeroed memory, marked
+ * as mappable to user space (see remap_vmalloc_range).
+ */
+
+static void *
+__vmalloc_user_node(size_t size, int node)
+{
+	struct vm_struct *area;
+	void *addr;
+
+	addr = vzalloc_node(size, node);
+	if (addr) {
+		area = find_vm_area(addr);
+		area->flags |= VM_USERMAP;
+	}
+
+	return addr;
+}
+
+
 int
-pfq_vmalloc_user(pfq_id_t id, struct pfq_shmem_descr *shmem, size_t mem_size)
+pfq_vmalloc_user(pfq_id_t id, struct pfq_shmem_descr *shmem, size_t mem_size, int node)
 {
 	size_t tot_mem = PAGE_ALIGN(mem_size);
         void *addr;
 
-	pr_devel("[PFQ] allocating shared memory...\n");
+	pr_devel("[PFQ] allocating shared memory (node %d)...\n", node);
 
-	addr = vmalloc_user(tot_mem);
+	addr = node == NUMA_NO_NODE ? vmalloc_user(tot_mem) : __vmalloc_user_node(tot_mem, node);
 	if (addr == NULL) {
 		printk(KERN_WARNING "[PFQ] error: shmem: out of memory (vmalloc %zu bytes)!", tot_mem);
 		return -ENOMEM;
@@ -263,6 +549,7 @@ pfq_vmalloc_user(pfq_id_t id, struct pfq_shmem_descr *shmem, size_t mem_size)
 
 	shmem->addr = addr;
 	shmem->id   = (int)id;
+	shmem->node = node;
         shmem->size = tot_mem;
 	shmem->kind = pfq_shmem_virt;
         shmem->hugepages_descr = NULL;
@@ -273,14 +560,20 @@ pfq_vmalloc_user(pfq_id_t id, struct pfq_shmem_descr *shmem, size_t mem_size)
 
 
 int
-pfq_shared_memory_alloc(pfq_id_t id, struct pfq_shmem_descr *shmem, unsigned long user_addr, size_t user_size, size_t hugepage_size, size_t req_size)
+pfq_shared_memory_alloc(pfq_id_t id, struct pfq_shmem_descr *shmem, unsigned long user_addr, size_t user_size, size_t hugepage_size, size_t req_size, int node)
 {
+	/* queues carved out of an arena registered by the process */
+
+	int err = user_addr ? pfq_arena_map(id, shmem, user_addr, user_size, req_size) : -ENOENT;
+	if (err != -ENOENT)
+		return err;
+
 	if (hugepage_size) {
-		if (pfq_hugepages_map(id, shmem, user_addr, user_size, hugepage_size, req_size) < 0)
+		if (pfq_hugepages_map(id, shmem, user_addr, user_size, hugepage_size, req_size, node) < 0)
 			return -ENOMEM;
 	}
 	else {
-		if (pfq_vmalloc_user(id, shmem, req_size) < 0)
+		if (pfq_vmalloc_user(id, shmem, req_size, node) < 0)
 			return -ENOMEM;
 	}
 
@@ -297,11 +590,13 @@ pfq_shared_memory_free(struct pfq_shmem_descr *shmem)
 		{
 			case pfq_shmem_virt: vfree(shmem->addr); break;
 			case pfq_shmem_user: pfq_hugepages_unmap(shmem); break;
+			case pfq_shmem_arena: pfq_arena_unmap(shmem); break;
 		}
 
 		shmem->addr = NULL;
 		shmem->hugepages_descr = NULL;
 		shmem->size = 0;
+		shmem->node = NUMA_NO_NODE;
 
 		pr_devel("[PFQ] shared memory freed.\n");
 	}
@@ -24,6 +24,8 @@
 #ifndef PFQ_SHMEM_H
 #define PFQ_SHMEM_H
 
+#include <pfq/define.h>
+
 #include <linux/vmalloc.h>
 #include <linux/net.h>
 
@@ -33,7 +35,8 @@ struct pfq_sock;
 enum pfq_shmem_kind
 {
 	pfq_shmem_virt,
-	pfq_shmem_user
+	pfq_shmem_user,
+	pfq_shmem_arena
 };
 
 
@@ -49,25 +52,61 @@ struct pfq_pages_descr
 struct pfq_shmem_descr
 {
 	int			id;
+	int			node;
 	void		       *addr;
 	size_t			size;
 	enum pfq_shmem_kind     kind;
+	int			arena;		/* index of the arena (pfq_shmem_arena) */
 	struct pfq_pages_descr *hugepages_descr;
 };
 
 
+struct pfq_arena
+{
+	struct pfq_pages_descr	pages;
+	struct mm_struct       *mm;		/* process the arena belongs to */
+	unsigned long		user_addr;
+	size_t			hugepage_size;
+	int			owner;		/* id of the registering socket, -1 = gone */
+	int			refcnt;		/* owner + sockets with queues in the arena */
+
+	struct
+	{
+		size_t		off;
+		size_t		size;
+	} region[Q_MAX_ID];			/* queues of the sockets (by id) */
+};
+
+
+struct pfq_arena_stat
+{
+	int			owner;
+	int			sockets;
+	size_t			size;
+	size_t			hugepage_size;
+	size_t			used;
+};
+
+
 extern size_t pfq_total_queue_mem(struct pfq_sock *so);
 extern size_t pfq_total_queue_mem_aligned(struct pfq_sock *so);
 
 extern int    pfq_mmap(struct file *file, struct socket *sock, struct vm_area_struct *vma);
-extern int    pfq_vmalloc_user(pfq_id_t, struct pfq_shmem_descr *shmem, size_t size);
+extern int    pfq_vmalloc_user(pfq_id_t, struct pfq_shmem_descr *shmem, size_t size, int node);
 
-extern int    pfq_hugepages_map(pfq_id_t, struct pfq_shmem_descr *shmem, unsigned long user_addr, size_t user_size, size_t hugepage_size, size_t req_size);
+extern int    pfq_hugepages_map(pfq_id_t, struct pfq_shmem_descr *shmem, unsigned long user_addr, size_t user_size, size_t hugepage_size, size_t req_size, int node);
 extern int    pfq_hugepages_unmap(struct pfq_shmem_descr *shmem);
 
 
-extern int    pfq_shared_memory_alloc(pfq_id_t, struct pfq_shmem_descr *shmem, unsigned long user_addr, size_t user_size, size_t huge_size, size_t req_size);
+extern int    pfq_shared_memory_alloc(pfq_id_t, struct pfq_shmem_descr *shmem, unsigned long user_addr, size_t user_size, size_t huge_size, size_t req_size, int node);
 extern void   pfq_shared_memory_free(struct pfq_shmem_descr *shmem);
 
+extern int    pin_HugePages(struct pfq_pages_descr *descr, int id, unsigned long user_addr, size_t user_size, size_t hugepage_size, int node);
+extern void   release_HugePages(struct pfq_pages_descr *descr);
+
+extern int    pfq_arena_register(pfq_id_t id, unsigned long user_addr, size_t user_size, size_t hugepage_size);
+extern void   pfq_arena_unregister(pfq_id_t id);
+extern bool   pfq_arena_get_stat(int n, struct pfq_arena_stat *stat);
+
 
 #endif /* PFQ_SHMEM_H */
@@ -89,16 +89,5 @@ unsigned int pfq_skb_end_offset(const struct sk_buff *skb)
 #endif
 
 
-static inline
-struct sk_buff *
-skb_clone_for_tx(struct sk_buff *skb, struct net_device *dev, gfp_t pri)
-{
-	if (likely(dev->priv_flags & IFF_TX_SKB_SHARING))
-		return skb_get(skb);
-
-	return skb_clone(skb, pri);
-}
-
-
 #endif /* PFQ_SKBUFF_H */
 
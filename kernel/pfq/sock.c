@@ -22,17 +22,24 @@
  ****************************************************************/
 
 #include <pfq/atomic.h>
+#include <pfq/fastpath.h>
 #include <pfq/global.h>
 #include <pfq/kcompat.h>
 #include <pfq/pool.h>
 #include <pfq/printk.h>
 #include <pfq/queue.h>
+#include <pfq/replay.h>
+#include <pfq/shmem.h>
 #include <pfq/sock.h>
 #include <pfq/sock.h>
 #include <pfq/thread.h>
 
 #include <linux/pf_q.h>
 
+#include <linux/cred.h>
+#include <linux/file.h>
+#include <linux/net.h>
+
 void
 pfq_sock_init_once(void)
 {
@@ -64,6 +71,12 @@ void pfq_sock_destruct(struct sock *sk)
 	free_percpu(so->stats);
         so->stats = NULL;
 
+	free_percpu(so->class_stats);
+	so->class_stats = NULL;
+
+	free_percpu(so->pacing_stats);
+	so->pacing_stats = NULL;
+
         skb_queue_purge(&sk->sk_error_queue);
 
         WARN_ON(atomic_read(&sk->sk_rmem_alloc));
@@ -97,6 +110,14 @@ int pfq_sock_counter(void)
 }
 
 
+/* Tx slots can hold a GSO frame, the Rx ones are limited by max_slot_size */
+
+size_t pfq_sock_max_tx_slot_size(void)
+{
+	return max_t(size_t, global->max_slot_size, PFQ_SHARED_QUEUE_SLOT_SIZE(Q_TX_GSO_MAX_LEN));
+}
+
+
 struct pfq_sock *
 pfq_sock_get_by_id(pfq_id_t id)
 {
@@ -127,6 +148,9 @@ void pfq_sock_release_id(pfq_id_t id)
 }
 
 
+static void pfq_sock_detach_expire(struct work_struct *work);
+
+
 int pfq_sock_init(struct pfq_sock *so, pfq_id_t id, size_t caplen, size_t xmitlen)
 {
 	int i;
@@ -151,6 +175,26 @@ int pfq_sock_init(struct pfq_sock *so, pfq_id_t id, size_t caplen, size_t xmitle
 		local_set(&stat->kern, 0);
 	}
 
+	so->class_stats = alloc_percpu(struct pfq_class_counters);
+	if (!so->class_stats) {
+		free_percpu(so->stats);
+		so->stats = NULL;
+		return -ENOMEM;
+	}
+
+	pfq_class_counters_reset(so->class_stats);
+
+	so->pacing_stats = alloc_percpu(struct pfq_pacing_counters);
+	if (!so->pacing_stats) {
+		free_percpu(so->class_stats);
+		so->class_stats = NULL;
+		free_percpu(so->stats);
+		so->stats = NULL;
+		return -ENOMEM;
+	}
+
+	pfq_pacing_counters_reset(so->pacing_stats);
+
 	/* setup id */
 
 	so->id = id;
@@ -168,14 +212,52 @@ int pfq_sock_init(struct pfq_sock *so, pfq_id_t id, size_t caplen, size_t xmitle
         so->shmem.addr = NULL;
         so->shmem.size = 0;
         so->shmem.kind = 0;
+        so->shmem.arena = -1;
+        so->shmem.node = NUMA_NO_NODE;
         so->shmem.hugepages_descr = NULL;
 
+        so->shmem_old.addr = NULL;
+        so->shmem_old.size = 0;
+        so->shmem_old.kind = 0;
+        so->shmem_old.arena = -1;
+        so->shmem_old.node = NUMA_NO_NODE;
+        so->shmem_old.hugepages_descr = NULL;
+
+        so->replay = NULL;
+
+	/* no shaping by default */
+
+	spin_lock_init(&so->tx_shaper_lock);
+	memset(&so->tx_shaper_sock, 0, sizeof(so->tx_shaper_sock));
+	memset(so->tx_shaper, 0, sizeof(so->tx_shaper));
+
+	/* no NUMA preference by default */
+
+	so->numa_node = Q_ANY_NODE;
+
         atomic_long_set(&so->shmem_addr,0);
+        atomic_long_set(&so->shmem_layout,0);
+        so->layout_gen = 0;
+
+	/* released on close by default */
+
+	so->detach.handle = 0;
+	so->detach.timeout = 0;
+	so->detach.detached = false;
+	INIT_DELAYED_WORK(&so->detach.work, pfq_sock_detach_expire);
 
         /* disable tiemstamping by default */
 
         so->tstamp = false;
 
+        /* Tx slots are copied by default */
+
+        so->tx_zerocopy = false;
+
+        /* slots not transmitted are dropped by default */
+
+        so->tx_lossless = false;
+
         /* initialize waitqueue */
 
         pfq_sock_init_waitqueue_head(&so->waitqueue);
@@ -188,6 +270,12 @@ int pfq_sock_init(struct pfq_sock *so, pfq_id_t id, size_t caplen, size_t xmitle
         so->rx_queue_len = 0;
         so->rx_slot_size  = PFQ_SHARED_QUEUE_SLOT_SIZE(caplen);
 
+	/* no Rx slots are reserved by default */
+
+	so->rx_reserved = 0;
+	for(i = 0; i < Q_CLASS_MAX; ++i)
+		so->rx_class_reserve[i] = 0;
+
 	/* Tx queues setup */
 
 	pfq_queue_info_init(&so->tx);
@@ -208,7 +296,7 @@ int pfq_sock_init(struct pfq_sock *so, pfq_id_t id, size_t caplen, size_t xmitle
 
 
 int
-pfq_sock_tx_bind(struct pfq_sock *so, int tid, int ifindex, int qindex)
+pfq_sock_tx_bind(struct pfq_sock *so, int tid, int ifindex, int qindex, int pipe)
 {
 	int queue = (int)so->txq_num_async;
 	int err = 0;
@@ -220,14 +308,15 @@ pfq_sock_tx_bind(struct pfq_sock *so, int tid, int ifindex, int qindex)
 
 	so->tx_async[queue].ifindex = ifindex;
 	so->tx_async[queue].queue = qindex;
+	so->tx_async[queue].pipe = pipe;
+	so->tx_async[queue].tid = tid;
 	so->txq_num_async++;
 
 	smp_wmb();
 
 	if ((err = pfq_bind_tx_thread(tid, so, queue)) < 0)
 	{
-		so->tx_async[queue].ifindex = -1;
-		so->tx_async[queue].queue = -1;
+		pfq_queue_info_init(&so->tx_async[queue]);
 		so->txq_num_async--;
 		return err;
 	}
@@ -241,18 +330,18 @@ pfq_sock_tx_unbind(struct pfq_sock *so)
 {
 	size_t n;
 
-	so->tx.ifindex = -1;
-	so->tx.queue = -1;
+	pfq_queue_info_init(&so->tx);
 
 	/* unbind async Tx queue */
 
 	if (pfq_unbind_tx_thread(so) < 0)
 		return -EPERM;
 
+	pfq_replay_stop(so);
+
 	for(n = 0; n < Q_MAX_TX_QUEUES; ++n)
 	{
-		so->tx_async[n].ifindex = -1;
-		so->tx_async[n].queue = -1;
+		pfq_queue_info_init(&so->tx_async[n]);
 	}
 
 	return 0;
@@ -303,6 +392,7 @@ pfq_sock_disable(struct pfq_sock *so)
 
 		pr_devel("[PFQ|%d] disabling shared queue...\n", so->id);
 		atomic_long_set(&so->shmem_addr, 0);
+		atomic_long_set(&so->shmem_layout, 0);
 
 		msleep(Q_GRACE_PERIOD);
 
@@ -317,4 +407,368 @@ pfq_sock_disable(struct pfq_sock *so)
 }
 
 
+/*
+ * resize the queues of an enabled socket, without disabling it: producers
+ * move to the new queues at a batch boundary, the consumer drains the old
+ * ones and then releases them (pfq_sock_resize_release).
+ */
+
+int
+pfq_sock_resize(struct pfq_sock *so, struct pfq_so_resize const *size)
+{
+	size_t rx_slot_size = PFQ_SHARED_QUEUE_SLOT_SIZE(size->caplen);
+	size_t tx_slot_size = PFQ_SHARED_QUEUE_SLOT_SIZE(size->xmitlen);
+	size_t rx_len = so->rx_len, rx_queue_len = so->rx_queue_len, rx_slot = so->rx_slot_size;
+	size_t tx_len = so->tx_len, tx_queue_len = so->tx_queue_len, tx_slot = so->tx_slot_size;
+	int err;
+
+	if (!atomic_long_read(&so->shmem_addr)) {
+		printk(KERN_INFO "[PFQ|%d] resize: socket not enabled!\n", so->id);
+		return -EPERM;
+	}
+
+	if (so->shmem.kind != pfq_shmem_virt) {
+		printk(KERN_INFO "[PFQ|%d] resize: not supported with HugePages!\n", so->id);
+		return -EOPNOTSUPP;
+	}
+
+	if (so->shmem_old.addr) {
+		printk(KERN_INFO "[PFQ|%d] resize: previous queues not released yet!\n", so->id);
+		return -EBUSY;
+	}
+
+	if (!size->rx_slots || size->rx_slots > Q_MAX_SOCKQUEUE_LEN ||
+	    !size->tx_slots || size->tx_slots > Q_MAX_SOCKQUEUE_LEN) {
+		printk(KERN_INFO "[PFQ|%d] resize: invalid slots (Rx=%zu Tx=%zu, max %d)!\n", so->id,
+		       size->rx_slots, size->tx_slots, Q_MAX_SOCKQUEUE_LEN);
+		return -EPERM;
+	}
+
+	if (rx_slot_size > (size_t)global->max_slot_size ||
+	    tx_slot_size > pfq_sock_max_tx_slot_size()) {
+		printk(KERN_INFO "[PFQ|%d] resize: invalid caplen=%zu/xmitlen=%zu (max slot size = %d/%zu)!\n", so->id,
+		       size->caplen, size->xmitlen, global->max_slot_size, pfq_sock_max_tx_slot_size());
+		return -EPERM;
+	}
+
+	if (so->rx_reserved > size->rx_slots) {
+		printk(KERN_INFO "[PFQ|%d] resize: %zu Rx slots reserved to classes!\n", so->id, so->rx_reserved);
+		return -EINVAL;
+	}
+
+	so->rx_len = size->caplen;
+	so->rx_queue_len = size->rx_slots;
+	so->rx_slot_size = rx_slot_size;
+
+	so->tx_len = size->xmitlen;
+	so->tx_queue_len = size->tx_slots;
+	so->tx_slot_size = tx_slot_size;
+
+	err = pfq_shared_queue_resize(so);
+	if (err < 0) {
+		so->rx_len = rx_len;
+		so->rx_queue_len = rx_queue_len;
+		so->rx_slot_size = rx_slot;
+		so->tx_len = tx_len;
+		so->tx_queue_len = tx_queue_len;
+		so->tx_slot_size = tx_slot;
+		return err;
+	}
+
+	printk(KERN_INFO "[PFQ|%d] resize: Rx %zu -> %zu slots, Tx %zu -> %zu slots.\n", so->id,
+	       rx_queue_len, so->rx_queue_len, tx_queue_len, so->tx_queue_len);
+	return 0;
+}
+
+
+/* the consumer has drained (and unmapped) the queues replaced by a resize */
+
+int
+pfq_sock_resize_release(struct pfq_sock *so)
+{
+	if (!so->shmem_old.addr)
+		return -ENOENT;
+
+	pfq_shared_queue_free(so, &so->shmem_old);
+
+	pr_devel("[PFQ|%d] resize: old queues released.\n", so->id);
+	return 0;
+}
+
+
+/*
+ * close the pipes of the other sockets to this one, before its id can be
+ * reused by a new socket (the caller holds the socket_lock).
+ */
+
+static void
+pfq_sock_close_pipes(struct pfq_sock *so)
+{
+	int n, i;
+
+	for(n = 0; n < Q_MAX_ID; n++)
+	{
+		struct pfq_sock *peer = pfq_sock_get_by_id((__force pfq_id_t)n);
+		if (peer == NULL || peer == so)
+			continue;
+
+		if (peer->tx.pipe == (__force int)so->id)
+			WRITE_ONCE(peer->tx.pipe, Q_TX_PIPE_CLOSED);
+
+		for(i = 0; i < Q_MAX_TX_QUEUES; i++)
+		{
+			if (peer->tx_async[i].pipe == (__force int)so->id)
+				WRITE_ONCE(peer->tx_async[i].pipe, Q_TX_PIPE_CLOSED);
+		}
+	}
+}
+
+
+/*
+ * release the resources of the socket: groups, Tx bindings, shared
+ * memory and id (the caller holds the socket_lock).
+ */
+
+void
+pfq_sock_destroy(struct pfq_sock *so)
+{
+	pr_devel("[PFQ|%d] disabling socket...\n", so->id);
+	pfq_sock_disable(so);
+
+	pfq_fastpath_update(&pfq_key_tstamp, so->tstamp, false);
+	so->tstamp = 0;
+
+	pfq_arena_unregister(so->id);
+
+	/* the pipes are closed before the grace period: no flush still holds the id */
+
+	pfq_sock_close_pipes(so);
+
+	pr_devel("[PFQ|%d] releasing id...\n", so->id);
+	msleep(Q_GRACE_PERIOD);
+	pfq_sock_release_id(so->id);
+}
+
+
+/* detached sockets */
 
+static void
+pfq_sock_detach_expire(struct work_struct *work)
+{
+	struct pfq_sock *so = container_of(to_delayed_work(work), struct pfq_sock, detach.work);
+	bool expired;
+
+	mutex_lock(&global->socket_lock);
+
+	expired = so->detach.detached;
+	if (expired) {
+		printk(KERN_INFO "[PFQ|%d] detached socket (handle %u) expired!\n", so->id, so->detach.handle);
+		so->detach.detached = false;
+		pfq_sock_destroy(so);
+	}
+
+	mutex_unlock(&global->socket_lock);
+
+	/* drop the reference held by pfq_sock_detach */
+
+	if (expired)
+		sock_put(&so->sk);
+}
+
+
+int
+pfq_sock_set_detach(struct pfq_sock *so, unsigned int handle, unsigned int timeout)
+{
+	int n;
+
+	if (handle && (timeout == 0 || timeout > Q_MAX_DETACH_TIMEOUT)) {
+		printk(KERN_INFO "[PFQ|%d] detach: invalid timeout (%u msec)!\n", so->id, timeout);
+		return -EINVAL;
+	}
+
+	/* HugePages are mapped in the address space of the process that closes the socket */
+
+	if (handle && so->shmem.addr && so->shmem.kind != pfq_shmem_virt) {
+		printk(KERN_INFO "[PFQ|%d] detach: not supported with HugePages!\n", so->id);
+		return -EOPNOTSUPP;
+	}
+
+	mutex_lock(&global->socket_lock);
+
+	for(n = 0; handle && n < Q_MAX_ID; n++)
+	{
+		struct pfq_sock *other = pfq_sock_get_by_id((__force pfq_id_t)n);
+		if (other && other != so && other->detach.handle == handle) {
+			mutex_unlock(&global->socket_lock);
+			printk(KERN_INFO "[PFQ|%d] detach: handle %u already in use by socket %d!\n", so->id, handle, n);
+			return -EBUSY;
+		}
+	}
+
+	so->detach.handle = handle;
+	so->detach.timeout = timeout;
+	so->detach.uid = current_euid();
+
+	mutex_unlock(&global->socket_lock);
+	return 0;
+}
+
+
+/*
+ * called on close (with the socket_lock held): if the socket has a handle
+ * and is enabled, keep it alive -- groups, bindings and queues included --
+ * and return true. The socket is released if nobody attaches within the timeout.
+ */
+
+bool
+pfq_sock_detach(struct pfq_sock *so)
+{
+	if (!so->detach.handle)
+		return false;
+
+	if (!atomic_long_read(&so->shmem_addr)) {
+		pr_devel("[PFQ|%d] detach: socket not enabled, releasing...\n", so->id);
+		return false;
+	}
+
+	if (so->shmem.kind != pfq_shmem_virt) {
+		printk(KERN_INFO "[PFQ|%d] detach: not supported with HugePages, releasing...\n", so->id);
+		return false;
+	}
+
+	sock_hold(&so->sk);
+	so->detach.detached = true;
+
+	schedule_delayed_work(&so->detach.work, msecs_to_jiffies(so->detach.timeout));
+
+	printk(KERN_INFO "[PFQ|%d] socket detached (handle %u, timeout %u msec).\n", so->id,
+	       so->detach.handle, so->detach.timeout);
+	return true;
+}
+
+
+/*
+ * take over the detached socket with the given handle: it is grafted on a new
+ * socket and file descriptor (as accept does), the calling socket is left
+ * untouched. Only the user that set the handle, from the same network
+ * namespace, can attach. The new process continues from the last slot
+ * committed in the shared queues.
+ */
+
+int
+pfq_sock_attach(struct socket *sock, unsigned int handle)
+{
+	struct pfq_sock *so = pfq_sk(sock->sk), *dso = NULL;
+	struct socket *newsock;
+	struct file *file;
+	int n, fd, err;
+
+	if (!handle)
+		return -EINVAL;
+
+	/* the descriptor first: the detached socket is claimed only if it can be returned */
+
+	fd = get_unused_fd_flags(0);
+	if (fd < 0)
+		return fd;
+
+	err = sock_create_lite(PF_Q, sock->type, 0, &newsock);
+	if (err < 0) {
+		put_unused_fd(fd);
+		return err;
+	}
+
+	newsock->ops = sock->ops;
+	__module_get(newsock->ops->owner);
+
+	file = sock_alloc_file(newsock, 0, NULL);
+	if (IS_ERR(file)) {
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4,17,0))
+		sock_release(newsock);
+#endif
+		put_unused_fd(fd);
+		return PTR_ERR(file);
+	}
+
+	mutex_lock(&global->socket_lock);
+
+	for(n = 0; n < Q_MAX_ID; n++)
+	{
+		struct pfq_sock *other = pfq_sock_get_by_id((__force pfq_id_t)n);
+		if (other && other->detach.detached && other->detach.handle == handle) {
+			dso = other;
+			break;
+		}
+	}
+
+	if (dso && (!uid_eq(dso->detach.uid, current_euid()) ||
+		    !net_eq(sock_net(&dso->sk), sock_net(sock->sk)))) {
+		printk(KERN_INFO "[PFQ|%d] attach: socket %d (handle %u) owned by another user!\n", so->id, dso->id, handle);
+		dso = NULL;
+	}
+
+	if (!dso) {
+		mutex_unlock(&global->socket_lock);
+		printk(KERN_INFO "[PFQ|%d] attach: no detached socket with handle %u!\n", so->id, handle);
+		fput(file);	/* releases newsock, no sk grafted yet */
+		put_unused_fd(fd);
+		return -ENOENT;
+	}
+
+	/* the reference held by pfq_sock_detach now belongs to newsock */
+
+	dso->detach.detached = false;
+
+	mutex_unlock(&global->socket_lock);
+
+	cancel_delayed_work_sync(&dso->detach.work);
+
+	printk(KERN_INFO "[PFQ|%d] attaching to socket %d (handle %u)...\n", so->id, dso->id, handle);
+
+	sock_reset_flag(&dso->sk, SOCK_DEAD);
+	sock_graft(&dso->sk, newsock);
+
+	/* as pfq_create: released by the close of the new descriptor */
+
+	down_read(&global->symtable_sem);
+
+	fd_install(fd, file);
+	return fd;
+}
+
+
+/* release the detached sockets (module unload) */
+
+void
+pfq_sock_detach_flush(void)
+{
+	struct pfq_sock *detached[Q_MAX_ID];
+	int n, count = 0;
+
+	mutex_lock(&global->socket_lock);
+
+	for(n = 0; n < Q_MAX_ID; n++)
+	{
+		struct pfq_sock *so = pfq_sock_get_by_id((__force pfq_id_t)n);
+		if (so && so->detach.detached) {
+			so->detach.detached = false;
+			detached[count++] = so;
+		}
+	}
+
+	mutex_unlock(&global->socket_lock);
+
+	for(n = 0; n < count; n++)
+	{
+		cancel_delayed_work_sync(&detached[n]->detach.work);
+
+		mutex_lock(&global->socket_lock);
+		pfq_sock_destroy(detached[n]);
+		mutex_unlock(&global->socket_lock);
+
+		sock_put(&detached[n]->sk);
+	}
+
+	if (count)
+		printk(KERN_INFO "[PFQ] %d detached socket(s) released.\n", count);
+}
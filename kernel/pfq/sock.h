@@ -25,17 +25,22 @@
 #define PFQ_SOCK_H
 
 #include <pfq/atomic.h>
+#include <pfq/bitops.h>
 #include <pfq/define.h>
 #include <pfq/endpoint.h>
 #include <pfq/kcompat.h>
 #include <pfq/pool.h>
+#include <pfq/shaper.h>
 #include <pfq/shmem.h>
 #include <pfq/sock.h>
 #include <pfq/stats.h>
 #include <pfq/thread.h>
 #include <pfq/types.h>
 
+#include <linux/kref.h>
+#include <linux/spinlock.h>
 #include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #ifdef __KERNEL__
 #include <net/sock.h>
@@ -49,10 +54,15 @@ pfq_sk(struct sock *sk)
 }
 
 
+struct pfq_replay;
+
+
 struct pfq_queue_info
 {
 	int	ifindex;
 	int	queue;
+	int	pipe;		/* id of the socket at the other end of a pipe, -1 = device, Q_TX_PIPE_CLOSED */
+	int	tid;		/* Tx thread of an async queue, -1 = sync */
 };
 
 
@@ -61,9 +71,53 @@ void pfq_queue_info_init(struct pfq_queue_info *info)
 {
 	info->ifindex = -1;
 	info->queue = -1;
+	info->pipe = -1;
+	info->tid = -1;
 }
 
 
+/* a socket with a handle survives the close for timeout msec,
+ * waiting for a new process to attach to it */
+
+struct pfq_sock_detach
+{
+	unsigned int		handle;
+	unsigned int		timeout;
+	kuid_t			uid;		/* owner that set the handle */
+	bool			detached;
+	struct delayed_work	work;
+};
+
+
+/* zero-copy Tx slots still referenced by the skbs of the drivers, per Tx
+ * queue (sync, then async) and buffer. The counters in the shared memory are
+ * a copy for the user space, written under lock while the queues are mapped
+ * (addr != NULL). Each skb in flight holds a reference. */
+
+struct pfq_tx_inflight
+{
+	struct kref		ref;
+	spinlock_t		lock;
+	struct pfq_shared_queue *addr;
+	int			count[1 + Q_MAX_TX_QUEUES][2];
+};
+
+
+/* layout of a generation of the shared queues: the headers in the shared
+ * memory are written for the user space only, the kernel never reads them */
+
+struct pfq_queue_layout
+{
+	struct pfq_shared_queue *addr;
+	size_t			rx_len;
+	size_t			rx_slot_size;
+	size_t			rx_size;
+	size_t			tx_size;
+	size_t			tx_slot_size;
+	struct pfq_tx_inflight	*tx_inflight;
+};
+
+
 struct pfq_sock
 {
         struct sock		sk;
@@ -74,6 +128,9 @@ struct pfq_sock
         int			egress_queue;
 	int			weight;
 	int			tstamp;
+	int			tx_zerocopy;
+	int			tx_lossless;
+	int			numa_node;
 
 	size_t			rx_len;
 	size_t			tx_len;
@@ -81,6 +138,9 @@ struct pfq_sock
 	size_t			rx_queue_len;
 	size_t			rx_slot_size;
 
+	size_t			rx_reserved;			/* total Rx slots reserved to classes */
+	size_t			rx_class_reserve[Q_CLASS_MAX];
+
 	size_t			tx_queue_len;
 	size_t			tx_slot_size;
 
@@ -96,7 +156,23 @@ struct pfq_sock
 
 	atomic_long_t		shmem_addr;
 
+	atomic_long_t		shmem_layout;			/* layout of the queues at shmem_addr */
+	struct pfq_queue_layout layout[2];			/* current and previous generation */
+	unsigned int		layout_gen;
+
+	struct pfq_shmem_descr  shmem_old;			/* queues drained by the consumer after a resize */
+
+	struct pfq_sock_detach	detach;
+
+	struct pfq_replay      *replay;				/* trace replayed by a Tx thread */
+
+	spinlock_t		tx_shaper_lock;			/* socket bucket and configuration */
+	struct pfq_tx_shaper	tx_shaper_sock;
+	struct pfq_tx_shaper	tx_shaper[Q_MAX_TX_QUEUES + 1];	/* sync queue, async queues */
+
         pfq_sock_stats_t __percpu *stats;
+	struct pfq_class_counters __percpu *class_stats;
+	struct pfq_pacing_counters __percpu *pacing_stats;
 
 } ____pfq_cacheline_aligned;
 
@@ -120,6 +196,39 @@ pfq_sock_get_tx_queue_info(struct pfq_sock *so, int index)
 }
 
 
+/* token bucket of a Tx queue (-1 = sync queue) */
+
+static inline
+struct pfq_tx_shaper *
+pfq_sock_tx_shaper(struct pfq_sock *so, int index)
+{
+	return &so->tx_shaper[index + 1];
+}
+
+
+/* Rx watermark for a packet of the given classes, in a queue of rx_len slots:
+ * slots reserved to other classes are not available to it. */
+
+static inline
+size_t pfq_sock_rx_class_watermark(struct pfq_sock const *so, size_t rx_len, unsigned long class_mask)
+{
+	size_t reserve = 0;
+	unsigned long bit;
+
+	pfq_bitwise_foreach(class_mask, bit,
+	{
+		size_t r = so->rx_class_reserve[pfq_ctz(bit)];
+		if (r > reserve)
+			reserve = r;
+	});
+
+	if (so->rx_reserved - reserve >= rx_len)
+		return 0;
+
+	return rx_len - (so->rx_reserved - reserve);
+}
+
+
 /* get queues headers */
 
 static inline
@@ -130,6 +239,14 @@ pfq_sock_shared_queue(struct pfq_sock *so)
 }
 
 
+static inline
+struct pfq_queue_layout *
+pfq_sock_queue_layout(struct pfq_sock *so)
+{
+	return (struct pfq_queue_layout *) atomic_long_read(&so->shmem_layout);
+}
+
+
 static inline
 struct pfq_shared_rx_queue *
 pfq_sock_rx_shared_queue(struct pfq_sock *so)
@@ -141,6 +258,16 @@ pfq_sock_rx_shared_queue(struct pfq_sock *so)
 }
 
 
+static inline
+struct pfq_shared_tx_queue *
+pfq_shared_tx_queue(struct pfq_shared_queue *sq, int index)
+{
+	if (index == -1)
+		return (struct pfq_shared_tx_queue *)&sq->tx;
+	return (struct pfq_shared_tx_queue *)&sq->tx_async[index];
+}
+
+
 static inline
 struct pfq_shared_tx_queue *
 pfq_sock_tx_shared_queue(struct pfq_sock *so, int index)
@@ -148,9 +275,7 @@ pfq_sock_tx_shared_queue(struct pfq_sock *so, int index)
 	struct pfq_shared_queue *sq = pfq_sock_shared_queue(so);
 	if (unlikely(sq == NULL))
 		return NULL;
-	if (index == -1)
-		return (struct pfq_shared_tx_queue *)&sq->tx;
-	return (struct pfq_shared_tx_queue *)&sq->tx_async[index];
+	return pfq_shared_tx_queue(sq, index);
 }
 
 
@@ -163,12 +288,21 @@ extern pfq_id_t pfq_sock_get_free_id(struct pfq_sock * so);
 extern int	pfq_sock_init(struct pfq_sock *so, pfq_id_t id, size_t caplen, size_t xmitlen);
 extern struct	pfq_sock * pfq_sock_get_by_id(pfq_id_t id);
 extern int	pfq_sock_counter(void);
+extern size_t	pfq_sock_max_tx_slot_size(void);
 extern void	pfq_sock_release_id(pfq_id_t id);
-extern int	pfq_sock_tx_bind(struct pfq_sock *so, int tid, int if_index, int queue);
+extern int	pfq_sock_tx_bind(struct pfq_sock *so, int tid, int if_index, int queue, int pipe);
 extern int	pfq_sock_tx_unbind(struct pfq_sock *so);
 
 extern int	pfq_sock_enable(struct pfq_sock *so, struct pfq_so_enable *mem);
 extern int	pfq_sock_disable(struct pfq_sock *so);
+extern void	pfq_sock_destroy(struct pfq_sock *so);
+extern int	pfq_sock_resize(struct pfq_sock *so, struct pfq_so_resize const *size);
+extern int	pfq_sock_resize_release(struct pfq_sock *so);
+
+extern int	pfq_sock_set_detach(struct pfq_sock *so, unsigned int handle, unsigned int timeout);
+extern bool	pfq_sock_detach(struct pfq_sock *so);
+extern int	pfq_sock_attach(struct socket *sock, unsigned int handle);	/* new fd */
+extern void	pfq_sock_detach_flush(void);
 
 
 #endif /* PFQ_SOCK_H */
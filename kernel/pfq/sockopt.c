@@ -27,6 +27,7 @@
 #include <pfq/bpf.h>
 #include <pfq/devmap.h>
 #include <pfq/endpoint.h>
+#include <pfq/fastpath.h>
 #include <pfq/global.h>
 #include <pfq/group.h>
 #include <pfq/io.h>
@@ -35,6 +36,7 @@
 #include <pfq/percpu.h>
 #include <pfq/printk.h>
 #include <pfq/queue.h>
+#include <pfq/replay.h>
 #include <pfq/sock.h>
 #include <pfq/sockopt.h>
 #include <pfq/stats.h>
@@ -60,6 +62,26 @@ int pfq_getsockopt(struct socket *sock,
         switch(optname)
         {
 
+        case Q_SO_ATTACH:
+        {
+                struct pfq_so_attach attach;
+
+                if (len != sizeof(attach))
+                        return -EINVAL;
+
+                if (copy_from_user(&attach, optval, sizeof(attach)))
+                        return -EFAULT;
+
+                attach.fd = pfq_sock_attach(sock, attach.handle);
+                if (attach.fd < 0)
+                        return attach.fd;
+
+                /* the descriptor is already installed: it is not undone on a fault */
+
+                if (copy_to_user(optval, &attach, sizeof(attach)))
+                        return -EFAULT;
+        } break;
+
         case Q_SO_GROUP_JOIN:
         {
                 struct pfq_so_group_join group;
@@ -207,6 +229,14 @@ int pfq_getsockopt(struct socket *sock,
                         return -EFAULT;
         } break;
 
+        case Q_SO_GET_TX_ASYNC:
+        {
+                if (len != sizeof(so->txq_num_async))
+                        return -EINVAL;
+                if (copy_to_user(optval, &so->txq_num_async, sizeof(so->txq_num_async)))
+                        return -EFAULT;
+        } break;
+
         case Q_SO_GET_GROUPS:
         {
                 unsigned long grps;
@@ -293,6 +323,121 @@ int pfq_getsockopt(struct socket *sock,
                         return -EFAULT;
         } break;
 
+        case Q_SO_GET_GROUP_STEER_STATS:
+        {
+                struct pfq_group *group;
+                struct pfq_steer_stats stat;
+                pfq_gid_t gid;
+
+                if (len != sizeof(stat))
+                        return -EINVAL;
+
+                if (copy_from_user(&stat, optval, sizeof(stat)))
+                        return -EFAULT;
+
+                gid = (__force pfq_gid_t)stat.gid;
+
+                group = pfq_group_get(gid);
+                if (group == NULL) {
+                        printk(KERN_INFO "[PFQ|%d] group error: invalid group id %d!\n", so->id, gid);
+                        return -EFAULT;
+                }
+
+		if (pfq_group_is_free(gid)) {
+                        printk(KERN_INFO "[PFQ|%d] group steer stats error: gid=%d is a free group!\n",
+                               so->id, gid);
+                        return -EACCES;
+		}
+
+                if (!pfq_group_access(gid, so->id)) {
+                        printk(KERN_INFO "[PFQ|%d] group steer stats error: gid=%d permission denied!\n",
+                               so->id, gid);
+                        return -EACCES;
+                }
+
+		pfq_steer_counters_read(group->steer_stats, &stat);
+
+                if (copy_to_user(optval, &stat, sizeof(stat)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GROUP_GET_RETA:
+        {
+                struct pfq_so_group_reta ureta;
+                pfq_gid_t gid;
+                int err;
+
+                if (len != sizeof(ureta))
+                        return -EINVAL;
+
+                if (copy_from_user(&ureta, optval, sizeof(ureta)))
+                        return -EFAULT;
+
+                gid = (__force pfq_gid_t)ureta.gid;
+
+                if (!pfq_group_access(gid, so->id)) {
+                        printk(KERN_INFO "[PFQ|%d] group reta error: gid=%d permission denied!\n",
+                               so->id, ureta.gid);
+                        return -EACCES;
+                }
+
+                err = pfq_group_get_reta(gid, &ureta);
+                if (err < 0)
+                        return err;
+
+                if (copy_to_user(optval, &ureta, sizeof(ureta)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_RX_CLASS_STATS:
+        {
+                struct pfq_class_stats stat;
+
+                if (len != sizeof(stat))
+                        return -EINVAL;
+
+		pfq_class_counters_read(so->class_stats, &stat);
+
+                if (copy_to_user(optval, &stat, sizeof(stat)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_TX_PACING_STATS:
+        {
+                struct pfq_tx_pacing_stats stat;
+
+                if (len != sizeof(stat))
+                        return -EINVAL;
+
+		pfq_pacing_counters_read(so->pacing_stats, &stat);
+
+                if (copy_to_user(optval, &stat, sizeof(stat)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_TX_REPLAY_STATS:
+        {
+                struct pfq_tx_replay_stats stat;
+
+                if (len != sizeof(stat))
+                        return -EINVAL;
+
+		pfq_replay_get_stats(so, &stat);
+
+                if (copy_to_user(optval, &stat, sizeof(stat)))
+                        return -EFAULT;
+        } break;
+
+        case Q_SO_GET_NUMA_NODE:
+        {
+                int node = atomic_long_read(&so->shmem_addr) ? so->shmem.node : so->numa_node;
+
+                if (len != sizeof(node))
+                        return -EINVAL;
+                if (copy_to_user(optval, &node, sizeof(node)))
+                        return -EFAULT;
+        } break;
+
         case Q_SO_GET_WEIGHT:
         {
                 if (len != sizeof(so->weight))
@@ -472,11 +617,41 @@ int pfq_setsockopt(struct socket *sock,
                         return -EFAULT;
 
                 tstamp = tstamp ? 1 : 0;
+
+                pfq_fastpath_update(&pfq_key_tstamp, so->tstamp, tstamp);
                 so->tstamp = tstamp;
 
                 pr_devel("[PFQ|%d] timestamp enabled.\n", so->id);
         } break;
 
+        case Q_SO_TX_ZEROCOPY:
+        {
+                int value;
+                if (optlen != sizeof(value))
+                        return -EINVAL;
+
+                if (copy_from_user(&value, optval, optlen))
+                        return -EFAULT;
+
+                so->tx_zerocopy = value ? 1 : 0;
+
+                pr_devel("[PFQ|%d] Tx zero-copy %s.\n", so->id, so->tx_zerocopy ? "enabled" : "disabled");
+        } break;
+
+        case Q_SO_TX_LOSSLESS:
+        {
+                int value;
+                if (optlen != sizeof(value))
+                        return -EINVAL;
+
+                if (copy_from_user(&value, optval, optlen))
+                        return -EFAULT;
+
+                so->tx_lossless = value ? 1 : 0;
+
+                pr_devel("[PFQ|%d] Tx lossless %s.\n", so->id, so->tx_lossless ? "enabled" : "disabled");
+        } break;
+
         case Q_SO_SET_RX_LEN:
         {
                 typeof(so->rx_len) caplen;
@@ -516,6 +691,19 @@ int pfq_setsockopt(struct socket *sock,
                         return -EPERM;
                 }
 
+                /* the queues of an enabled socket are changed by Q_SO_RESIZE */
+
+                if (atomic_long_read(&so->shmem_addr)) {
+                        printk(KERN_INFO "[PFQ|%d] Rx slots: socket enabled!\n", so->id);
+                        return -EBUSY;
+                }
+
+                if (slots < so->rx_reserved) {
+                        printk(KERN_INFO "[PFQ|%d] invalid Rx slots=%zu (%zu reserved to classes)\n",
+                               so->id, slots, so->rx_reserved);
+                        return -EPERM;
+                }
+
                 so->rx_queue_len = slots;
 
                 pr_devel("[PFQ|%d] rx_queue: slots=%zu\n", so->id, so->rx_queue_len);
@@ -553,8 +741,8 @@ int pfq_setsockopt(struct socket *sock,
 
 		tx_slot_size = PFQ_SHARED_QUEUE_SLOT_SIZE(xmitlen);
 
-                if (tx_slot_size > (size_t)global->max_slot_size) {
-                        printk(KERN_INFO "[PFQ|%d] invalid xmitlen=%zu (max slot size = %d)\n", so->id, xmitlen, global->max_slot_size);
+                if (tx_slot_size > pfq_sock_max_tx_slot_size()) {
+                        printk(KERN_INFO "[PFQ|%d] invalid xmitlen=%zu (max Tx slot size = %zu)\n", so->id, xmitlen, pfq_sock_max_tx_slot_size());
                         return -EPERM;
                 }
 
@@ -592,6 +780,263 @@ int pfq_setsockopt(struct socket *sock,
 
         } break;
 
+        case Q_SO_SET_RX_CLASS_RESERVE:
+        {
+                struct pfq_so_class_reserve res;
+                size_t reserved = so->rx_reserved;
+                unsigned long bit;
+
+                if (optlen != sizeof(res))
+                        return -EINVAL;
+
+                if (copy_from_user(&res, optval, optlen))
+                        return -EFAULT;
+
+                if (res.class_mask == 0) {
+                        printk(KERN_INFO "[PFQ|%d] class reserve: empty class mask!\n", so->id);
+                        return -EINVAL;
+                }
+
+                /* bounded per class, the total can not wrap */
+
+                if (res.slots > so->rx_queue_len) {
+                        printk(KERN_INFO "[PFQ|%d] class reserve: %zu slots exceed the Rx queue (%zu slots)!\n",
+                               so->id, res.slots, so->rx_queue_len);
+                        return -EPERM;
+                }
+
+                pfq_bitwise_foreach(res.class_mask, bit,
+                {
+                        reserved += res.slots - so->rx_class_reserve[pfq_ctz(bit)];
+                });
+
+                if (reserved > so->rx_queue_len) {
+                        printk(KERN_INFO "[PFQ|%d] class reserve: %zu slots exceed the Rx queue (%zu slots)!\n",
+                               so->id, reserved, so->rx_queue_len);
+                        return -EPERM;
+                }
+
+                pfq_bitwise_foreach(res.class_mask, bit,
+                {
+                        so->rx_class_reserve[pfq_ctz(bit)] = res.slots;
+                });
+
+                so->rx_reserved = reserved;
+
+                pr_devel("[PFQ|%d] class reserve: class_mask=%lx slots=%zu (total reserved %zu)\n",
+                         so->id, res.class_mask, res.slots, so->rx_reserved);
+        } break;
+
+        case Q_SO_SET_NUMA_NODE:
+        {
+                int node;
+
+                if (optlen != sizeof(node))
+                        return -EINVAL;
+
+                if (copy_from_user(&node, optval, optlen))
+                        return -EFAULT;
+
+                if (atomic_long_read(&so->shmem_addr)) {
+                        printk(KERN_INFO "[PFQ|%d] numa node: socket already enabled!\n", so->id);
+                        return -EPERM;
+                }
+
+                if (node != Q_ANY_NODE && node != Q_AUTO_NODE &&
+                    (node < 0 || node >= MAX_NUMNODES || !node_online(node))) {
+                        printk(KERN_INFO "[PFQ|%d] numa node=%d: invalid node!\n", so->id, node);
+                        return -EINVAL;
+                }
+
+                so->numa_node = node;
+
+                pr_devel("[PFQ|%d] numa node set to %d.\n", so->id, node);
+        } break;
+
+        case Q_SO_SET_DETACH:
+        {
+                struct pfq_so_detach detach;
+                int err;
+
+                if (optlen != sizeof(detach))
+                        return -EINVAL;
+
+                if (copy_from_user(&detach, optval, optlen))
+                        return -EFAULT;
+
+                err = pfq_sock_set_detach(so, detach.handle, detach.timeout);
+                if (err < 0)
+                        return err;
+
+                pr_devel("[PFQ|%d] detach: handle=%u timeout=%u msec.\n", so->id, detach.handle, detach.timeout);
+        } break;
+
+        case Q_SO_ARENA_REGISTER:
+        {
+                struct pfq_so_enable mem;
+
+                if (optlen != sizeof(mem))
+                        return -EINVAL;
+
+                if (copy_from_user(&mem, optval, optlen))
+                        return -EFAULT;
+
+                return pfq_arena_register(so->id, mem.user_addr, mem.user_size, mem.hugepage_size);
+        }
+
+        case Q_SO_RESIZE:
+        {
+                struct pfq_so_resize size;
+
+                if (optlen != sizeof(size))
+                        return -EINVAL;
+
+                if (copy_from_user(&size, optval, optlen))
+                        return -EFAULT;
+
+                return pfq_sock_resize(so, &size);
+        }
+
+        case Q_SO_RESIZE_RELEASE:
+        {
+                return pfq_sock_resize_release(so);
+        }
+
+        case Q_SO_GROUP_SET_RETA:
+        {
+                struct pfq_so_group_reta ureta;
+                struct pfq_group_reta *reta = NULL;
+                unsigned long sock_mask;
+                unsigned int n;
+                pfq_gid_t gid;
+
+                if (optlen != sizeof(ureta))
+                        return -EINVAL;
+
+                if (copy_from_user(&ureta, optval, optlen))
+                        return -EFAULT;
+
+		gid = (__force pfq_gid_t)ureta.gid;
+
+		if (!pfq_group_has_joined(gid, so->id)) {
+                        printk(KERN_INFO "[PFQ|%d] reta: gid=%d not joined!\n", so->id, ureta.gid);
+			return -EACCES;
+		}
+
+                if (ureta.size > Q_MAX_RETA_SIZE || (ureta.size & (ureta.size - 1))) {
+                        printk(KERN_INFO "[PFQ|%d] reta error: invalid size=%u (power of 2, max %d)!\n",
+                               so->id, ureta.size, Q_MAX_RETA_SIZE);
+                        return -EINVAL;
+                }
+
+                if (ureta.size) {
+
+                        sock_mask = pfq_group_get_all_sock_mask(gid);
+
+                        reta = kmalloc(sizeof(struct pfq_group_reta) + ureta.size, GFP_KERNEL);
+                        if (reta == NULL) {
+                                printk(KERN_INFO "[PFQ|%d] reta: out of memory!\n", so->id);
+                                return -ENOMEM;
+                        }
+
+                        reta->size = ureta.size;
+
+                        for(n = 0; n < ureta.size; n++)
+                        {
+                                int id;
+                                if (copy_from_user(&id, &ureta.table[n], sizeof(id))) {
+                                        kfree(reta);
+                                        return -EFAULT;
+                                }
+
+                                if (id < 0 || id >= Q_MAX_ID || !(sock_mask & (1UL << id))) {
+                                        printk(KERN_INFO "[PFQ|%d] reta error: bucket %u -> id=%d not in gid=%d!\n",
+                                               so->id, n, id, ureta.gid);
+                                        kfree(reta);
+                                        return -EINVAL;
+                                }
+
+                                reta->id[n] = (int8_t)id;
+                        }
+                }
+
+                pfq_group_set_reta(gid, reta);
+
+                pr_devel("[PFQ|%d] reta of %u buckets set for gid=%d\n", so->id, ureta.size, ureta.gid);
+        } break;
+
+        case Q_SO_GROUP_FLOW_EXPORT:
+        {
+                struct pfq_so_group_flow_export fexp;
+                pfq_gid_t gid;
+                int err;
+
+                if (optlen != sizeof(fexp))
+                        return -EINVAL;
+
+                if (copy_from_user(&fexp, optval, optlen))
+                        return -EFAULT;
+
+		gid = (__force pfq_gid_t)fexp.gid;
+
+		if (!pfq_group_has_joined(gid, so->id)) {
+                        printk(KERN_INFO "[PFQ|%d] flow export: gid=%d not joined!\n", so->id, fexp.gid);
+			return -EACCES;
+		}
+
+                if (fexp.active_timeout && fexp.active_timeout < fexp.idle_timeout) {
+                        printk(KERN_INFO "[PFQ|%d] flow export error: active timeout (%u) < idle timeout (%u) msec!\n",
+                               so->id, fexp.active_timeout, fexp.idle_timeout);
+                        return -EINVAL;
+                }
+
+                if (fexp.idle_timeout && so->rx_len < sizeof(struct pfq_flow_record)) {
+                        printk(KERN_INFO "[PFQ|%d] flow export error: caplen=%zu too small for flow records (%zu bytes)!\n",
+                               so->id, so->rx_len, sizeof(struct pfq_flow_record));
+                        return -EINVAL;
+                }
+
+                err = pfq_group_set_flow_export(gid, fexp.idle_timeout, fexp.active_timeout);
+                if (err < 0) {
+                        printk(KERN_INFO "[PFQ|%d] flow export: error %d for gid=%d!\n", so->id, err, fexp.gid);
+                        return err;
+                }
+
+                pr_devel("[PFQ|%d] flow-record export %s for gid=%d (idle=%u active=%u msec)\n",
+			 so->id, (fexp.idle_timeout ? "enabled" : "disabled"), fexp.gid,
+			 fexp.idle_timeout, fexp.active_timeout);
+        } break;
+
+        case Q_SO_GROUP_STEER_DYNAMIC:
+        {
+                struct pfq_so_group_steer steer;
+                pfq_gid_t gid;
+
+                if (optlen != sizeof(steer))
+                        return -EINVAL;
+
+                if (copy_from_user(&steer, optval, optlen))
+                        return -EFAULT;
+
+		gid = (__force pfq_gid_t)steer.gid;
+
+		if (!pfq_group_has_joined(gid, so->id)) {
+                        printk(KERN_INFO "[PFQ|%d] steer dynamic: gid=%d not joined!\n", so->id, steer.gid);
+			return -EACCES;
+		}
+
+                if (steer.threshold > 100) {
+                        printk(KERN_INFO "[PFQ|%d] steer dynamic error: invalid threshold=%u%% for gid=%d!\n",
+                               so->id, steer.threshold, steer.gid);
+                        return -EINVAL;
+                }
+
+                pfq_group_set_steer_threshold(gid, steer.threshold);
+
+                pr_devel("[PFQ|%d] load-aware steering %s for gid=%d (threshold=%u%%)\n",
+			 so->id, (steer.threshold ? "enabled" : "disabled"), steer.gid, steer.threshold);
+        } break;
+
         case Q_SO_GROUP_LEAVE:
         {
                 pfq_gid_t gid;
@@ -652,14 +1097,14 @@ int pfq_setsockopt(struct socket *sock,
                                 return -EINVAL;
                         }
 
-                        pfq_group_set_filter(gid, filter);
+                        pfq_group_set_filter(gid, filter, pfq_sk_filter_fingerprint(filter));
 
                         pr_devel("[PFQ|%d] fprog: gid=%d (fprog len %d bytes)\n",
 				 so->id, fprog.gid, fprog.fcode.len);
                 }
                 else {
 			/* reset the filter */
-                        pfq_group_set_filter(gid, NULL);
+                        pfq_group_set_filter(gid, NULL, 0);
                         pr_devel("[PFQ|%d] fprog: gid=%d (resetting filter)\n", so->id, fprog.gid);
                 }
 
@@ -770,7 +1215,7 @@ int pfq_setsockopt(struct socket *sock,
 
 		if (bind.tid >= 0) /* async queues */
 		{
-			int err = pfq_sock_tx_bind(so, bind.tid, bind.ifindex, bind.qindex);
+			int err = pfq_sock_tx_bind(so, bind.tid, bind.ifindex, bind.qindex, -1);
 			if (err < 0) {
 				return err;
 			}
@@ -781,6 +1226,7 @@ int pfq_setsockopt(struct socket *sock,
 		{
 			so->tx.ifindex = bind.ifindex;
 			so->tx.queue = bind.qindex;
+			so->tx.pipe = -1;
 			pr_devel("[PFQ|%d] Tx bind: if_index=%d qindex=%d\n", so->id,
 				so->tx.ifindex,
 				so->tx.queue);
@@ -788,11 +1234,180 @@ int pfq_setsockopt(struct socket *sock,
 
         } break;
 
+        case Q_SO_TX_BIND_PIPE:
+        {
+                struct pfq_so_tx_pipe pipe;
+		pfq_id_t id;
+
+                if (optlen != sizeof(pipe))
+                        return -EINVAL;
+
+                if (copy_from_user(&pipe, optval, optlen))
+                        return -EFAULT;
+
+		if (pipe.tid < -1) {
+			printk(KERN_INFO "[PFQ|%d] Tx pipe: invalid thread index (%d)!\n", so->id, pipe.tid);
+			return -EPERM;
+		}
+
+		if (pipe.tid >= 0 &&
+		    so->txq_num_async >= Q_MAX_TX_QUEUES) {
+			printk(KERN_INFO "[PFQ|%d] Tx pipe: max number of sock queues exceeded!\n", so->id);
+			return -EPERM;
+		}
+
+		id = (__force pfq_id_t)pipe.id;
+
+		/* the peer cannot be released while the pipe is bound (see pfq_sock_close_pipes) */
+
+		mutex_lock(&global->socket_lock);
+
+		if (pipe.id < 0 || pipe.id >= Q_MAX_ID || pfq_sock_get_by_id(id) == NULL) {
+			mutex_unlock(&global->socket_lock);
+			printk(KERN_INFO "[PFQ|%d] Tx pipe: invalid socket id=%d\n", so->id, pipe.id);
+			return -EINVAL;
+		}
+
+		/* the sockets at the two ends must have joined a common group */
+
+		if (!(pfq_group_get_groups(so->id) & pfq_group_get_groups(id))) {
+			mutex_unlock(&global->socket_lock);
+			printk(KERN_INFO "[PFQ|%d] Tx pipe: no group shared with socket id=%d!\n", so->id, pipe.id);
+			return -EACCES;
+		}
+
+		if (pipe.tid >= 0) /* async queues */
+		{
+			int err = pfq_sock_tx_bind(so, pipe.tid, -1, -1, pipe.id);
+			if (err < 0) {
+				mutex_unlock(&global->socket_lock);
+				return err;
+			}
+		}
+		else /* sync queue */
+		{
+			so->tx.ifindex = -1;
+			so->tx.queue = -1;
+			WRITE_ONCE(so->tx.pipe, pipe.id);
+		}
+
+		mutex_unlock(&global->socket_lock);
+
+		pr_devel("[PFQ|%d] Tx[%d] pipe: socket id=%d\n", so->id, pipe.tid, pipe.id);
+
+        } break;
+
 	case Q_SO_TX_UNBIND:
 	{
 		pfq_sock_tx_unbind(so);
         } break;
 
+        case Q_SO_TX_DOORBELL:
+        {
+		int queue;
+
+		if (optlen != sizeof(queue))
+			return -EINVAL;
+
+		if (copy_from_user(&queue, optval, optlen))
+			return -EFAULT;
+
+		if (queue < 0 || queue >= (int)so->txq_num_async) {
+			printk(KERN_INFO "[PFQ|%d] Tx doorbell: bad queue %d!\n", so->id, queue);
+			return -EPERM;
+		}
+
+		pfq_tx_thread_doorbell(so->tx_async[queue].tid);
+        } break;
+
+        case Q_SO_TX_THREAD_START:
+        case Q_SO_TX_THREAD_PIN:
+        {
+		struct pfq_so_tx_thread thread;
+
+		if (optlen != sizeof(thread))
+			return -EINVAL;
+
+		if (copy_from_user(&thread, optval, optlen))
+			return -EFAULT;
+
+		if (optname == Q_SO_TX_THREAD_START)
+			return pfq_tx_thread_start(thread.tid, thread.cpu);
+
+		return pfq_tx_thread_pin(thread.tid, thread.cpu);
+        }
+
+        case Q_SO_TX_THREAD_STOP:
+        {
+		int tid;
+
+		if (optlen != sizeof(tid))
+			return -EINVAL;
+
+		if (copy_from_user(&tid, optval, optlen))
+			return -EFAULT;
+
+		return pfq_tx_thread_stop(tid);
+        }
+
+        case Q_SO_TX_REPLAY:
+        {
+		struct pfq_so_tx_replay replay;
+
+		if (optlen != sizeof(replay))
+			return -EINVAL;
+
+		if (copy_from_user(&replay, optval, optlen))
+			return -EFAULT;
+
+		if (pfq_sock_shared_queue(so) == NULL) {
+			printk(KERN_INFO "[PFQ|%d] Tx replay: socket not enabled!\n", so->id);
+			return -EPERM;
+		}
+
+		return pfq_replay_start(so, &replay);
+        }
+
+        case Q_SO_TX_REPLAY_STOP:
+        {
+		pfq_replay_stop(so);
+        } break;
+
+        case Q_SO_TX_SHAPER:
+        {
+		struct pfq_so_tx_shaper opt;
+		struct pfq_tx_shaper *shaper;
+
+		if (optlen != sizeof(opt))
+			return -EINVAL;
+
+		if (copy_from_user(&opt, optval, optlen))
+			return -EFAULT;
+
+		if (opt.queue < Q_TX_SHAPER_SOCKET || opt.queue >= Q_MAX_TX_QUEUES) {
+			printk(KERN_INFO "[PFQ|%d] Tx shaper: bad queue %d!\n", so->id, opt.queue);
+			return -EINVAL;
+		}
+
+		if ((opt.mode != Q_TX_SHAPER_PACKETS && opt.mode != Q_TX_SHAPER_BYTES) ||
+		    opt.rate > Q_TX_SHAPER_MAX || opt.burst > Q_TX_SHAPER_MAX ||
+		    (opt.rate && opt.burst == 0)) {
+			printk(KERN_INFO "[PFQ|%d] Tx shaper: bad bucket (mode=%d rate=%llu burst=%llu)!\n",
+			       so->id, opt.mode, (unsigned long long)opt.rate, (unsigned long long)opt.burst);
+			return -EINVAL;
+		}
+
+		shaper = opt.queue == Q_TX_SHAPER_SOCKET ? &so->tx_shaper_sock : pfq_sock_tx_shaper(so, opt.queue);
+
+		spin_lock_bh(&so->tx_shaper_lock);
+		pfq_tx_shaper_init(shaper, &opt, (uint64_t)ktime_to_ns(ktime_get_real()));
+		spin_unlock_bh(&so->tx_shaper_lock);
+
+		pr_devel("[PFQ|%d] Tx shaper: queue %d rate=%llu burst=%llu %s%s.\n", so->id, opt.queue,
+			 (unsigned long long)opt.rate, (unsigned long long)opt.burst,
+			 opt.mode == Q_TX_SHAPER_BYTES ? "bytes" : "packets", opt.drop ? " (drop)" : "");
+        } break;
+
         case Q_SO_TX_QUEUE_XMIT:
         {
 		int queue;
@@ -810,7 +1425,8 @@ int pfq_setsockopt(struct socket *sock,
 
 		if (queue == 0) { /* transmit Tx queue */
 
-			tx_response_t tx = pfq_sk_queue_xmit(so, -1, Q_NO_KTHREAD);
+			uint64_t departure;
+			tx_response_t tx = pfq_sk_queue_xmit(so, -1, Q_NO_KTHREAD, NULL, &departure);
 
 			sparse_add(so->stats, sent, tx.ok);
 			sparse_add(so->stats, fail, tx.fail);
@@ -70,6 +70,78 @@ void pfq_group_counters_reset(struct pfq_group_counters __percpu *counters)
 }
 
 
+void pfq_class_counters_read(struct pfq_class_counters __percpu *counters, struct pfq_class_stats *stats)
+{
+	int n;
+	for(n = 0; n < Q_CLASS_MAX; n++)
+		stats->drop[n] = (long unsigned)sparse_read(counters, drop[n]);
+}
+
+
+void pfq_class_counters_reset(struct pfq_class_counters __percpu *counters)
+{
+	int i, n;
+	for_each_present_cpu(i)
+	{
+		struct pfq_class_counters * ctr = per_cpu_ptr(counters, i);
+		for(n = 0; n < Q_CLASS_MAX; n++)
+			local_set(&ctr->drop[n], 0);
+	}
+}
+
+
+void pfq_pacing_counters_read(struct pfq_pacing_counters __percpu *counters, struct pfq_tx_pacing_stats *stats)
+{
+	int n;
+	stats->deferred = (long unsigned)sparse_read(counters, deferred);
+	for(n = 0; n < Q_TX_PACING_BUCKETS; n++)
+		stats->late[n] = (long unsigned)sparse_read(counters, late[n]);
+	stats->held   = (long unsigned)sparse_read(counters, held);
+	stats->shaped = (long unsigned)sparse_read(counters, shaped);
+	stats->zerocopy = (long unsigned)sparse_read(counters, zerocopy);
+}
+
+
+void pfq_pacing_counters_reset(struct pfq_pacing_counters __percpu *counters)
+{
+	int i, n;
+	for_each_present_cpu(i)
+	{
+		struct pfq_pacing_counters * ctr = per_cpu_ptr(counters, i);
+		local_set(&ctr->deferred, 0);
+		for(n = 0; n < Q_TX_PACING_BUCKETS; n++)
+			local_set(&ctr->late[n], 0);
+		local_set(&ctr->held, 0);
+		local_set(&ctr->shaped, 0);
+		local_set(&ctr->zerocopy, 0);
+	}
+}
+
+
+void pfq_steer_counters_read(struct pfq_steer_counters __percpu *counters, struct pfq_steer_stats *stats)
+{
+	stats->flows = (long unsigned)sparse_read(counters, flows);
+	stats->moves = (long unsigned)sparse_read(counters, moves);
+	stats->stuck = (long unsigned)sparse_read(counters, stuck);
+	stats->untracked = (long unsigned)sparse_read(counters, untracked);
+}
+
+
+void pfq_steer_counters_reset(struct pfq_steer_counters __percpu *counters)
+{
+	int i;
+	for_each_present_cpu(i)
+	{
+		struct pfq_steer_counters * ctr = per_cpu_ptr(counters, i);
+
+		local_set(&ctr->flows, 0);
+		local_set(&ctr->moves, 0);
+		local_set(&ctr->stuck, 0);
+		local_set(&ctr->untracked, 0);
+	}
+}
+
+
 void pfq_memory_stats_reset(struct pfq_memory_stats __percpu *stats)
 {
 	int i;
@@ -56,6 +56,31 @@ struct pfq_group_counters
 };
 
 
+struct pfq_class_counters
+{
+	local_t drop[Q_CLASS_MAX];
+};
+
+
+struct pfq_pacing_counters
+{
+	local_t deferred;
+	local_t late[Q_TX_PACING_BUCKETS];
+	local_t held;
+	local_t shaped;
+	local_t zerocopy;
+};
+
+
+struct pfq_steer_counters
+{
+	local_t flows;
+	local_t moves;
+	local_t stuck;
+	local_t untracked;
+};
+
+
 struct pfq_memory_stats
 {
 	local_t os_alloc;
@@ -113,6 +138,12 @@ struct pfq_pool_stats
 extern void pfq_kernel_stats_read(struct pfq_kernel_stats __percpu *kstats, struct pfq_stats *stats);
 extern void pfq_kernel_stats_reset(struct pfq_kernel_stats __percpu *stats);
 extern void pfq_group_counters_reset(struct pfq_group_counters __percpu *counters);
+extern void pfq_class_counters_read(struct pfq_class_counters __percpu *counters, struct pfq_class_stats *stats);
+extern void pfq_class_counters_reset(struct pfq_class_counters __percpu *counters);
+extern void pfq_pacing_counters_read(struct pfq_pacing_counters __percpu *counters, struct pfq_tx_pacing_stats *stats);
+extern void pfq_pacing_counters_reset(struct pfq_pacing_counters __percpu *counters);
+extern void pfq_steer_counters_read(struct pfq_steer_counters __percpu *counters, struct pfq_steer_stats *stats);
+extern void pfq_steer_counters_reset(struct pfq_steer_counters __percpu *counters);
 extern void pfq_memory_stats_reset(struct pfq_memory_stats __percpu *stats);
 
 static inline void pfq_global_stats_reset(struct pfq_kernel_stats __percpu *stats)
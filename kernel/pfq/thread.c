@@ -33,21 +33,28 @@
 #include <linux/kthread.h>
 #include <linux/mutex.h>
 #include <linux/jiffies.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/cpumask.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0))
+#include <linux/sched/clock.h>
+#endif
 
 
 static DEFINE_MUTEX(pfq_thread_tx_pool_lock);
 
 
-static struct pfq_thread_tx_data pfq_thread_tx_pool[Q_MAX_CPU] =
-{
-	[0 ... Q_MAX_CPU-1] = {
-		.id	= -1,
-		.cpu    = -1,
-		.task	= NULL,
-		.sock   = {NULL, NULL, NULL, NULL},
-		.sock_queue = {{-1}, {-1}, {-1}, {-1}}
-	}
-};
+/* Tx threads are started at load time (tx_cpu) or at runtime; the data of
+ * a thread is valid as long as its task is running */
+
+static struct pfq_thread_tx_data pfq_thread_tx_pool[Q_MAX_TX_THREADS];
+
+
+static void pfq_tx_rebalance(struct work_struct *work);
+
+static DECLARE_DELAYED_WORK(pfq_tx_rebalance_work, pfq_tx_rebalance);
 
 
 #ifdef PFQ_DEBUG
@@ -64,10 +71,127 @@ pfq_thread_ping(const char *type, struct pfq_thread_data const *data)
 
 
 
+/* sleep until shortly before the departure of the next deferred packet:
+ * the Tx path busy-waits the last Q_TX_PACING_SPIN/2 nsec */
+
+static void
+pfq_tx_thread_sleep_until(uint64_t departure)
+{
+	s64 gap = (s64)(departure - (uint64_t)ktime_to_ns(ktime_get_real())) - Q_TX_PACING_SPIN/2;
+	ktime_t timeout;
+
+	if (gap <= 0)
+		return;
+
+	timeout = ns_to_ktime(min_t(s64, gap, Q_TX_PACING_MAX_SLEEP));
+
+	set_current_state(TASK_INTERRUPTIBLE);
+	schedule_hrtimeout(&timeout, HRTIMER_MODE_REL);
+}
+
+
+/* idle: no queue registered, or nothing to transmit for tx_idle_spin usec */
+
+static bool
+pfq_tx_thread_idle(u64 *idle_since, bool reg)
+{
+	u64 now;
+
+	if (!reg)
+		return true;
+
+	if (global->tx_idle_spin < 0)
+		return false;
+
+	now = local_clock();
+	if (!*idle_since) {
+		*idle_since = now;
+		return global->tx_idle_spin == 0;
+	}
+
+	return now - *idle_since >= (u64)global->tx_idle_spin * NSEC_PER_USEC;
+}
+
+
+/* futex-style flag in the shared Tx queues: a producer finding it set
+ * rings the doorbell of the thread (Q_SO_TX_DOORBELL) */
+
+static void
+pfq_tx_thread_set_sleeping(struct pfq_thread_tx_data *data, int value)
+{
+	int n;
+
+	for(n = 0; n < Q_TX_THREAD_QUEUES; n++)
+	{
+		int sock_queue = atomic_read(&data->sock_queue[n]);
+		struct pfq_sock *sock;
+
+		smp_rmb();
+		sock = data->sock[n];
+
+		if (sock_queue != -1 && sock_queue != Q_TX_QUEUE_REPLAY && sock != NULL) {
+			struct pfq_shared_tx_queue *tx_queue = pfq_sock_tx_shared_queue(sock, sock_queue);
+			if (tx_queue)
+				__atomic_store_n(&tx_queue->cons.sleeping, value, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+
+static bool
+pfq_tx_thread_pending(struct pfq_thread_tx_data *data)
+{
+	int n;
+
+	for(n = 0; n < Q_TX_THREAD_QUEUES; n++)
+	{
+		int sock_queue = atomic_read(&data->sock_queue[n]);
+		struct pfq_sock *sock;
+
+		smp_rmb();
+		sock = data->sock[n];
+
+		if (sock_queue != -1 && sock != NULL && pfq_sk_queue_pending(sock, sock_queue))
+			return true;
+	}
+
+	return false;
+}
+
+
+static void
+pfq_tx_thread_wait(struct pfq_thread_tx_data *data)
+{
+	/* set the flag, then look at the queues once more: a producer
+	 * either sees the flag or its slots are seen here */
+
+	pfq_tx_thread_set_sleeping(data, 1);
+	smp_mb();
+
+	if (!pfq_tx_thread_pending(data)) {
+		data->sleeps++;
+		wait_event_interruptible_timeout(data->waitq,
+						 atomic_read(&data->doorbell) || kthread_should_stop(),
+						 Q_TX_THREAD_SLEEP);
+	}
+
+	if (atomic_xchg(&data->doorbell, 0)) {
+		u64 latency = (u64)ktime_to_ns(ktime_get()) - data->doorbell_ts;
+		data->wakeups++;
+		data->wake_latency += latency;
+		if (latency > data->wake_latency_max)
+			data->wake_latency_max = latency;
+	}
+
+	pfq_tx_thread_set_sleeping(data, 0);
+}
+
+
 static int
 pfq_tx_thread(void *_data)
 {
 	struct pfq_thread_tx_data *data = (struct pfq_thread_tx_data *)_data;
+	u64 idle_since = 0;
 
 #ifdef PFQ_DEBUG
         int now = 0;
@@ -87,8 +211,10 @@ pfq_tx_thread(void *_data)
 		/* transmit the registered socket's queues */
 		bool reg = false;
 		int total_sent = 0, n;
+		uint64_t departure = 0;
+		u64 begin = local_clock();
 
-		for(n = 0; n < Q_MAX_TX_QUEUES; n++)
+		for(n = 0; n < Q_TX_THREAD_QUEUES; n++)
 		{
 			struct pfq_sock *sock;
 			int sock_queue;
@@ -99,9 +225,14 @@ pfq_tx_thread(void *_data)
 			sock = data->sock[n];
 
 			if (sock_queue != -1 && sock != NULL) {
+				uint64_t next;
 				reg = true;
-				tx = pfq_sk_queue_xmit(sock, sock_queue, data->cpu);
+				tx = pfq_sk_queue_xmit(sock, sock_queue, data->cpu, &data->tx_pool, &next);
 				total_sent += tx.ok;
+				data->sock_sent[n] += tx.ok;
+
+				if (next && (!departure || next < departure))
+					departure = next;
 
 				sparse_add(sock->stats,	  sent, tx.ok);
 				sparse_add(sock->stats,   fail, tx.fail);
@@ -110,6 +241,11 @@ pfq_tx_thread(void *_data)
 			}
 		}
 
+		/* utilization: time spent in the passes that transmitted */
+
+		if (total_sent)
+			data->busy += local_clock() - begin;
+
                 if (kthread_should_stop())
                         break;
 
@@ -120,11 +256,22 @@ pfq_tx_thread(void *_data)
 		}
 #endif
 
-		if (total_sent == 0)
-			pfq_relax();
+		/* spin for tx_idle_spin usec, then sleep until a doorbell */
 
-		if (!reg)
-			msleep(1);
+		if (total_sent == 0 && departure) {
+			pfq_tx_thread_sleep_until(departure);
+			idle_since = 0;
+		}
+		else if (total_sent == 0) {
+			if (pfq_tx_thread_idle(&idle_since, reg)) {
+				pfq_tx_thread_wait(data);
+				idle_since = 0;
+			}
+			else
+				pfq_relax();
+		}
+		else
+			idle_since = 0;
 	}
 
         printk(KERN_INFO "[PFQ] Tx[%d] thread stopped on cpu %d.\n", data->id, data->cpu);
@@ -133,36 +280,179 @@ pfq_tx_thread(void *_data)
 }
 
 
+static inline bool
+pfq_tx_thread_running(int tid)
+{
+	return tid >= 0 && tid < Q_MAX_TX_THREADS && pfq_thread_tx_pool[tid].task != NULL;
+}
+
+
+static int
+pfq_tx_thread_free_slot(struct pfq_thread_tx_data *data)
+{
+	int n;
+	for(n = 0; n < Q_TX_THREAD_QUEUES; n++)
+	{
+		if (atomic_read(&data->sock_queue[n]) == -1 && data->sock[n] == NULL)
+			return n;
+	}
+	return -1;
+}
+
+
+static int
+pfq_tx_thread_nr_queues(struct pfq_thread_tx_data *data)
+{
+	int n, ret = 0;
+	for(n = 0; n < Q_TX_THREAD_QUEUES; n++)
+	{
+		if (atomic_read(&data->sock_queue[n]) != -1)
+			ret++;
+	}
+	return ret;
+}
+
+
+/* add a socket queue to a thread (pool lock held) */
+
+static void
+pfq_tx_thread_add(struct pfq_thread_tx_data *data, int n, struct pfq_sock *sock, int sock_queue)
+{
+	data->sock[n] = sock;
+	data->sock_sent[n] = 0;
+	data->sock_sent_prev[n] = 0;
+	if (sock_queue < Q_MAX_TX_QUEUES)
+		sock->tx_async[sock_queue].tid = data->id;
+	smp_wmb();
+	atomic_set(&data->sock_queue[n], sock_queue);
+
+	pfq_tx_thread_doorbell(data->id);
+}
+
+
+/* reserve a slot of a thread for a socket queue being moved (pool lock held):
+ * the slot is not served and not given to other queues until the handover */
+
+static int
+pfq_tx_thread_reserve(struct pfq_thread_tx_data *to, struct pfq_sock *sock)
+{
+	int m = pfq_tx_thread_free_slot(to);
+	if (m != -1)
+		to->sock[m] = sock;
+	return m;
+}
+
+
+/* hand a queue no longer served by its thread over to the reserved slot of
+ * another one (pool lock held) */
+
+static void
+pfq_tx_thread_handover(struct pfq_thread_tx_data *from, int n, struct pfq_thread_tx_data *to, int m,
+		       struct pfq_sock *sock, int sock_queue)
+{
+	atomic_set(&from->sock_queue[n], -1);
+	from->sock[n] = NULL;
+
+	/* the flag was set by the old thread: if left, the producer would ring the doorbell for nothing */
+
+	if (sock_queue != Q_TX_QUEUE_REPLAY) {
+		struct pfq_shared_tx_queue *tx_queue = pfq_sock_tx_shared_queue(sock, sock_queue);
+		if (tx_queue)
+			__atomic_store_n(&tx_queue->cons.sleeping, 0, __ATOMIC_RELAXED);
+	}
+
+	pfq_tx_thread_add(to, m, sock, sock_queue);
+
+	from->migrations++;
+
+	printk(KERN_INFO "[PFQ] sock_id = %d, queue = %d migrated from Tx[%d] to Tx[%d] thread.\n",
+	       sock->id, sock_queue, from->id, to->id);
+}
+
+
+/* a queue moved by the rebalance is served by neither thread for a grace
+ * period (waited without the pool lock), so that the two threads never run
+ * it concurrently. An unbind in the meantime cancels the move. */
+
+struct pfq_tx_thread_move
+{
+	struct pfq_thread_tx_data *from, *to;
+	struct pfq_sock *sock;			/* NULL: no move in progress */
+	int sock_queue;
+	int n, m;
+};
+
+static struct pfq_tx_thread_move pfq_tx_rebalance_move;
+
+
+static int
+pfq_tx_thread_move_start(struct pfq_thread_tx_data *from, int n, struct pfq_thread_tx_data *to)
+{
+	struct pfq_tx_thread_move *move = &pfq_tx_rebalance_move;
+	int m = pfq_tx_thread_reserve(to, from->sock[n]);
+
+	if (m == -1)
+		return -EBUSY;
+
+	move->from = from;
+	move->to = to;
+	move->n = n;
+	move->m = m;
+	move->sock = from->sock[n];
+	move->sock_queue = atomic_read(&from->sock_queue[n]);
+
+	/* stop serving the queue: the slot stays taken until the handover */
+
+	atomic_set(&from->sock_queue[n], -1);
+	smp_wmb();
+	return 0;
+}
+
+
+static void
+pfq_tx_thread_move_cancel(struct pfq_tx_thread_move *move)
+{
+	move->from->sock[move->n] = NULL;
+	move->to->sock[move->m] = NULL;
+	move->sock = NULL;
+}
+
+
+static void
+pfq_tx_thread_move_complete(struct pfq_tx_thread_move *move)
+{
+	if (!move->sock)
+		return; /* cancelled */
+
+	pfq_tx_thread_handover(move->from, move->n, move->to, move->m, move->sock, move->sock_queue);
+	move->sock = NULL;
+}
+
+
 int
 pfq_bind_tx_thread(int tid, struct pfq_sock *sock, int sock_queue)
 {
 	struct pfq_thread_tx_data *thread_data;
 	int n;
 
-	if (tid >= global->tx_cpu_nr) {
-		printk(KERN_INFO "[PFQ] Tx[%d] thread not available (%d Tx threads running)!\n", tid, global->tx_cpu_nr);
+	mutex_lock(&pfq_thread_tx_pool_lock);
+
+	if (!pfq_tx_thread_running(tid)) {
+		mutex_unlock(&pfq_thread_tx_pool_lock);
+		printk(KERN_INFO "[PFQ] Tx[%d] thread not available!\n", tid);
 		return -ESRCH;
 	}
 
 	thread_data = &pfq_thread_tx_pool[tid];
 
-	mutex_lock(&pfq_thread_tx_pool_lock);
-
-	for(n = 0; n < Q_MAX_TX_QUEUES; n++)
-	{
-		if (atomic_read(&thread_data->sock_queue[n]) == -1)
-			break;
-	}
-
-	if (n == Q_MAX_TX_QUEUES) {
+	n = pfq_tx_thread_free_slot(thread_data);
+	if (n == -1) {
 		mutex_unlock(&pfq_thread_tx_pool_lock);
 		printk(KERN_INFO "[PFQ] Tx[%d] thread busy (no queue available)!\n", tid);
 		return -EBUSY;
 	}
 
-	thread_data->sock[n] = sock;
-	smp_wmb();
-	atomic_set(&thread_data->sock_queue[n], sock_queue);
+	pfq_tx_thread_add(thread_data, n, sock, sock_queue);
 
         mutex_unlock(&pfq_thread_tx_pool_lock);
         printk(KERN_INFO "[PFQ] Tx[%d] thread bound to sock_id = %d, queue = %d...\n", tid, sock->id, sock_queue);
@@ -170,21 +460,80 @@ pfq_bind_tx_thread(int tid, struct pfq_sock *sock, int sock_queue)
 }
 
 
+void
+pfq_tx_thread_doorbell(int tid)
+{
+	struct pfq_thread_tx_data *data;
+
+	if (!pfq_tx_thread_running(tid))
+		return;
+
+	data = &pfq_thread_tx_pool[tid];
+
+	atomic_long_inc(&data->doorbells);
+
+	if (!atomic_read(&data->doorbell)) {
+		data->doorbell_ts = (u64)ktime_to_ns(ktime_get());
+		smp_wmb();
+		atomic_set(&data->doorbell, 1);
+	}
+
+	wake_up_interruptible(&data->waitq);
+}
+
+
 int
-pfq_unbind_tx_thread(struct pfq_sock *sock)
+pfq_tx_thread_get_stat(int tid, struct pfq_tx_thread_stat *stat)
+{
+	struct pfq_thread_tx_data *data;
+
+	if (!pfq_tx_thread_running(tid))
+		return 0;
+
+	data = &pfq_thread_tx_pool[tid];
+
+	stat->cpu = data->cpu;
+	stat->queues = pfq_tx_thread_nr_queues(data);
+	stat->util = data->util;
+	stat->migrations = data->migrations;
+	stat->sleeps = data->sleeps;
+	stat->wakeups = data->wakeups;
+	stat->doorbells = (unsigned long)atomic_long_read(&data->doorbells);
+	stat->wake_latency = data->wake_latency;
+	stat->wake_latency_max = data->wake_latency_max;
+	return 1;
+}
+
+
+/* unbind a queue of the socket (sock_queue), or all of them (-1) */
+
+static int
+__pfq_unbind_tx_thread(struct pfq_sock *sock, int sock_queue)
 {
+	struct pfq_tx_thread_move *move = &pfq_tx_rebalance_move;
 	int n, i;
 	mutex_lock(&pfq_thread_tx_pool_lock);
 
-	for(n = 0; n < global->tx_cpu_nr; n++)
+	/* a queue being moved by the rebalance (not served by any thread) */
+
+	if (move->sock == sock && (sock_queue == -1 || move->sock_queue == sock_queue)) {
+		pfq_tx_thread_move_cancel(move);
+		msleep(Q_GRACE_PERIOD);
+	}
+
+	for(n = 0; n < Q_MAX_TX_THREADS; n++)
 	{
 		struct pfq_thread_tx_data *data = &pfq_thread_tx_pool[n];
 
-		for(i = 0; i < Q_MAX_TX_QUEUES; i++)
+		if (!data->task)
+			continue;
+
+		for(i = 0; i < Q_TX_THREAD_QUEUES; i++)
 		{
 			if (atomic_read(&data->sock_queue[i]) != -1)
 			{
-				if (data->sock[i] == sock) {
+				if (data->sock[i] == sock &&
+				    (sock_queue == -1 || atomic_read(&data->sock_queue[i]) == sock_queue)) {
 					atomic_set(&data->sock_queue[i], -1);
 					smp_wmb();
 					msleep(Q_GRACE_PERIOD);
@@ -200,77 +549,365 @@ pfq_unbind_tx_thread(struct pfq_sock *sock)
 
 
 int
-pfq_start_tx_threads(void)
+pfq_unbind_tx_thread(struct pfq_sock *sock)
 {
-	int err = 0;
+	return __pfq_unbind_tx_thread(sock, -1);
+}
 
-	if (global->tx_cpu_nr)
+
+int
+pfq_unbind_tx_thread_queue(struct pfq_sock *sock, int sock_queue)
+{
+	return __pfq_unbind_tx_thread(sock, sock_queue);
+}
+
+
+/*
+ * runtime management of the Tx threads
+ */
+
+int
+pfq_tx_thread_start(int tid, int cpu)
+{
+	struct pfq_thread_tx_data *data;
+	int n, err = 0;
+
+	if (tid < 0 || tid >= Q_MAX_TX_THREADS) {
+		printk(KERN_INFO "[PFQ] Tx[%d] thread: invalid index (max %d)!\n", tid, Q_MAX_TX_THREADS);
+		return -EINVAL;
+	}
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu)) {
+		printk(KERN_INFO "[PFQ] Tx[%d] thread: cpu %d not online!\n", tid, cpu);
+		return -EINVAL;
+	}
+
+	mutex_lock(&pfq_thread_tx_pool_lock);
+
+	data = &pfq_thread_tx_pool[tid];
+
+	if (data->task) {
+		mutex_unlock(&pfq_thread_tx_pool_lock);
+		printk(KERN_INFO "[PFQ] Tx[%d] thread already running on cpu %d!\n", tid, data->cpu);
+		return -EBUSY;
+	}
+
+	data->id = tid;
+	data->cpu = cpu;
+
+	for(n = 0; n < Q_TX_THREAD_QUEUES; n++)
 	{
-		int n, node;
-		printk(KERN_INFO "[PFQ] starting %d Tx thread(s)...\n", global->tx_cpu_nr);
+		atomic_set(&data->sock_queue[n], -1);
+		data->sock[n] = NULL;
+	}
 
-		for(n = 0; n < global->tx_cpu_nr; n++)
-		{
-			struct pfq_thread_tx_data *data = &pfq_thread_tx_pool[n];
-
-			node = global->tx_cpu[n] == -1 ? NUMA_NO_NODE : cpu_to_node(global->tx_cpu[n]);
-
-			data->id = n;
-			data->cpu = global->tx_cpu[n];
-			data->task = kthread_create_on_node(pfq_tx_thread,
-							    data, node,
-							    "kpfq-Tx/%d", data->cpu);
-			if (IS_ERR(data->task)) {
-				printk(KERN_INFO "[PFQ] kernel_thread: create failed on cpu %d!\n",
-				       data->cpu);
-				err = PTR_ERR(data->task);
-				data->task = NULL;
-				return err;
-			}
+	data->busy = 0;
+	data->busy_prev = 0;
+	data->util = 0;
+	data->migrations = 0;
+
+	data->sleeps = 0;
+	data->wakeups = 0;
+	atomic_long_set(&data->doorbells, 0);
+	data->wake_latency = 0;
+	data->wake_latency_max = 0;
+
+	init_waitqueue_head(&data->waitq);
+	atomic_set(&data->doorbell, 0);
+
+#ifdef PFQ_USE_SKB_POOL
+	if (pfq_skb_pool_init_tx(&data->tx_pool, cpu) < 0) {
+		mutex_unlock(&pfq_thread_tx_pool_lock);
+		printk(KERN_INFO "[PFQ] Tx[%d] thread: could not allocate the skb pool!\n", tid);
+		return -ENOMEM;
+	}
+#endif
+
+	data->task = kthread_create_on_node(pfq_tx_thread,
+					    data, cpu_to_node(cpu),
+					    "kpfq-Tx/%d", tid);
+	if (IS_ERR(data->task)) {
+		printk(KERN_INFO "[PFQ] kernel_thread: create failed on cpu %d!\n", cpu);
+		err = PTR_ERR(data->task);
+		data->task = NULL;
+		mutex_unlock(&pfq_thread_tx_pool_lock);
+		return err;
+	}
+
+	kthread_bind(data->task, cpu);
+
+	pr_devel("[PFQ] created Tx[%d] kthread on cpu %d...\n", tid, cpu);
 
-			kthread_bind(data->task, data->cpu);
+	wake_up_process(data->task);
 
-			pr_devel("[PFQ] created Tx[%d] kthread on cpu %d...\n", data->id, data->cpu);
+	mutex_unlock(&pfq_thread_tx_pool_lock);
+	return 0;
+}
+
+
+/* stop a Tx thread: its queues are moved to the least loaded threads, once
+ * the thread has exited (no grace period is required) */
+
+int
+pfq_tx_thread_stop(int tid)
+{
+	struct pfq_thread_tx_data *data, *to[Q_TX_THREAD_QUEUES];
+	int slot[Q_TX_THREAD_QUEUES];
+	int n, i;
+
+	/* no rebalance in progress: its move could involve this thread */
+
+	cancel_delayed_work_sync(&pfq_tx_rebalance_work);
+
+	mutex_lock(&pfq_thread_tx_pool_lock);
+
+	if (!pfq_tx_thread_running(tid)) {
+		mutex_unlock(&pfq_thread_tx_pool_lock);
+		schedule_delayed_work(&pfq_tx_rebalance_work, msecs_to_jiffies(Q_TX_REBALANCE_INTERVAL));
+		return -ESRCH;
+	}
+
+	data = &pfq_thread_tx_pool[tid];
 
-			wake_up_process(data->task);
+	for(n = 0; n < Q_TX_THREAD_QUEUES; n++)
+	{
+		to[n] = NULL;
+
+		if (atomic_read(&data->sock_queue[n]) == -1)
+			continue;
+
+		for(i = 0; i < Q_MAX_TX_THREADS; i++)
+		{
+			struct pfq_thread_tx_data *that = &pfq_thread_tx_pool[i];
+			if (i == tid || !that->task || pfq_tx_thread_free_slot(that) == -1)
+				continue;
+			if (!to[n] || that->util < to[n]->util)
+				to[n] = that;
 		}
+
+		if (!to[n]) {
+			while (n-- > 0)
+				if (to[n])
+					to[n]->sock[slot[n]] = NULL;
+
+			mutex_unlock(&pfq_thread_tx_pool_lock);
+			schedule_delayed_work(&pfq_tx_rebalance_work, msecs_to_jiffies(Q_TX_REBALANCE_INTERVAL));
+			printk(KERN_INFO "[PFQ] Tx[%d] thread: could not migrate its queues!\n", tid);
+			return -EBUSY;
+		}
+
+		slot[n] = pfq_tx_thread_reserve(to[n], data->sock[n]);
 	}
 
+	kthread_stop(data->task);
+
+	for(n = 0; n < Q_TX_THREAD_QUEUES; n++)
+	{
+		if (to[n])
+			pfq_tx_thread_handover(data, n, to[n], slot[n], data->sock[n], atomic_read(&data->sock_queue[n]));
+	}
+
+	data->task = NULL;
+	data->id  = -1;
+	data->cpu = -1;
+
+	mutex_unlock(&pfq_thread_tx_pool_lock);
+
+	schedule_delayed_work(&pfq_tx_rebalance_work, msecs_to_jiffies(Q_TX_REBALANCE_INTERVAL));
+
+	printk(KERN_INFO "[PFQ] Tx[%d] thread stopped.\n", tid);
+	return 0;
+}
+
+
+int
+pfq_tx_thread_pin(int tid, int cpu)
+{
+	struct pfq_thread_tx_data *data;
+	int err;
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_online(cpu)) {
+		printk(KERN_INFO "[PFQ] Tx[%d] thread: cpu %d not online!\n", tid, cpu);
+		return -EINVAL;
+	}
+
+	mutex_lock(&pfq_thread_tx_pool_lock);
+
+	if (!pfq_tx_thread_running(tid)) {
+		mutex_unlock(&pfq_thread_tx_pool_lock);
+		return -ESRCH;
+	}
+
+	data = &pfq_thread_tx_pool[tid];
+
+	err = set_cpus_allowed_ptr(data->task, cpumask_of(cpu));
+	if (!err)
+		data->cpu = cpu;
+
+	mutex_unlock(&pfq_thread_tx_pool_lock);
+
+	if (!err)
+		printk(KERN_INFO "[PFQ] Tx[%d] thread pinned to cpu %d.\n", tid, cpu);
 	return err;
 }
 
 
-void
-pfq_stop_tx_threads(void)
+/*
+ * periodic rebalancing: a queue of a thread above Q_TX_REBALANCE_HIGH
+ * utilization is migrated to the least loaded thread (below
+ * Q_TX_REBALANCE_LOW); the queue moved is the one whose load is closer to
+ * half the difference between the two threads
+ */
+
+static void
+pfq_tx_rebalance(struct work_struct *work)
 {
-	if (global->tx_cpu_nr)
+	struct pfq_thread_tx_data *hot = NULL, *cold = NULL;
+	unsigned long load[Q_TX_THREAD_QUEUES], total;
+	u64 period = (u64)Q_TX_REBALANCE_INTERVAL * NSEC_PER_MSEC;
+	bool moving = false;
+	int n, i, best = -1;
+
+	mutex_lock(&pfq_thread_tx_pool_lock);
+
+	for(n = 0; n < Q_MAX_TX_THREADS; n++)
 	{
-		int n;
+		struct pfq_thread_tx_data *data = &pfq_thread_tx_pool[n];
+		u64 busy;
 
-		printk(KERN_INFO "[PFQ] stopping %d Tx thread(s)...\n", global->tx_cpu_nr);
+		if (!data->task)
+			continue;
 
-		for(n = 0; n < global->tx_cpu_nr; n++)
+		busy = data->busy;
+		data->util = (int)min_t(u64, div64_u64((busy - data->busy_prev) * 100, period), 100);
+		data->busy_prev = busy;
+
+		if (data->util > Q_TX_REBALANCE_HIGH && pfq_tx_thread_nr_queues(data) > 1 &&
+		    (!hot || data->util > hot->util))
+			hot = data;
+
+		if (data->util < Q_TX_REBALANCE_LOW && pfq_tx_thread_free_slot(data) != -1 &&
+		    (!cold || data->util < cold->util))
+			cold = data;
+	}
+
+	if (hot && cold && hot != cold)
+	{
+		long target, diff = LONG_MAX;
+
+		total = 0;
+		for(i = 0; i < Q_TX_THREAD_QUEUES; i++)
 		{
-			struct pfq_thread_tx_data *data = &pfq_thread_tx_pool[n];
+			unsigned long sent = hot->sock_sent[i];
+			load[i] = atomic_read(&hot->sock_queue[i]) != -1 ? sent - hot->sock_sent_prev[i] : 0;
+			total += load[i];
+		}
 
-			if (data->task)
-			{
-				int i;
-				pr_devel("[PFQ stopping Tx[%d] thread@%p\n", data->id, data->task);
+		/* the load of the queues in utilization points */
 
-				kthread_stop(data->task);
-				data->id   = -1;
-				data->cpu  = -1;
-				data->task = NULL;
+		target = (hot->util - cold->util) / 2;
 
-				for(i=0; i < Q_MAX_TX_QUEUES; ++i)
-				{
-					atomic_set(&data->sock_queue[i], -1);
-					data->sock[i] = NULL;
-				}
+		for(i = 0; total && i < Q_TX_THREAD_QUEUES; i++)
+		{
+			long share;
+			if (!load[i])
+				continue;
+			share = (long)(load[i] * (unsigned long)hot->util / total);
+			if (abs(share - target) < diff) {
+				diff = abs(share - target);
+				best = i;
 			}
 		}
+
+		if (best != -1)
+			moving = pfq_tx_thread_move_start(hot, best, cold) == 0;
 	}
+
+	/* per-queue load for the next period */
+
+	for(n = 0; n < Q_MAX_TX_THREADS; n++)
+	{
+		struct pfq_thread_tx_data *data = &pfq_thread_tx_pool[n];
+		if (!data->task)
+			continue;
+		for(i = 0; i < Q_TX_THREAD_QUEUES; i++)
+			data->sock_sent_prev[i] = data->sock_sent[i];
+	}
+
+	mutex_unlock(&pfq_thread_tx_pool_lock);
+
+	/* the grace period of the move, without the pool lock: binds and unbinds go on */
+
+	if (moving) {
+		msleep(Q_GRACE_PERIOD);
+
+		mutex_lock(&pfq_thread_tx_pool_lock);
+		pfq_tx_thread_move_complete(&pfq_tx_rebalance_move);
+		mutex_unlock(&pfq_thread_tx_pool_lock);
+	}
+
+	schedule_delayed_work(&pfq_tx_rebalance_work, msecs_to_jiffies(Q_TX_REBALANCE_INTERVAL));
+}
+
+
+int
+pfq_start_tx_threads(void)
+{
+	int n, err;
+
+	if (global->tx_cpu_nr)
+		printk(KERN_INFO "[PFQ] starting %d Tx thread(s)...\n", global->tx_cpu_nr);
+
+	for(n = 0; n < global->tx_cpu_nr; n++)
+	{
+		if ((err = pfq_tx_thread_start(n, global->tx_cpu[n])) < 0)
+			return err;
+	}
+
+	schedule_delayed_work(&pfq_tx_rebalance_work, msecs_to_jiffies(Q_TX_REBALANCE_INTERVAL));
+	return 0;
+}
+
+
+void
+pfq_stop_tx_threads(void)
+{
+	int n;
+
+	cancel_delayed_work_sync(&pfq_tx_rebalance_work);
+
+	for(n = 0; n < Q_MAX_TX_THREADS; n++)
+	{
+		struct pfq_thread_tx_data *data = &pfq_thread_tx_pool[n];
+
+		if (data->task)
+		{
+			int i;
+			pr_devel("[PFQ stopping Tx[%d] thread@%p\n", data->id, data->task);
+
+			kthread_stop(data->task);
+			data->id   = -1;
+			data->cpu  = -1;
+			data->task = NULL;
+
+			for(i=0; i < Q_TX_THREAD_QUEUES; ++i)
+			{
+				atomic_set(&data->sock_queue[i], -1);
+				data->sock[i] = NULL;
+			}
+		}
+	}
+}
+
+
+/* the skbs of the pools may be held by the drivers until the module is released */
+
+void
+pfq_tx_thread_pool_free_all(void)
+{
+	int n;
+	for(n = 0; n < Q_MAX_TX_THREADS; n++)
+		pfq_skb_pool_free_tx(&pfq_thread_tx_pool[n].tx_pool);
 }
 
 
@@ -280,6 +917,10 @@ pfq_check_threads_affinity(void)
 	bool inuse[Q_MAX_CPU] = {false};
 	int i, cpu;
 
+	if (global->tx_cpu_nr > Q_MAX_TX_THREADS) {
+		printk(KERN_INFO "[PFQ] error: %d Tx threads (max %d)!\n", global->tx_cpu_nr, Q_MAX_TX_THREADS);
+		return -EFAULT;
+	}
 
 	/* check Tx thread affinity */
 
@@ -299,4 +940,3 @@ pfq_check_threads_affinity(void)
 
 	return 0;
 }
-
@@ -25,13 +25,16 @@
 #define PFQ_THREAD_H
 
 #include <pfq/define.h>
+#include <pfq/pool.h>
 
 #include <linux/kthread.h>
 #include <linux/mutex.h>
 #include <linux/rwsem.h>
+#include <linux/wait.h>
 
 
 struct pfq_sock;
+struct pfq_tx_thread_stat;
 
 extern struct task_struct *kthread_tx_pool [Q_MAX_CPU];
 
@@ -39,6 +42,13 @@ extern int  pfq_start_tx_threads(void);
 extern void pfq_stop_tx_threads(void);
 extern int  pfq_bind_tx_thread(int tx_index, struct pfq_sock *sock, int sock_queue);
 extern int  pfq_unbind_tx_thread(struct pfq_sock *sock);
+extern int  pfq_unbind_tx_thread_queue(struct pfq_sock *sock, int sock_queue);
+extern void pfq_tx_thread_doorbell(int tid);
+extern int  pfq_tx_thread_get_stat(int tid, struct pfq_tx_thread_stat *stat);
+extern int  pfq_tx_thread_start(int tid, int cpu);
+extern int  pfq_tx_thread_stop(int tid);
+extern int  pfq_tx_thread_pin(int tid, int cpu);
+extern void pfq_tx_thread_pool_free_all(void);
 
 extern int pfq_check_threads_affinity(void);
 extern int pfq_check_napi_contexts(void);
@@ -59,12 +69,51 @@ struct pfq_thread_tx_data
 
 	/* specific for Tx data */
 
-	struct pfq_sock *	sock[Q_MAX_TX_QUEUES];
-	atomic_t		sock_queue[Q_MAX_TX_QUEUES];
+	struct pfq_sock *	sock[Q_TX_THREAD_QUEUES];
+	atomic_t		sock_queue[Q_TX_THREAD_QUEUES];
+
+	/* skb pool owned by this thread (kept across restarts) */
+
+	struct pfq_skb_pool	tx_pool;
+
+	/* load: packets sent per queue and nsec spent transmitting */
+
+	unsigned long		sock_sent[Q_TX_THREAD_QUEUES];
+	unsigned long		sock_sent_prev[Q_TX_THREAD_QUEUES];
+	u64			busy;
+	u64			busy_prev;
+	int			util;			/* % over the last rebalance interval */
+	unsigned long		migrations;		/* queues given away */
+
+	/* idle: sleep on the waitqueue until a doorbell */
+
+	wait_queue_head_t	waitq;
+	atomic_t		doorbell;
+	u64			doorbell_ts;
+
+	unsigned long		sleeps;
+	unsigned long		wakeups;		/* by a doorbell */
+	atomic_long_t		doorbells;
+	u64			wake_latency;		/* total nsec, doorbell to wakeup */
+	u64			wake_latency_max;
 
 } ____pfq_cacheline_aligned;
 
 
+struct pfq_tx_thread_stat
+{
+	int			cpu;
+	int			queues;
+	int			util;
+	unsigned long		migrations;
+	unsigned long		sleeps;
+	unsigned long		wakeups;
+	unsigned long		doorbells;
+	u64			wake_latency;
+	u64			wake_latency_max;
+};
+
+
 
 static inline
 void pfq_relax(void)
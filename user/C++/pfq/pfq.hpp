@@ -315,6 +315,39 @@ namespace pfq {
         }
 
 
+        //! Open a socket detached by a previous process under the given handle.
+        /*!
+         * The socket continues from the last slot committed in the shared queues.
+         * See set_detach.
+         */
+
+        void
+        attach(unsigned int handle)
+        {
+            if (data_)
+                throw system_error("PFQ: socket already open");
+
+            auto ptr = pfq_attach(handle);
+            if (!ptr)
+                throw system_error(errno, pfq_error(NULL));
+
+            data_.reset(ptr);
+        }
+
+        //! Keep the socket alive for timeout msec after close, under the given handle.
+        /*!
+         * A process can take over the socket by means of attach.
+         * A handle of 0 restores the default behavior.
+         */
+
+        void
+        set_detach(unsigned int handle, unsigned int timeout)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_set_detach(q, handle, timeout));
+        }
+
+
         //! Open the socket with the named-parameter idiom.
         /*!
          * Unspecified parameters are set to default values as
@@ -429,6 +462,45 @@ namespace pfq {
             throw_if(q, pfq_enable(q));
         }
 
+        //! Register a HugePages arena, in which the sockets of the process can place their queues.
+
+        void
+        register_arena(void *addr, size_t size, size_t hugepage_size)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_register_arena(q, addr, size, hugepage_size));
+        }
+
+        //! Return the size of the memory required by the socket queues.
+
+        size_t
+        mem_required() const
+        {
+            auto q = this->data();
+            return as<size_t>(q, pfq_mem_required(q));
+        }
+
+        //! Enable the socket with the queues placed at the given address of a registered arena.
+
+        void
+        enable_arena(void *addr)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_enable_arena(q, addr));
+        }
+
+        //! Resize the Rx and Tx queues of an enabled socket.
+        /*!
+         * Packets left in the old Rx queues are returned by the subsequent reads.
+         */
+
+        void
+        resize(size_t rx_slots, size_t caplen, size_t tx_slots, size_t xmitlen)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_resize(q, rx_slots, caplen, tx_slots, xmitlen));
+        }
+
         //! Disable the socket.
         /*!
          * Release the shared memory, stop kernel threads.
@@ -491,6 +563,42 @@ namespace pfq {
         }
 
 
+        //! Reserve Rx slots to the given classes.
+        /*!
+         * Packets of classes without reservation are dropped first
+         * when the Rx queue is above the watermark.
+         */
+
+        void
+        rx_class_reserve(unsigned long class_mask, size_t slots)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_set_rx_class_reserve(q, class_mask, slots));
+        }
+
+        //! Specify the NUMA node of the consumer.
+        /*!
+         * The node must be set before the socket is enabled.
+         */
+
+        void
+        numa_node(int node)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_set_numa_node(q, node));
+        }
+
+        //! Return the NUMA node of the socket.
+
+        int
+        numa_node() const
+        {
+            int node;
+            auto q = this->data();
+            throw_if(q, pfq_get_numa_node(q, &node));
+            return node;
+        }
+
         //! Specify the capture length of packets, in bytes.
         /*!
          * Capture length must be set before the socket is enabled.
@@ -646,6 +754,97 @@ namespace pfq {
             throw_if(q, pfq_bind_tx(q, dev, queue, tid));
         }
 
+        //! Bind the socket for transmission to the Rx queue of another socket.
+        /*!
+         *  The peer socket (specified by id) must share a group with this one.
+         *  If 'no_kthread' is specified, the pipe is synchronous.
+         */
+
+        void
+        bind_tx_pipe(int id, int tid = no_kthread)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_bind_tx_pipe(q, id, tid));
+        }
+
+        //! Enable/disable zero-copy transmission.
+        /*!
+         * Slots are transmitted as page fragments of the Tx queue, instead of being copied.
+         */
+
+        void
+        tx_zerocopy_enable(bool value)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_tx_zerocopy_enable(q, value));
+        }
+
+        //! Enable/disable lossless transmission.
+        /*!
+         * Tx slots are kept in the queue while the device queue is stopped, instead of being dropped.
+         */
+
+        void
+        tx_lossless_enable(bool value)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_tx_lossless_enable(q, value));
+        }
+
+        //! Start a Tx thread on the given cpu.
+
+        void
+        tx_thread_start(int tid, int cpu)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_tx_thread_start(q, tid, cpu));
+        }
+
+        //! Stop a Tx thread, migrating its queues to the other threads.
+
+        void
+        tx_thread_stop(int tid)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_tx_thread_stop(q, tid));
+        }
+
+        //! Move a Tx thread to another cpu.
+
+        void
+        tx_thread_pin(int tid, int cpu)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_tx_thread_pin(q, tid, cpu));
+        }
+
+        //! Set the token bucket of a Tx queue, or of the socket (see pfq_tx_shaper).
+
+        void
+        tx_shaper(int queue, int mode, uint64_t rate, uint64_t burst, bool drop = false)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_tx_shaper(q, queue, mode, rate, burst, drop));
+        }
+
+        //! Replay a trace from a Tx thread (see pfq_tx_replay).
+
+        void
+        tx_replay(const char *dev, pfq_so_tx_replay replay)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_tx_replay(q, dev, &replay));
+        }
+
+        //! Stop the replay of the trace.
+
+        void
+        tx_replay_stop()
+        {
+            auto q = this->data();
+            throw_if(q, pfq_tx_replay_stop(q));
+        }
+
         //! Unbind the socket transmission.
         /*!
          * Unbind the socket for transmission from any device/queue.
@@ -842,6 +1041,29 @@ namespace pfq {
             return 0;
         }
 
+        //! Wait for room in the Tx queues.
+        /*!
+         * Return true if a Tx queue can take a packet, false on timeout.
+         */
+
+        bool
+        wait_tx_space(long int microseconds = -1 /* infinite */)
+        {
+            struct timespec timeout;
+            struct pollfd fd = {data()->fd, POLLOUT, 0 };
+
+            if (microseconds >= 0) {
+                timeout.tv_sec  = microseconds / 1000000;
+                timeout.tv_nsec = (microseconds % 1000000) * 1000;
+            }
+
+            int ret = ::ppoll(&fd, 1, microseconds < 0 ? nullptr : &timeout, nullptr);
+            if (ret < 0 && errno != EINTR)
+               throw system_error(errno, "PFQ: ppoll error");
+
+            return ret > 0;
+        }
+
         //! Read packets in place.
         /*!
          * Wait for packets and return a 'queue' descriptor, which contains
@@ -900,6 +1122,37 @@ namespace pfq {
                             , qver);
         }
 
+        //! Claim a batch of packets, for multi-consumer reads.
+        /*!
+         * Multiple threads can consume the Rx queue of the same socket,
+         * each claiming at most 'slots' packets at a time. The returned queue
+         * must be given back by means of 'release', once processed.
+         *
+         * Not to be mixed with 'read', 'recv' or 'dispatch'.
+         */
+
+        net_queue
+        claim(size_t slots)
+        {
+            pfq_net_queue nq;
+            auto q = this->data();
+            throw_if(q, pfq_claim(q, &nq, slots));
+            if (nq.len == 0)
+                return net_queue();
+            return net_queue(nq.queue, nq.slot_size, nq.len, nq.index);
+        }
+
+        //! Release the packets claimed by 'claim'.
+
+        void
+        release(net_queue const &nq)
+        {
+            pfq_net_queue tmp;
+            tmp.len = nq.size();
+            auto q = this->data();
+            throw_if(q, pfq_release(q, &tmp));
+        }
+
         //! Return the current commit version (used internally by the memory mapped queue).
 
         pfq_qver_t
@@ -980,6 +1233,56 @@ namespace pfq {
             throw_if(q, pfq_vlan_set_filter(q, gid, vid));
         }
 
+        //! Enable/disable load-aware steering for the given group.
+        /*!
+         * New flows are moved to the least loaded socket when the Rx queue
+         * occupancy (%) of the selected one exceeds the threshold; 0 disables it.
+         */
+
+        void group_steer_dynamic(int gid, unsigned int threshold)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_set_group_steer_dynamic(q, gid, threshold));
+        }
+
+        //! Enable/disable the in-kernel flow-record export mode for the given group.
+        /*!
+         * Packets are accounted in a kernel flow cache and exported as pfq_flow_record
+         * (pfq_pkthdr.info.ifindex == Q_PKTHDR_FLOW_RECORD) when flows expire.
+         * Timeouts are in msec; an idle timeout of 0 disables the mode.
+         */
+
+        void group_flow_export(int gid, unsigned int idle_timeout, unsigned int active_timeout = 0)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_set_group_flow_export(q, gid, idle_timeout, active_timeout));
+        }
+
+        //! Load the steering indirection table of the given group.
+        /*!
+         * Each hash bucket is mapped to a socket id; the size must be a power of 2.
+         * An empty table removes it.
+         */
+
+        void group_reta(int gid, std::vector<int> const &table)
+        {
+            auto q = this->data();
+            throw_if(q, pfq_set_group_reta(q, gid, table.data(), table.size()));
+        }
+
+        //! Return the steering indirection table of the given group.
+
+        std::vector<int>
+        group_reta(int gid) const
+        {
+            std::vector<int> table(Q_MAX_RETA_SIZE);
+            size_t size = table.size();
+            auto q = this->data();
+            throw_if(q, pfq_get_group_reta(q, gid, table.data(), &size));
+            table.resize(size);
+            return table;
+        }
+
         //! Specify the vlan capture filters in the given range.
 
         template <typename Iter>
@@ -1019,6 +1322,39 @@ namespace pfq {
             return stat;
         }
 
+        //! Return the per-class drop counters of the socket.
+
+        pfq_class_stats
+        rx_class_stats() const
+        {
+            pfq_class_stats stat;
+            auto q = this->data();
+            throw_if(q, pfq_get_rx_class_stats(q, &stat));
+            return stat;
+        }
+
+        //! Return the pacing error histogram of the packets sent with a departure time.
+
+        pfq_tx_pacing_stats
+        tx_pacing_stats() const
+        {
+            pfq_tx_pacing_stats stat;
+            auto q = this->data();
+            throw_if(q, pfq_get_tx_pacing_stats(q, &stat));
+            return stat;
+        }
+
+        //! Return the progress of the trace replayed by the kernel.
+
+        pfq_tx_replay_stats
+        tx_replay_stats() const
+        {
+            pfq_tx_replay_stats stat;
+            auto q = this->data();
+            throw_if(q, pfq_get_tx_replay_stats(q, &stat));
+            return stat;
+        }
+
         //! Return the statistics of the given group.
 
         pfq_stats
@@ -1041,6 +1377,17 @@ namespace pfq {
             return std::vector<unsigned long>(std::begin(cs.counter), std::end(cs.counter));
         }
 
+        //! Return the load-aware steering statistics of the given group.
+
+        pfq_steer_stats
+        group_steer_stats(int gid) const
+        {
+            pfq_steer_stats stat;
+            auto q = this->data();
+            throw_if(q, pfq_get_group_steer_stats(q, gid, &stat));
+            return stat;
+        }
+
         //! Return the memory size of the Rx queue.
 
         size_t
@@ -1080,6 +1427,28 @@ namespace pfq {
         }
 
 
+        //! Store a GSO frame and transmit the packets in the queue.
+        /*!
+         * The TCP frame is segmented in gso_size payload chunks by the device (TSO) or by
+         * software GSO; gso_type is Q_TX_GSO_TCPV4 or Q_TX_GSO_TCPV6 (see pfq_send_raw_gso).
+         */
+
+        bool
+        send_gso(const_buffer pkt, unsigned int gso_size, int gso_type, size_t fsync = 1)
+        {
+            retry:
+            auto ret = send_raw(pkt.first, pkt.second, 0, 1, no_kthread, gso_size, gso_type);
+            if (!ret || ++data_->tx_attempt == fsync)
+            {
+                data_->tx_attempt = 0;
+                this->sync_queue(0);
+                if (!ret)
+                    goto retry;
+            }
+            return ret;
+        }
+
+
         //! Transmit the packet asynchronously.
         /*!
          * The transmission is handled by PFQ kernel threads.
@@ -1115,7 +1484,8 @@ namespace pfq {
          * The packet is copied into a Tx queue. If 'async' is true and 'queue' is set to any_queue, a TSS symmetric hash
          * function is used to select the Tx queue. The packet is transmitted at the given timestamp by a PFQ kernel thread.
          * Otherwise the queue is flushed every 'fhint' packets.
-         * A timestamp of 0 nanoseconds means immediate transmission.
+         * A timestamp of 0 nanoseconds means immediate transmission. A gso_size other than 0
+         * transmits a GSO frame (see send_gso).
          */
 
         bool
@@ -1123,11 +1493,16 @@ namespace pfq {
                 , size_t len
                 , uint64_t nsec
                 , unsigned int copies
-                , int async)
+                , int async
+                , unsigned int gso_size = 0
+                , int gso_type = 0)
         {
             if (unlikely(!data_->shm_addr))
                 throw system_error("PFQ: send: socket not enabled");
 
+            if (gso_size && (gso_size > UINT16_MAX || len > Q_TX_GSO_MAX_LEN || len > data_->tx_slot_size - sizeof(struct pfq_pkthdr)))
+                throw system_error("PFQ: send: GSO frame larger than the Tx slot");
+
             ptrdiff_t *poff_addr;
             uint16_t caplen;
             int tss;
@@ -1186,6 +1561,8 @@ namespace pfq {
                 hdr->len              = static_cast<uint16_t>(len);
                 hdr->caplen           = static_cast<uint16_t>(caplen);
                 hdr->info.data.copies = copies;
+                hdr->info.data.gso_size = static_cast<uint16_t>(gso_size);
+                hdr->info.data.gso_type = static_cast<uint16_t>(gso_type);
 
 			    memcpy(hdr+1, buf, caplen);
 
@@ -27,6 +27,7 @@
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 
 #include <net/if.h>
 #include <net/ethernet.h>
@@ -47,6 +48,7 @@
 #include <poll.h>
 
 #include <linux/if_ether.h>
+#include <linux/mempolicy.h>
 #include <linux/pf_q.h>
 
 #include <pfq/pfq.h>
@@ -223,11 +225,131 @@ pfq_open_group(unsigned long class_mask, int group_policy, size_t caplen, size_t
 }
 
 
+/* Rx/Tx queues within the shared memory */
+
+static void
+shared_queue_setup(pfq_t *q)
+{
+	q->rx_queue_addr = (char *)(q->shm_addr) + sizeof(struct pfq_shared_queue);
+	q->rx_queue_size = q->rx_slots * q->rx_slot_size;
+
+	q->tx_queue_addr = (char *)(q->shm_addr) + sizeof(struct pfq_shared_queue) + q->rx_queue_size * 2;
+	q->tx_queue_size = q->tx_slots * q->tx_slot_size;
+
+	q->rx_claim = 0;
+	q->rx_claim_done = 0;
+	q->rx_claim_index = 0;
+	q->rx_claim_lock = 0;
+}
+
+
+pfq_t *
+pfq_attach(unsigned int handle)
+{
+	struct pfq_so_attach attach = { handle, -1 };
+	unsigned long groups = 0;
+	size_t async = 0;
+	socklen_t size;
+	pfq_t *q;
+
+	/* a fresh socket, to ask the kernel for a descriptor of the detached one */
+
+	q = pfq_open_nogroup(64, 1024, 64, 1024);
+	if (q == NULL)
+		return NULL;
+
+	size = sizeof(attach);
+	if (getsockopt(q->fd, PF_Q, Q_SO_ATTACH, &attach, &size) == -1) {
+		close(q->fd);
+		return __error = "PFQ: attach error", free(q), NULL;
+	}
+
+	/* from now on the socket is the detached one */
+
+	close(q->fd);
+	q->fd = attach.fd;
+
+	q->id = PFQ_VERSION_CODE;
+	size = sizeof(q->id);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_ID, &q->id, &size) == -1)
+		goto error;
+
+	size = sizeof(q->rx_slots);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_RX_SLOTS, &q->rx_slots, &size) == -1)
+		goto error;
+
+	size = sizeof(q->rx_slot_size);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_RX_SLOT_SIZE, &q->rx_slot_size, &size) == -1)
+		goto error;
+
+	size = sizeof(q->tx_slots);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_SLOTS, &q->tx_slots, &size) == -1)
+		goto error;
+
+	size = sizeof(q->tx_slot_size);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_SLOT_SIZE, &q->tx_slot_size, &size) == -1)
+		goto error;
+
+	size = sizeof(async);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_ASYNC, &async, &size) == -1)
+		goto error;
+
+	size = sizeof(q->shm_size);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_SHMEM_SIZE, &q->shm_size, &size) == -1)
+		goto error;
+
+	size = sizeof(groups);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_GROUPS, &groups, &size) == -1)
+		goto error;
+
+	q->rx_len = q->rx_slot_size - sizeof(struct pfq_pkthdr);
+	q->tx_len = q->tx_slot_size - sizeof(struct pfq_pkthdr);
+	q->tx_num_async = async;
+	q->gid = groups ? __builtin_ctzl(groups) : -1;
+	q->detach = handle;
+
+	/* map the shared queues (still enabled) */
+
+	q->shm_addr = mmap(NULL, q->shm_size, PROT_READ|PROT_WRITE, MAP_SHARED, q->fd, 0);
+	if (q->shm_addr == MAP_FAILED) {
+		q->shm_addr = NULL;
+		goto error;
+	}
+
+	shared_queue_setup(q);
+	return __error = NULL, q;
+
+error:
+	close(q->fd);
+	return __error = "PFQ: attach: socket info error", free(q), NULL;
+}
+
+
+int
+pfq_set_detach(pfq_t *q, unsigned int handle, unsigned int timeout)
+{
+	struct pfq_so_detach d = { handle, timeout };
+
+	if (handle && (q->shm_hugepages_size || q->arena))
+		return Q_ERROR(q, "PFQ: detach not supported with HugePages");
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_DETACH, &d, sizeof(d)) == -1)
+		return Q_ERROR(q, "PFQ: set detach error");
+
+	q->detach = handle;
+	return Q_OK(q);
+}
+
+
 int pfq_close(pfq_t *q)
 {
 	if (q->fd != -1)
 	{
-		if (q->shm_addr)
+		/* a detached socket keeps its queues: just unmap them */
+
+		if (q->shm_addr && q->detach)
+			munmap(q->shm_addr, q->shm_size);
+		else if (q->shm_addr)
 			pfq_disable(q);
 
 		if (close(q->fd) < 0)
@@ -305,6 +427,32 @@ const char *size_to_string(size_t size)
 }
 
 
+/* bind the HugePages to the NUMA node of the socket, before the
+ * kernel pins them */
+
+static int
+mbind_node(pfq_t *q, void *addr, size_t len)
+{
+	unsigned long mask;
+	unsigned int cpu;
+	int node;
+
+	if (pfq_get_numa_node(q, &node) < 0)
+		return -1;
+
+	if (node == Q_AUTO_NODE) {
+		if (syscall(SYS_getcpu, &cpu, &node, NULL) == -1)
+			return -1;
+	}
+
+	if (node < 0 || node >= (int)(sizeof(mask) << 3))
+		return 0;
+
+	mask = 1UL << node;
+	return (int)syscall(SYS_mbind, addr, len, MPOL_PREFERRED, &mask, sizeof(mask) << 3, 0);
+}
+
+
 int
 pfq_enable(pfq_t *q)
 {
@@ -365,6 +513,10 @@ pfq_enable(pfq_t *q)
 
 		q->shm_hugepages_size = mem.user_size;
 
+		if (mbind_node(q, q->shm_hugepages, mem.user_size) == -1) {
+			fprintf(stdout, "[PFQ] could not bind HugePages to the NUMA node!\n");
+		}
+
 		mem.user_addr = (unsigned long)q->shm_hugepages;
 
 		/* enable socket memory */
@@ -406,12 +558,130 @@ pfq_enable(pfq_t *q)
 		q->shm_hugepages_size = 0;
 	}
 
-	q->rx_queue_addr = (char *)(q->shm_addr) + sizeof(struct pfq_shared_queue);
-	q->rx_queue_size = q->rx_slots * q->rx_slot_size;
+	shared_queue_setup(q);
+	return Q_OK(q);
+}
 
-	q->tx_queue_addr = (char *)(q->shm_addr) + sizeof(struct pfq_shared_queue) + q->rx_queue_size * 2;
-	q->tx_queue_size = q->tx_slots * q->tx_slot_size;
 
+int
+pfq_register_arena(pfq_t *q, void *addr, size_t size, size_t hugepage_size)
+{
+	struct pfq_so_enable mem = { .user_addr = (unsigned long)addr
+				   , .user_size = size
+				   , .hugepage_size = hugepage_size
+				   };
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_ARENA_REGISTER, &mem, sizeof(mem)) == -1)
+		return Q_ERROR(q, "PFQ: arena register error");
+
+	return Q_OK(q);
+}
+
+
+long
+pfq_mem_required(pfq_t const *q)
+{
+	size_t sock_mem; socklen_t size = sizeof(sock_mem);
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_SHMEM_SIZE, &sock_mem, &size) == -1)
+		return Q_ERROR(q, "PFQ: queue memory error");
+
+	return Q_VALUE(q, (long)sock_mem);
+}
+
+
+int
+pfq_enable_arena(pfq_t *q, void *addr)
+{
+	size_t sock_mem; socklen_t size = sizeof(sock_mem);
+	struct pfq_so_enable mem;
+
+	if (q->shm_addr != MAP_FAILED &&
+	    q->shm_addr != NULL) {
+		return Q_ERROR(q, "PFQ: queue already enabled");
+	}
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_SHMEM_SIZE, &sock_mem, &size) == -1) {
+		return Q_ERROR(q, "PFQ: queue memory error");
+	}
+
+	mem.user_addr = (unsigned long)addr;
+	mem.user_size = sock_mem;
+	mem.hugepage_size = 0;
+
+	if(setsockopt(q->fd, PF_Q, Q_SO_ENABLE, &mem, sizeof(mem)) == -1)
+		return Q_ERROR(q, "PFQ: socket enable (arena)");
+
+	/* queue memory: already mapped by the user */
+
+	q->shm_addr = addr;
+	q->shm_size = sock_mem;
+	q->shm_hugepages = NULL;
+	q->shm_hugepages_size = 0;
+	q->arena = 1;
+
+	shared_queue_setup(q);
+	return Q_OK(q);
+}
+
+
+int
+pfq_resize(pfq_t *q, size_t rx_slots, size_t caplen, size_t tx_slots, size_t xmitlen)
+{
+	struct pfq_so_resize size = { .rx_slots = rx_slots
+				    , .caplen   = caplen
+				    , .tx_slots = tx_slots
+				    , .xmitlen  = xmitlen
+				    };
+	size_t sock_mem; socklen_t len = sizeof(sock_mem);
+	void *addr;
+
+	if (q->shm_addr == MAP_FAILED || q->shm_addr == NULL)
+		return Q_ERROR(q, "PFQ: resize: socket not enabled");
+
+	if (q->shm_hugepages_size || q->arena)
+		return Q_ERROR(q, "PFQ: resize: not supported with HugePages or arena");
+
+	if (q->old.shm_addr)
+		return Q_ERROR(q, "PFQ: resize: previous queues not drained yet");
+
+	/* flush the synchronous Tx queue: pending slots are not migrated */
+
+	if (q->tx_num_async == 0)
+		pfq_sync_queue(q, 0);
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_RESIZE, &size, sizeof(size)) == -1)
+		return Q_ERROR(q, "PFQ: resize error");
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_SHMEM_SIZE, &sock_mem, &len) == -1)
+		return Q_ERROR(q, "PFQ: resize: queue memory error");
+
+	addr = mmap(NULL, sock_mem, PROT_READ|PROT_WRITE, MAP_SHARED, q->fd, 0);
+	if (addr == MAP_FAILED)
+		return Q_ERROR(q, "PFQ: resize (memory map)");
+
+	/* keep the old Rx queues around until drained */
+
+	q->old.shm_addr = q->shm_addr;
+	q->old.shm_size = q->shm_size;
+	q->old.rx_queue_addr = q->rx_queue_addr;
+	q->old.rx_queue_size = q->rx_queue_size;
+	q->old.rx_slots = q->rx_slots;
+	q->old.rx_slot_size = q->rx_slot_size;
+
+	q->shm_addr = addr;
+	q->shm_size = sock_mem;
+
+	q->rx_slots = rx_slots;
+	q->rx_len = caplen;
+	q->rx_slot_size = ALIGN(sizeof(struct pfq_pkthdr) + caplen, PFQ_SLOT_ALIGNMENT);
+
+	q->tx_slots = tx_slots;
+	q->tx_len = xmitlen;
+	q->tx_slot_size = ALIGN(sizeof(struct pfq_pkthdr) + xmitlen, PFQ_SLOT_ALIGNMENT);
+	q->tx_attempt = 0;
+
+	shared_queue_setup(q);
 	return Q_OK(q);
 }
 
@@ -422,7 +692,14 @@ pfq_disable(pfq_t *q)
 	if (q->fd == -1)
 		return Q_ERROR(q, "PFQ: socket not open");
 
-	if (q->shm_addr != MAP_FAILED) {
+	if (q->old.shm_addr) {
+		munmap(q->old.shm_addr, q->old.shm_size);
+		memset(&q->old, 0, sizeof(q->old));
+	}
+
+	/* the arena belongs to the user */
+
+	if (q->shm_addr != MAP_FAILED && !q->arena) {
 
 		if (q->shm_hugepages_size) {
 			if (munmap(q->shm_hugepages, q->shm_hugepages_size) == -1)
@@ -436,6 +713,7 @@ pfq_disable(pfq_t *q)
 
 	q->shm_addr = NULL;
 	q->shm_size = 0;
+	q->arena = 0;
 
 	if(setsockopt(q->fd, PF_Q, Q_SO_DISABLE, NULL, 0) == -1) {
 		return Q_ERROR(q, "PFQ: socket disable");
@@ -515,6 +793,79 @@ pfq_get_weight(pfq_t const *q)
 	return Q_VALUE(q, ret);
 }
 
+
+int
+pfq_set_rx_class_reserve(pfq_t *q, unsigned long class_mask, size_t slots)
+{
+	struct pfq_so_class_reserve res = { class_mask, slots };
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_RX_CLASS_RESERVE, &res, sizeof(res)) == -1) {
+		return Q_ERROR(q, "PFQ: set Rx class reserve");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_rx_class_stats(pfq_t const *q, struct pfq_class_stats *stats)
+{
+	socklen_t size = sizeof(struct pfq_class_stats);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_RX_CLASS_STATS, stats, &size) == -1) {
+		return Q_ERROR(q, "PFQ: get Rx class stats error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_tx_pacing_stats(pfq_t const *q, struct pfq_tx_pacing_stats *stats)
+{
+	socklen_t size = sizeof(struct pfq_tx_pacing_stats);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_PACING_STATS, stats, &size) == -1) {
+		return Q_ERROR(q, "PFQ: get Tx pacing stats error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_tx_replay_stats(pfq_t const *q, struct pfq_tx_replay_stats *stats)
+{
+	socklen_t size = sizeof(struct pfq_tx_replay_stats);
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_TX_REPLAY_STATS, stats, &size) == -1) {
+		return Q_ERROR(q, "PFQ: get Tx replay stats error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_set_numa_node(pfq_t *q, int node)
+{
+	int enabled = pfq_is_enabled(q);
+	if (enabled == 1) {
+		return Q_ERROR(q, "PFQ: enabled (numa node could not be set)");
+	}
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_SET_NUMA_NODE, &node, sizeof(node)) == -1) {
+		return Q_ERROR(q, "PFQ: set numa node error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_get_numa_node(pfq_t const *q, int *node)
+{
+	socklen_t size = sizeof(*node);
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_NUMA_NODE, node, &size) == -1) {
+	        return Q_ERROR(q, "PFQ: get numa node error");
+	}
+	return Q_OK(q);
+}
+
+
 int
 pfq_ifindex(pfq_t const *q, const char *dev)
 {
@@ -1447,6 +1798,30 @@ pfq_poll(pfq_t *q, long int microseconds /* = -1 -> infinite */)
 }
 
 
+int
+pfq_wait_tx_space(pfq_t *q, long int microseconds /* = -1 -> infinite */)
+{
+	struct timespec timeout;
+	struct pollfd fd = {q->fd, POLLOUT, 0 };
+        int ret;
+
+	if (q->fd == -1) {
+		return Q_ERROR(q, "PFQ: socket not open");
+	}
+
+	if (microseconds >= 0) {
+		timeout.tv_sec  = microseconds/1000000;
+		timeout.tv_nsec = (microseconds%1000000) * 1000;
+	}
+
+	ret = ppoll(&fd, 1, microseconds < 0 ? NULL : &timeout, NULL);
+	if (ret < 0 && errno != EINTR) {
+	    return Q_ERROR(q, "PFQ: ppoll error");
+	}
+	return Q_VALUE(q, ret > 0 ? 1 : 0);
+}
+
+
 int
 pfq_get_stats(pfq_t const *q, struct pfq_stats *stats)
 {
@@ -1483,6 +1858,73 @@ pfq_get_group_counters(pfq_t const *q, int gid, struct pfq_counters *cs)
 }
 
 
+int
+pfq_get_group_steer_stats(pfq_t const *q, int gid, struct pfq_steer_stats *stats)
+{
+	socklen_t size = sizeof(struct pfq_steer_stats);
+	stats->gid = gid;
+
+	if (getsockopt(q->fd, PF_Q, Q_SO_GET_GROUP_STEER_STATS, stats, &size) == -1) {
+		return Q_ERROR(q, "PFQ: get group steer stats error");
+	}
+	return Q_OK(q);
+}
+
+
+int
+pfq_set_group_steer_dynamic(pfq_t *q, int gid, unsigned int threshold)
+{
+        struct pfq_so_group_steer value = { gid, threshold };
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_GROUP_STEER_DYNAMIC, &value, sizeof(value)) == -1) {
+	        return Q_ERROR(q, "PFQ: group steer dynamic");
+        }
+
+        return Q_OK(q);
+}
+
+
+int
+pfq_set_group_flow_export(pfq_t *q, int gid, unsigned int idle_timeout, unsigned int active_timeout)
+{
+        struct pfq_so_group_flow_export value = { gid, idle_timeout, active_timeout };
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_GROUP_FLOW_EXPORT, &value, sizeof(value)) == -1) {
+	        return Q_ERROR(q, "PFQ: group flow export");
+        }
+
+        return Q_OK(q);
+}
+
+
+int
+pfq_set_group_reta(pfq_t *q, int gid, int const *table, size_t size)
+{
+        struct pfq_so_group_reta value = { gid, (unsigned int)size, (int *)table };
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_GROUP_SET_RETA, &value, sizeof(value)) == -1) {
+	        return Q_ERROR(q, "PFQ: group set reta");
+        }
+
+        return Q_OK(q);
+}
+
+
+int
+pfq_get_group_reta(pfq_t const *q, int gid, int *table, size_t *size)
+{
+        struct pfq_so_group_reta value = { gid, (unsigned int)*size, table };
+	socklen_t len = sizeof(value);
+
+        if (getsockopt(q->fd, PF_Q, Q_SO_GROUP_GET_RETA, &value, &len) == -1) {
+	        return Q_ERROR(q, "PFQ: group get reta");
+        }
+
+        *size = value.size;
+        return Q_OK(q);
+}
+
+
 int
 pfq_vlan_filters_enable(pfq_t *q, int gid, int toggle)
 {
@@ -1519,16 +1961,99 @@ int pfq_vlan_reset_filter(pfq_t *q, int gid, int vid)
 }
 
 
+/* swap the Rx double buffer, return the number of packets available
+ * in the queue just released by the kernel */
+
+static size_t
+pfq_swap_rx_queue_at(struct pfq_shared_queue *qd, char *queue_addr, size_t queue_size,
+		     size_t slot_size, size_t slots, unsigned long int *qver_ret)
+{
+	unsigned long int data, qver;
+
+	data = __atomic_load_n(&qd->rx.shinfo, __ATOMIC_RELAXED);
+	qver = PFQ_SHARED_QUEUE_VER(data);
+
+        /* at wrap-around reset Rx slots... */
+
+        if (unlikely(((qver+1) & (PFQ_SHARED_QUEUE_VER_MASK^1))== 0))
+        {
+            char * raw = queue_addr + ((qver+1) & 1) * queue_size;
+            char * end = raw + queue_size;
+            const pfq_qver_t rst = qver & 1;
+            for(; raw < end; raw += slot_size)
+                ((struct pfq_pkthdr *)raw)->info.commit = rst;
+        }
+
+	/* swap the queue... */
+
+        data = __atomic_exchange_n(&qd->rx.shinfo, ((qver+1) << (PFQ_SHARED_QUEUE_LEN_SIZE<<3)), __ATOMIC_RELAXED);
+
+	*qver_ret = qver;
+	return min(PFQ_SHARED_QUEUE_LEN(data), slots);
+}
+
+
+static size_t
+pfq_swap_rx_queue(pfq_t *q, struct pfq_shared_queue *qd, unsigned long int *qver_ret)
+{
+	return pfq_swap_rx_queue_at(qd, (char *)q->rx_queue_addr, q->rx_queue_size,
+				    q->rx_slot_size, q->rx_slots, qver_ret);
+}
+
+
+/* read what is left in the queues replaced by a resize; once they are
+ * empty (and the last batch returned has been consumed) release them */
+
+static int
+pfq_read_old(pfq_t *q, struct pfq_net_queue *nq)
+{
+	struct pfq_shared_queue * qd = (struct pfq_shared_queue *)(q->old.shm_addr);
+	unsigned long int qver;
+	size_t queue_len;
+
+	if (PFQ_SHARED_QUEUE_LEN(__atomic_load_n(&qd->rx.shinfo, __ATOMIC_RELAXED))) {
+
+		queue_len = pfq_swap_rx_queue_at(qd, (char *)q->old.rx_queue_addr, q->old.rx_queue_size,
+						 q->old.rx_slot_size, q->old.rx_slots, &qver);
+
+		nq->queue = (char *)(q->old.rx_queue_addr) + (qver & 1) * q->old.rx_queue_size;
+		nq->index = (unsigned int)qver;
+		nq->len   = queue_len;
+		nq->slot_size = q->old.rx_slot_size;
+
+		if (queue_len)
+			return Q_VALUE(q, (int)queue_len);
+	}
+
+	if (munmap(q->old.shm_addr, q->old.shm_size) == -1)
+		return Q_ERROR(q, "PFQ: read: munmap error (resize)");
+
+	memset(&q->old, 0, sizeof(q->old));
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_RESIZE_RELEASE, NULL, 0) == -1)
+		return Q_ERROR(q, "PFQ: read: resize release error");
+
+	return Q_OK(q);
+}
+
+
 int
 pfq_read(pfq_t *q, struct pfq_net_queue *nq, long int microseconds)
 {
 	struct pfq_shared_queue * qd = (struct pfq_shared_queue *)(q->shm_addr);
 	unsigned long int data, qver;
+	size_t queue_len;
 
         if (unlikely(qd == NULL)) {
 		return Q_ERROR(q, "PFQ: read: socket not enabled");
 	}
 
+	if (unlikely(q->old.shm_addr != NULL)) {
+		int ret = pfq_read_old(q, nq);
+		if (ret != 0)
+			return ret;
+	}
+
 	data = __atomic_load_n(&qd->rx.shinfo, __ATOMIC_RELAXED);
 
 	if (unlikely(PFQ_SHARED_QUEUE_LEN(data) == 0)) {
@@ -1542,24 +2067,7 @@ pfq_read(pfq_t *q, struct pfq_net_queue *nq, long int microseconds)
 #endif
 	}
 
-        /* at wrap-around reset Rx slots... */
-
-	qver = PFQ_SHARED_QUEUE_VER(data);
-
-        if (unlikely(((qver+1) & (PFQ_SHARED_QUEUE_VER_MASK^1))== 0))
-        {
-            char * raw = (char *)(q->rx_queue_addr) + ((qver+1) & 1) * q->rx_queue_size;
-            char * end = raw + q->rx_queue_size;
-            const pfq_qver_t rst = qver & 1;
-            for(; raw < end; raw += q->rx_slot_size)
-                ((struct pfq_pkthdr *)raw)->info.commit = rst;
-        }
-
-	/* swap the queue... */
-
-        data = __atomic_exchange_n(&qd->rx.shinfo, ((qver+1) << (PFQ_SHARED_QUEUE_LEN_SIZE<<3)), __ATOMIC_RELAXED);
-
-	size_t queue_len = min(PFQ_SHARED_QUEUE_LEN(data), q->rx_slots);
+	queue_len = pfq_swap_rx_queue(q, qd, &qver);
 
 	nq->queue = (char *)(q->rx_queue_addr) + (qver & 1) * q->rx_queue_size;
 	nq->index = (unsigned int)qver;
@@ -1570,6 +2078,97 @@ pfq_read(pfq_t *q, struct pfq_net_queue *nq, long int microseconds)
 }
 
 
+/* claim word: generation (24 bits) | batch len (20 bits) | next slot (20 bits) */
+
+#define RX_CLAIM_SLOT_BITS	20
+#define RX_CLAIM_SLOT_MASK	((1ULL << RX_CLAIM_SLOT_BITS) - 1)
+
+#define RX_CLAIM_GEN(c)		((c) >> (RX_CLAIM_SLOT_BITS * 2))
+#define RX_CLAIM_LEN(c)		(((c) >> RX_CLAIM_SLOT_BITS) & RX_CLAIM_SLOT_MASK)
+#define RX_CLAIM_NEXT(c)	((c) & RX_CLAIM_SLOT_MASK)
+
+#define RX_CLAIM(gen, len, next) \
+	((((uint64_t)(gen) & 0xffffff) << (RX_CLAIM_SLOT_BITS * 2)) | ((uint64_t)(len) << RX_CLAIM_SLOT_BITS) | (uint64_t)(next))
+
+
+int
+pfq_claim(pfq_t *q, struct pfq_net_queue *nq, size_t slots)
+{
+	struct pfq_shared_queue * qd = (struct pfq_shared_queue *)(q->shm_addr);
+	uint64_t claim, next;
+	unsigned long int qver;
+	size_t len;
+
+        if (unlikely(qd == NULL)) {
+		return Q_ERROR(q, "PFQ: claim: socket not enabled");
+	}
+
+	for(;;)
+	{
+		claim = __atomic_load_n(&q->rx_claim, __ATOMIC_ACQUIRE);
+
+		/* claim a batch of the current queue */
+
+		if (RX_CLAIM_NEXT(claim) < RX_CLAIM_LEN(claim)) {
+
+			uint32_t index = __atomic_load_n(&q->rx_claim_index, __ATOMIC_RELAXED);
+
+			next = min(RX_CLAIM_NEXT(claim) + slots, RX_CLAIM_LEN(claim));
+
+			if (!__atomic_compare_exchange_n(&q->rx_claim, &claim, (claim & ~RX_CLAIM_SLOT_MASK) | next,
+							 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+				continue;
+
+			nq->queue = (char *)(q->rx_queue_addr) + (index & 1) * q->rx_queue_size
+				    + RX_CLAIM_NEXT(claim) * q->rx_slot_size;
+			nq->index = index;
+			nq->len   = next - RX_CLAIM_NEXT(claim);
+			nq->slot_size = q->rx_slot_size;
+
+			return Q_VALUE(q, (int)nq->len);
+		}
+
+		/* the current queue is exhausted: the last consumer swaps it,
+		 * once all the claimed slots are released */
+
+		if (__atomic_load_n(&q->rx_claim_done, __ATOMIC_ACQUIRE) != RX_CLAIM_LEN(claim) ||
+		    __atomic_exchange_n(&q->rx_claim_lock, 1, __ATOMIC_ACQUIRE)) {
+			nq->len = 0;
+			return Q_VALUE(q, 0);
+		}
+
+		if (__atomic_load_n(&q->rx_claim, __ATOMIC_RELAXED) != claim) {
+			__atomic_store_n(&q->rx_claim_lock, 0, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		len = PFQ_SHARED_QUEUE_LEN(__atomic_load_n(&qd->rx.shinfo, __ATOMIC_RELAXED)) ?
+			pfq_swap_rx_queue(q, qd, &qver) : 0;
+
+		if (len) {
+			__atomic_store_n(&q->rx_claim_index, (uint32_t)qver, __ATOMIC_RELAXED);
+			__atomic_store_n(&q->rx_claim_done, 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&q->rx_claim, RX_CLAIM(RX_CLAIM_GEN(claim) + 1, len, 0), __ATOMIC_RELEASE);
+		}
+
+		__atomic_store_n(&q->rx_claim_lock, 0, __ATOMIC_RELEASE);
+
+		if (!len) {
+			nq->len = 0;
+			return Q_VALUE(q, 0);
+		}
+	}
+}
+
+
+int
+pfq_release(pfq_t *q, struct pfq_net_queue const *nq)
+{
+	__atomic_add_fetch(&q->rx_claim_done, nq->len, __ATOMIC_RELEASE);
+	return Q_OK(q);
+}
+
+
 int
 pfq_recv(pfq_t *q, void *buf, size_t buflen, struct pfq_net_queue *nq, long int microseconds)
 {
@@ -1631,6 +2230,21 @@ pfq_bind_tx(pfq_t *q, const char *dev, int queue, int tid)
 }
 
 
+int
+pfq_bind_tx_pipe(pfq_t *q, int id, int tid)
+{
+	struct pfq_so_tx_pipe p = { tid, id };
+
+        if (setsockopt(q->fd, PF_Q, Q_SO_TX_BIND_PIPE, &p, sizeof(p)) == -1)
+		return Q_ERROR(q, "PFQ: Tx pipe bind error");
+
+	if (tid != Q_NO_KTHREAD)
+		q->tx_num_async++;
+
+	return Q_OK(q);
+}
+
+
 int
 pfq_unbind_tx(pfq_t *q)
 {
@@ -1642,6 +2256,117 @@ pfq_unbind_tx(pfq_t *q)
 }
 
 
+int
+pfq_tx_zerocopy_enable(pfq_t *q, int value)
+{
+	if (setsockopt(q->fd, PF_Q, Q_SO_TX_ZEROCOPY, &value, sizeof(value)) == -1)
+		return Q_ERROR(q, "PFQ: set Tx zero-copy");
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_tx_lossless_enable(pfq_t *q, int value)
+{
+	if (setsockopt(q->fd, PF_Q, Q_SO_TX_LOSSLESS, &value, sizeof(value)) == -1)
+		return Q_ERROR(q, "PFQ: set Tx lossless");
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_tx_shaper(pfq_t *q, int queue, int mode, uint64_t rate, uint64_t burst, int drop)
+{
+	struct pfq_so_tx_shaper shaper = { queue, mode, drop, rate, burst };
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_TX_SHAPER, &shaper, sizeof(shaper)) == -1)
+		return Q_ERROR(q, "PFQ: Tx shaper error");
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_tx_thread_start(pfq_t *q, int tid, int cpu)
+{
+	struct pfq_so_tx_thread thread = { tid, cpu };
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_TX_THREAD_START, &thread, sizeof(thread)) == -1)
+		return Q_ERROR(q, "PFQ: Tx thread start error");
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_tx_thread_stop(pfq_t *q, int tid)
+{
+	if (setsockopt(q->fd, PF_Q, Q_SO_TX_THREAD_STOP, &tid, sizeof(tid)) == -1)
+		return Q_ERROR(q, "PFQ: Tx thread stop error");
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_tx_thread_pin(pfq_t *q, int tid, int cpu)
+{
+	struct pfq_so_tx_thread thread = { tid, cpu };
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_TX_THREAD_PIN, &thread, sizeof(thread)) == -1)
+		return Q_ERROR(q, "PFQ: Tx thread pin error");
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_tx_replay(pfq_t *q, const char *dev, struct pfq_so_tx_replay *replay)
+{
+        int ifindex;
+
+        ifindex = pfq_ifindex(q, dev);
+        if (ifindex == -1)
+		return Q_ERROR(q, "PFQ: device not found");
+
+	replay->ifindex = ifindex;
+
+	if (setsockopt(q->fd, PF_Q, Q_SO_TX_REPLAY, replay, sizeof(*replay)) == -1)
+		return Q_ERROR(q, "PFQ: Tx replay error");
+
+	return Q_OK(q);
+}
+
+
+int
+pfq_tx_replay_stop(pfq_t *q)
+{
+	if (setsockopt(q->fd, PF_Q, Q_SO_TX_REPLAY_STOP, NULL, 0) == -1)
+		return Q_ERROR(q, "PFQ: Tx replay stop error");
+
+	return Q_OK(q);
+}
+
+
+size_t
+pfq_tx_replay_record(void *buf, size_t size, size_t off, uint64_t tstamp, const void *pkt, uint32_t caplen, uint32_t len)
+{
+	struct pfq_replay_pkthdr *hdr = (struct pfq_replay_pkthdr *)((char *)buf + off);
+
+	if (size < off || Q_REPLAY_RECORD_LEN(caplen) > size - off)
+		return 0;
+
+	hdr->tstamp = tstamp;
+	hdr->caplen = caplen;
+	hdr->len    = len;
+	memcpy(hdr+1, pkt, caplen);
+
+	return off + Q_REPLAY_RECORD_LEN(caplen);
+}
+
+
 int
 pfq_send_raw( pfq_t *q
 	    , const void *buf
@@ -1649,6 +2374,20 @@ pfq_send_raw( pfq_t *q
 	    , uint64_t nsec
 	    , unsigned int copies
 	    , int async)
+{
+	return pfq_send_raw_gso(q, buf, len, nsec, copies, async, 0, 0);
+}
+
+
+int
+pfq_send_raw_gso( pfq_t *q
+		, const void *buf
+		, const size_t len
+		, uint64_t nsec
+		, unsigned int copies
+		, int async
+		, unsigned int gso_size
+		, int gso_type)
 {
         struct pfq_shared_queue *sh_queue = (struct pfq_shared_queue *)(q->shm_addr);
         struct pfq_shared_tx_queue *tx;
@@ -1656,11 +2395,16 @@ pfq_send_raw( pfq_t *q
         ptrdiff_t offset, *poff_addr;
         uint16_t caplen;
         char *base_addr;
-        int tss;
+        int tss, flip = 0;
 
 	if (unlikely(q->shm_addr == NULL))
 		return Q_ERROR(q, "PFQ: send: socket not enabled");
 
+	/* a GSO frame is never cut to the slot */
+
+	if (gso_size && (gso_size > UINT16_MAX || len > Q_TX_GSO_MAX_LEN || len > q->tx_slot_size - sizeof(struct pfq_pkthdr)))
+		return Q_ERROR(q, "PFQ: send: GSO frame larger than the Tx slot");
+
 	if (async != Q_NO_KTHREAD) {
 		if (unlikely(q->tx_num_async == 0))
 			return Q_ERROR(q, "PFQ: send: socket not bound to async thread");
@@ -1677,7 +2421,13 @@ pfq_send_raw( pfq_t *q
 
 	index = __atomic_load_n(&tx->cons.index, __ATOMIC_RELAXED);
 	if (index == __atomic_load_n(&tx->prod.index, __ATOMIC_RELAXED)) {
+
+		/* zero-copy: the next buffer is reusable once the driver has released its slots */
+
+		if (__atomic_load_n(&tx->cons.inflight[(index+1) & 1], __ATOMIC_ACQUIRE))
+			return Q_VALUE(q, 0);
 		++index;
+		flip = 1;
 		poff_addr = (index & 1) ? &tx->prod.off1 : &tx->prod.off0;
                 __atomic_store_n(poff_addr, 0, __ATOMIC_RELEASE);
                 __atomic_store_n(&tx->prod.index, index, __ATOMIC_RELEASE);
@@ -1698,8 +2448,20 @@ pfq_send_raw( pfq_t *q
 		hdr->len	       = (uint16_t)len;
 		hdr->caplen	       = (uint16_t)caplen;
 		hdr->info.data.copies  = copies;
+		hdr->info.data.gso_size = (uint16_t)gso_size;
+		hdr->info.data.gso_type = (uint16_t)gso_type;
 		__builtin_memcpy(hdr+1, buf, caplen);
                 __atomic_store_n(poff_addr, offset + (ptrdiff_t)q->tx_slot_size, __ATOMIC_RELEASE);
+
+		/* the Tx thread sleeps only once it has caught up with the producer,
+		 * that is after a flip: ring the doorbell if it announced the sleep */
+
+		if (flip && tss != -1) {
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&tx->cons.sleeping, __ATOMIC_RELAXED))
+				setsockopt(q->fd, PF_Q, Q_SO_TX_DOORBELL, &tss, sizeof(tss));
+		}
+
 		return Q_VALUE(q, (int)len);
 	}
 
@@ -1727,6 +2489,27 @@ pfq_send( pfq_t *q
 }
 
 
+int
+pfq_send_gso( pfq_t *q
+	    , const void *ptr
+	    , size_t len
+	    , unsigned int gso_size
+	    , int gso_type
+	    , size_t fsync)
+{
+	int ret;
+	retry:
+	ret = pfq_send_raw_gso(q, ptr, len, 0, 1, Q_NO_KTHREAD, gso_size, gso_type);
+	if (ret == 0 || ++q->tx_attempt == fsync) {
+		q->tx_attempt = 0;
+		pfq_sync_queue(q, 0);
+		if (ret == 0)
+			goto retry;
+	}
+	return ret;
+}
+
+
 int
 pfq_sync_queue(pfq_t *q, int queue)
 {
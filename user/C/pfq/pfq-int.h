@@ -82,7 +82,32 @@ struct pfq_data_int
 	int id;
 	int gid;
 
+	unsigned int detach;		/* handle the socket is detached under on close */
+	int arena;			/* queues carved out of a user arena */
+
 	struct pfq_net_queue nq;
+
+	/* Rx queues replaced by a resize, drained by pfq_read */
+
+	struct
+	{
+		void * shm_addr;
+		size_t shm_size;
+
+		void * rx_queue_addr;
+		size_t rx_queue_size;
+
+		size_t rx_slots;
+		size_t rx_slot_size;
+	} old;
+
+	/* multi-consumer Rx: claim word (generation|len|next), queue index,
+	 * slots released and swap lock of the batch being consumed */
+
+	uint64_t rx_claim;
+	uint64_t rx_claim_done;
+	uint32_t rx_claim_index;
+	uint32_t rx_claim_lock;
 };
 
 #endif /* PFQ_INT_H */
@@ -288,6 +288,27 @@ extern pfq_t* pfq_open_group(unsigned long class_mask, int group_policy,
 extern int pfq_close(pfq_t *);
 
 
+/*! Open a socket detached by a previous process under the given handle. */
+/*!
+ * The socket continues from the last slot committed in the shared queues,
+ * with the groups, bindings and computations it had when detached.
+ * See 'pfq_set_detach'.
+ */
+
+extern pfq_t* pfq_attach(unsigned int handle);
+
+
+/*! Keep the socket alive for timeout msec after close, under the given handle. */
+/*!
+ * Packets keep being enqueued while no process is attached (until the
+ * Rx queue is full). If no process attaches within the timeout, the socket is
+ * released. A handle of 0 restores the default behavior.
+ * Not supported with HugePages.
+ */
+
+extern int pfq_set_detach(pfq_t *q, unsigned int handle, unsigned int timeout);
+
+
 /*! Return the id of the socket. */
 
 extern int pfq_id(pfq_t *q);
@@ -309,6 +330,45 @@ extern int pfq_group_id(pfq_t *q);
 extern int pfq_enable(pfq_t *q);
 
 
+/*! Register a HugePages arena, in which the sockets of the process can place their queues. */
+/*!
+ * The memory (addr, size) is mapped by the user from a hugetlbfs file;
+ * hugepage_size is the size of the pages backing it. The arena is
+ * released when this socket and all the sockets using it are closed.
+ */
+
+extern int pfq_register_arena(pfq_t *q, void *addr, size_t size, size_t hugepage_size);
+
+
+/*! Return the size of the memory required by the socket queues. */
+/*!
+ * Socket queues are placed in an arena at offsets that are multiple of the page size.
+ */
+
+extern long pfq_mem_required(pfq_t const *q);
+
+
+/*! Enable the socket with the queues placed at the given address of a registered arena. */
+/*!
+ * The region [addr, addr + pfq_mem_required(q)) must lie within an arena
+ * registered by the process and must not overlap the queues of other sockets.
+ */
+
+extern int pfq_enable_arena(pfq_t *q, void *addr);
+
+
+/*! Resize the Rx and Tx queues of an enabled socket. */
+/*!
+ * The socket keeps running: the kernel moves to the new queues, while the
+ * packets left in the old Rx queues are returned by the subsequent pfq_read
+ * calls, before the ones captured in the new queues. Pending slots of
+ * asynchronous Tx queues are not migrated. Not supported with HugePages or
+ * arenas.
+ */
+
+extern int pfq_resize(pfq_t *q, size_t rx_slots, size_t caplen, size_t tx_slots, size_t xmitlen);
+
+
 /*! Disable the socket. */
 /*!
  * Release the shared memory, stop kernel threads.
@@ -341,6 +401,56 @@ extern int pfq_set_weight(pfq_t *q, int value);
 extern int pfq_get_weight(pfq_t const *q);
 
 
+/*! Reserve Rx slots to the given classes. */
+/*!
+ * When the Rx queue is above the watermark, packets of classes without
+ * reservation are dropped first, leaving the reserved slots to the
+ * other classes. Each class in the mask is assigned the given slots.
+ */
+
+extern int pfq_set_rx_class_reserve(pfq_t *q, unsigned long class_mask, size_t slots);
+
+
+/*! Return the per-class drop counters of the socket. */
+
+extern int pfq_get_rx_class_stats(pfq_t const *q, struct pfq_class_stats *stats);
+
+
+/*! Return the pacing error histogram of the packets sent with a departure time. */
+/*!
+ * Packets sent by pfq_send_at are transmitted at their departure time: the
+ * histogram counts how late they left, in decades from 100 nsec to 1 msec.
+ * The counters of the token buckets (pfq_tx_shaper) are reported as well.
+ */
+
+extern int pfq_get_tx_pacing_stats(pfq_t const *q, struct pfq_tx_pacing_stats *stats);
+
+
+/*! Return the progress of the trace replayed by the kernel. */
+
+extern int pfq_get_tx_replay_stats(pfq_t const *q, struct pfq_tx_replay_stats *stats);
+
+
+/*! Specify the NUMA node of the consumer. */
+/*!
+ * The shared memory of the socket is allocated on the given node.
+ * Q_AUTO_NODE selects the node of the CPU enabling the socket,
+ * Q_ANY_NODE (default) has no preference.
+ * The node must be set before the socket is enabled.
+ */
+
+extern int pfq_set_numa_node(pfq_t *q, int node);
+
+
+/*! Store the NUMA node of the socket in node. */
+/*!
+ * Once enabled, the node where the shared memory is allocated.
+ * The node can be Q_ANY_NODE (-1), hence it is not the return value.
+ */
+
+extern int pfq_get_numa_node(pfq_t const *q, int *node);
+
+
 /*! Specify the capture length of packets, in bytes. */
 /*!
  * Capture length must be set before the socket is enabled.
@@ -449,6 +559,109 @@ extern int pfq_egress_unbind(pfq_t *q);
 extern int pfq_bind_tx(pfq_t *q, const char *dev, int queue, int core);
 
 
+/*! Bind the socket for transmission to the Rx queue of the socket with the given id. */
+/*!
+ *  Packets sent are copied into the Rx queue of the peer socket, which must
+ *  share a group with this one. Slots received this way have ifindex set to
+ *  Q_PKTHDR_PIPE and queue set to the id of the sender.
+ *  If 'Q_NO_KTHREAD' is specified as tid, the pipe is synchronous.
+ */
+
+extern int pfq_bind_tx_pipe(pfq_t *q, int id, int tid);
+
+
+/*! Enable/disable zero-copy transmission. */
+/*!
+ *  Slots are transmitted as page fragments of the Tx queue instead of being
+ *  copied into a socket buffer (frames up to 128 bytes are still copied).
+ *  A Tx buffer is reused by the sender only after the driver has released all
+ *  its slots: completion is reported in the consumer section of the Tx queue,
+ *  and a send returns 0 in the meantime. The frames sent this way are counted
+ *  in the zerocopy field of pfq_get_tx_pacing_stats().
+ */
+
+extern int pfq_tx_zerocopy_enable(pfq_t *q, int value);
+
+
+/*! Enable/disable lossless transmission. */
+/*!
+ *  When the device queue is stopped the kernel stops consuming the Tx slots,
+ *  instead of dropping them after tx_retry attempts, and resumes when the
+ *  queue is woken up. Senders find the Tx queue full (a send returns 0) and
+ *  can block in pfq_wait_tx_space().
+ */
+
+extern int pfq_tx_lossless_enable(pfq_t *q, int value);
+
+
+/*! Set the token bucket of a Tx queue, or of the whole socket. */
+/*!
+ *  The queue is Q_TX_SHAPER_SOCKET (bucket shared by all the Tx queues of the
+ *  socket), Q_TX_SHAPER_SYNC or the index of an async queue. The rate is in
+ *  packets or bytes per second (mode Q_TX_SHAPER_PACKETS or Q_TX_SHAPER_BYTES),
+ *  the burst is the size of the bucket; a rate of 0 disables the bucket.
+ *  Exceeding packets hold the queue until the tokens are available (they leave
+ *  with the next transmission, or from the Tx thread), or are dropped if drop
+ *  is set. Holds and drops are reported by pfq_get_tx_pacing_stats(); drops
+ *  are also counted as discarded in the socket stats.
+ */
+
+extern int pfq_tx_shaper(pfq_t *q, int queue, int mode, uint64_t rate, uint64_t burst, int drop);
+
+
+/*! Start a Tx thread with the given index on the given cpu. */
+/*!
+ *  Threads started at load time (tx_cpu) take the indexes 0..N-1; a thread
+ *  can serve up to 32 socket queues. Every second the queues of a thread
+ *  above 80% utilization are rebalanced toward the least loaded thread.
+ */
+
+extern int pfq_tx_thread_start(pfq_t *q, int tid, int cpu);
+
+
+/*! Stop the Tx thread with the given index. */
+/*!
+ *  The queues bound to the thread are migrated to the other threads first;
+ *  the call fails if no other thread can take them.
+ */
+
+extern int pfq_tx_thread_stop(pfq_t *q, int tid);
+
+
+/*! Move the Tx thread with the given index to another cpu. */
+
+extern int pfq_tx_thread_pin(pfq_t *q, int tid, int cpu);
+
+
+/*! Replay a trace from a Tx thread. */
+/*!
+ *  The trace is a sequence of records (struct pfq_replay_pkthdr followed by
+ *  the packet, see pfq_tx_replay_record()) stored in a page aligned buffer,
+ *  possibly backed by HugePages; the kernel pins the buffer and the thread
+ *  replay->tid transmits it on the device/queue, replay->loops times (0 means
+ *  forever), with the original gaps scaled by 1000/replay->rate (0 means
+ *  as fast as possible). MAC addresses can be rewritten, and IP addresses
+ *  advanced by a step at each loop. The buffer must stay mapped until the
+ *  replay is stopped, or the socket closed.
+ */
+
+extern int pfq_tx_replay(pfq_t *q, const char *dev, struct pfq_so_tx_replay *replay);
+
+
+/*! Stop the replay of the trace. */
+
+extern int pfq_tx_replay_stop(pfq_t *q);
+
+
+/*! Append a record to a trace buffer of the given size. */
+/*!
+ *  Return the offset of the next record, 0 if the buffer is full.
+ */
+
+extern size_t pfq_tx_replay_record(void *buf, size_t size, size_t off, uint64_t tstamp,
+				   const void *pkt, uint32_t caplen, uint32_t len);
+
+
 /*! Unbind the socket for transmission. */
 /*!
  * Unbind the socket for transmission from any device/queue.
@@ -534,6 +747,52 @@ extern int pfq_vlan_set_filter(pfq_t *q, int gid, int vid);
 extern int pfq_vlan_reset_filter(pfq_t *q, int gid, int vid);
 
 
+/*! Enable/disable load-aware steering for the given group. */
+/*!
+ * When the Rx queue occupancy of the socket selected by the steering
+ * function exceeds threshold (percentage), new flows are moved to the least
+ * loaded socket of the group. Flows already seen stick to their socket.
+ * A new flow whose (per-cpu) flow table entry is taken by a live flow is
+ * steered by the hash, not moved. A threshold of 0 disables it.
+ */
+
+extern int pfq_set_group_steer_dynamic(pfq_t *q, int gid, unsigned int threshold);
+
+
+/*! Enable/disable the in-kernel flow-record export mode for the given group. */
+/*!
+ * Packets accepted by the group are accounted in a per-cpu flow cache (keyed
+ * by IPv4 5-tuple and vlan id) instead of being delivered. Flows idle for
+ * idle_timeout msec, active for more than active_timeout msec (0 = never) or
+ * evicted by a collision are exported to the sockets of the group as
+ * struct pfq_flow_record, one per slot, with pfq_pkthdr.info.ifindex set to
+ * Q_PKTHDR_FLOW_RECORD. The caplen must be large enough to hold a record.
+ * An idle_timeout of 0 disables the mode (pending flows are exported).
+ */
+
+extern int pfq_set_group_flow_export(pfq_t *q, int gid, unsigned int idle_timeout, unsigned int active_timeout);
+
+
+/*! Load the steering indirection table of the given group. */
+/*!
+ * The table maps hash buckets to socket ids (of sockets joined to the group).
+ * Once loaded, the hash computed by steering functions selects the bucket
+ * table[hash & (size-1)]. The size must be a power of 2 (up to Q_MAX_RETA_SIZE),
+ * a size of 0 removes the table. The table is replaced atomically.
+ */
+
+extern int pfq_set_group_reta(pfq_t *q, int gid, int const *table, size_t size);
+
+
+/*! Return the steering indirection table of the given group. */
+/*!
+ * On input size is the capacity of table, on output the number of buckets
+ * (0 if the group has no table).
+ */
+
+extern int pfq_get_group_reta(pfq_t const *q, int gid, int *table, size_t *size);
+
+
 /*! Wait for packets. */
 /*!
  * Wait for packets available for reading. A timeout in microseconds can be specified.
@@ -542,6 +801,16 @@ extern int pfq_vlan_reset_filter(pfq_t *q, int gid, int vid);
 extern int pfq_poll(pfq_t *q, long int microseconds /* = -1 -> infinite */);
 
 
+/*! Wait for room in the Tx queues. */
+/*!
+ * Wait until a Tx queue of the socket can take a packet, that is when the
+ * kernel has released the slots of a buffer. A timeout in microseconds can
+ * be specified. Return 1 if there is room, 0 on timeout.
+ */
+
+extern int pfq_wait_tx_space(pfq_t *q, long int microseconds /* = -1 -> infinite */);
+
+
 /*! Read packets in place. */
 /*!
  * Wait for packets and return the number of packets available.
@@ -554,6 +823,26 @@ extern int pfq_poll(pfq_t *q, long int microseconds /* = -1 -> infinite */);
 extern int pfq_read(pfq_t *q, struct pfq_net_queue *nq, long int microseconds);
 
 
+/*! Claim a batch of packets, for multi-consumer reads. */
+/*!
+ * Multiple threads can consume the Rx queue of the same socket, each
+ * claiming at most 'slots' packets at a time. Packets are referenced by the
+ * 'pfq_net_queue' data structure and must be given back by means of
+ * 'pfq_release', once processed. The queue is swapped by the last consumer,
+ * when all the claimed packets are released.
+ *
+ * Return the number of packets claimed (0 if none is available).
+ * Not to be mixed with 'pfq_read', 'pfq_recv' or 'pfq_dispatch'.
+ */
+
+extern int pfq_claim(pfq_t *q, struct pfq_net_queue *nq, size_t slots);
+
+
+/*! Release the packets claimed by 'pfq_claim'. */
+
+extern int pfq_release(pfq_t *q, struct pfq_net_queue const *nq);
+
+
 /*! Receive packets in the given buffer. */
 /*!
  * Wait for packets and return the number of packets available.
@@ -604,6 +893,11 @@ extern int pfq_get_group_stats(pfq_t const *q, int gid, struct pfq_stats *stats)
 extern int pfq_get_group_counters(pfq_t const *q, int gid, struct pfq_counters *cs);
 
 
+/*! Return the load-aware steering statistics of the given group. */
+
+extern int pfq_get_group_steer_stats(pfq_t const *q, int gid, struct pfq_steer_stats *stats);
+
+
 /*! Transmit the packets in the queue. */
 
 extern int pfq_sync_queue(pfq_t *q, int queue);
@@ -617,6 +911,22 @@ extern int pfq_sync_queue(pfq_t *q, int queue);
 extern int pfq_send_raw(pfq_t *q, const void *ptr, size_t len, uint64_t nsec, unsigned int copies, int async);
 
 
+/*! Schedule the transmission of a GSO frame. */
+/*!
+ * A TCP frame (Ethernet, optionally 802.1Q tagged, IPv4 or IPv6) up to
+ * Q_TX_GSO_MAX_LEN bytes is copied into a Tx slot and transmitted as a
+ * single skb, segmented in gso_size payload chunks by the device (TSO) or
+ * by software GSO. The gso_type is Q_TX_GSO_TCPV4 or Q_TX_GSO_TCPV6, the
+ * TCP checksum is computed by the kernel. The frame must fit a Tx slot
+ * (see xmitlen of pfq_open). A gso_size of 0 is a regular transmission.
+ * The sent counter accounts the frames handed to the device (the
+ * segments, with software GSO); invalid frames are accounted as failed.
+ */
+
+extern int pfq_send_raw_gso(pfq_t *q, const void *ptr, size_t len, uint64_t nsec, unsigned int copies, int async,
+			    unsigned int gso_size, int gso_type);
+
+
 /*! Store the packet and transmit the packets in the queue. */
 /*!
  * The queue is flushed every fsync packets (0 means immediate synchronization).
@@ -628,6 +938,15 @@ extern
 int pfq_send(pfq_t *q, const void *ptr, size_t len, unsigned int copies, size_t fsync);
 
 
+/*! Store a GSO frame and transmit the packets in the queue. */
+/*!
+ * As pfq_send, for a frame to be segmented (see pfq_send_raw_gso).
+ */
+
+extern
+int pfq_send_gso(pfq_t *q, const void *ptr, size_t len, unsigned int gso_size, int gso_type, size_t fsync);
+
+
 /*! Transmit the packet asynchronously. */
 
 static inline
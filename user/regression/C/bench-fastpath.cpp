@@ -0,0 +1,167 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * Receive path throughput for each optional stage of pfq_receive()
+ * (timestamp, BPF filter, vlan filters, pfq-lang computation).
+ *
+ * usage: bench-fastpath tx-dev rx-dev [seconds]
+ *
+ * Packets are generated on tx-dev and captured on rx-dev (e.g. a veth pair).
+ * The "plain" configuration runs with all the stages disabled.
+ *
+ ****************************************************************/
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include <pfq/pfq.hpp>
+#include <pfq/lang/default.hpp>
+
+using namespace pfq::lang;
+
+
+namespace opt
+{
+    const char *tx_dev;
+    const char *rx_dev;
+
+    int seconds = 5;
+
+    const size_t caplen = 64;
+    const size_t slots  = 65536;
+}
+
+
+static std::atomic_bool stop(false);
+
+
+static void
+make_packet(char *buf, size_t n)
+{
+    auto eh = reinterpret_cast<ethhdr *>(buf);
+    auto ih = reinterpret_cast<iphdr *>(eh + 1);
+    auto uh = reinterpret_cast<udphdr *>(ih + 1);
+
+    memset(buf, 0, opt::caplen);
+    memset(eh->h_dest, 0xff, ETH_ALEN);
+    eh->h_proto  = htons(ETH_P_IP);
+
+    ih->version  = 4;
+    ih->ihl      = 5;
+    ih->ttl      = 64;
+    ih->protocol = IPPROTO_UDP;
+    ih->tot_len  = htons(opt::caplen - sizeof(ethhdr));
+    ih->saddr    = htonl(0x0a000000 | static_cast<uint32_t>(n & 0xffff));
+    ih->daddr    = htonl(0x0a800001);
+
+    uh->source   = htons(static_cast<uint16_t>(1024 + (n & 0x7fff)));
+    uh->dest     = htons(9);
+    uh->len      = htons(opt::caplen - sizeof(ethhdr) - sizeof(iphdr));
+}
+
+
+static void
+generator()
+{
+    pfq::socket q(opt::caplen, 1024, opt::caplen, 4096);
+    char pkt[opt::caplen];
+    size_t n = 0;
+
+    q.bind_tx(opt::tx_dev, pfq::any_queue, pfq::no_kthread);
+    q.enable();
+
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        make_packet(pkt, n++);
+        q.send(pfq::const_buffer(pkt, sizeof(pkt)), 128);
+    }
+}
+
+
+static void
+bench(const char *name, std::function<void(pfq::socket &)> setup)
+{
+    pfq::socket q(opt::caplen, opt::slots);
+    size_t count = 0;
+
+    q.bind(opt::rx_dev);
+    setup(q);
+    q.enable();
+
+    stop.store(false);
+
+    std::thread gen(generator);
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(opt::seconds);
+    while (std::chrono::steady_clock::now() < end)
+    {
+        auto many = q.read(1000);
+        count += many.size();
+    }
+
+    stop.store(true);
+    gen.join();
+
+    auto stats = q.stats();
+
+    std::cout << name << ": " << static_cast<double>(count)/opt::seconds << " pkt/sec"
+              << " (recv:" << stats.recv << " lost:" << stats.lost << " drop:" << stats.drop << ")" << std::endl;
+}
+
+
+int
+main(int argc, char *argv[])
+try
+{
+    if (argc < 3)
+        throw std::runtime_error(std::string("usage: ").append(argv[0]).append(" tx-dev rx-dev [seconds]"));
+
+    opt::tx_dev = argv[1];
+    opt::rx_dev = argv[2];
+
+    if (argc > 3) opt::seconds = std::stoi(argv[3]);
+
+    /* a single BPF_RET is optimized out by the kernel, load the ethertype first */
+
+    static struct sock_filter accept[] = { BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+                                           BPF_STMT(BPF_RET | BPF_K, 0xffff) };
+
+    bench("plain", [](pfq::socket &) { });
+
+    bench("timestamp", [](pfq::socket &q) {
+        q.timestamping_enable(true);
+    });
+
+    bench("bpf", [](pfq::socket &q) {
+        struct sock_fprog prog = { 2, accept };
+        q.set_group_fprog(q.group_id(), prog);
+    });
+
+    bench("vlan-filter", [](pfq::socket &q) {
+        q.vlan_filters_enable(q.group_id(), true);
+        q.vlan_set_filter(q.group_id(), 0);
+    });
+
+    bench("computation", [](pfq::socket &q) {
+        q.set_group_computation(q.group_id(), unit);
+    });
+
+    return 0;
+}
+catch(std::exception &e)
+{
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
@@ -0,0 +1,156 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * Lazy forwarding throughput (pfq-lang forward) with one and more copies
+ * of each packet to the same device.
+ *
+ * usage: bench-lazy-fwd tx-dev rx-dev fwd-dev sink-dev [seconds]
+ *
+ * Packets are generated on tx-dev and captured on rx-dev, forwarded to
+ * fwd-dev and received on sink-dev (e.g. two veth pairs: tx-dev/rx-dev and
+ * fwd-dev/sink-dev).
+ *
+ ****************************************************************/
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include <pfq/pfq.hpp>
+#include <pfq/lang/default.hpp>
+
+using namespace pfq::lang;
+
+
+namespace opt
+{
+    const char *tx_dev;
+    const char *rx_dev;
+    const char *fwd_dev;
+    const char *sink_dev;
+
+    int seconds = 5;
+
+    const size_t caplen = 64;
+    const size_t slots  = 65536;
+}
+
+
+static std::atomic_bool stop(false);
+
+
+static void
+make_packet(char *buf, size_t n)
+{
+    auto eh = reinterpret_cast<ethhdr *>(buf);
+    auto ih = reinterpret_cast<iphdr *>(eh + 1);
+    auto uh = reinterpret_cast<udphdr *>(ih + 1);
+
+    memset(buf, 0, opt::caplen);
+    memset(eh->h_dest, 0xff, ETH_ALEN);
+    eh->h_proto  = htons(ETH_P_IP);
+
+    ih->version  = 4;
+    ih->ihl      = 5;
+    ih->ttl      = 64;
+    ih->protocol = IPPROTO_UDP;
+    ih->tot_len  = htons(opt::caplen - sizeof(ethhdr));
+    ih->saddr    = htonl(0x0a000000 | static_cast<uint32_t>(n & 0xffff));
+    ih->daddr    = htonl(0x0a800001);
+
+    uh->source   = htons(static_cast<uint16_t>(1024 + (n & 0x7fff)));
+    uh->dest     = htons(9);
+    uh->len      = htons(opt::caplen - sizeof(ethhdr) - sizeof(iphdr));
+}
+
+
+static void
+generator()
+{
+    pfq::socket q(opt::caplen, 1024, opt::caplen, 4096);
+    char pkt[opt::caplen];
+    size_t n = 0;
+
+    q.bind_tx(opt::tx_dev, pfq::any_queue, pfq::no_kthread);
+    q.enable();
+
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        make_packet(pkt, n++);
+        q.send(pfq::const_buffer(pkt, sizeof(pkt)), 128);
+    }
+}
+
+
+template <typename Comp>
+static void
+bench(const char *name, Comp comp)
+{
+    pfq::socket fwd(opt::caplen, opt::slots);
+    pfq::socket sink(opt::caplen, opt::slots);
+    size_t count = 0;
+
+    fwd.bind(opt::rx_dev);
+    fwd.set_group_computation(fwd.group_id(), comp);
+    fwd.enable();
+
+    sink.bind(opt::sink_dev);
+    sink.enable();
+
+    stop.store(false);
+
+    std::thread gen(generator);
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(opt::seconds);
+    while (std::chrono::steady_clock::now() < end)
+    {
+        auto many = sink.read(1000);
+        count += many.size();
+    }
+
+    stop.store(true);
+    gen.join();
+
+    auto stats = fwd.group_stats(fwd.group_id());
+
+    std::cout << name << ": " << static_cast<double>(count)/opt::seconds << " pkt/sec received"
+              << " (recv:" << stats.recv << " frwd:" << stats.frwd << " drop:" << stats.drop << ")" << std::endl;
+}
+
+
+int
+main(int argc, char *argv[])
+try
+{
+    if (argc < 5)
+        throw std::runtime_error(std::string("usage: ").append(argv[0]).append(" tx-dev rx-dev fwd-dev sink-dev [seconds]"));
+
+    opt::tx_dev   = argv[1];
+    opt::rx_dev   = argv[2];
+    opt::fwd_dev  = argv[3];
+    opt::sink_dev = argv[4];
+
+    if (argc > 5) opt::seconds = std::stoi(argv[5]);
+
+    std::string dev(opt::fwd_dev);
+
+    bench("forward", forward(dev));
+    bench("forward x2", forward(dev) >> forward(dev));
+    bench("forward x4", forward(dev) >> forward(dev) >> forward(dev) >> forward(dev));
+
+    return 0;
+}
+catch(std::exception &e)
+{
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
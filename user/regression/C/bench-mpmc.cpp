@@ -0,0 +1,265 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * Multi-consumer Rx queue vs. N sockets with kernel steering,
+ * under a Zipf distribution of flows.
+ *
+ * usage: bench-mpmc tx-dev rx-dev [threads] [zipf-s] [flows] [work] [seconds]
+ *
+ * Packets are generated on tx-dev and captured on rx-dev (e.g. a veth pair).
+ *
+ ****************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <cstring>
+#include <cmath>
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include <pfq/pfq.hpp>
+#include <pfq/lang/default.hpp>
+
+using namespace pfq::lang;
+
+
+namespace opt
+{
+    const char *tx_dev;
+    const char *rx_dev;
+
+    size_t threads = 4;
+    double zipf_s  = 1.1;
+    size_t flows   = 1024;
+    size_t work    = 200;       /* busy loop per packet */
+    int seconds    = 10;
+
+    const size_t caplen = 64;
+    const size_t slots  = 65536;
+    const size_t batch  = 64;
+    const int gid = 42;
+}
+
+
+static std::atomic_bool stop(false);
+
+
+/* Zipf distributed flow generator */
+
+struct zipf
+{
+    zipf(size_t n, double s)
+    : cdf_(n), gen_(std::random_device{}()), uni_(0.0, 1.0)
+    {
+        double sum = 0;
+        for(size_t i = 0; i < n; i++)
+            cdf_[i] = (sum += 1.0/std::pow(static_cast<double>(i+1), s));
+        for(auto &c : cdf_)
+            c /= sum;
+    }
+
+    size_t operator()()
+    {
+        return static_cast<size_t>(std::lower_bound(cdf_.begin(), cdf_.end(), uni_(gen_)) - cdf_.begin());
+    }
+
+private:
+    std::vector<double> cdf_;
+    std::mt19937 gen_;
+    std::uniform_real_distribution<double> uni_;
+};
+
+
+static void
+make_packet(char *buf, size_t flow)
+{
+    auto eh = reinterpret_cast<ethhdr *>(buf);
+    auto ih = reinterpret_cast<iphdr *>(eh + 1);
+    auto uh = reinterpret_cast<udphdr *>(ih + 1);
+
+    memset(buf, 0, opt::caplen);
+    memset(eh->h_dest, 0xff, ETH_ALEN);
+    eh->h_proto  = htons(ETH_P_IP);
+
+    ih->version  = 4;
+    ih->ihl      = 5;
+    ih->ttl      = 64;
+    ih->protocol = IPPROTO_UDP;
+    ih->tot_len  = htons(opt::caplen - sizeof(ethhdr));
+    ih->saddr    = htonl(0x0a000000 | static_cast<uint32_t>(flow));
+    ih->daddr    = htonl(0x0a800001);
+
+    uh->source   = htons(static_cast<uint16_t>(1024 + (flow & 0x7fff)));
+    uh->dest     = htons(9);
+    uh->len      = htons(opt::caplen - sizeof(ethhdr) - sizeof(iphdr));
+}
+
+
+static void
+generator()
+{
+    pfq::socket q(opt::caplen, 1024, opt::caplen, 4096);
+    zipf z(opt::flows, opt::zipf_s);
+    char pkt[opt::caplen];
+
+    q.bind_tx(opt::tx_dev, pfq::any_queue, pfq::no_kthread);
+    q.enable();
+
+    while (!stop.load(std::memory_order_relaxed))
+    {
+        make_packet(pkt, z());
+        q.send(pfq::const_buffer(pkt, sizeof(pkt)), 128);
+    }
+}
+
+
+static inline void
+process(pfq::net_queue::iterator &it)
+{
+    while (!it.ready())
+        std::this_thread::yield();
+
+    for(volatile size_t n = 0; n < opt::work; n = n + 1)
+    { }
+}
+
+
+static std::vector<size_t>
+run_sockets()
+{
+    std::vector<pfq::socket> socks;
+    std::vector<size_t> count(opt::threads);
+    std::vector<std::thread> ths;
+
+    for(size_t n = 0; n < opt::threads; n++)
+    {
+        socks.emplace_back(pfq::group_policy::undefined, opt::caplen, opt::slots);
+        socks.back().join_group(opt::gid, pfq::group_policy::shared);
+        socks.back().enable();
+    }
+
+    socks.front().bind_group(opt::gid, opt::rx_dev);
+    socks.front().set_group_computation(opt::gid, ip >> steer_flow);
+
+    for(size_t n = 0; n < opt::threads; n++)
+    {
+        ths.emplace_back([&, n] {
+            auto &q = socks[n];
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                auto many = q.read(1000);
+                for(auto it = many.begin(); it != many.end(); ++it) {
+                    process(it);
+                    count[n]++;
+                }
+            }
+        });
+    }
+
+    for(auto &t : ths)
+        t.join();
+
+    return count;
+}
+
+
+static std::vector<size_t>
+run_mpmc()
+{
+    pfq::socket q(opt::caplen, opt::slots);
+    std::vector<size_t> count(opt::threads);
+    std::vector<std::thread> ths;
+
+    q.bind(opt::rx_dev);
+    q.enable();
+
+    for(size_t n = 0; n < opt::threads; n++)
+    {
+        ths.emplace_back([&, n] {
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                auto many = q.claim(opt::batch);
+                for(auto it = many.begin(); it != many.end(); ++it) {
+                    process(it);
+                    count[n]++;
+                }
+                q.release(many);
+            }
+        });
+    }
+
+    for(auto &t : ths)
+        t.join();
+
+    return count;
+}
+
+
+template <typename Fun>
+static void
+bench(const char *name, Fun fun)
+{
+    stop.store(false);
+
+    std::thread gen(generator);
+    std::thread timer([] {
+        std::this_thread::sleep_for(std::chrono::seconds(opt::seconds));
+        stop.store(true);
+    });
+
+    auto count = fun();
+
+    timer.join();
+    gen.join();
+
+    auto total = std::accumulate(count.begin(), count.end(), size_t(0));
+    auto max   = *std::max_element(count.begin(), count.end());
+    auto avg   = static_cast<double>(total)/static_cast<double>(count.size());
+
+    std::cout << name << ": " << static_cast<double>(total)/opt::seconds << " pkt/sec, per-thread:";
+    for(auto c : count)
+        std::cout << ' ' << c;
+    std::cout << ", imbalance (max/avg): " << (avg ? static_cast<double>(max)/avg : 0.0) << std::endl;
+}
+
+
+int
+main(int argc, char *argv[])
+try
+{
+    if (argc < 3)
+        throw std::runtime_error(std::string("usage: ").append(argv[0]).append(" tx-dev rx-dev [threads] [zipf-s] [flows] [work] [seconds]"));
+
+    opt::tx_dev = argv[1];
+    opt::rx_dev = argv[2];
+
+    if (argc > 3) opt::threads = std::stoul(argv[3]);
+    if (argc > 4) opt::zipf_s  = std::stod(argv[4]);
+    if (argc > 5) opt::flows   = std::stoul(argv[5]);
+    if (argc > 6) opt::work    = std::stoul(argv[6]);
+    if (argc > 7) opt::seconds = std::stoi(argv[7]);
+
+    std::cout << "threads:" << opt::threads << " zipf-s:" << opt::zipf_s << " flows:" << opt::flows
+              << " work:" << opt::work << " seconds:" << opt::seconds << std::endl;
+
+    bench("sockets (steer_flow)", run_sockets);
+    bench("mpmc (claim/release)", run_mpmc);
+
+    return 0;
+}
+catch(std::exception &e)
+{
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
@@ -0,0 +1,141 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * Transmission throughput of sync sends and of a Tx thread sharing the
+ * same cpu (each context transmits with an skb pool of its own).
+ *
+ * usage: bench-tx-contention dev [cpu] [seconds]
+ *
+ * A Tx thread is started on cpu (index 63); the async producer runs on
+ * the next cpu.
+ *
+ ****************************************************************/
+
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <pfq/pfq.hpp>
+
+
+namespace opt
+{
+    const char *dev;
+
+    int cpu     = 0;
+    int seconds = 5;
+
+    const int tid = 63;
+    const size_t len = 64;
+}
+
+
+static std::atomic_bool stop(false);
+
+
+static void
+pin(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(static_cast<size_t>(cpu), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+
+static void
+sync_sender(unsigned long &sent)
+{
+    pfq::socket q(64, 1024, opt::len, 4096);
+    char pkt[opt::len] = { 0 };
+
+    pin(opt::cpu);
+
+    q.bind_tx(opt::dev, pfq::any_queue, pfq::no_kthread);
+    q.enable();
+
+    while (!stop.load(std::memory_order_relaxed))
+        q.send(pfq::const_buffer(pkt, sizeof(pkt)), 128);
+
+    sent = q.stats().sent;
+}
+
+
+static void
+async_sender(unsigned long &sent)
+{
+    pfq::socket q(64, 1024, opt::len, 4096);
+    char pkt[opt::len] = { 0 };
+
+    pin(opt::cpu + 1);
+
+    q.bind_tx(opt::dev, pfq::any_queue, opt::tid);
+    q.enable();
+
+    while (!stop.load(std::memory_order_relaxed))
+        q.send_async(pfq::const_buffer(pkt, sizeof(pkt)), 1, 0);
+
+    sent = q.stats().sent;
+}
+
+
+static void
+bench(const char *name, bool sync, bool async)
+{
+    unsigned long sync_sent = 0, async_sent = 0;
+    std::thread s, a;
+
+    stop.store(false);
+
+    if (sync)
+        s = std::thread(sync_sender, std::ref(sync_sent));
+    if (async)
+        a = std::thread(async_sender, std::ref(async_sent));
+
+    std::this_thread::sleep_for(std::chrono::seconds(opt::seconds));
+    stop.store(true);
+
+    if (sync)
+        s.join();
+    if (async)
+        a.join();
+
+    std::cout << name << ": sync " << static_cast<double>(sync_sent)/opt::seconds << " pkt/sec, "
+              << "async " << static_cast<double>(async_sent)/opt::seconds << " pkt/sec" << std::endl;
+}
+
+
+int
+main(int argc, char *argv[])
+try
+{
+    if (argc < 2)
+        throw std::runtime_error(std::string("usage: ").append(argv[0]).append(" dev [cpu] [seconds]"));
+
+    opt::dev = argv[1];
+
+    if (argc > 2) opt::cpu     = std::stoi(argv[2]);
+    if (argc > 3) opt::seconds = std::stoi(argv[3]);
+
+    pfq::socket ctrl(64);
+    ctrl.tx_thread_start(opt::tid, opt::cpu);
+
+    bench("sync", true, false);
+    bench("async", false, true);
+    bench("sync+async", true, true);
+
+    ctrl.tx_thread_stop(opt::tid);
+    return 0;
+}
+catch(std::exception &e)
+{
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
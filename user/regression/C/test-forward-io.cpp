@@ -0,0 +1,182 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * Immediate forwarding (pfq-lang forwardIO) regression test.
+ *
+ * A sequence of numbered UDP packets is injected on tx-dev, captured on
+ * rx-dev and forwarded to fwd-dev with forwardIO. Every packet must be
+ * received on sink-dev, in order, and accounted as forwarded.
+ *
+ * usage: test-forward-io tx-dev rx-dev fwd-dev sink-dev [packets]
+ *
+ * (e.g. two veth pairs: tx-dev/rx-dev and fwd-dev/sink-dev)
+ *
+ ****************************************************************/
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include <pfq/pfq.hpp>
+#include <pfq/lang/default.hpp>
+
+using namespace pfq::lang;
+
+
+namespace opt
+{
+    const char *tx_dev;
+    const char *rx_dev;
+    const char *fwd_dev;
+    const char *sink_dev;
+
+    size_t packets = 10000;
+
+    const size_t caplen = 64;
+    const size_t slots  = 65536;
+}
+
+
+static void
+make_packet(char *buf, uint32_t seq)
+{
+    auto eh = reinterpret_cast<ethhdr *>(buf);
+    auto ih = reinterpret_cast<iphdr *>(eh + 1);
+    auto uh = reinterpret_cast<udphdr *>(ih + 1);
+
+    memset(buf, 0, opt::caplen);
+    memset(eh->h_dest, 0xff, ETH_ALEN);
+    eh->h_proto  = htons(ETH_P_IP);
+
+    ih->version  = 4;
+    ih->ihl      = 5;
+    ih->ttl      = 64;
+    ih->protocol = IPPROTO_UDP;
+    ih->tot_len  = htons(opt::caplen - sizeof(ethhdr));
+    ih->saddr    = htonl(0x0a000001);
+    ih->daddr    = htonl(0x0a800001);
+
+    uh->source   = htons(1024);
+    uh->dest     = htons(9);
+    uh->len      = htons(opt::caplen - sizeof(ethhdr) - sizeof(iphdr));
+
+    auto payload = reinterpret_cast<uint32_t *>(uh + 1);
+    *payload = htonl(seq);
+}
+
+
+static bool
+is_test_packet(const char *buf, size_t caplen)
+{
+    auto eh = reinterpret_cast<const ethhdr *>(buf);
+    auto ih = reinterpret_cast<const iphdr *>(eh + 1);
+    auto uh = reinterpret_cast<const udphdr *>(ih + 1);
+
+    return caplen >= sizeof(ethhdr) + sizeof(iphdr) + sizeof(udphdr) + 4 &&
+           eh->h_proto == htons(ETH_P_IP) && ih->protocol == IPPROTO_UDP && uh->dest == htons(9);
+}
+
+
+static uint32_t
+packet_seq(const char *buf)
+{
+    auto payload = reinterpret_cast<const uint32_t *>(buf + sizeof(ethhdr) + sizeof(iphdr) + sizeof(udphdr));
+    return ntohl(*payload);
+}
+
+
+int
+main(int argc, char *argv[])
+try
+{
+    if (argc < 5)
+        throw std::runtime_error(std::string("usage: ").append(argv[0]).append(" tx-dev rx-dev fwd-dev sink-dev [packets]"));
+
+    opt::tx_dev   = argv[1];
+    opt::rx_dev   = argv[2];
+    opt::fwd_dev  = argv[3];
+    opt::sink_dev = argv[4];
+
+    if (argc > 5) opt::packets = std::stoul(argv[5]);
+
+    pfq::socket fwd(opt::caplen, opt::slots);
+    pfq::socket sink(opt::caplen, opt::slots);
+    pfq::socket gen(opt::caplen, 1024, opt::caplen, 4096);
+
+    fwd.bind(opt::rx_dev);
+    fwd.set_group_computation(fwd.group_id(), udp >> filter(has_dst_port(9)) >> forwardIO(opt::fwd_dev));
+    fwd.enable();
+
+    sink.bind(opt::sink_dev);
+    sink.enable();
+
+    gen.bind_tx(opt::tx_dev, pfq::any_queue, pfq::no_kthread);
+    gen.enable();
+
+    char pkt[opt::caplen];
+
+    for(uint32_t seq = 0; seq < opt::packets; seq++)
+    {
+        make_packet(pkt, seq);
+        while (!gen.send(pfq::const_buffer(pkt, sizeof(pkt)), 1))
+            std::this_thread::yield();
+
+        if ((seq & 1023) == 1023)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // receive the forwarded packets, in order...
+
+    size_t count = 0;
+    uint32_t next = 0;
+
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (count < opt::packets && std::chrono::steady_clock::now() < end)
+    {
+        auto many = sink.read(100000);
+        for(auto it = many.begin(); it != many.end(); ++it)
+        {
+            while (!it.ready())
+                std::this_thread::yield();
+
+            auto buf = static_cast<const char *>(it.data());
+            if (!is_test_packet(buf, (*it).caplen))
+                continue;
+
+            auto seq = packet_seq(buf);
+            if (seq != next)
+                throw std::runtime_error("out of order: packet " + std::to_string(seq) + ", expected " + std::to_string(next));
+
+            next++;
+            count++;
+        }
+    }
+
+    auto stats = fwd.group_stats(fwd.group_id());
+
+    std::cout << "sent:" << opt::packets << " received:" << count
+              << " (group recv:" << stats.recv << " frwd:" << stats.frwd << " disc:" << stats.disc << ")" << std::endl;
+
+    if (count != opt::packets)
+        throw std::runtime_error("packets lost!");
+
+    if (stats.frwd != opt::packets || stats.disc != 0)
+        throw std::runtime_error("forward counters mismatch!");
+
+    std::cout << "Test successfully passed." << std::endl;
+    return 0;
+}
+catch(std::exception &e)
+{
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
@@ -1,11 +1,20 @@
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
 
 #undef NDEBUG
 #include <assert.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pfq/pfq.h>
 
 #include <pthread.h>
@@ -85,6 +94,33 @@ void test_caplen()
 }
 
 
+void test_numa_node()
+{
+	pfq_t * q = pfq_open(64, 1024, 64, 1024);
+	int node;
+        assert(q);
+
+	assert(pfq_get_numa_node(q, &node) == 0);
+	assert(node == Q_ANY_NODE);
+	assert(pfq_set_numa_node(q, 4096) == -1);
+	assert(pfq_set_numa_node(q, Q_AUTO_NODE) == 0);
+	assert(pfq_get_numa_node(q, &node) == 0);
+	assert(node == Q_AUTO_NODE);
+
+	assert(pfq_enable(q) == 0);
+	assert(pfq_get_numa_node(q, &node) == 0);
+	assert(node >= 0);
+	assert(pfq_set_numa_node(q, 0) == -1);
+	assert(pfq_disable(q) == 0);
+
+	assert(pfq_set_numa_node(q, 0) == 0);
+	assert(pfq_get_numa_node(q, &node) == 0);
+	assert(node == 0);
+
+	pfq_close(q);
+}
+
+
 void test_xmitlen()
 {
 	pfq_t * q = pfq_open(64, 1024, 64, 1024);
@@ -197,6 +233,24 @@ void test_read()
 }
 
 
+void test_claim()
+{
+	pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        assert(q);
+
+	struct pfq_net_queue nq;
+        assert(pfq_claim(q, &nq, 64) == -1);
+
+	assert(pfq_enable(q) == 0);
+
+        assert(pfq_claim(q, &nq, 64) == 0);
+        assert(nq.len <= 64);
+        assert(pfq_release(q, &nq) == 0);
+
+	pfq_close(q);
+}
+
+
 void test_stats()
 {
 	pfq_t * q = pfq_open(64, 1024, 64, 1024);
@@ -213,6 +267,70 @@ void test_stats()
 }
 
 
+void test_rx_class_reserve()
+{
+	pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        assert(q);
+
+	assert(pfq_set_rx_class_reserve(q, 0, 128) == -1);
+	assert(pfq_set_rx_class_reserve(q, Q_CLASS_CONTROL_PLANE, 2048) == -1);
+	assert(pfq_set_rx_class_reserve(q, Q_CLASS_CONTROL_PLANE, 512) == 0);
+	assert(pfq_set_rx_class_reserve(q, Q_CLASS_USER_PLANE, 1024) == -1);
+	assert(pfq_set_rx_class_reserve(q, Q_CLASS_CONTROL_PLANE, 256) == 0);
+	assert(pfq_set_rx_class_reserve(q, Q_CLASS_USER_PLANE, 512) == 0);
+	assert(pfq_set_rx_class_reserve(q, Q_CLASS_USER_PLANE|Q_CLASS_CONTROL_PLANE, 1UL << 63) == -1);
+
+	assert(pfq_set_rx_slots(q, 512) == -1);
+	assert(pfq_set_rx_slots(q, 768) == 0);
+	assert(pfq_set_rx_slots(q, 1024) == 0);
+
+	struct pfq_class_stats s;
+	assert(pfq_get_rx_class_stats(q, &s) == 0);
+
+	assert(s.drop[0] == 0);
+	assert(s.drop[1] == 0);
+	assert(s.drop[2] == 0);
+
+	pfq_close(q);
+}
+
+
+void test_rx_class_drop()
+{
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        pfq_t * p = pfq_open(64, 64, 64, 1024);
+        char pkt[64] = { 0 };
+        int n;
+
+        /* the records of a pipe are default class: 16 slots out of 64 */
+
+        assert(pfq_set_rx_class_reserve(p, Q_CLASS_CONTROL_PLANE, 48) == 0);
+
+        assert(pfq_join_group(q, 15, Q_CLASS_DEFAULT, Q_POLICY_GROUP_SHARED) == 15);
+        assert(pfq_join_group(p, 15, Q_CLASS_DEFAULT, Q_POLICY_GROUP_SHARED) == 15);
+
+        assert(pfq_bind_tx_pipe(q, pfq_id(p), Q_NO_KTHREAD) == 0);
+        assert(pfq_enable(q) == 0);
+        assert(pfq_enable(p) == 0);
+
+        for(n = 0; n < 32; n++)
+                assert(pfq_send(q, pkt, sizeof(pkt), 1, 1) == sizeof(pkt));
+
+	struct pfq_net_queue nq;
+        assert(pfq_read(p, &nq, 1000) == 16);
+
+	struct pfq_class_stats s;
+	assert(pfq_get_rx_class_stats(p, &s) == 0);
+
+	assert(s.drop[0] == 16);
+	assert(s.drop[1] == 0);
+	assert(s.drop[2] == 0);
+
+        pfq_close(q);
+        pfq_close(p);
+}
+
+
 void test_group_stats()
 {
 	pfq_t * q = pfq_open(64, 1024, 64, 1024);
@@ -233,6 +351,95 @@ void test_group_stats()
 }
 
 
+void test_group_steer_dynamic()
+{
+	pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        assert(q);
+
+	struct pfq_steer_stats s;
+	assert(pfq_get_group_steer_stats(q, 12, &s) == -1);
+	assert(pfq_set_group_steer_dynamic(q, 12, 80) == -1);
+
+	assert(pfq_join_group(q, 12, Q_CLASS_DEFAULT, Q_POLICY_GROUP_RESTRICTED) == 12);
+
+	assert(pfq_set_group_steer_dynamic(q, 12, 101) == -1);
+	assert(pfq_set_group_steer_dynamic(q, 12, 80) == 0);
+
+	assert(pfq_get_group_steer_stats(q, 12, &s) == 0);
+
+	assert(s.flows == 0);
+	assert(s.moves == 0);
+	assert(s.stuck == 0);
+	assert(s.untracked == 0);
+
+	assert(pfq_set_group_steer_dynamic(q, 12, 0) == 0);
+
+	pfq_close(q);
+}
+
+
+void test_group_reta()
+{
+	pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        assert(q);
+
+	int id = pfq_id(q);
+	int table[8] = { id, id, id, id, id, id, id, id };
+	int out[8];
+	size_t size = 8;
+
+	assert(pfq_set_group_reta(q, 13, table, 8) == -1);
+
+	assert(pfq_join_group(q, 13, Q_CLASS_DEFAULT, Q_POLICY_GROUP_RESTRICTED) == 13);
+
+	assert(pfq_set_group_reta(q, 13, table, 6) == -1);
+
+	table[3] = id + 1;
+	assert(pfq_set_group_reta(q, 13, table, 8) == -1);
+	table[3] = id;
+
+	assert(pfq_set_group_reta(q, 13, table, 8) == 0);
+	assert(pfq_get_group_reta(q, 13, out, &size) == 0);
+	assert(size == 8);
+	assert(memcmp(table, out, sizeof(table)) == 0);
+
+	size = 4;
+	assert(pfq_get_group_reta(q, 13, out, &size) == -1);
+
+	assert(pfq_set_group_reta(q, 13, NULL, 0) == 0);
+	size = 8;
+	assert(pfq_get_group_reta(q, 13, out, &size) == 0);
+	assert(size == 0);
+
+	pfq_close(q);
+}
+
+
+void test_group_flow_export()
+{
+	pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        assert(q);
+
+	assert(pfq_set_group_flow_export(q, 14, 1000, 0) == -1);
+
+	assert(pfq_join_group(q, 14, Q_CLASS_DEFAULT, Q_POLICY_GROUP_RESTRICTED) == 14);
+
+	assert(pfq_set_group_flow_export(q, 14, 1000, 500) == -1);
+	assert(pfq_set_group_flow_export(q, 14, 1000, 10000) == 0);
+	assert(pfq_set_group_flow_export(q, 14, 0, 0) == 0);
+
+	pfq_close(q);
+
+	q = pfq_open(32, 1024, 64, 1024);
+        assert(q);
+
+	assert(pfq_join_group(q, 14, Q_CLASS_DEFAULT, Q_POLICY_GROUP_RESTRICTED) == 14);
+	assert(pfq_set_group_flow_export(q, 14, 1000, 0) == -1);
+
+	pfq_close(q);
+}
+
+
 void test_my_group_stats_priv()
 {
 	pfq_t * q = pfq_open_group(Q_CLASS_DEFAULT, Q_POLICY_GROUP_PRIVATE, 64, 1024, 64, 1024);
@@ -574,6 +781,288 @@ void test_bind_tx()
 }
 
 
+void test_tx_pipe()
+{
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        pfq_t * p = pfq_open(64, 1024, 64, 1024);
+        char pkt[64] = { 0 };
+
+        assert(pfq_bind_tx_pipe(q, pfq_id(p), Q_NO_KTHREAD) == -1);
+
+        assert(pfq_join_group(q, 15, Q_CLASS_DEFAULT, Q_POLICY_GROUP_SHARED) == 15);
+        assert(pfq_join_group(p, 15, Q_CLASS_DEFAULT, Q_POLICY_GROUP_SHARED) == 15);
+
+        assert(pfq_bind_tx_pipe(q, pfq_id(p), Q_NO_KTHREAD) == 0);
+        assert(pfq_enable(q) == 0);
+        assert(pfq_enable(p) == 0);
+
+        assert(pfq_send(q, pkt, sizeof(pkt), 1, 1) == sizeof(pkt));
+
+	struct pfq_net_queue nq;
+        assert(pfq_read(p, &nq, 1000) == 1);
+        assert(pfq_pkt_header(pfq_net_queue_begin(&nq))->info.ifindex == Q_PKTHDR_PIPE);
+        assert(pfq_pkt_header(pfq_net_queue_begin(&nq))->info.queue == (uint16_t)pfq_id(q));
+
+        pfq_close(q);
+        pfq_close(p);
+}
+
+
+/* a frame of the zero-copy test: the payload depends on the sequence number */
+
+static void zerocopy_frame(char *pkt, size_t len, uint32_t seq)
+{
+        size_t n;
+
+        memset(pkt, 0, 12);
+        pkt[12] = (char)0x88; pkt[13] = (char)0xb5;    /* local experimental */
+        memcpy(pkt + 14, &seq, sizeof(seq));
+
+        for(n = 18; n < len; n++)
+                pkt[n] = (char)(n + seq);
+}
+
+
+void test_tx_zerocopy()
+{
+        pfq_t * q = pfq_open(64, 1024, 1514, 1024);
+        struct sockaddr_ll sll;
+        struct pfq_tx_pacing_stats s;
+        char pkt[1500], buf[2048];
+        int fd, intact = 0, broken = 0;
+        ssize_t len;
+        uint32_t n;
+
+        /* the frames are looped back by lo: capture them with a packet socket */
+
+        fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        assert(fd != -1);
+
+        memset(&sll, 0, sizeof(sll));
+        sll.sll_family = AF_PACKET;
+        sll.sll_protocol = htons(ETH_P_ALL);
+        sll.sll_ifindex = pfq_ifindex(q, "lo");
+        assert(bind(fd, (struct sockaddr *)&sll, sizeof(sll)) == 0);
+
+        assert(pfq_tx_zerocopy_enable(q, 1) == 0);
+        assert(pfq_bind_tx(q, "lo", Q_ANY_QUEUE, Q_NO_KTHREAD) == 0);
+        assert(pfq_enable(q) == 0);
+
+        /* more than the Tx slots: buffers are reused after completion */
+
+        for(n = 0; n < 4096; n++) {
+                zerocopy_frame(pkt, sizeof(pkt), n);
+                assert(pfq_send(q, pkt, sizeof(pkt), 1, 64) == sizeof(pkt));
+        }
+
+        assert(pfq_sync_queue(q, 0) == 0);
+
+        /* the payload was sent from the slot pages */
+
+        assert(pfq_get_tx_pacing_stats(q, &s) == 0);
+        assert(s.zerocopy > 0);
+
+        /* ...and arrives intact: a slot is not reused while it is referenced */
+
+        usleep(10000);
+
+        while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        {
+                uint32_t seq;
+
+                if (len < 18 || buf[12] != (char)0x88 || buf[13] != (char)0xb5)
+                        continue;
+
+                memcpy(&seq, buf + 14, sizeof(seq));
+                zerocopy_frame(pkt, sizeof(pkt), seq);
+
+                if (len == sizeof(pkt) && memcmp(buf, pkt, sizeof(pkt)) == 0)
+                        intact++;
+                else
+                        broken++;
+        }
+
+        assert(intact > 0);
+        assert(broken == 0);
+
+        close(fd);
+        pfq_close(q);
+}
+
+
+void test_send_gso()
+{
+        pfq_t * q = pfq_open(64, 1024, 16384, 64);
+        static char pkt[8000];
+        struct pfq_stats s;
+
+        /* Ethernet + IPv4 + TCP (127.0.0.1 -> 127.0.0.1) */
+
+        memset(pkt, 0, sizeof(pkt));
+        pkt[12] = 0x08; pkt[13] = 0x00;
+        pkt[14] = 0x45;
+        pkt[16] = (char)((sizeof(pkt) - 14) >> 8);
+        pkt[17] = (char)((sizeof(pkt) - 14) & 0xff);
+        pkt[22] = 64;
+        pkt[23] = 6;
+        pkt[26] = 127; pkt[29] = 1;
+        pkt[30] = 127; pkt[33] = 1;
+        pkt[46] = 0x50;
+
+        assert(pfq_bind_tx(q, "lo", Q_ANY_QUEUE, Q_NO_KTHREAD) == 0);
+        assert(pfq_enable(q) == 0);
+
+        assert(pfq_send_gso(q, pkt, sizeof(pkt), 1448, Q_TX_GSO_TCPV4, 1) == sizeof(pkt));
+
+        assert(pfq_get_stats(q, &s) == 0);
+        assert(s.sent >= 1);
+        assert(s.fail == 0);
+
+        /* mismatching type */
+
+        assert(pfq_send_gso(q, pkt, sizeof(pkt), 1448, Q_TX_GSO_TCPV6, 1) == sizeof(pkt));
+
+        assert(pfq_get_stats(q, &s) == 0);
+        assert(s.fail == 1);
+
+        /* larger than the slot */
+
+        assert(pfq_send_raw_gso(q, pkt, 20000, 0, 1, Q_NO_KTHREAD, 1448, Q_TX_GSO_TCPV4) == -1);
+
+        pfq_close(q);
+}
+
+
+void test_tx_pacing()
+{
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        struct pfq_tx_pacing_stats s;
+        struct timespec ts;
+        char pkt[64] = { 0 };
+        unsigned long late = 0;
+        int n;
+
+        assert(pfq_bind_tx(q, "lo", Q_ANY_QUEUE, Q_NO_KTHREAD) == 0);
+        assert(pfq_enable(q) == 0);
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 5000000;
+        if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+        }
+
+        assert(pfq_send_at(q, pkt, sizeof(pkt), 1, Q_NO_KTHREAD, &ts) == sizeof(pkt));
+
+        /* not yet departed */
+
+        assert(pfq_sync_queue(q, 0) == 0);
+        assert(pfq_get_tx_pacing_stats(q, &s) == 0);
+        assert(s.deferred == 0);
+
+        usleep(10000);
+
+        assert(pfq_sync_queue(q, 0) == 0);
+        assert(pfq_get_tx_pacing_stats(q, &s) == 0);
+        assert(s.deferred == 1);
+
+        for(n = 0; n < Q_TX_PACING_BUCKETS; n++)
+                late += s.late[n];
+        assert(late == 1);
+
+        pfq_close(q);
+}
+
+
+void test_arena()
+{
+	size_t size = 32 << 20;
+	char *arena = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        assert(arena != MAP_FAILED);
+
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        pfq_t * p = pfq_open(64, 1024, 64, 1024);
+
+        long mem = pfq_mem_required(q);
+        assert(mem > 0 && 2 * (size_t)mem <= size);
+
+        assert(pfq_enable_arena(q, arena) == -1);
+
+        assert(pfq_register_arena(q, arena, size, 2 << 20) == 0);
+        assert(pfq_register_arena(p, arena, size, 2 << 20) == -1);
+
+        assert(pfq_enable_arena(q, arena) == 0);
+        assert(pfq_enable_arena(p, arena + mem/2) == -1);
+        assert(pfq_enable_arena(p, arena + mem) == 0);
+
+        assert(pfq_mem_addr(p) == arena + mem);
+
+        pfq_close(q);
+        pfq_close(p);
+
+        munmap(arena, size);
+}
+
+
+void test_resize()
+{
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        struct pfq_net_queue nq;
+        void *addr;
+
+        assert(pfq_resize(q, 4096, 128, 2048, 128) == -1);
+
+        assert(pfq_enable(q) == 0);
+        addr = (void *)pfq_mem_addr(q);
+
+        assert(pfq_resize(q, 0, 128, 2048, 128) == -1);
+        assert(pfq_resize(q, 4096, 128, 2048, 128) == 0);
+        assert(pfq_resize(q, 8192, 128, 2048, 128) == -1);
+
+        assert(pfq_get_rx_slots(q) == 4096);
+        assert(pfq_mem_addr(q) != addr);
+
+        /* drain the old queues */
+
+        assert(pfq_read(q, &nq, 0) >= 0);
+        assert(pfq_read(q, &nq, 0) >= 0);
+        assert(pfq_resize(q, 8192, 128, 2048, 128) == 0);
+
+        pfq_close(q);
+}
+
+
+void test_detach()
+{
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        pfq_t * p = pfq_open(64, 1024, 64, 1024);
+        int id = pfq_id(q);
+
+        assert(pfq_set_detach(q, 0xbeef, 0) == -1);
+        assert(pfq_set_detach(q, 0xbeef, 2000) == 0);
+        assert(pfq_set_detach(p, 0xbeef, 2000) == -1);
+        pfq_close(p);
+
+        assert(pfq_attach(0xbeef) == NULL);
+
+        assert(pfq_enable(q) == 0);
+        pfq_close(q);
+
+        p = pfq_attach(0xbeef);
+        assert(p);
+        assert(pfq_id(p) == id);
+        assert(pfq_is_enabled(p) == 1);
+
+	struct pfq_net_queue nq;
+        assert(pfq_read(p, &nq, 10) >= 0);
+
+        assert(pfq_set_detach(p, 0, 0) == 0);
+        pfq_close(p);
+
+        assert(pfq_attach(0xbeef) == NULL);
+}
+
+
 void test_tx_thread()
 {
         pfq_t * q = pfq_open(64, 1024, 64, 1024);
@@ -585,6 +1074,193 @@ void test_tx_thread()
 }
 
 
+void test_tx_doorbell()
+{
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        struct pfq_stats s;
+        char pkt[64] = { 0 };
+        int n;
+
+        /* a Tx thread of its own, not one started at module load */
+
+        assert(pfq_tx_thread_start(q, 62, 0) == 0);
+
+        assert(pfq_bind_tx(q, "lo", Q_ANY_QUEUE, 62) == 0);
+        assert(pfq_enable(q) == 0);
+
+        /* let the Tx thread go to sleep */
+
+        usleep(20000);
+
+        assert(pfq_send_async(q, pkt, sizeof(pkt), 1, 0) == sizeof(pkt));
+
+        for(n = 0; n < 100; n++) {
+                assert(pfq_get_stats(q, &s) == 0);
+                if (s.sent == 1)
+                        break;
+                usleep(1000);
+        }
+
+        assert(s.sent == 1);
+
+        pfq_close(q);
+
+        q = pfq_open(64, 1024, 64, 1024);
+        assert(pfq_tx_thread_stop(q, 62) == 0);
+        pfq_close(q);
+}
+
+
+void test_tx_thread_pool()
+{
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        char pkt[64] = { 0 };
+
+        assert(pfq_tx_thread_start(q, 63, 0) == 0);
+        assert(pfq_tx_thread_start(q, 63, 0) == -1);
+
+        assert(pfq_bind_tx(q, "lo", Q_ANY_QUEUE, 63) == 0);
+        assert(pfq_enable(q) == 0);
+
+        assert(pfq_send_async(q, pkt, sizeof(pkt), 1, 0) == sizeof(pkt));
+        assert(pfq_tx_thread_pin(q, 63, 0) == 0);
+
+        pfq_close(q);
+
+        q = pfq_open(64, 1024, 64, 1024);
+
+        assert(pfq_tx_thread_stop(q, 63) == 0);
+        assert(pfq_tx_thread_stop(q, 63) == -1);
+
+        pfq_close(q);
+}
+
+
+void test_tx_lossless()
+{
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        char pkt[64] = { 0 };
+        struct pfq_stats s;
+
+        assert(pfq_tx_lossless_enable(q, 1) == 0);
+        assert(pfq_wait_tx_space(q, 0) == 0);
+
+        assert(pfq_bind_tx(q, "lo", Q_ANY_QUEUE, Q_NO_KTHREAD) == 0);
+        assert(pfq_enable(q) == 0);
+
+        assert(pfq_wait_tx_space(q, 0) == 1);
+
+        assert(pfq_send(q, pkt, sizeof(pkt), 1, 1) == sizeof(pkt));
+
+        assert(pfq_get_stats(q, &s) == 0);
+        assert(s.sent == 1);
+        assert(s.fail == 0);
+
+        assert(pfq_wait_tx_space(q, 1000) == 1);
+
+        pfq_close(q);
+}
+
+
+void test_tx_shaper()
+{
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        char pkt[64] = { 0 };
+        struct pfq_tx_pacing_stats ps;
+        struct pfq_stats s;
+        int n;
+
+        assert(pfq_tx_shaper(q, -3, Q_TX_SHAPER_PACKETS, 10, 5, 1) == -1);
+        assert(pfq_tx_shaper(q, Q_MAX_TX_QUEUES, Q_TX_SHAPER_PACKETS, 10, 5, 1) == -1);
+        assert(pfq_tx_shaper(q, Q_TX_SHAPER_SYNC, 2, 10, 5, 1) == -1);
+        assert(pfq_tx_shaper(q, Q_TX_SHAPER_SYNC, Q_TX_SHAPER_PACKETS, 10, 0, 1) == -1);
+
+        assert(pfq_tx_shaper(q, Q_TX_SHAPER_SOCKET, Q_TX_SHAPER_BYTES, 1000000, 64000, 0) == 0);
+        assert(pfq_tx_shaper(q, Q_TX_SHAPER_SYNC, Q_TX_SHAPER_PACKETS, 10, 5, 1) == 0);
+
+        assert(pfq_bind_tx(q, "lo", Q_ANY_QUEUE, Q_NO_KTHREAD) == 0);
+        assert(pfq_enable(q) == 0);
+
+        for(n = 0; n < 20; n++)
+                assert(pfq_send(q, pkt, sizeof(pkt), 1, 1) == sizeof(pkt));
+
+        assert(pfq_get_stats(q, &s) == 0);
+        assert(pfq_get_tx_pacing_stats(q, &ps) == 0);
+
+        assert(s.sent + ps.shaped == 20);
+        assert(s.sent >= 5 && s.sent < 10);
+        assert(s.disc == ps.shaped);
+
+        /* disabled */
+
+        assert(pfq_tx_shaper(q, Q_TX_SHAPER_SYNC, Q_TX_SHAPER_PACKETS, 0, 0, 0) == 0);
+        assert(pfq_send(q, pkt, sizeof(pkt), 1, 1) == sizeof(pkt));
+
+        pfq_close(q);
+}
+
+
+void test_tx_replay()
+{
+        pfq_t * q = pfq_open(64, 1024, 64, 1024);
+        size_t size = 4096, off = 0;
+        char pkt[64] = { 0 };
+        struct pfq_so_tx_replay replay;
+        struct pfq_tx_replay_stats s;
+        int n;
+
+        void *trace = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        assert(trace != MAP_FAILED);
+
+        for(n = 0; n < 4; n++)
+                off = pfq_tx_replay_record(trace, size, off, (uint64_t)n * 1000, pkt, sizeof(pkt), sizeof(pkt));
+
+        assert(off == 4 * Q_REPLAY_RECORD_LEN(sizeof(pkt)));
+        assert(pfq_tx_replay_record(trace, 64, 0, 0, pkt, sizeof(pkt), sizeof(pkt)) == 0);
+
+        memset(&replay, 0, sizeof(replay));
+        replay.user_addr     = (unsigned long)trace;
+        replay.user_size     = size;
+        replay.hugepage_size = size;
+        replay.size          = off;
+        replay.tid           = 63;
+        replay.queue         = Q_ANY_QUEUE;
+        replay.loops         = 2;
+
+        /* socket not enabled */
+        assert(pfq_tx_replay(q, "lo", &replay) == -1);
+
+        assert(pfq_tx_thread_start(q, 63, 0) == 0);
+        assert(pfq_enable(q) == 0);
+
+        assert(pfq_tx_replay(q, "unknown", &replay) == -1);
+        assert(pfq_tx_replay(q, "lo", &replay) == 0);
+        assert(pfq_tx_replay(q, "lo", &replay) == -1);
+
+        for(n = 0; n < 100; n++) {
+                assert(pfq_get_tx_replay_stats(q, &s) == 0);
+                if (s.done)
+                        break;
+                usleep(10000);
+        }
+
+        assert(s.done);
+        assert(s.sent + s.fail == 8);
+
+        assert(pfq_tx_replay_stop(q) == 0);
+        assert(pfq_get_tx_replay_stats(q, &s) == 0);
+        assert(s.sent == 0 && !s.done);
+
+        pfq_close(q);
+
+        q = pfq_open(64, 1024, 64, 1024);
+        assert(pfq_tx_thread_stop(q, 63) == 0);
+        pfq_close(q);
+
+        munmap(trace, size);
+}
+
+
 void test_tx_queue()
 {
         pfq_t * q = pfq_open(64, 1024, 64, 1024);
@@ -630,6 +1306,7 @@ main(int argc __attribute__((unused)), char *argv[]__attribute__((unused)))
 	TEST(test_timestamp);
 	TEST(test_caplen);
 	TEST(test_xmitlen);
+	TEST(test_numa_node);
 	TEST(test_rx_slots);
 	TEST(test_rx_slot_size);
 	TEST(test_tx_slots);
@@ -640,10 +1317,16 @@ main(int argc __attribute__((unused)), char *argv[]__attribute__((unused)))
 	TEST(test_poll);
 
 	TEST(test_read);
+	TEST(test_claim);
 
 	TEST(test_stats);
+	TEST(test_rx_class_reserve);
+	TEST(test_rx_class_drop);
 
 	TEST(test_group_stats);
+	TEST(test_group_steer_dynamic);
+	TEST(test_group_reta);
+	TEST(test_group_flow_export);
         TEST(test_my_group_stats_priv);
 	TEST(test_my_group_stats_restricted);
 	TEST(test_my_group_stats_shared);
@@ -667,8 +1350,20 @@ main(int argc __attribute__((unused)), char *argv[]__attribute__((unused)))
         TEST(test_group_context);
 
         TEST(test_bind_tx);
+        TEST(test_tx_pipe);
+        TEST(test_detach);
+        TEST(test_tx_zerocopy);
+        TEST(test_send_gso);
+        TEST(test_tx_pacing);
+        TEST(test_arena);
+        TEST(test_resize);
 
         // TEST(test_tx_thread);
+        TEST(test_tx_doorbell);
+        TEST(test_tx_thread_pool);
+        TEST(test_tx_lossless);
+        TEST(test_tx_replay);
+        TEST(test_tx_shaper);
 
         TEST(test_tx_queue);
 
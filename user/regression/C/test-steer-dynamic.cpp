@@ -0,0 +1,211 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * Load-aware steering regression test.
+ *
+ * UDP flows are injected on tx-dev and captured on rx-dev (e.g. a veth
+ * pair) by two sockets of a shared group, balanced with steer_flow and
+ * load-aware steering. The first batch of flows fills both sockets; then
+ * one socket is drained and the old flows are sent again along with new
+ * ones. The new flows hashed to the loaded socket must be moved, while
+ * every flow (old or new) must be delivered to a single socket.
+ *
+ * usage: test-steer-dynamic tx-dev rx-dev
+ *
+ ****************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+#include <sched.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#include <pfq/pfq.hpp>
+#include <pfq/lang/default.hpp>
+
+using namespace pfq::lang;
+
+
+namespace opt
+{
+    const size_t caplen = 64;
+    const size_t slots  = 1024;
+    const int gid = 43;
+
+    const unsigned int threshold = 5;   /* % of slots */
+
+    const uint16_t flows   = 64;        /* per batch */
+    const size_t   packets = 4;         /* per flow, first batch */
+}
+
+
+static void
+make_packet(char *buf, uint16_t flow)
+{
+    auto eh = reinterpret_cast<ethhdr *>(buf);
+    auto ih = reinterpret_cast<iphdr *>(eh + 1);
+    auto uh = reinterpret_cast<udphdr *>(ih + 1);
+
+    memset(buf, 0, opt::caplen);
+    memset(eh->h_dest, 0xff, ETH_ALEN);
+    eh->h_proto  = htons(ETH_P_IP);
+
+    ih->version  = 4;
+    ih->ihl      = 5;
+    ih->ttl      = 64;
+    ih->protocol = IPPROTO_UDP;
+    ih->tot_len  = htons(opt::caplen - sizeof(ethhdr));
+    ih->saddr    = htonl(0x0a000000 | flow);
+    ih->daddr    = htonl(0x0a800001);
+
+    uh->source   = htons(static_cast<uint16_t>(1024 + flow));
+    uh->dest     = htons(9);
+    uh->len      = htons(opt::caplen - sizeof(ethhdr) - sizeof(iphdr));
+}
+
+
+/* return true and the flow of a test packet */
+
+static bool
+packet_flow(const char *buf, size_t caplen, uint16_t &flow)
+{
+    auto eh = reinterpret_cast<const ethhdr *>(buf);
+    auto ih = reinterpret_cast<const iphdr *>(eh + 1);
+    auto uh = reinterpret_cast<const udphdr *>(ih + 1);
+
+    if (caplen < sizeof(ethhdr) + sizeof(iphdr) + sizeof(udphdr) ||
+        eh->h_proto != htons(ETH_P_IP) || ih->protocol != IPPROTO_UDP || uh->dest != htons(9))
+        return false;
+
+    flow = static_cast<uint16_t>(ntohs(uh->source) - 1024);
+    return true;
+}
+
+
+int
+main(int argc, char *argv[])
+try
+{
+    if (argc < 3)
+        throw std::runtime_error(std::string("usage: ").append(argv[0]).append(" tx-dev rx-dev"));
+
+    // a single CPU: the flow table of load-aware steering is per-cpu...
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+        throw std::runtime_error("sched_setaffinity");
+
+    std::vector<pfq::socket> socks;
+
+    for(size_t n = 0; n < 2; n++)
+    {
+        socks.emplace_back(pfq::group_policy::undefined, opt::caplen, opt::slots);
+        socks.back().join_group(opt::gid, pfq::group_policy::shared);
+        socks.back().enable();
+    }
+
+    socks.front().bind_group(opt::gid, argv[2]);
+    socks.front().set_group_computation(opt::gid, steer_flow);
+    socks.front().group_steer_dynamic(opt::gid, opt::threshold);
+
+    pfq::socket tx(opt::caplen, 1024, opt::caplen, 4096);
+    tx.bind_tx(argv[1], pfq::any_queue, pfq::no_kthread);
+    tx.enable();
+
+    char pkt[opt::caplen];
+
+    auto send = [&](uint16_t flow) {
+        make_packet(pkt, flow);
+        while (!tx.send(pfq::const_buffer(pkt, sizeof(pkt)), 1))
+            std::this_thread::yield();
+    };
+
+    std::map<uint16_t, std::set<size_t>> owner;
+    std::map<uint16_t, size_t> count;
+
+    auto drain = [&](size_t n) {
+        auto many = socks[n].read(100000);
+        for(auto it = many.begin(); it != many.end(); ++it)
+        {
+            while (!it.ready())
+                std::this_thread::yield();
+
+            uint16_t flow;
+            if (packet_flow(static_cast<const char *>(it.data()), (*it).caplen, flow)) {
+                owner[flow].insert(n);
+                count[flow]++;
+            }
+        }
+    };
+
+    // first batch: old flows fill both the sockets...
+
+    for(size_t p = 0; p < opt::packets; p++)
+        for(uint16_t f = 0; f < opt::flows; f++)
+            send(f);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // drain the less loaded socket, the other stays above the threshold...
+
+    auto loaded = socks[0].stats().recv >= socks[1].stats().recv ? 0 : 1;
+    drain(1 - loaded);
+
+    auto moves = socks.front().group_steer_stats(opt::gid).moves;
+
+    // second batch (within the flow timeout): old and new flows...
+
+    for(size_t p = 0; p < opt::packets; p++)
+        for(uint16_t f = 0; f < opt::flows; f++) {
+            send(f);
+            send(static_cast<uint16_t>(opt::flows + f));
+        }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    drain(0);
+    drain(1);
+
+    auto stats = socks.front().group_steer_stats(opt::gid);
+
+    size_t split = 0, missing = 0;
+
+    for(uint16_t f = 0; f < 2 * opt::flows; f++)
+    {
+        auto expected = (f < opt::flows ? 2 : 1) * opt::packets;
+        if (count[f] != expected)
+            missing++;
+        if (owner[f].size() > 1)
+            split++;
+    }
+
+    std::cout << "flows:" << stats.flows << " moves:" << stats.moves << " stuck:" << stats.stuck
+              << " untracked:" << stats.untracked << ", " << missing << " incomplete, "
+              << split << " split across sockets" << std::endl;
+
+    if (missing || split || stats.moves == moves) {
+        std::cout << "FAIL" << std::endl;
+        return 1;
+    }
+
+    std::cout << "PASS" << std::endl;
+    return 0;
+}
+catch(std::exception &e)
+{
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
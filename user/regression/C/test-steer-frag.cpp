@@ -0,0 +1,414 @@
+/***************************************************************
+ *
+ * (C) 2011-16 Nicola Bonelli <nicola@pfq.io>
+ *
+ * Fragment-consistent steering regression test.
+ *
+ * A trace of fragmented IPv4/IPv6 UDP datagrams (either read from a pcap
+ * file or synthesized) is injected on tx-dev and captured on rx-dev
+ * (e.g. a veth pair) by N sockets of a shared group balanced with the
+ * given steering function. Every datagram of the trace must be delivered,
+ * and all its fragments to the same socket.
+ *
+ * With tx-dev and rx-dev both set to fragloop0 (kernel/module/fragloop),
+ * the trace is received through pfq_receive_frag, with the L3/L4 hash of
+ * a NIC (e.g. -b steer_rss).
+ *
+ * usage: test-steer-frag [-f in.pcap] [-w out.pcap] [-b steer_flow|steer_rss|steer_p2p|steer_key] [-n sockets] tx-dev rx-dev
+ *
+ ****************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <map>
+#include <set>
+#include <tuple>
+#include <stdexcept>
+
+#include <pcap.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+
+#include <pfq/pfq.hpp>
+#include <pfq/lang/default.hpp>
+
+using namespace pfq::lang;
+
+
+namespace opt
+{
+    std::string pcap_in;
+    std::string pcap_out;
+    std::string steer = "steer_flow";
+
+    size_t sockets = 4;
+
+    const size_t caplen = 128;
+    const size_t slots  = 8192;
+    const int gid = 42;
+
+    const size_t datagrams = 256;
+    const size_t datalen   = 4000;
+    const size_t mtu       = 1500;
+}
+
+
+#define IP_MF       0x2000
+#define IP_OFFSET   0x1fff
+
+using packet = std::vector<char>;
+
+/* datagram key: ip version, src, dst, id */
+
+using datagram = std::tuple<int, std::string, std::string, uint32_t>;
+
+
+struct ipv6_frag
+{
+    uint8_t  nexthdr;
+    uint8_t  reserved;
+    uint16_t frag_off;
+    uint32_t identification;
+};
+
+
+static void
+fragment_ipv4(std::vector<packet> &out, uint32_t saddr, uint32_t daddr, uint16_t id)
+{
+    std::vector<char> l4(sizeof(udphdr) + opt::datalen, 'x');
+    auto uh = reinterpret_cast<udphdr *>(l4.data());
+    uh->source = htons(static_cast<uint16_t>(1024 + id));
+    uh->dest   = htons(9);
+    uh->len    = htons(static_cast<uint16_t>(l4.size()));
+
+    const size_t chunk = (opt::mtu - sizeof(iphdr)) & ~7ul;
+
+    for(size_t off = 0; off < l4.size(); off += chunk)
+    {
+        auto len = std::min(chunk, l4.size() - off);
+        packet p(sizeof(ethhdr) + sizeof(iphdr) + len);
+
+        auto eh = reinterpret_cast<ethhdr *>(p.data());
+        auto ih = reinterpret_cast<iphdr *>(eh + 1);
+
+        memset(eh->h_dest, 0xff, ETH_ALEN);
+        eh->h_proto  = htons(ETH_P_IP);
+
+        ih->version  = 4;
+        ih->ihl      = 5;
+        ih->ttl      = 64;
+        ih->protocol = IPPROTO_UDP;
+        ih->id       = htons(id);
+        ih->tot_len  = htons(static_cast<uint16_t>(sizeof(iphdr) + len));
+        ih->frag_off = htons(static_cast<uint16_t>((off >> 3) | (off + len < l4.size() ? IP_MF : 0)));
+        ih->saddr    = saddr;
+        ih->daddr    = daddr;
+
+        memcpy(ih + 1, l4.data() + off, len);
+        out.push_back(std::move(p));
+    }
+}
+
+
+static void
+fragment_ipv6(std::vector<packet> &out, uint32_t saddr, uint32_t daddr, uint32_t id)
+{
+    std::vector<char> l4(sizeof(udphdr) + opt::datalen, 'x');
+    auto uh = reinterpret_cast<udphdr *>(l4.data());
+    uh->source = htons(static_cast<uint16_t>(1024 + id));
+    uh->dest   = htons(9);
+    uh->len    = htons(static_cast<uint16_t>(l4.size()));
+
+    const size_t chunk = (opt::mtu - sizeof(ipv6hdr) - sizeof(ipv6_frag)) & ~7ul;
+
+    for(size_t off = 0; off < l4.size(); off += chunk)
+    {
+        auto len = std::min(chunk, l4.size() - off);
+        packet p(sizeof(ethhdr) + sizeof(ipv6hdr) + sizeof(ipv6_frag) + len);
+
+        auto eh = reinterpret_cast<ethhdr *>(p.data());
+        auto ih = reinterpret_cast<ipv6hdr *>(eh + 1);
+        auto fh = reinterpret_cast<ipv6_frag *>(ih + 1);
+
+        memset(eh->h_dest, 0xff, ETH_ALEN);
+        eh->h_proto = htons(ETH_P_IPV6);
+
+        ih->version     = 6;
+        ih->payload_len = htons(static_cast<uint16_t>(sizeof(ipv6_frag) + len));
+        ih->nexthdr     = 44; /* fragment */
+        ih->hop_limit   = 64;
+        ih->saddr.s6_addr32[0] = htonl(0x20010db8);
+        ih->saddr.s6_addr32[3] = saddr;
+        ih->daddr.s6_addr32[0] = htonl(0x20010db8);
+        ih->daddr.s6_addr32[3] = daddr;
+
+        fh->nexthdr        = IPPROTO_UDP;
+        fh->frag_off       = htons(static_cast<uint16_t>(off | (off + len < l4.size() ? 1 : 0)));
+        fh->identification = htonl(id);
+
+        memcpy(fh + 1, l4.data() + off, len);
+        out.push_back(std::move(p));
+    }
+}
+
+
+static std::vector<packet>
+synthesize()
+{
+    std::vector<packet> trace;
+
+    for(size_t n = 0; n < opt::datagrams; n++)
+    {
+        auto src = htonl(0x0a000000 | static_cast<uint32_t>(n % 16));
+        auto dst = htonl(0x0a800001);
+
+        if (n & 1)
+            fragment_ipv6(trace, src, dst, static_cast<uint32_t>(n));
+        else
+            fragment_ipv4(trace, src, dst, static_cast<uint16_t>(n));
+    }
+
+    return trace;
+}
+
+
+static std::vector<packet>
+load_pcap(std::string const &file)
+{
+    char errbuf[PCAP_ERRBUF_SIZE];
+    std::vector<packet> trace;
+
+    auto in = pcap_open_offline(file.c_str(), errbuf);
+    if (in == nullptr)
+        throw std::runtime_error(errbuf);
+
+    struct pcap_pkthdr *h; const u_char *bytes;
+    while (pcap_next_ex(in, &h, &bytes) == 1)
+        trace.emplace_back(bytes, bytes + h->caplen);
+
+    pcap_close(in);
+    return trace;
+}
+
+
+static void
+dump_pcap(std::string const &file, std::vector<packet> const &trace)
+{
+    auto p = pcap_open_dead(DLT_EN10MB, 65535);
+    auto out = pcap_dump_open(p, file.c_str());
+    if (out == nullptr)
+        throw std::runtime_error(pcap_geterr(p));
+
+    for(auto const &pkt : trace)
+    {
+        struct pcap_pkthdr h = {};
+        h.caplen = h.len = static_cast<bpf_u_int32>(pkt.size());
+        pcap_dump(reinterpret_cast<u_char *>(out), &h, reinterpret_cast<const u_char *>(pkt.data()));
+    }
+
+    pcap_dump_close(out);
+    pcap_close(p);
+}
+
+
+/* return true and the datagram key if the packet is a fragment */
+
+static bool
+fragment_key(const char *data, size_t caplen, datagram &key)
+{
+    auto eh = reinterpret_cast<ethhdr const *>(data);
+    char addr[INET6_ADDRSTRLEN];
+
+    if (eh->h_proto == htons(ETH_P_IP) && caplen >= sizeof(ethhdr) + sizeof(iphdr))
+    {
+        auto ih = reinterpret_cast<iphdr const *>(eh + 1);
+        if (!(ih->frag_off & htons(IP_MF|IP_OFFSET)))
+            return false;
+
+        std::get<0>(key) = 4;
+        std::get<1>(key) = inet_ntop(AF_INET, &ih->saddr, addr, sizeof(addr));
+        std::get<2>(key) = inet_ntop(AF_INET, &ih->daddr, addr, sizeof(addr));
+        std::get<3>(key) = ntohs(ih->id);
+        return true;
+    }
+
+    if (eh->h_proto == htons(ETH_P_IPV6) && caplen >= sizeof(ethhdr) + sizeof(ipv6hdr) + sizeof(ipv6_frag))
+    {
+        auto ih = reinterpret_cast<ipv6hdr const *>(eh + 1);
+        if (ih->nexthdr != 44)
+            return false;
+
+        auto fh = reinterpret_cast<ipv6_frag const *>(ih + 1);
+
+        std::get<0>(key) = 6;
+        std::get<1>(key) = inet_ntop(AF_INET6, &ih->saddr, addr, sizeof(addr));
+        std::get<2>(key) = inet_ntop(AF_INET6, &ih->daddr, addr, sizeof(addr));
+        std::get<3>(key) = ntohl(fh->identification);
+        return true;
+    }
+
+    return false;
+}
+
+
+static void
+set_steering(pfq::socket &q, std::string const &name)
+{
+    if (name == "steer_flow")
+        q.set_group_computation(opt::gid, steer_flow);
+    else if (name == "steer_rss")
+        q.set_group_computation(opt::gid, steer_rss);
+    else if (name == "steer_p2p")
+        q.set_group_computation(opt::gid, steer_p2p);
+    else if (name == "steer_key")
+        q.set_group_computation(opt::gid, function("steer_key", static_cast<uint64_t>(Q_KEY_IP_SRC|Q_KEY_IP_DST|Q_KEY_IP_PROTO|Q_KEY_SRC_PORT|Q_KEY_DST_PORT)));
+    else
+        throw std::runtime_error("unknown steering function: " + name);
+}
+
+
+int
+main(int argc, char *argv[])
+try
+{
+    std::vector<const char *> devs;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        auto next = [&]() -> const char * {
+            if (++i == argc)
+                throw std::runtime_error(std::string(argv[i-1]) + ": argument missing");
+            return argv[i];
+        };
+
+        if (strcmp(argv[i], "-f") == 0)
+            opt::pcap_in = next();
+        else if (strcmp(argv[i], "-w") == 0)
+            opt::pcap_out = next();
+        else if (strcmp(argv[i], "-b") == 0)
+            opt::steer = next();
+        else if (strcmp(argv[i], "-n") == 0)
+            opt::sockets = std::stoul(next());
+        else
+            devs.push_back(argv[i]);
+    }
+
+    auto trace = opt::pcap_in.empty() ? synthesize() : load_pcap(opt::pcap_in);
+
+    if (!opt::pcap_out.empty()) {
+        dump_pcap(opt::pcap_out, trace);
+        std::cout << trace.size() << " packets written to " << opt::pcap_out << std::endl;
+        return 0;
+    }
+
+    if (devs.size() != 2)
+        throw std::runtime_error(std::string("usage: ").append(argv[0]).append(" [-f in.pcap] [-w out.pcap] [-b steer_function] [-n sockets] tx-dev rx-dev"));
+
+    // capture sockets...
+
+    std::vector<pfq::socket> socks;
+
+    for(size_t n = 0; n < opt::sockets; n++)
+    {
+        socks.emplace_back(pfq::group_policy::undefined, opt::caplen, opt::slots);
+        socks.back().join_group(opt::gid, pfq::group_policy::shared);
+        socks.back().enable();
+    }
+
+    socks.front().bind_group(opt::gid, devs[1]);
+    set_steering(socks.front(), opt::steer);
+
+    std::atomic_bool stop(false);
+    std::vector<std::map<datagram, size_t>> seen(opt::sockets);
+    std::vector<std::thread> ths;
+
+    for(size_t n = 0; n < opt::sockets; n++)
+    {
+        ths.emplace_back([&, n] {
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                auto many = socks[n].read(1000);
+                for(auto it = many.begin(); it != many.end(); ++it)
+                {
+                    while (!it.ready())
+                        std::this_thread::yield();
+
+                    datagram key;
+                    if (fragment_key(static_cast<const char *>(it.data()), it->caplen, key))
+                        seen[n][key]++;
+                }
+            }
+        });
+    }
+
+    // inject the trace...
+
+    pfq::socket tx(opt::caplen, 1024, 2048, 4096);
+    tx.bind_tx(devs[0], pfq::any_queue, pfq::no_kthread);
+    tx.enable();
+
+    for(auto const &pkt : trace)
+        tx.send(pfq::const_buffer(pkt.data(), pkt.size()));
+
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    stop.store(true);
+    for(auto &t : ths)
+        t.join();
+
+    // check fragment consistency...
+
+    std::set<datagram> expected;
+    for(auto const &pkt : trace) {
+        datagram key;
+        if (fragment_key(pkt.data(), pkt.size(), key))
+            expected.insert(key);
+    }
+
+    std::map<datagram, std::set<size_t>> owner;
+    size_t frags = 0;
+
+    for(size_t n = 0; n < opt::sockets; n++)
+        for(auto const &kv : seen[n]) {
+            owner[kv.first].insert(n);
+            frags += kv.second;
+        }
+
+    size_t broken = 0, ipv6 = 0, missing = 0;
+    for(auto const &kv : owner) {
+        if (kv.second.size() > 1)
+            broken++;
+        if (std::get<0>(kv.first) == 6)
+            ipv6++;
+    }
+
+    for(auto const &key : expected)
+        if (owner.find(key) == owner.end())
+            missing++;
+
+    std::cout << opt::steer << ": " << frags << " fragments, " << owner.size() << "/" << expected.size() << " datagrams ("
+              << ipv6 << " IPv6), " << missing << " missing, " << broken << " split across sockets" << std::endl;
+
+    if (owner.empty() || owner.size() != expected.size() || missing || broken) {
+        std::cout << "FAIL" << std::endl;
+        return 1;
+    }
+
+    std::cout << "PASS" << std::endl;
+    return 0;
+}
+catch(std::exception &e)
+{
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
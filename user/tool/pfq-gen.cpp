@@ -33,6 +33,8 @@
 #include <net/if.h>
 #include <netinet/ether.h>
 #include <arpa/inet.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <more/vt100.hpp>
 #include <more/binding.hpp>
@@ -130,6 +132,10 @@ namespace opt
     bool   interactive = false;
     bool   checksum    = false;
 
+    bool   kernel_replay = false;
+    double replay_speed  = 0;
+    uint32_t replay_ip_step = 0;
+
     double rate = 0;
 
     uint32_t src_ip;
@@ -255,6 +261,7 @@ namespace thread
         , m_fail(std::unique_ptr<std::atomic_ullong>(new std::atomic_ullong(0)))
         , m_gen()
         , m_packet(make_packets(opt::len, opt::src_ip, opt::dst_ip, opt::src_port, opt::dst_port, opt::preload))
+        , m_kthread(kthread)
         {
             if (m_bind.dev.empty())
                 throw std::runtime_error("context[" + std::to_string (m_id) + "]: device unspecified");
@@ -297,7 +304,10 @@ namespace thread
 
             if (!opt::file.empty()) {
 #ifdef HAVE_PCAP_H
-                pcap_generator();
+                if (opt::kernel_replay)
+                    kernel_replay();
+                else
+                    pcap_generator();
 #else
                 throw std::runtime_error("pcap support disabled!");
 #endif
@@ -632,6 +642,117 @@ namespace thread
                 pcap_close(p);
             }
         }
+
+        //
+        // the trace is loaded in a (HugePages) buffer and replayed by the
+        // Tx thread: no system call per packet, gaps paced by the kernel.
+        //
+
+        void kernel_replay()
+        {
+            struct pcap_pkthdr *hdr;
+            u_char *data;
+            size_t size = 0, count = 0, off = 0;
+
+            if (!m_async)
+                throw std::runtime_error("kernel replay requires a Tx thread (-k)");
+
+            // first pass: size of the records...
+
+            auto p = pcap_open_offline(opt::file.c_str(), opt::errbuf);
+            if (p == nullptr)
+                throw std::runtime_error("pcap_open_offline:" + std::string(opt::errbuf));
+
+            while (count < opt::npackets && pcap_next_ex(p, &hdr, (u_char const **)&data) == 1)
+            {
+                size += Q_REPLAY_RECORD_LEN(std::min<size_t>(hdr->caplen, opt::len));
+                count++;
+            }
+
+            pcap_close(p);
+
+            if (size == 0)
+                throw std::runtime_error(opt::file + ": empty trace!");
+
+            // trace buffer: 2M HugePages if available...
+
+            size_t page_size = 2*1024*1024;
+            size_t user_size = (size + page_size - 1) & ~(page_size - 1);
+
+            auto addr = mmap(nullptr, user_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE, -1, 0);
+            if (addr == MAP_FAILED)
+            {
+                std::cout << "*** Warning: trace not backed by HugePages ***" << std::endl;
+
+                page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                user_size = (size + page_size - 1) & ~(page_size - 1);
+
+                addr = mmap(nullptr, user_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+                if (addr == MAP_FAILED)
+                    throw std::system_error(errno, std::generic_category());
+            }
+
+            // second pass: the records...
+
+            p = pcap_open_offline(opt::file.c_str(), opt::errbuf);
+            if (p == nullptr)
+                throw std::runtime_error("pcap_open_offline:" + std::string(opt::errbuf));
+
+            for(size_t i = 0; i < count && pcap_next_ex(p, &hdr, (u_char const **)&data) == 1; i++)
+            {
+                auto plen = std::min<size_t>(hdr->caplen, opt::len);
+                auto ts = static_cast<uint64_t>(hdr->ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(hdr->ts.tv_usec) * 1000;
+
+                off = pfq_tx_replay_record(addr, user_size, off, ts, data, static_cast<uint32_t>(plen), hdr->len);
+            }
+
+            pcap_close(p);
+
+            pfq_so_tx_replay replay;
+            memset(&replay, 0, sizeof(replay));
+
+            replay.user_addr     = reinterpret_cast<unsigned long>(addr);
+            replay.user_size     = user_size;
+            replay.hugepage_size = page_size;
+            replay.size          = off;
+            replay.tid           = m_kthread.front();
+            replay.queue         = m_bind.dev.front().queue.front();
+            replay.loops         = static_cast<unsigned int>(opt::loop);
+            replay.rate          = static_cast<unsigned int>(opt::replay_speed * 1000);
+
+            if (!opt::src_mac.empty()) {
+                replay.rewrite |= Q_REPLAY_REWRITE_MAC_SRC;
+                memcpy(replay.mac_src, ether_aton(opt::src_mac.c_str()), 6);
+            }
+            if (!opt::dst_mac.empty()) {
+                replay.rewrite |= Q_REPLAY_REWRITE_MAC_DST;
+                memcpy(replay.mac_dst, ether_aton(opt::dst_mac.c_str()), 6);
+            }
+            if (opt::replay_ip_step) {
+                replay.rewrite |= Q_REPLAY_REWRITE_IP_SRC;
+                replay.ip_src_step = opt::replay_ip_step;
+            }
+
+            m_pfq.tx_replay(m_bind.dev.front().name.c_str(), replay);
+
+            std::cout << "[PFQ] " << opt::file << ": " << count << " packets replayed by kpfq/" << replay.tid << " (loops: " << opt::loop << ")..." << std::endl;
+
+            for(;;)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+                auto stats = m_pfq.tx_replay_stats();
+
+                m_sent->store(stats.sent, std::memory_order_relaxed);
+                m_fail->store(stats.fail, std::memory_order_relaxed);
+
+                if (stats.done || opt::stop.load(std::memory_order_relaxed))
+                    break;
+            }
+
+            m_pfq.tx_replay_stop();
+            munmap(addr, user_size);
+        }
 #endif
 
         template <typename Tp, typename Dur>
@@ -661,6 +782,8 @@ namespace thread
 
         std::unique_ptr<char[]> m_packet;
 
+        std::vector<int> m_kthread;
+
         bool m_async;
     };
 
@@ -682,6 +805,9 @@ void usage(std::string name)
 #ifdef HAVE_PCAP_H
         " -r --read FILE                Read pcap trace file to send\n"
         "    --loop                     Loop through the trace file N times\n"
+        "    --kernel-replay            Replay the trace from the Tx thread (-k); --loop 0 loops forever\n"
+        "    --replay-speed DOUBLE      Replay with the original timing, scaled (0 = no pacing)\n"
+        "    --replay-ip-step INT       Advance the IP source addresses at every loop\n"
 #endif
 
         " -C --ip-checksum              Enable IP checksum\n"
@@ -755,6 +881,34 @@ try
             continue;
         }
 
+        if ( any_strcmp(argv[i], "--kernel-replay") )
+        {
+            opt::kernel_replay = true;
+            continue;
+        }
+
+        if ( any_strcmp(argv[i], "--replay-speed") )
+        {
+            if (++i == argc)
+            {
+                throw std::runtime_error("speed missing");
+            }
+
+            opt::replay_speed = atof(argv[i]);
+            continue;
+        }
+
+        if ( any_strcmp(argv[i], "--replay-ip-step") )
+        {
+            if (++i == argc)
+            {
+                throw std::runtime_error("step missing");
+            }
+
+            opt::replay_ip_step = static_cast<uint32_t>(std::atoi(argv[i]));
+            continue;
+        }
+
         if ( any_strcmp(argv[i], "-F", "--rand-flow") )
         {
             opt::rand_flow = true;